@@ -20,25 +20,107 @@
 // Replacements of native calls
 %native (start_thread) int utlStartThread(lua_State *L);
 %native (stop_thread) int utlStopThread(lua_State *L);
+%native (join_thread) int utlJoinThread(lua_State *L);
+%native (thread_stopping) int utlThreadStopping(lua_State *L);
+%native (thread_schedule) int utlThreadSched(lua_State *L);
+%native (notify_sched) int utlNotifySched(lua_State *L);
 %native (wave_add_generic) int utlWaveAddGeneric(lua_State *L);
 %native (run_script) int utlRunScript(lua_State *L);
 %native (update_script) int utlUpdateScript(lua_State *L);
 %native (script_status) int utlScriptStatus(lua_State *L);
 %native (callback) int utlCallback(lua_State *L);
 %native (event_callback) int utlEventCallback(lua_State *L);
+%native (cancel_callback) int utlCallbackCancel(lua_State *L);
+%native (cancel_event_callback) int utlEventCallbackCancel(lua_State *L);
+%native (callback_count) int utlCallbackCount(lua_State *L);
+%native (counter_start) int utlCounterStart(lua_State *L);
+%native (counter_get) int utlCounterRead(lua_State *L);
+%native (counter_stop) int utlCounterStop(lua_State *L);
+%native (decoder_open) int utlDecoderStart(lua_State *L);
+%native (decoder_get) int utlDecoderRead(lua_State *L);
+%native (decoder_close) int utlDecoderCancel(lua_State *L);
 %native (serial_read) int utlSerialRead(lua_State *L);
 %native (i2c_read_block_data) int utlI2CReadBlockData(lua_State *L);
 %native (i2c_block_process_call) int utlI2CBlockProcessCall(lua_State *L);
 %native (i2c_read_i2c_block_data) int utlI2CReadI2CBlockData(lua_State *L);
 %native (i2c_read_device) int utlI2CReadDevice(lua_State *L);
 %native (i2c_zip) int utlI2CZip(lua_State *L);
+%native (bb_i2c_zip) int utlI2CbbZip(lua_State *L);
+%native (i2c_transact) int utlI2CTransact(lua_State *L);
+%native (zip_create) int utlZipCreate(lua_State *L);
+%native (zip_add) int utlZipAdd(lua_State *L);
+%native (zip_run) int utlZipRun(lua_State *L);
+%native (zip_info) int utlZipInfo(lua_State *L);
+%native (i2c_scan) int utlI2CScan(lua_State *L);
 %native (spi_read) int utlSPIRead(lua_State *L);
 %native (spi_xfer) int utlSPITransfer(lua_State *L);
 %native (bb_spi_xfer) int utlSPIbbTransfer(lua_State *L);
 %native (bb_serial_read) int utlSerialbbRead(lua_State *L);
 %native (file_read) int utlFileRead(lua_State *L);
+%native (write_chunked) int utlWriteChunked(lua_State *L);
+%native (file_read_all) int utlFileReadAll(lua_State *L);
+%native (file_copy_to) int utlFileCopyTo(lua_State *L);
+%native (file_write_from) int utlFileWriteFrom(lua_State *L);
+%native (file_names) int utlFileNames(lua_State *L);
+%native (file_names_iter) int utlFileNamesIter(lua_State *L);
+%native (spi_sampler_start) int utlSPISamplerStart(lua_State *L);
+%native (spi_sampler_read) int utlSPISamplerRead(lua_State *L);
+%native (spi_sampler_info) int utlSPISamplerInfo(lua_State *L);
+%native (spi_sampler_stop) int utlSPISamplerStop(lua_State *L);
+%native (array_new) int utlArrayNew(lua_State *L);
+%native (fast_methods) int utlFastMethods(lua_State *L);
+%native (object_new) int utlObjectNew(lua_State *L);
+%native (monotonic) int utlMonotonic(lua_State *L);
+%native (tickclock_open) int utlTickClockOpen(lua_State *L);
+%native (tickclock_sync) int utlTickClockSync(lua_State *L);
+%native (tickclock_unwrap) int utlTickClockUnwrap(lua_State *L);
+%native (tickclock_to_local) int utlTickClockToLocal(lua_State *L);
+%native (tickclock_to_tick) int utlTickClockToTick(lua_State *L);
+%native (tickclock_info) int utlTickClockInfo(lua_State *L);
+%native (tickclock_close) int utlTickClockClose(lua_State *L);
+%native (timer_new) int utlTimerNew(lua_State *L);
+%native (timer_run) int utlTimerRun(lua_State *L);
+%native (timer_stop) int utlTimerStop(lua_State *L);
+%native (timer_info) int utlTimerInfo(lua_State *L);
+%native (wait_events) int utlWaitEvents(lua_State *L);
+%native (busy_wait) int utlBusyWait(lua_State *L);
 %native (file_list) int utlFileList(lua_State *L);
 %native (bsc_i2c) int utlI2CSlaveTransfer(lua_State *L);
+%native (replay_compile) int utlReplayCompile(lua_State *L);
+%native (replay_run) int utlReplayRun(lua_State *L);
+%native (pool_create) int utlPoolCreate(lua_State *L);
+%native (pool_submit) int utlPoolSubmit(lua_State *L);
+%native (pool_wait) int utlPoolWait(lua_State *L);
+%native (pool_job_state) int utlPoolJobState(lua_State *L);
+%native (pool_info) int utlPoolInfo(lua_State *L);
+%native (pool_close) int utlPoolClose(lua_State *L);
+%native (chan_create) int utlChanCreate(lua_State *L);
+%native (chan_open) int utlChanOpen(lua_State *L);
+%native (chan_send) int utlChanSend(lua_State *L);
+%native (chan_receive) int utlChanReceive(lua_State *L);
+%native (chan_fd) int utlChanFd(lua_State *L);
+%native (chan_info) int utlChanInfo(lua_State *L);
+%native (chan_close) int utlChanClose(lua_State *L);
+%native (capture_start) int utlCaptureStart(lua_State *L);
+%native (capture_stop) int utlCaptureStop(lua_State *L);
+%native (capture_info) int utlCaptureInfo(lua_State *L);
+%native (capfile_open) int utlCaptureOpen(lua_State *L);
+%native (capfile_info) int utlCaptureFileInfo(lua_State *L);
+%native (capfile_seek) int utlCaptureSeek(lua_State *L);
+%native (capfile_read) int utlCaptureRead(lua_State *L);
+%native (capfile_close) int utlCaptureClose(lua_State *L);
+%native (notify_reader_open) int utlNotifyReaderOpen(lua_State *L);
+%native (notify_reader_begin) int utlNotifyReaderBegin(lua_State *L);
+%native (notify_reader_pause) int utlNotifyReaderPause(lua_State *L);
+%native (notify_reader_read) int utlNotifyReaderRead(lua_State *L);
+%native (notify_reader_fd) int utlNotifyReaderFd(lua_State *L);
+%native (notify_reader_info) int utlNotifyReaderInfo(lua_State *L);
+%native (notify_reader_close) int utlNotifyReaderClose(lua_State *L);
+%native (serial_stream_open) int utlSerialStreamOpen(lua_State *L);
+%native (serial_stream_read) int utlSerialStreamRead(lua_State *L);
+%native (serial_stream_fd) int utlSerialStreamFd(lua_State *L);
+%native (serial_stream_info) int utlSerialStreamInfo(lua_State *L);
+%native (serial_stream_close) int utlSerialStreamClose(lua_State *L);
 
 // type mapping
 %typemap(in) uint_32_t {
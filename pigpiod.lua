@@ -138,8 +138,6 @@ Raspberry Pi 3 GPIO information:
    
 _ENV = setmetatable(gpio, {__index = _G})
 
-local tsleep = 0.001
-
 --------------------------------------------------------------------------------
 -- Check result and return true upon success.
 -- @param err error code return by pigpiod function.
@@ -166,6 +164,34 @@ local function tryV(retval)
    return retval
 end
 
+--------------------------------------------------------------------------------
+-- Check the results of a native function returning a value or nil + error.
+-- @param res value returned by native function.
+-- @param err error code or error text returned by native function.
+-- @return value upon success,
+--         nil + error text (+ error code) upon failure.
+--------------------------------------------------------------------------------
+local function tryR(res, err)
+   if res then return res end
+   if math.type(err) == "integer" then return nil, perror(err), err end
+   return nil, err
+end
+
+---
+-- Create a session or device object. Objects are userdata holding the
+-- pi and device handles natively; all other fields are kept in a table
+-- of the object. Objects still open are closed when collected.
+-- @param class Class table with the methods of the object.
+-- @param fields Table with the fields of the object including
+--        <code>pihandle</code> and <code>handle</code>.
+-- @param anchor Keep the object alive until its handle is set to nil.
+-- @return Object.
+local function newObject(class, fields, anchor)
+   local obj = object_new(class, fields.pihandle, fields.handle, anchor)
+   for k, v in pairs(fields) do obj[k] = v end
+   return obj
+end
+
 ---
 -- Convert a notification sample given in binary coded form in a Lua string
 -- into a table.
@@ -181,12 +207,6 @@ local function decodeNotificationSample(s)
    return t
 end
 
----
--- Active sessions are maintained in a global table.
--- Used to retrieve session object from handle in callbacks and for finalization
--- during object garbage collection.
-_G._PIGPIOD_SESSIONS = {}
-
 ---
 -- Active waveforms are maintained in a global table.
 -- Used to retrieve session object from handle in callbacks and for finalization
@@ -285,7 +305,7 @@ local cScript = {}
 ---
 -- Run a script.
 -- @param self Script.
--- @param param List of up to 10 parameters for the script.
+-- @param param List or u32 array of up to 10 parameters for the script.
 -- @return true on success, nil + errormsg on failure.
 cScript.run = function(self, param)
    return tryB(run_script(self.pihandle, self.handle, param))
@@ -294,7 +314,7 @@ end
 ---
 -- Update parameters of a script, which may already run.
 -- @param self Script.
--- @param param List of up to 10 parameters replacing the corresponding
+-- @param param List or u32 array of up to 10 parameters replacing the corresponding
 --              subset of previous parameters.
 -- @return true on success, nil + errormsg on failure.
 cScript.update = function(self, param)
@@ -304,9 +324,10 @@ end
 ---
 -- Retrieve the run status and the parameters of given script.
 -- @param self Script.
+-- @param into Optional u32 array of 10 elements receiving the parameters.
 -- @return Run status and list of parameters on success; nil + errormsg on failure.
-cScript.status = function(self)
-   local param, status = script_status(self.pihandle, self.handle)
+cScript.status = function(self, into)
+   local param, status = script_status(self.pihandle, self.handle, into)
    if status < 0 then
       return nil, perror(status)
    end
@@ -336,17 +357,29 @@ end
 --- <h3>Pin event callback</h3>
 -- Callbacks are executed when a the state of a certain pin changes. If a
 -- watchdog is configured on the pin, the callback is also called with a pseudo
--- level indication.<br>
+-- level indication. Any number of callbacks may be attached to the same pin,
+-- also from different sessions.<br>
 -- Constructor: <code>cb=session:callback(pin, edge, func, userdata)</code>
 -- @type cCallback
 --------------------------------------------------------------------------------
 local cCallback = {}
+---
+-- Retrieve the edges counted by a callback with policy "count".
+-- @param self Callback.
+-- @param reset Reset the counter to 0 if true.
+-- @return count, last level, last tick on success, nil + errormsg on failure.
+function cCallback.count(self, reset)
+   local count, level, tick = callback_count(self.id, reset)
+   if not count then return nil, perror(level), level end
+   return count, level, tick
+end
+
 ---
 -- Cancel callback.
 -- @param self Callback.
 -- @return true on success, nil + errormsg on failure.
 function cCallback.cancel(self)
-   local res, err = tryB(callback_cancel(self.id))
+   local res, err = tryB(cancel_callback(self.id))
    if not res then return nil, err end
    self.session.callbacks[self.id] = nil
    return res
@@ -364,17 +397,110 @@ local cEventCallback = {}
 -- @param self Eventcallback
 -- @return true on success, nil + errormsg on failure.
 function cEventCallback.cancel(self)
-   local res, err = tryB(event_callback_cancel(self.id))
+   local res, err = tryB(cancel_event_callback(self.id))
    if not res then return nil, err end
    self.session.eventcallbacks[self.id] = nil
    return res
 end
 
+--------------------------------------------------------------------------------
+--- <h3>Pulse train decoder</h3>
+-- Decoders turn the edges of one or more pins into frames natively in the
+-- notification thread, only complete frames are delivered to Lua. Built-in
+-- decoders are "quadrature", "wiegand", "nec" and "dht22".<br>
+-- Constructor: <code>dec=session:openDecoder(name, pins, func, userdata, opts)</code>
+-- @type cDecoder
+--------------------------------------------------------------------------------
+local cDecoder = {}
+
+local decoderFields = {
+   quadrature = {"position", "delta"},
+   wiegand = {"bits", "low", "high"},
+   nec = {"address", "command", "repeated", "raw"},
+   dht22 = {"humidity", "temperature", "valid", "raw", "checksum"}
+}
+
+local function signed(v)
+   if v >= 0x80000000 then return v - 0x100000000 end
+   return v
+end
+
+--
+-- Convert the values of a decoded frame to a table.
+--
+local function decoderFrame(name, tick, ...)
+   local frame = {tick = tick}
+   local fields = decoderFields[name]
+   if not fields then
+      frame.data = {...}
+      return frame
+   end
+   for i, field in ipairs(fields) do
+      frame[field] = select(i, ...)
+   end
+   if name == "quadrature" then
+      frame.position = signed(frame.position)
+      frame.delta = signed(frame.delta)
+   elseif name == "wiegand" then
+      frame.code = (frame.high << 32) | frame.low
+   elseif name == "nec" then
+      frame.repeated = frame.repeated ~= 0
+   elseif name == "dht22" then
+      frame.humidity = frame.humidity / 10
+      frame.temperature = signed(frame.temperature) / 10
+      frame.valid = frame.valid ~= 0
+   end
+   return frame
+end
+
+---
+-- Read the last frame of the decoder.
+-- @param self Decoder.
+-- @return Frame table, nil if no frame has been decoded yet or nil +
+-- errormsg on failure.
+function cDecoder.read(self)
+   local tick, err = decoder_get(self.id)
+   if tick == nil then
+      if err then return nil, perror(err), err end
+      return nil
+   end
+   return decoderFrame(self.name, decoder_get(self.id))
+end
+
+---
+-- Start a read cycle of a DHT11/DHT22 sensor by pulling the data pin low.
+-- The frame is delivered once the sensor has finished its answer.
+-- @param self Decoder.
+-- @return true on success, nil + errormsg on failure.
+function cDecoder.trigger(self)
+   local sess, pin = self.session, self.pins[1]
+   local ok, err = sess:setMode(pin, OUTPUT)
+   if not ok then return nil, err end
+   ok, err = sess:write(pin, 0)
+   if not ok then return nil, err end
+   sleep(self.params[1] == 11 and 0.018 or 0.002)
+   return sess:setMode(pin, INPUT)
+end
+
+---
+-- Stop the decoder.
+-- @param self Decoder.
+-- @return true on success, nil + errormsg on failure.
+function cDecoder.cancel(self)
+   local res, err = tryB(decoder_close(self.id))
+   if not res then return nil, err end
+   self.session.decoders[self.id] = nil
+   return res
+end
+
 --------------------------------------------------------------------------------
 -- <h3>Notification channels</h3>
--- Notification channels record pin changes in a FIFO which is readable by a
--- file.<br>
--- Constructor:<code>notify=session:openNotify()</code>
+-- Notification channels record pin changes in a FIFO. Samples are read
+-- natively in large chunks into a ring buffer and delivered in batches by
+-- <code>notify:read()</code>. Sessions with a local daemon read the pipe
+-- /dev/pigpioN, other sessions receive the samples through the
+-- notification socket of the session.<br>
+-- Constructor:<code>notify=session:openNotify(opts)</code>
 -- @type cNotify
 --------------------------------------------------------------------------------
 local cNotify = {}
@@ -384,6 +510,9 @@ local cNotify = {}
 -- @param bits Bitmask defining the GPIOs to monitor.
 -- @return true on success, nil + errormsg on failure.
 cNotify.begin = function(self, bits)
+   if self.reader and not self.filename then
+      return tryB(notify_reader_begin(self.reader, bits))
+   end
    return tryB(notify_begin(self.pihandle, self.handle, bits))
 end
 
@@ -392,9 +521,45 @@ end
 -- @param self Notification channel.
 -- @return true on success, nil + errormsg on failure.
 cNotify.pause = function(self)
+   if self.reader and not self.filename then
+      return tryB(notify_reader_pause(self.reader))
+   end
    return tryB(notify_pause(self.pihandle, self.handle))
 end
 
+---
+-- Read a batch of notification samples.
+-- Samples are returned as arrays with the n-th sample in the n-th element
+-- of each array.
+-- @param self Notification channel.
+-- @param max Maximum number of samples - default: 1024.
+-- @param timeout Time in seconds to wait for samples if none are
+--        available, negative waits forever - default: 0.
+-- @return Arrays of ticks, levels, flags and sequence numbers, empty if
+--         no samples are available, nil + errormsg on failure.
+cNotify.read = function(self, max, timeout)
+   return notify_reader_read(self.reader, max or 1024, timeout)
+end
+
+---
+-- Retrieve a file descriptor which becomes readable when samples arrive.
+-- Useful in combination with select() or poll() of other libraries. Call
+-- <code>read()</code> until it returns an empty batch after wakeup.
+-- @param self Notification channel.
+-- @return File descriptor.
+cNotify.fd = function(self)
+   return notify_reader_fd(self.reader)
+end
+
+---
+-- Retrieve the number of buffered samples, the ring capacity and the
+-- number of samples dropped due to ring overflow.
+-- @param self Notification channel.
+-- @return count, capacity, drops
+cNotify.info = function(self)
+   return notify_reader_info(self.reader)
+end
+
 ---
 -- Convert a notification sample given in binary coded form in a Lua string
 -- into a table.
@@ -411,10 +576,126 @@ end
 -- @param self Notification channel.
 -- @return true on success, nil + errormsg on failure.
 cNotify.close = function(self)
-   local res, err = tryB(notify_close(self.pihandle, self.handle))
-   if not res then return nil, err end
+   if self.reader then
+      notify_reader_close(self.reader)
+   end
+   if self.filename then
+      local res, err = tryB(notify_close(self.pihandle, self.handle))
+      if not res then return nil, err end
+   end
    self.session.notifychannels[self.handle] = nil
-   return res
+   return true
+end
+
+--------------------------------------------------------------------------------
+-- <h3>Serial Streams</h3>
+-- A serial stream polls a serial device in a background thread and buffers
+-- the data received natively. Lua takes complete lines, delimited or fixed
+-- length messages from the buffer, either waiting with a timeout or after
+-- polling the file descriptor of the stream. The poll interval adapts to the
+-- traffic on the line.<br>
+-- Constructor:<code>stream=device:openStream(opts)</code>
+-- @type cSerialStream
+--------------------------------------------------------------------------------
+local cSerialStream = {}
+
+---
+-- Read a line. The end of line "\n" or "\r\n" is removed.
+-- @param self Serial stream.
+-- @param timeout Time in seconds to wait for a complete line, negative
+--        waits forever - default: 0.
+-- @return Line on success, nil + "timeout" if no complete line is
+--         available, nil + errormsg on failure.
+cSerialStream.readLine = function(self, timeout)
+   return tryR(serial_stream_read(self.stream, "line", nil, timeout))
+end
+
+---
+-- Read a message terminated by a delimiter. The delimiter is removed.
+-- @param self Serial stream.
+-- @param delim Delimiter string.
+-- @param timeout Time in seconds to wait, negative waits forever - default: 0.
+-- @return Message on success, nil + "timeout" if no complete message is
+--         available, nil + errormsg on failure.
+cSerialStream.readUntil = function(self, delim, timeout)
+   return tryR(serial_stream_read(self.stream, "delim", delim, timeout))
+end
+
+---
+-- Read exactly nbytes bytes.
+-- @param self Serial stream.
+-- @param nbytes Length of the message.
+-- @param timeout Time in seconds to wait, negative waits forever - default: 0.
+-- @return Message on success, nil + "timeout" if less than nbytes are
+--         available, nil + errormsg on failure.
+cSerialStream.readBytes = function(self, nbytes, timeout)
+   return tryR(serial_stream_read(self.stream, "length", nbytes, timeout))
+end
+
+---
+-- Read whatever is buffered, up to nbytes bytes.
+-- @param self Serial stream.
+-- @param nbytes Maximum number of bytes - default: 1024.
+-- @param timeout Time in seconds to wait for data, negative waits forever
+--        - default: 0.
+-- @return Data on success, nil + "timeout" if no data is available,
+--         nil + errormsg on failure.
+cSerialStream.read = function(self, nbytes, timeout)
+   return tryR(serial_stream_read(self.stream, "any", nbytes or 1024, timeout))
+end
+
+---
+-- Iterate over received lines until no line arrives within timeout.
+-- @param self Serial stream.
+-- @param timeout Time in seconds to wait for each line - default: forever.
+-- @return Iterator function.
+cSerialStream.lines = function(self, timeout)
+   return function()
+      return (serial_stream_read(self.stream, "line", nil, timeout or -1))
+   end
+end
+
+---
+-- Retrieve a file descriptor which is readable while the stream holds
+-- data. The data need not form a complete message.
+-- @param self Serial stream.
+-- @return File descriptor.
+cSerialStream.fd = function(self)
+   return serial_stream_fd(self.stream)
+end
+
+---
+-- Retrieve the number of buffered bytes, the buffer capacity, the number
+-- of polls, the number of bytes received and the error code of the poller.
+-- @param self Serial stream.
+-- @return count, capacity, polls, bytes, err
+cSerialStream.info = function(self)
+   return serial_stream_info(self.stream)
+end
+
+---
+-- Stop polling and release the buffer.
+-- @param self Serial stream.
+-- @return true.
+cSerialStream.close = function(self)
+   serial_stream_close(self.stream)
+   self.device.stream = nil
+   return true
+end
+
+--
+-- Common constructor of streams on serial and bit bang serial devices.
+--
+local function openSerialStream(dev, bb, opts)
+   local opts = opts or {}
+   if dev.stream then dev.stream:close() end
+   local stream, err = serial_stream_open(dev.pihandle, dev.handle, bb,
+                                          opts.capacity, opts.mininterval,
+                                          opts.maxinterval)
+   if not stream then return nil, err end
+   local s = setmetatable({stream = stream, device = dev}, {__index = cSerialStream})
+   dev.stream = s
+   return s
 end
 
 --------------------------------------------------------------------------------
@@ -430,9 +711,11 @@ local cSerial = {}
 -- @param self Device.
 -- @return true on success, nil + errormsg on failure.
 function cSerial.close(self)
+   if self.stream then self.stream:close() end
    local res, err = tryB(serial_close(self.pihandle, self.handle))
    if not res then return nil, err end
    self.session.serialdevs[self.handle] = nil
+   self.handle = nil
    return res
 end
 
@@ -455,24 +738,30 @@ end
 
 ---
 -- Write data to serial interface.
+-- Data of any length is accepted: large data is split into chunks which
+-- are pipelined to the daemon.
 -- @param self Device.
--- @param data Data to send as Lua string.
+-- @param data Data to send as Lua string or array.
 -- @return true on success, nil + errormsg on failure.
 function cSerial.write(self, data)
-   return tryB(serial_write(self.pihandle, self.handle, data, #data))
+   local n, err = write_chunked(self.pihandle, "serial", self.handle, data)
+   if not n then return nil, perror(err), err end
+   return true
 end
 
 ---
 -- Read data from serial interface. Up to nbytes are read.
 -- @param self Device.
 -- @param nbytes Number of bytes to read.
+-- @param into Optional array receiving the data, returned instead of a
+--        string together with the number of bytes received.
 -- @return Data read.
-function cSerial.read(self, nbytes)
-   local res, errno = serial_read(self.pihandle, self.handle, nbytes)
+function cSerial.read(self, nbytes, into)
+   local res, errno = serial_read(self.pihandle, self.handle, nbytes, into)
    if res == nil then
       return nil, perror(errno)
    end
-   return res
+   return res, errno
 end
 
 ---
@@ -483,6 +772,18 @@ function cSerial.dataAvailable(self)
    return tryV(serial_data_available(self.pihandle, self.handle))
 end
 
+---
+-- Start streaming: a background thread polls the device and buffers the
+-- data received. Do not mix <code>read()</code> of the device with reads
+-- of the stream.
+-- @param self Device.
+-- @param opts Options: <code>{capacity=BYTES, mininterval=SECONDS,
+--        maxinterval=SECONDS}</code> - default: 4096 bytes, 1 ms to 50 ms.
+-- @return Serial stream on success, nil + errormsg on failure.
+function cSerial.openStream(self, opts)
+   return openSerialStream(self, false, opts)
+end
+
 --------------------------------------------------------------------------------
 -- <h3>I2C Device</h3>
 -- This is a master I2C device.<br>
@@ -498,6 +799,7 @@ function cI2C.close(self)
    local ret, err = tryB(i2c_close(self.pihandle, self.handle))
    if not ret then return nil, err end
    self.session.i2cdevs[self.handle] = nil
+   self.handle = nil
    return ret
 end
 
@@ -533,9 +835,7 @@ end
 -- @param reg Register number.
 -- @param byte Byte to write.
 -- @return true on success, nil + errormsg on failure
-function cI2C.writeByte(self, reg, byte)
-   return tryB(i2c_write_byte_data(self.pihandle, self.handle, reg, byte))
-end
+-- @function cI2C.writeByte
 
 ---
 -- Write the given 16 bit word to the given register in given device.
@@ -543,27 +843,21 @@ end
 -- @param reg Register number.
 -- @param word  Word to write.
 -- @return true on success, nil + errormsg on failure
-function cI2C.writeWord(self, reg, word)
-   return tryB(i2c_write_word_data(self.pihandle, self.handle, reg, word))
-end
+-- @function cI2C.writeWord
 
 ---
 -- Read a byte from the given register in given device.
 -- @param self Device.
 -- @param reg Register number.
 -- @return Byte read on success, nil + errormsg on failure.
-function cI2C.readByte(self, reg)
-   return tryV(i2c_read_byte_data(self.pihandle, self.handle, reg))
-end
+-- @function cI2C.readByte
 
 ---
 -- Read a 16 bit word from the given register in given device.
 -- @param self Device.
 -- @param reg Register number.
 -- @return Word read on success, nil + errormsg on failure.
-function cI2C.readWord(self, reg)
-   return tryV(i2c_read_word_data(self.pihandle, self.handle, reg))
-end
+-- @function cI2C.readWord
 
 ---
 -- Write + read (process) given 16 bit value to/freom given device.
@@ -589,14 +883,16 @@ end
 -- Read a block of bytes from given register of given device.
 -- @param self Device.
 -- @param reg Register number.
+-- @param into Optional array receiving the data, returned instead of a
+--        string together with the number of bytes received.
 -- @return Binary data stored in Lua string allowing embedded zeros on success
 --         nil + errormsg on failure.
-function cI2C.readBlockData(self, reg)
-   local res, errno = i2c_read_block_data(self.pihandle, self.handle, reg)
+function cI2C.readBlockData(self, reg, into)
+   local res, errno = i2c_read_block_data(self.pihandle, self.handle, reg, into)
    if res == nil then
       return nil, perror(errno)
    end
-   return res
+   return res, errno
 end
 
 ---
@@ -624,48 +920,80 @@ end
 -- @param self Device.
 -- @param reg Register number.
 -- @param nbytes Number of bytes to be read.
+-- @param into Optional array receiving the data, returned instead of a
+--        string together with the number of bytes received.
 -- @return Number of byte read.
-function cI2C.readI2CBlockData(self, reg, nbytes)
-   local res, errno = i2c_read_i2c_block_data(self.pihandle, self.handle, reg, nbytes)
-   if res == nil then
-      return nil, perror(errno)
-   end
-   return res
-end
+-- @function cI2C.readI2CBlockData
 
 ---
 -- Read given number bytes from given device.
 -- @param self Device.
 -- @param nbytes Number of bytes to be read.
+-- @param into Optional array receiving the data, returned instead of a
+--        string together with the number of bytes received.
 -- @return Lua string with read data.
-function cI2C.readDevice(self, nbytes)
-   local res, errno = i2c_read_device(self.pihandle, self.handle, nbytes)
-   if not res then
-      return nil, perror(errno)
-   end
-   return res
-end
+-- @function cI2C.readDevice
 
 ---
 -- Write given data to given device.
+-- Data of any length is accepted: large data is split into chunks which
+-- are pipelined to the daemon, each chunk being a transfer of its own.
 -- @param self Device.
--- @param data Lua string with data to write.
+-- @param data Lua string or array with data to write.
 -- @return true on success, nil + errormsg on failure.
 function cI2C.writeDevice(self, data)
-   return tryB(i2c_write_device(self.pihandle, self.handle, data, #data))
+   local n, err = write_chunked(self.pihandle, "i2c", self.handle, data)
+   if not n then return nil, perror(err), err end
+   return true
 end
 
 ---
 -- Execute a sequence of I2C commands.
 -- For details see <a href=http://abyz.me.uk/rpi/pigpio/pdif2.html#i2c_zip> I2C ZIP </a>
 -- @param self Device.
--- @param inbuf Lua String with data to be sent.
--- @param outlen Number of Byte to be returned.
+-- @param inbuf Lua String with data to be sent or a zip program created
+--        by <code>gpio.newZip()</code>.
+-- @param outlen Number of Byte to be returned - ignored for zip programs.
 -- @return Bytes read in a Lua string on success, nil + errormsg on failure.
+-- Zip programs return a table mapping the names of their reads to the
+-- bytes read and the string of all bytes read.
 function cI2C.zip(self, inbuf, outlen)
+   if type(inbuf) == "table" then
+      local results, raw = zip_run(self.pihandle, self.handle, inbuf.handle, false)
+      if not results then return nil, perror(raw), raw end
+      return results, raw
+   end
    return tryV(i2c_zip(self.pihandle, self.handle, inbuf, #inbuf, outlen))
 end
 
+---
+-- Execute a list of operations in one transaction.
+-- All operations are sent to the daemon as one pipeline without waiting
+-- for each reply. Operations are given as tables, e.g.<br>
+-- <code>dev:transact{{"read_byte", 0x3b}, {"write_word", 0x10, 0x1234},
+-- {"read_i2c_block", 0x43, 6}}</code><br>
+-- Supported operations: write_quick(bit), send_byte(val), receive_byte(),
+-- write_byte(reg, val), write_word(reg, val), read_byte(reg), read_word(reg),
+-- process_call(reg, val), write_block(reg, data), read_block(reg),
+-- write_i2c_block(reg, data), read_i2c_block(reg, n), write_device(data),
+-- read_device(n). The names of the corresponding methods, e.g.
+-- "readByte", are accepted as well.
+-- @param self Device.
+-- @param ops List of operations.
+-- @return List of results on success: the value or string read or true
+-- for write operations. On failure of any operation nil, errormsg of the
+-- first failure and the list of results with false for failed operations.
+function cI2C.transact(self, ops)
+   local results, errs = i2c_transact(self.pihandle, self.handle, ops)
+   if not results then return nil, perror(errs), errs end
+   if errs then
+      for i = 1, #ops do
+         if errs[i] then return nil, perror(errs[i]), results end
+      end
+   end
+   return results
+end
+
 --------------------------------------------------------------------------------
 -- <h3>I2C Bit Banging Device</h3>
 -- This device is a GPIO based I2C device allowing special service primitives.
@@ -682,6 +1010,7 @@ function cI2Cbb.close(self)
    local res, err = tryB(bb_i2c_close(self.pihandle, self.handle))
    if not res then return nil, err end
    self.session.bbi2cdevs[self.handle] = nil
+   self.handle = nil
    return res
 end
 
@@ -689,13 +1018,160 @@ end
 -- Execute a sequence of I2C commands.
 -- For details see <a href=http://abyz.me.uk/rpi/pigpio/pdif2.html#i2c_zip> I2C ZIP </a>
 -- @param self Device.
--- @param inbuf Lua String with data to be sent.
--- @param outlen Number of Byte to be returned.
+-- @param inbuf Lua String with data to be sent or a zip program created
+--        by <code>gpio.newZip()</code>.
+-- @param outlen Number of Byte to be returned - ignored for zip programs.
 -- @return Bytes read in a Lua string on success, nil + errormsg on failure.
+-- Zip programs return a table mapping the names of their reads to the
+-- bytes read and the string of all bytes read.
 function cI2Cbb.zip(self, inbuf, outlen)
+   if type(inbuf) == "table" then
+      local results, raw = zip_run(self.pihandle, self.handle, inbuf.handle, true)
+      if not results then return nil, perror(raw), raw end
+      return results, raw
+   end
    return tryV(bb_i2c_zip(self.pihandle, self.handle, inbuf, #inbuf, outlen))
 end
 
+--------------------------------------------------------------------------------
+-- <h3>I2C Zip Program</h3>
+-- A command buffer for <code>dev:zip()</code> of I2C and bit banging I2C
+-- devices, assembled natively. The methods append commands and return
+-- the program, hence calls can be chained. A program is built once and
+-- executed any number of times.<br>
+-- Constructor: <code>zip=gpio.newZip()</code>
+-- @type cZip
+--------------------------------------------------------------------------------
+local cZip = {}
+
+---
+-- Set the device address.
+-- @param self Zip program.
+-- @param addr I2C address.
+-- @return self
+function cZip.addr(self, addr)
+   zip_add(self.handle, "addr", addr)
+   return self
+end
+
+---
+-- Set the flags of following transfers.
+-- @param self Zip program.
+-- @param flags 16 bit flags.
+-- @return self
+function cZip.flags(self, flags)
+   zip_add(self.handle, "flags", flags)
+   return self
+end
+
+---
+-- Start condition (bit banging) or combined transfers on (I2C).
+-- @param self Zip program.
+-- @return self
+function cZip.start(self)
+   zip_add(self.handle, "start")
+   return self
+end
+cZip.combinedOn = cZip.start
+
+---
+-- Stop condition (bit banging) or combined transfers off (I2C).
+-- @param self Zip program.
+-- @return self
+function cZip.stop(self)
+   zip_add(self.handle, "stop")
+   return self
+end
+cZip.combinedOff = cZip.stop
+
+---
+-- Write bytes.
+-- @param self Zip program.
+-- @param data Lua string or table of byte values.
+-- @return self
+function cZip.write(self, data)
+   zip_add(self.handle, "write", data)
+   return self
+end
+
+---
+-- Read bytes.
+-- @param self Zip program.
+-- @param n Number of bytes.
+-- @param name Key of the bytes in the result table - default: index of
+--        the read in the program.
+-- @return self
+function cZip.read(self, n, name)
+   zip_add(self.handle, "read", n, name)
+   return self
+end
+
+---
+-- End of the program.
+-- @param self Zip program.
+-- @return self
+cZip["end"] = function(self)
+   zip_add(self.handle, "end")
+   return self
+end
+
+---
+-- Retrieve the command buffer and the number of bytes read.
+-- @param self Zip program.
+-- @return Command buffer as Lua string, number of bytes read.
+function cZip.buffer(self)
+   return zip_info(self.handle)
+end
+
+--------------------------------------------------------------------------------
+-- <h3>SPI Samplers</h3>
+-- An SPI sampler repeats a fixed transfer at a given rate in a background
+-- thread, pipelining the transfers due. A value is taken from each received
+-- frame and buffered natively together with the tick of the transfer.<br>
+-- Constructor:<code>sampler=device:startSampling(tx, rate, opts)</code>
+-- @type cSPISampler
+--------------------------------------------------------------------------------
+local cSPISampler = {}
+
+---
+-- Read a batch of samples.
+-- @param self SPI sampler.
+-- @param max Maximum number of samples - default: 4096.
+-- @param timeout Time in seconds to wait for samples if none are
+--        available, negative waits forever - default: 0.
+-- @param ticks Optional u32 array receiving the ticks.
+-- @param values Optional u32 array receiving the values, required
+--        together with ticks. At most as many samples as both arrays
+--        hold are read.
+-- @return u32 arrays of ticks and values and the number of samples read,
+--         new arrays of this size if none are given, nil + errormsg if
+--         sampling has failed.
+cSPISampler.read = function(self, max, timeout, ticks, values)
+   local res, err, n = spi_sampler_read(self.sampler, max or 4096, timeout, ticks, values)
+   if not res then return tryR(res, err) end
+   return res, err, n
+end
+
+---
+-- Retrieve the number of buffered samples, the ring capacity, the number
+-- of samples dropped due to ring overflow, the number of samples and
+-- pipelines so far and the error code of the sampler.
+-- @param self SPI sampler.
+-- @return count, capacity, drops, samples, batches, err
+cSPISampler.info = function(self)
+   return spi_sampler_info(self.sampler)
+end
+
+---
+-- Stop sampling and release the ring.
+-- @param self SPI sampler.
+-- @return true.
+cSPISampler.stop = function(self)
+   spi_sampler_stop(self.sampler)
+   self.device.sampler = nil
+   return true
+end
+
 --------------------------------------------------------------------------------
 -- <h3>SPI Device</h3>
 -- This is a master SPI device.<br>
@@ -709,9 +1185,11 @@ local cSPI = {}
 -- @param self Decvice.
 -- @return true on success, nil + errormsg on failure
 function cSPI.close(self)
+   if self.sampler then self.sampler:stop() end
    local res, err = tryB(spi_close(self.pihandle, self.handle))
    if not res then return nil, err end
    self.session.spidevs[self.handle] = nil
+   self.handle = nil
    return true
 end
 
@@ -719,39 +1197,57 @@ end
 -- Read given number of bytes from SPI interface.
 -- @param self Device.
 -- @param nbytes Number of bytes to read.
+-- @param into Optional array receiving the data, returned instead of a
+--        string together with the number of bytes received.
 -- @return Data read in Lua string, nil + errormsg on failure.
-function cSPI.read(self, nbytes)
-   local res, errno = spi_read(self.pihandle, self.handle, nbytes)
-   if res == nil then
-      return nil, perror(errno)
-   end
-   return res
-end
+-- @function cSPI.read
 
 ---
 -- Write given data to SPI interface.
+-- Data of any length is accepted: large data is split into chunks which
+-- are pipelined to the daemon, each chunk being a transfer of its own.
 -- @param self Device.
 -- @param data Data to write in a Lua string.
 -- @return Number of byte written, nil + errormsg on failure
 function cSPI.write(self, data)
-   local res, errno = spi_write(self.pihandle, self.handle, data, #data)
-   if not res then
-      return nil, perror(errno)
-   end
-   return res
+   local n, err = write_chunked(self.pihandle, "spi", self.handle, data)
+   if not n then return nil, perror(err), err end
+   return n
 end
 
 ---
 -- Transfer (write and read) given data.
 -- The number of bytes read is equal to the number of bytes written.
 -- @param self Device.
--- @param data Data to write in a Lua string.
+-- @param data Data to write in a Lua string or an array.
+-- @param into Optional array receiving the data, returned instead of a
+--        string together with the number of bytes received.
 -- @return Data read in a Lua string on success, nil + errormsg on failure.
-function cSPI.transfer(self, data)
-   local s, err = spi_xfer(self.pihandle, self.handle, data, #data)
-   if not s then
-      return nil, err
-   end
+-- @function cSPI.transfer
+
+---
+-- Start sampling: the transfer of tx is repeated at the given rate by a
+-- background thread. The value of a sample is the big endian number in
+-- bytes first to first + nbytes - 1 (0 based) of the received frame,
+-- and-ed with mask. For a MCP3008 channel c use
+-- <code>dev:startSampling(string.char(1, 0x80 + c * 16, 0), 10000,
+-- {first=1, nbytes=2, mask=0x3ff})</code>.
+-- @param self Device.
+-- @param tx Frame to transfer, at most 32 bytes.
+-- @param rate Samples per second.
+-- @param opts Options: <code>{capacity=SAMPLES, first=FIRST, nbytes=NBYTES,
+--        mask=MASK}</code> - default: 65536 samples, bytes 0 to 3 of the
+--        frame, all bits.
+-- @return SPI sampler on success, nil + errormsg on failure.
+function cSPI.startSampling(self, tx, rate, opts)
+   local opts = opts or {}
+   if self.sampler then self.sampler:stop() end
+   local sampler, err = spi_sampler_start(self.pihandle, self.handle, tx, rate,
+                                          opts.capacity, opts.first,
+                                          opts.nbytes, opts.mask)
+   if not sampler then return nil, err end
+   local s = setmetatable({sampler = sampler, device = self}, {__index = cSPISampler})
+   self.sampler = s
    return s
 end
 
@@ -771,6 +1267,7 @@ function cSPIbb.close(self)
    local res, err = tryB(bb_spi_close(self.pihandle, self.handle))
    if not res then return nil, err end
    self.session.bbspidevs[self.handle] = nil
+   self.handle = nil
    return true
 end
 
@@ -778,14 +1275,16 @@ end
 -- Transfer (write and read) given data.
 -- The number of bytes read is equal to the number of bytes written.
 -- @param self Device.
--- @param data Data to write in a Lua string.
+-- @param data Data to write in a Lua string or an array.
+-- @param into Optional array receiving the data, returned instead of a
+--        string together with the number of bytes received.
 -- @return Data read in a Lua string on success, nil + errormsg on failure.
-function cSPIbb.transfer(self, data)
-   local s, errcode = bb_spi_xfer(self.pihandle, self.handle, data, #data)
+function cSPIbb.transfer(self, data, into)
+   local s, err = bb_spi_xfer(self.pihandle, self.handle, data, nil, into)
    if not s then
-      return nil, perror(errcode)
+      return nil, perror(err), err
    end
-   return s
+   return s, err
 end
 
 --------------------------------------------------------------------------------
@@ -801,11 +1300,13 @@ local cSerialRead = {}
 -- @param self Device.
 -- @return true on success, nil + errormsg on failure.
 function cSerialRead.close(self)
+   if self.stream then self.stream:close() end
    local res, err = tryB(bb_serial_read_close(self.pihandle, self.handle))
    if not res then
       return nil, err
    end
    self.session.bbserialdevs[self.handle] = nil
+   self.handle = nil
    return true
 end
 
@@ -813,13 +1314,15 @@ end
 -- Read data from serial read bit banging device.
 -- @param self Device.
 -- @param nbytes Number of bytes to read.
+-- @param into Optional array receiving the data, returned instead of a
+--        string together with the number of bytes received.
 -- @return Data read in Lua string on success, nil + errormsg on failure.
-function cSerialRead.read(self, nbytes)
-   local s, errcode = bb_serial_read(self.pihandle, self.handle, nbytes)
+function cSerialRead.read(self, nbytes, into)
+   local s, errcode = bb_serial_read(self.pihandle, self.handle, nbytes, into)
    if not s then
       return nil, perror(errcode)
    end
-   return s
+   return s, errcode
 end
 
 ---
@@ -836,6 +1339,18 @@ function cSerialRead.invert(self, invert)
    return true
 end
 
+---
+-- Start streaming: a background thread polls the device and buffers the
+-- data received. Do not mix <code>read()</code> of the device with reads
+-- of the stream.
+-- @param self Device.
+-- @param opts Options: <code>{capacity=BYTES, mininterval=SECONDS,
+--        maxinterval=SECONDS}</code> - default: 4096 bytes, 1 ms to 50 ms.
+-- @return Serial stream on success, nil + errormsg on failure.
+function cSerialRead.openStream(self, opts)
+   return openSerialStream(self, true, opts)
+end
+
 --------------------------------------------------------------------------------
 -- <h3>Files</h3>
 -- File object allows managing storage in connected hosts.
@@ -852,6 +1367,7 @@ function cFile.close(self)
    local res, err = tryB(file_close(self.pihandle, self.handle))
    if not res then return nil, err end
    self.session.files[self.handle] = nil
+   self.handle = nil
    return true
 end
 
@@ -859,22 +1375,28 @@ end
 -- Read the given number of bytes from the file.
 -- @param self File.
 -- @param nbytes Number of bytes to read.
+-- @param into Optional array receiving the data, returned instead of a
+--        string together with the number of bytes received.
 -- @return Data read in Lua string on success, nil + errormsg on failure.
-function cFile.read(self, nbytes)
-   local s, errcode = file_read(self.pihandle, self.handle, nbytes)
+function cFile.read(self, nbytes, into)
+   local s, errcode = file_read(self.pihandle, self.handle, nbytes, into)
    if not s then
       return nil, perror(errcode)
    end
-   return s
+   return s, errcode
 end
 
 ---
 -- Write the given data to the file.
+-- Data of any length is accepted: large data is split into chunks which
+-- are pipelined to the daemon.
 -- @param self File.
 -- @param data Data to be written.
 -- @return true on success, nil + errormsg on failure.
 function cFile.write(self, data)
-   return tryB(file_write(self.pihandle, self.handle, data, #data))
+   local n, err = write_chunked(self.pihandle, "file", self.handle, data)
+   if not n then return nil, perror(err), err end
+   return true
 end
 
 ---
@@ -888,6 +1410,146 @@ function cFile.seek(self, offset, from)
    return tryV(file_seek(self.pihandle, self.handle, offset, from))
 end
 
+---
+-- Read from the current position to the end of the file.
+-- Several reads are kept in flight, with chunks growing up to the maximum
+-- the daemon supports.
+-- @param self File.
+-- @return Data read in Lua string on success, nil + errormsg on failure.
+function cFile.readAll(self)
+   return tryR(file_read_all(self.pihandle, self.handle))
+end
+
+---
+-- Copy from the current position to the end of the file into a local file.
+-- @param self File.
+-- @param localpath Name of the local file, which is overwritten.
+-- @return Number of bytes copied on success, nil + errormsg on failure.
+function cFile.copyTo(self, localpath)
+   return tryR(file_copy_to(self.pihandle, self.handle, localpath))
+end
+
+---
+-- Write the contents of a local file at the current position.
+-- @param self File.
+-- @param localpath Name of the local file.
+-- @return Number of bytes written on success, nil + errormsg on failure.
+function cFile.writeFrom(self, localpath)
+   return tryR(file_write_from(self.pihandle, self.handle, localpath))
+end
+
+--------------------------------------------------------------------------------
+-- <h3>Capture</h3>
+-- A running capture of the notification stream of a session into a file.
+-- Level changes, watchdog and event reports are encoded natively in the
+-- notification thread and written in large blocks by a writer thread.<br>
+-- Constructor: <code>cap=session:startCapture(filename, pins, opts)</code>
+-- @type cCapture
+--------------------------------------------------------------------------------
+local cCapture = {}
+
+---
+-- Retrieve capture statistics.
+-- @param self Capture.
+-- @return Table with fields <code>records, drops, blocks, bytes, running</code>
+--         and <code>error</code> if writing failed.
+function cCapture.info(self)
+   return capture_info(self.handle)
+end
+
+---
+-- Stop the capture and complete the file with its index.
+-- @param self Capture.
+-- @return Statistics as with <code>info()</code> on success, nil + errormsg
+--         on failure.
+function cCapture.stop(self)
+   self.session.captures[self] = nil
+   return capture_stop(self.handle)
+end
+
+--------------------------------------------------------------------------------
+-- <h3>Tick Clock</h3>
+-- Relates the 32 bit tick of the daemon of a session to the monotonic
+-- clock of the local host, see <code>gpio.monotonic()</code>. Each sync
+-- reads the tick in a short burst of round trips; offset and drift are
+-- fitted through the recent syncs with small round trip times. Ticks are
+-- unwrapped to 64 bit, which is correct for ticks within 35 minutes of
+-- the latest tick seen; feeding the ticks of callbacks to
+-- <code>clock:unwrap()</code> keeps it so between syncs.<br>
+-- Constructor: <code>clock=session:openClock(opts)</code>
+-- @type cTickClock
+--------------------------------------------------------------------------------
+local cTickClock = {}
+
+---
+-- Sync the clock now.
+-- @param self Tick clock.
+-- @return true on success, nil + errormsg if no round trip succeeded.
+function cTickClock.sync(self)
+   return tryR(tickclock_sync(self.clock))
+end
+
+---
+-- Unwrap a tick to 64 bit.
+-- @param self Tick clock.
+-- @param tick Tick as reported by the daemon.
+-- @return Unwrapped tick.
+function cTickClock.unwrap(self, tick)
+   return tickclock_unwrap(self.clock, tick)
+end
+
+---
+-- Convert a tick into local monotonic time.
+-- Ticks beyond 32 bit are taken as unwrapped already.
+-- @param self Tick clock.
+-- @param tick Tick.
+-- @return Local monotonic time in seconds.
+function cTickClock.toLocal(self, tick)
+   return tickclock_to_local(self.clock, tick)
+end
+
+---
+-- Convert local monotonic time into a tick.
+-- @param self Tick clock.
+-- @param t Local monotonic time in seconds - default: now.
+-- @return Unwrapped tick.
+function cTickClock.toTick(self, t)
+   return tickclock_to_tick(self.clock, t)
+end
+
+---
+-- Estimate the current tick of the daemon without a round trip.
+-- @param self Tick clock.
+-- @return Unwrapped tick.
+function cTickClock.now(self)
+   return tickclock_to_tick(self.clock)
+end
+
+---
+-- Retrieve the state of the clock.
+-- @param self Tick clock.
+-- @return Table with fields <code>offset</code> (local time of the first
+--         synced tick), <code>drift</code> (ppm), <code>minrtt</code>
+--         (seconds), <code>samples</code>, <code>syncs</code> and
+--         <code>err</code> (error message of the latest sync if it
+--         failed).
+function cTickClock.info(self)
+   local offset, drift, minrtt, samples, syncs, err = tickclock_info(self.clock)
+   return {offset = offset, drift = drift, minrtt = minrtt,
+           samples = samples, syncs = syncs,
+           err = err ~= 0 and perror(err) or nil}
+end
+
+---
+-- Close the clock and stop syncing.
+-- @param self Tick clock.
+-- @return true.
+function cTickClock.close(self)
+   self.session.clocks[self] = nil
+   tickclock_close(self.clock)
+   return true
+end
+
 --------------------------------------------------------------------------------
 -- <h3>I2C Slave Device</h3>
 -- This is a slave I2C device.<br>
@@ -906,6 +1568,7 @@ function cI2CSlave.close(self)
       return nil, perror(errcode)
    end
    self.session.i2cslvs[self.handle] = nil
+   self.handle = nil
    return res
 end
 
@@ -984,19 +1647,44 @@ cSession.close = function(self)
    for _, item in pairs(self.notifychannels) do item:close() end
    for _, item in pairs(self.callbacks) do item:cancel() end
    for _, item in pairs(self.eventcallbacks) do item:cancel() end
+   for _, item in pairs(self.decoders) do item:cancel() end
+   for item in pairs(self.captures) do item:stop() end
+   for item in pairs(self.clocks) do item:close() end
    for _, item in pairs(self.i2cdevs) do item:close() end
    for _, item in pairs(self.spidevs) do item:close() end
    for _, item in pairs(self.serialdevs) do item:close() end
    for _, item in pairs(self.bbi2cdevs) do item:close() end
+   for _, item in pairs(self.bbserialdevs) do item:close() end
    for _, item in pairs(self.bbspidevs) do item:close() end
    for _, item in pairs(self.files) do item:close() end
    for _, item in pairs(self.i2cslvs) do item:close() end
-   _G._PIGPIOD_SESSIONS[self.handle] = nil
    pigpio_stop(self.handle)
    self.handle = nil
    return true
 end
 
+---
+-- Set CPU affinity and real-time priority of the session's threads.
+-- The notification thread receives GPIO reports from the daemon, the
+-- dispatch thread is the calling thread which executes Lua callbacks.
+-- @param self Session.
+-- @param opts Table with optional fields <code>cpu</code> and
+--        <code>priority</code> for the notification thread and
+--        <code>dispatchcpu</code> and <code>dispatchpriority</code> for
+--        the dispatch thread. A cpu of -1 leaves the affinity unchanged,
+--        a priority > 0 selects SCHED_FIFO, 0 the default policy.
+-- @return true on success, nil + errormsg on error.
+cSession.setScheduling = function(self, opts)
+   if opts.cpu or opts.priority then
+      local ok, err, code = tryB(notify_sched(self.handle, opts.cpu or -1, opts.priority or 0))
+      if not ok then return nil, err, code end
+   end
+   if opts.dispatchcpu or opts.dispatchpriority then
+      return tryB(thread_schedule(nil, opts.dispatchcpu or -1, opts.dispatchpriority or 0))
+   end
+   return true
+end
+
 ---
 -- Set pin mode.
 -- @param self Session.
@@ -1031,9 +1719,7 @@ end
 -- @param self Session.
 -- @param pin GPIO number.
 -- @return Pin level.
-cSession.read = function(self, pin)
-   return tryV(gpioread(self.handle, pin))
-end
+-- @function cSession.read
 
 ---
 -- Write pin level.
@@ -1041,9 +1727,7 @@ end
 -- @param pin GPIO number.
 -- @param val Level to set, 0 or 1.
 -- @return true on success, nil + errormsg on failure.
-cSession.write = function(self, pin, val)
-   return tryB(gpio_write(self.handle, pin, val))
-end
+-- @function cSession.write
 
 ---
 -- Start Software controlled PWM on given pin.
@@ -1051,18 +1735,14 @@ end
 -- @param pin GPIO number.
 -- @param dutycycle Dutycycle to use (0..range) default: 0..255.
 -- @return true on success, nil + errormsg on failure.
-cSession.setPwmDutycycle = function(self, pin, dutycycle)
-   return tryB(set_PWM_dutycycle(self.handle, pin, dutycycle))
-end
+-- @function cSession.setPwmDutycycle
 
 ---
 -- Get the PWM duty cycle.
 -- @param self Session.
 -- @param pin GPIO number.
 -- @return Active dutycycle: 0..range 
-cSession.getPwmDutycycle = function(self, pin)
-   return tryV(get_PWM_dutycycle(self.handle, pin))
-end
+-- @function cSession.getPwmDutycycle
 
 ---
 -- Set the dutycycle range for PWM on given pin.
@@ -1115,39 +1795,54 @@ end
 -- @param self Session.
 -- @param pin GPIO number.
 -- @param pulsewidth Pulsewidth between 500 and 2500, default: 1500.
-cSession.setServoPulsewidth = function(self, pin, pulsewidth)
-   return tryB(set_servo_pulsewidth(self.handle, pin, pulsewidth))
-end
-cSession.servo = cSession.setServoPulsewidth
+-- @function cSession.setServoPulsewidth
 
 ---
 -- Get servo pulsewidth.
 -- @param self Session.
 -- @param pin GPIO number.
 -- @return Servo pulsewidth.
-cSession.getServoPulsewidth = function(self, pin)
-   return tryV(get_servo_pulsewidth(self.handle, pin))
-end
+-- @function cSession.getServoPulsewidth
 
 ---
 -- Open a notification channel.
--- Data can be read from file /dev/pigpio<handle> with <handle>
--- as returned by this function.
+-- Samples are read with <code>notify:read()</code>. Sessions with a daemon
+-- on the local host read the pipe /dev/pigpio<handle>, other sessions
+-- take the samples from the notification socket of the session.
 -- @param self Session.
--- @return Notifcation channel handle.
-cSession.openNotify = function(self)
+-- @param opts Options (optional):
+-- <ul>
+-- <li>capacity: size of the sample ring - default: 4096.
+-- <li>mode: "pipe" or "socket" - default: "pipe" for local sessions.
+-- </ul>
+-- @return Notification channel on success, nil + errormsg on failure.
+cSession.openNotify = function(self, opts)
+   opts = opts or {}
    local notify = {}
-   notify.handle = math.floor(notify_open(self.handle))
+   local localhost = {localhost = true, ["127.0.0.1"] = true, ["::1"] = true}
    notify.pihandle = self.handle
-   if notify.handle < 0  then
-      return nil, perror(notify.handle), notify.handle
+   notify.session = self
+   if (opts.mode or (localhost[self.host] and "pipe" or "socket")) == "pipe" then
+      notify.handle = math.floor(notify_open(self.handle))
+      if notify.handle < 0  then
+         return nil, perror(notify.handle), notify.handle
+      end
+      notify.filename = "/dev/pigpio"..notify.handle
+      local reader, err = notify_reader_open(self.handle, notify.handle, opts.capacity)
+      if not reader then
+         notify_close(self.handle, notify.handle)
+         return nil, err
+      end
+      notify.reader = reader
+   else
+      notify.reader = notify_reader_open(self.handle, -1, opts.capacity)
+      -- key into the session's channel list
+      notify.handle = notify
    end
    setmetatable(notify, {
                    __index = cNotify,
                    __gc = function(self) self:close() end
    })
-   notify.filename = "/dev/pigpio"..notify.handle
-   notify.session = self
    self.notifychannels[notify.handle] = notify
    return notify
 end
@@ -1178,43 +1873,10 @@ cSession.setNoiseFilter = function(self, pin, steady, active)
    return tryB(set_noise_filter(self.handle, pin, steady, active))
 end
 
-cSession.readBank1 = function(self)
-   return tryV(read_bank_1(self.handle))
-end
-
-cSession.readBank2 = function(self)
-   return tryV(read_bank_2(self.handle))
-end
-
-cSession.clearBank1 = function(self, bits)
-   return tryB(clear_bank_1(self.handle, bits))
-end
-
-cSession.clearBank2 = function(self, bits)
-   return tryB(clear_bank_2(self.handle, bits))
-end
-
-cSession.setBank1 = function(self, bits)
-   return tryB(clear_bank_1(self.handle, bits))
-end
-
-cSession.setBank2 = function(self, bits)
-   return tryB(clear_bank_2(self.handle, bits))
-end
-
 cSession.hardwareClock = function(self, pin, clkfreq)
    return tryB(hardware_clock(self.handle, pin, clkfreq))
 end
 
-cSession.hardwarePwm = function(self, pin, pwmfreq, pwmduty)
-   return tryB(hardware_PWM(self.handle, pin, pwmfreq, pwmduty))
-end
-
-cSession.getCurrentTick = function(self)
-   return tryV(get_current_tick(self.handle))
-end
-cSession.tick = cSession.getCurrentTick
-
 cSession.getHardwareRevision = function(self)
    local hwrev = get_hardware_revision(self.handle)
    local typ, model, comment
@@ -1453,20 +2115,47 @@ end
 cSession.storeScript = cSession.openScript
 cSession.scriptOpen = cSession.openScript
 
+local policies = {
+   all = 0,
+   latest = 1,
+   rate = 2,
+   count = 3
+}
+
 ---
 -- Define a pin event callback function.
 -- The callback function has the following signature:<br>
--- <code>cbfunc(sess, pin, level, tick, [userdata])</code>
+-- <code>cbfunc(sess, pin, level, tick, userdata, count)</code><br>
+-- The delivery policy is selected by <code>opts.policy</code>:
+-- <ul>
+-- <li>"all" (default): one call per edge, count is 1.</li>
+-- <li>"latest": edges arriving while a call is pending are collapsed into
+-- this call which receives the final level and tick and the number of
+-- edges in count.</li>
+-- <li>"rate": at most <code>opts.rate</code> calls per second; count
+-- gives the number of edges since the previous call.</li>
+-- <li>"count": no calls at all, edges are only counted natively; read them
+-- with <code>cb:count()</code>. func may be nil.</li>
+-- </ul>
 -- @param self Session.
 -- @param pin GPIO number.
 -- @param edge Type of edge:
 --        <code>gpio.RISING_EDGE, gpio.FALLING_EDGE, gpio.EITHER_EDGE</code>
 -- @param func Lua callback function.
 -- @param userdata Any Lua value as user parameter.
+-- @param opts Delivery options <code>{policy=POLICY, rate=N}</code> (optional).
 -- @return Callback object.
-cSession.callback = function(self, pin, edge, func, userdata)
+cSession.callback = function(self, pin, edge, func, userdata, opts)
    local callback = {}
-   callback.id = gpio.callback(self.handle, pin, edge, func, userdata)
+   local policy, rate
+   if opts then
+      policy = policies[opts.policy or "all"]
+      if not policy then
+         return nil, "invalid callback policy '" .. tostring(opts.policy) .. "'"
+      end
+      rate = opts.rate
+   end
+   callback.id = gpio.callback(self, pin, edge, func, userdata, policy, rate)
    if callback.id < 0 then
       return nil, perror(callback.id), callback.id
    end
@@ -1481,7 +2170,7 @@ end
 
 cSession.eventCallback = function(self, event, func, userdata)
    local callback = {}
-   callback.id = event_callback(self.handle, event, func, userdata)
+   callback.id = event_callback(self, event, func, userdata)
    if callback.id < 0 then
       return nil, perror(callback.id), callback.id
    end
@@ -1494,6 +2183,96 @@ cSession.eventCallback = function(self, event, func, userdata)
    return callback
 end
 
+---
+-- Start a pulse train decoder.
+-- The decoder function has the following signature:<br>
+-- <code>func(sess, frame, userdata)</code><br>
+-- Frames are tables with the tick of the frame and the fields
+-- <ul>
+-- <li>"quadrature" (pins A, B): position in detents, delta;
+-- opts.params[1] = steps per detent (4).</li>
+-- <li>"wiegand" (pins D0, D1): bits, code (low, high);
+-- default watchdog 10 ms ends a frame.</li>
+-- <li>"nec" (IR receiver pin): address, command, repeated, raw;
+-- opts.params = {activehigh (0), tolerance in % (25)}.</li>
+-- <li>"dht22" (data pin): humidity in %, temperature in C, valid, raw,
+-- checksum; opts.params = {model 22 or 11, bit threshold in us (50)}.
+-- Start a reading with <code>dec:trigger()</code>.</li>
+-- </ul>
+-- @param self Session.
+-- @param name Decoder type.
+-- @param pins GPIO number or list of GPIO numbers.
+-- @param func Lua function called for each frame, may be nil to poll
+--        frames with <code>dec:read()</code>.
+-- @param userdata Any Lua value as user parameter.
+-- @param opts Options <code>{params={...}, watchdog=MS}</code> (optional).
+-- @return Decoder object on success, nil + errormsg on failure.
+cSession.openDecoder = function(self, name, pins, func, userdata, opts)
+   opts = opts or {}
+   if type(pins) == "number" then pins = {pins} end
+   local decoder = {
+      name = name,
+      pins = pins,
+      params = opts.params or {},
+      session = self
+   }
+   local handler
+   if func then
+      handler = function(sess, id, tick, ud, ...)
+         func(sess, decoderFrame(name, tick, ...), ud)
+      end
+   end
+   decoder.id = decoder_open(self, name, pins, decoder.params,
+                             opts.watchdog, handler, userdata)
+   if decoder.id < 0 then
+      return nil, perror(decoder.id), decoder.id
+   end
+   setmetatable(decoder, {
+                   __index = cDecoder,
+                   __gc = function(self) self:cancel() end
+   })
+   self.decoders[decoder.id] = decoder
+   return decoder
+end
+
+---
+-- Start counting edges on a pin.
+-- Edges are counted natively in the notification thread without any
+-- Lua callback. Starting a running counter resets it.
+-- @param self Session.
+-- @param pin GPIO number.
+-- @return true on success, nil + errormsg on failure.
+cSession.startCounter = function(self, pin)
+   return tryB(counter_start(self.handle, pin))
+end
+
+---
+-- Read the edge counter of a pin.
+-- Returns a table with the fields <code>edges, rising, falling, level,
+-- tick, window</code> and, once measured, <code>period, minperiod,
+-- maxperiod, meanperiod, frequency</code> and <code>duty</code>.
+-- Periods are measured between rising edges in microseconds, the
+-- frequency in Hz. The window reaches from counter start or last reset to
+-- the last edge.
+-- @param self Session.
+-- @param pin GPIO number.
+-- @param reset Start a new window after reading if true.
+-- @return Counter table on success, nil + errormsg on failure.
+cSession.counter = function(self, pin, reset)
+   local c, err = counter_get(self.handle, pin, reset)
+   if not c then return nil, perror(err), err end
+   return c
+end
+
+---
+-- Stop counting edges on a pin.
+-- @param self Session.
+-- @param pin GPIO number.
+-- @return true on success, nil + errormsg on failure.
+cSession.stopCounter = function(self, pin)
+   return tryB(counter_stop(self.handle, pin))
+end
+
 ---
 -- Wait for an edge to occur.
 -- @param self Session.
@@ -1574,6 +2353,81 @@ cSession.shell = function(self, name, scriptparam)
    return status
 end
 
+---
+-- Replay a compiled list of pigs style commands.
+--
+-- The commands are sent through the pipelined command path, several
+-- commands are in flight at any time. With option <code>timed</code>
+-- each command carrying a recorded tick is delayed until its offset from
+-- the first recorded tick has elapsed.
+-- @param self Session.
+-- @param prog Command list as returned by <code>gpio.compileCommands()</code>
+--             or <code>gpio.loadCommands()</code>.
+-- @param opts Options table (optional):
+-- <ul>
+-- <li>timed: honour recorded ticks - default: false.
+-- <li>speed: replay speed factor for timed replay - default: 1.
+-- <li>results: return the list of command results - default: false.
+-- Data replied by a command is dropped, its result is the number of
+-- bytes replied.
+-- </ul>
+-- @return Number of commands executed, number of failed commands and
+--         optionally the list of results on success, nil + errormsg on failure.
+cSession.replay = function(self, prog, opts)
+   local opts = opts or {}
+   local n, nerr, results = replay_run(self.handle, prog, opts.timed, opts.speed, opts.results)
+   if not n then
+      return nil, perror(nerr), nerr
+   end
+   return n, nerr, results
+end
+
+---
+-- Start capturing the notification stream into a file.
+-- No Lua code is involved per record; the file can be read with
+-- <code>gpio.openCapture()</code>, also while the capture is running.
+-- @param self Session.
+-- @param filename Name of the capture file.
+-- @param pins List of GPIO numbers or bit mask - default: GPIO 0 to 27.
+-- @param opts Options <code>{blocksize=BYTES}</code> (optional).
+-- @return Capture object on success, nil + errormsg on failure.
+cSession.startCapture = function(self, filename, pins, opts)
+   local bits = pins or 0x0fffffff
+   if type(pins) == "table" then
+      bits = 0
+      for _, pin in ipairs(pins) do bits = bits | (1 << pin) end
+   end
+   local handle, err = capture_start(self.handle, filename, bits,
+                                     opts and opts.blocksize)
+   if not handle then
+      if math.type(err) == "integer" then return nil, perror(err), err end
+      return nil, err
+   end
+   local capture = setmetatable({handle = handle, session = self},
+                                {__index = cCapture})
+   self.captures[capture] = true
+   return capture
+end
+
+---
+-- Open a tick clock for the session.
+-- The clock is synced when opened and then periodically by a thread.
+-- @param self Session.
+-- @param opts Options (optional):
+-- <ul>
+-- <li>interval: seconds between syncs, 0 for manual syncs only - default: 1.
+-- <li>window: number of syncs fitted - default: 32.
+-- </ul>
+-- @return Tick clock on success, nil + errormsg on failure.
+cSession.openClock = function(self, opts)
+   opts = opts or {}
+   local clock, err = tickclock_open(self, opts.interval, opts.window)
+   if not clock then return tryR(clock, err) end
+   local tc = setmetatable({clock = clock, session = self}, {__index = cTickClock})
+   self.clocks[tc] = true
+   return tc
+end
+
 ---
 -- Open serial device.
 -- @param self Session.
@@ -1592,10 +2446,7 @@ cSession.openSerial = function(self, baud, tty, name)
       return nil, perror(serial.handle)
    end
    serial.pihandle = self.handle
-   setmetatable(serial, {
-                   __index = cSerial,
-                   __gc = function(self) self:close() end
-   })
+   serial = newObject(cSerial, serial)
    self.serialdevs[serial.handle] = serial
    serial.session = self
    serial.name = name or ("serial-"..serial.handle)
@@ -1619,10 +2470,7 @@ cSession.openI2C = function(self, bus, address, name)
       return nil, perror(i2c.handle)
    end
    i2c.pihandle = self.handle
-   setmetatable(i2c, {
-                   __index = cI2C,
-                   __gc = function(self) self:close() end
-   })
+   i2c = newObject(cI2C, i2c)
    i2c.name = name or ("i2cdev-"..i2c.handle)
    i2c.session = self
    self.i2cdevs[i2c.handle] = i2c
@@ -1633,25 +2481,17 @@ end
 -- Scan an I2C bus for present devices.
 -- Returns a list of table in the following form:
 -- <code>{{addr=ADDR, status="ok"|"used", data=DATA}, ... {addr, ...}}</code>
+-- Addresses are probed in pipelined batches, hence a full scan costs a
+-- few round trips only.
 -- @param self Session.
 -- @param bus Bus index 0 or 1.
+-- @param first First address to probe - default: 0x00.
+-- @param last Last address to probe - default: 0x7f.
 -- @return List of connect and usable or not usable devices on success,
 --         nil + errormsg on failure.
-cSession.scanI2C = function(self, bus)
-   local devlist = {}
-   for addr = 0x00, 0x7f do
-      local dev, err = self:openI2C(bus, addr, "none")
-      if not dev then
-         if err == "bad I2C bus" then return nil, err end
-         table.insert(devlist, {addr=addr, data=0xFF, status="used"})
-      else
-         local data, err = dev:receiveByte()
-         if data then
-            table.insert(devlist, {addr=addr, data=data, status="ok"})
-         end
-         dev:close()
-      end
-   end
+cSession.scanI2C = function(self, bus, first, last)
+   local devlist, err = i2c_scan(self.handle, bus, first, last)
+   if not devlist then return nil, perror(err), err end
    return devlist
 end
 
@@ -1673,10 +2513,7 @@ cSession.openSPI = function(self, spichannel, bitrate, flags, name)
       return nil, perror(spi.handle)
    end
    spi.pihandle = self.handle
-   setmetatable(spi, {
-                   __index = cSPI,
-                   __gc = function(self) self:close() end
-   })
+   spi = newObject(cSPI, spi)
    spi.name = name or ("spidev-" .. spi.handle)
    spi.session = self
    self.spidevs[spi.handle] = spi
@@ -1692,18 +2529,16 @@ end
 -- @return Instance of serial read device on success, nil + errormsg on failure
 cSession.openSerialRead = function(self, rxd, baud, name)
    local serial = {}
-   local res = tryB(bb_serial_read_open(self.pihandle, rxd, baud))
+   local res, err = tryB(bb_serial_read_open(self.handle, rxd, baud))
    if not res then
-      return nil, perror(res)
+      return nil, err
    end
    serial.handle = rxd
-   setmetatable(serial, {
-                   __index = cSerialRead,
-                   __gc = function(self) self:close() end
-   })
+   serial.pihandle = self.handle
+   serial = newObject(cSerialRead, serial)
    serial.name = name or ("serialreaddev-"..serial.handle)
    serial.session = self
-   self.bbserialdefs[serial.handle] = serial
+   self.bbserialdevs[serial.handle] = serial
    return serial
 end
 
@@ -1720,14 +2555,11 @@ cSession.openI2Cbb = function(self, sda, scl, baud, name)
    local res, err = tryB(bb_i2c_open(self.handle, sda, scl, baud))
    if not res then return nil, err end
    i2c.handle = sda
-   i2c.pihandle = i2c.handle
-   setmetatable(i2c, {
-                   __index = cI2Cbb,
-                   __gc = function(self) self:close() end
-   })
+   i2c.pihandle = self.handle
+   i2c = newObject(cI2Cbb, i2c)
    i2c.name = name or ("i2cbb-"..i2c.handle)
    i2c.session = self
-   i2c.bbi2cdevs[i2c.handle] = i2c
+   self.bbi2cdevs[i2c.handle] = i2c
    return i2c
 end
 
@@ -1760,10 +2592,7 @@ cSession.openSPIbb = function(self, cs, miso, mosi, sclk, bitrate, flags, name)
    spi.miso = miso
    spi.sclk = sclk
    spi.pihandle = self.handle
-   setmetatable(spi, {
-                   __index = cSPIbb,
-                   __gc = function(self) self.close() end
-   })
+   spi = newObject(cSPIbb, spi)
    spi.name = name or ("spibbdev-" .. spi.handle)
    spi.session = self
    spi.session.bbspidevs[spi.handle] = spi
@@ -1793,10 +2622,7 @@ cSession.openFile = function(self, filename, mode, name)
       return nil, perror(file.handle)
    end
    file.pihandle = self.handle
-   setmetatable(file, {
-                   __index = cFile,
-                   __gc = function(self) self.close() end
-   })
+   file = newObject(cFile, file)
    file.session = self
    self.files[file.handle] = file
    file.name = name or ("file-" .. file.handle)
@@ -1808,17 +2634,31 @@ end
 -- The pattern must match an entry in <code>/opt/pigpio/access</code>.
 -- @param self Session.
 -- @param pattern Pattern used for file search.
--- @return List with file names, nil + errormsg on failure.
+-- @return List with file names and the listing as received,
+--         nil + errormsg on failure.
 cSession.listFiles = function(self, pattern)
-   local buf, errcode = file_list(self.handle, pattern)
-   if not buf then
-      return nil, perror(errcode)
+   local t, buf = file_names(self.handle, pattern)
+   if not t then
+      return nil, perror(buf), buf
    end
-   local t = {}
-   string.gsub(buf, "(.-)([\n\r]+)", function(a,b) table.insert(t, a) end)
    return t, buf
 end
 
+---
+-- Iterate over the files matching the given pattern.
+-- Names are created one by one, which suits huge listings.
+-- The pattern must match an entry in <code>/opt/pigpio/access</code>.
+-- @param self Session.
+-- @param pattern Pattern used for file search.
+-- @return Iterator function on success, nil + errormsg on failure.
+cSession.eachFile = function(self, pattern)
+   local iter, err = file_names_iter(self.handle, pattern)
+   if not iter then
+      return nil, perror(err), err
+   end
+   return iter
+end
+
 ---
 -- Open I2C Slave device.
 -- @param self Session.
@@ -1833,16 +2673,292 @@ cSession.openI2CSlave = function(self, address, name)
    slv.address = address
    slv.handle = 0
    slv.pihandle = self.handle
-   setmetatable(slv, {
-                   __index = cI2CSlave,
-                   __gc = function(self) self:close() end
-   })
+   slv = newObject(cI2CSlave, slv)
    slv.name = name or ("i2cslvdev-"..slv.handle)
    slv.session = self
    self.i2cslvs[slv.handle] = slv
    return slv
 end
 
+--------------------------------------------------------------------------------
+-- <h3>Thread Pool</h3>
+-- A pool of worker threads, each with its own pre-warmed Lua state.
+-- Jobs are given as Lua code in a string plus arguments of type number,
+-- string or boolean. Compiled code is cached per worker, hence repeated
+-- jobs do not pay for state creation nor for compilation.<br>
+-- Constructor: <code>pool=gpio.openThreadPool(nworkers, modules)</code>
+-- @type cThreadPool
+--------------------------------------------------------------------------------
+local cThreadPool = {}
+
+--------------------------------------------------------------------------------
+-- <h3>Thread Pool Job</h3>
+-- A job submitted to a thread pool.<br>
+-- Constructor: <code>job=pool:submit(code, ...)</code>
+-- @type cJob
+--------------------------------------------------------------------------------
+local cJob = {}
+
+---
+-- Submit a job.
+-- The code receives the arguments in <code>...</code>. Its return values
+-- must be of type number, string or boolean.
+-- @param self Thread pool.
+-- @param code Lua code in a string.
+-- @param ... Arguments for the job.
+-- @return Job object.
+function cThreadPool.submit(self, code, ...)
+   local job = {
+      handle = pool_submit(self.handle, code, ...),
+      pool = self
+   }
+   return setmetatable(job, {__index = cJob})
+end
+
+---
+-- Submit a job and wait for its completion.
+-- @param self Thread pool.
+-- @param code Lua code in a string.
+-- @param ... Arguments for the job.
+-- @return true + results of the job on success, nil + errormsg on failure.
+function cThreadPool.run(self, code, ...)
+   return pool_wait(pool_submit(self.handle, code, ...))
+end
+
+---
+-- Retrieve number of queued jobs and number of workers.
+-- @param self Thread pool.
+-- @return Number of queued jobs, number of workers.
+function cThreadPool.info(self)
+   return pool_info(self.handle)
+end
+
+---
+-- Close the thread pool.
+-- Queued jobs fail, running jobs are completed before return.
+-- @param self Thread pool.
+-- @return true on success.
+function cThreadPool.close(self)
+   pool_close(self.handle)
+   return true
+end
+
+---
+-- Wait for completion of a job.
+-- @param self Job.
+-- @param timeout Timeout in seconds - default: wait forever.
+-- @return true + results of the job on success, nil + errormsg on failure
+--         or "timeout".
+function cJob.wait(self, timeout)
+   return pool_wait(self.handle, timeout)
+end
+
+---
+-- Retrieve the state of a job.
+-- @param self Job.
+-- @return "queued", "running" or "done".
+function cJob.state(self)
+   return pool_job_state(self.handle)
+end
+
+--------------------------------------------------------------------------------
+-- <h3>Channel</h3>
+-- A bounded message queue between Lua states of different threads.
+-- A message consists of one or more values of type number, string or
+-- boolean which are copied from the sending into the receiving state.
+-- Any number of threads may send and receive on the same channel. Other
+-- threads get hold of a channel by its name.<br>
+-- Constructor: <code>chan=gpio.openChannel(capacity, name)</code>
+-- @type cChannel
+--------------------------------------------------------------------------------
+local cChannel = {}
+
+---
+-- Send a message, waiting while the channel is full.
+-- @param self Channel.
+-- @param ... Values of the message.
+-- @return true on success, nil + "closed" on failure.
+function cChannel.send(self, ...)
+   return chan_send(self.handle, nil, ...)
+end
+
+---
+-- Send a message, waiting at most the given time while the channel is full.
+-- @param self Channel.
+-- @param timeout Timeout in seconds, 0 does not wait at all.
+-- @param ... Values of the message.
+-- @return true on success, nil + "full", "timeout" or "closed" on failure.
+function cChannel.trySend(self, timeout, ...)
+   return chan_send(self.handle, timeout or 0, ...)
+end
+
+---
+-- Receive a message.
+-- @param self Channel.
+-- @param timeout Timeout in seconds - default: wait forever.
+-- @return Values of the message on success, nil + "timeout" or "closed"
+--         on failure.
+function cChannel.receive(self, timeout)
+   return chan_receive(self.handle, timeout)
+end
+
+---
+-- Receive a message without waiting.
+-- @param self Channel.
+-- @return Values of the message on success, nil + "empty" or "closed"
+--         on failure.
+function cChannel.tryReceive(self)
+   return chan_receive(self.handle, 0)
+end
+
+---
+-- Retrieve a file descriptor which is readable while messages are pending
+-- or once the channel has been closed.
+-- Useful in combination with select() or poll() of other libraries.
+-- @param self Channel.
+-- @return File descriptor.
+function cChannel.fd(self)
+   return chan_fd(self.handle)
+end
+
+---
+-- Retrieve number of pending messages, capacity and name.
+-- @param self Channel.
+-- @return Number of messages, capacity, name.
+function cChannel.info(self)
+   return chan_info(self.handle)
+end
+
+---
+-- Close the channel for all threads.
+-- Pending messages can still be received, sending fails.
+-- @param self Channel.
+-- @return true on success.
+function cChannel.close(self)
+   return chan_close(self.handle)
+end
+
+--------------------------------------------------------------------------------
+-- <h3>Periodic Timer</h3>
+-- Runs a Lua function at a fixed period. Deadlines are absolute times
+-- of the monotonic clock, hence late wake ups and the time spent in the
+-- function do not accumulate to drift. Lua callbacks of events are called
+-- while waiting for the next deadline. A call running past the next
+-- deadline is counted as an overrun and the deadlines missed are skipped.<br>
+-- Constructor: <code>timer=gpio.newTimer(period, opts)</code>
+-- @type cTimer
+--------------------------------------------------------------------------------
+local cTimer = {}
+
+---
+-- Run the timer.
+-- The function is called as <code>func(k, late)</code> with k the number
+-- of the period, counting skipped ones, and late the seconds between
+-- deadline and call. Returning false stops the run.
+-- @param self Timer.
+-- @param func Function to call each period.
+-- @param count Number of periods to run - default: until stopped.
+-- @return Number of periods run.
+function cTimer.run(self, func, count)
+   return timer_run(self.handle, func, count)
+end
+
+---
+-- Stop the run after the current call.
+-- @param self Timer.
+-- @return true.
+function cTimer.stop(self)
+   timer_stop(self.handle)
+   return true
+end
+
+---
+-- Retrieve the statistics of all runs since creation or last clear.
+-- @param self Timer.
+-- @param clear Clear statistics after retrieval if true.
+-- @return Table with fields <code>runs, overruns, skipped</code> and
+--         <code>minlate, maxlate, meanlate, jitter</code> (standard
+--         deviation of lateness), <code>maxexec</code> in seconds.
+function cTimer.info(self, clear)
+   local runs, overruns, skipped, minlate, maxlate, meanlate, varlate, maxexec =
+      timer_info(self.handle, clear)
+   return {runs = runs, overruns = overruns, skipped = skipped,
+           minlate = minlate, maxlate = maxlate, meanlate = meanlate,
+           jitter = math.sqrt(varlate), maxexec = maxexec}
+end
+
+--------------------------------------------------------------------------------
+-- <h3>Capture file</h3>
+-- Reader of a capture file. Records consist of a tick unwrapped to 64 bit,
+-- the levels of the captured pins and flags which are 0 for level changes
+-- and the watchdog or event flags of the notification otherwise.<br>
+-- Constructor: <code>file=gpio.openCapture(filename)</code>
+-- @type cCaptureFile
+--------------------------------------------------------------------------------
+local cCaptureFile = {}
+
+---
+-- Retrieve information about the capture.
+-- @param self Capture file.
+-- @return Table with fields <code>bits, blocksize, started, blocks,
+--         records</code> and <code>first, last</code> tick if not empty.
+function cCaptureFile.info(self)
+   return capfile_info(self.handle)
+end
+
+---
+-- Position the file at the first record at or after given tick.
+-- The block containing the tick is found via the index of the file.
+-- @param self Capture file.
+-- @param tick Tick - default: start of capture.
+-- @return self
+function cCaptureFile.seek(self, tick)
+   capfile_seek(self.handle, tick)
+   return self
+end
+
+---
+-- Read records from the current position.
+-- @param self Capture file.
+-- @param max Maximum number of records.
+-- @param to Last tick to read - default: end of capture.
+-- @return Arrays of ticks, levels and flags, empty at the end of the range.
+function cCaptureFile.read(self, max, to)
+   return capfile_read(self.handle, max, to)
+end
+
+---
+-- Iterate over the records in a range of ticks.
+-- Records are decoded in batches.<br>
+-- <code>for tick, levels, flags in file:samples(from, to) do ... end</code>
+-- @param self Capture file.
+-- @param from First tick - default: start of capture.
+-- @param to Last tick - default: end of capture.
+-- @param batch Records per batch - default: 4096.
+-- @return Iterator function.
+function cCaptureFile.samples(self, from, to, batch)
+   local handle, ticks, levels, flags, i = self.handle, {}, {}, {}, 0
+   capfile_seek(handle, from)
+   return function()
+      i = i + 1
+      if i > #ticks then
+         ticks, levels, flags = capfile_read(handle, batch or 4096, to)
+         if #ticks == 0 then return nil end
+         i = 1
+      end
+      return ticks[i], levels[i], flags[i]
+   end
+end
+
+---
+-- Close the capture file.
+-- @param self Capture file.
+-- @return true
+function cCaptureFile.close(self)
+   capfile_close(self.handle)
+   return true
+end
+
 --------------------------------------------------------------------------------
 -- <h3>SPI Flags</h3>
 -- A set of "macros" (Lua functions) that can be used to assemble the <code>flags</code> parameter
@@ -1903,17 +3019,28 @@ spiFlags = {
    end
 }
 
+-- The methods called at high rates are implemented natively, see
+-- pigpiod_fast.c; their documentation is kept with the classes. The bank,
+-- hardwarePwm and tick methods of sessions are native as well.
+for k, f in pairs(fast_methods("session")) do cSession[k] = f end
+for k, f in pairs(fast_methods("spi")) do cSPI[k] = f end
+for k, f in pairs(fast_methods("i2c")) do cI2C[k] = f end
+
 --------------------------------------------------------------------------------
 -- Module functions.
 -- The pigpio module provides the following functions in the modules name space:
 -- <code>open()</code> - opens a session with local or remote host.<br>
 -- <code>tick()</code> - returns hosts tick time in microseconds.<br>
 -- <code>time()</code> - returns hosts time in seconcs sincd last epoche a floating point.<br>
+-- <code>monotonic()</code> - returns seconds of the local monotonic clock.<br>
 -- <code>getEventStats()</code> - returns event statistics.<br>
 -- <code>clearEventStats()</code> - clears event statistics.<br>
 -- <code>wait()</code> - wait a certain time with possibility for lua event callbacks.<br>
 -- <code>busyWait()</code> - wait without any process blocking call.<br>
+-- <code>newTimer()</code> - creates a drift-free periodic timer.<br>
 -- <code>perror()</code> - returns a textual description of an error code.<br>
+-- <code>compileCommands()</code> - compiles pigs style commands for replay.<br>
+-- <code>loadCommands()</code> - loads and compiles pigs style commands for replay.<br>
 -- @section Functions
 --------------------------------------------------------------------------------
 
@@ -1923,8 +3050,9 @@ spiFlags = {
 -- @param host Hostname of target system. Default: localhost.
 -- @param port Port to be used. Default: 8888.
 -- @param name Name of this session (optional).
+-- @param opts Scheduling options, see <code>cSession:setScheduling()</code> (optional).
 -- @return Session object of class cSession.
-function open(host, port, name)
+function open(host, port, name, opts)
    local sess = {}
    sess.host = tostring(host or "localhost")
    sess.port = tostring(port or 8888)
@@ -1933,11 +3061,8 @@ function open(host, port, name)
       return nil, perror(sess.handle), sess.handle
    end
    sess.name = name or ("sess-"..sess.handle)
-   _G._PIGPIOD_SESSIONS[sess.handle] = sess
-   setmetatable(sess, {
-                   __index = cSession,
-                   __gc = function(self) self:close() end
-   })
+   sess.pihandle = sess.handle
+   sess = newObject(cSession, sess, true)
    sess.i2cdevs={}
    sess.spidevs={}
    sess.serialdevs={}
@@ -1946,42 +3071,60 @@ function open(host, port, name)
    sess.notifychannels={}
    sess.callbacks={}
    sess.eventcallbacks={}
+   sess.decoders={}
+   sess.captures={}
+   sess.clocks={}
    sess.bbi2cdevs = {}
    sess.bbserialdevs = {}
    sess.bbspidevs = {}
    sess.files = {}
    sess.i2cslvs = {}
+   if opts then
+      local ok, err, code = sess:setScheduling(opts)
+      if not ok then
+         sess:close()
+         return nil, err, code
+      end
+   end
    return sess
 end
 
 ---
 -- Wait for a while.
--- This function blocks in time chunks allowing Lua callbacks to be called
--- by the pigpiod library. The given waiting time t is split into n=t/ts
--- blocking calls to gpio.sleep(ts) with ts = 1 ms by default.
+-- Sleeps until the deadline on the monotonic clock and calls the Lua
+-- callbacks of events as soon as they arrive.
 -- @param t time to sleep in seconds.
--- @param ts time step to use - optional.
+-- @param ts ignored, callbacks are no longer polled in time steps.
 -- @return true
 function wait(t, ts)
-   local ts = (ts or tsleep)
-   local n = t / ts
-   for i = 1, n do
-      sleep(ts)
-   end
+   wait_events(t)
    return true
 end
 
 ---
 -- Busy wait for a while.
+-- Polls the monotonic clock, hence the time waited does not depend on
+-- the speed of the CPU. Callbacks are not called meanwhile.
 -- @param t time to sleep in seconds.
 -- @return true.
 function busyWait(t)
-   local n = t * 3 * 1e7
-   for i = 1, n do
-   end
+   busy_wait(t)
    return true
 end
 
+---
+-- Create a periodic timer.
+-- <code>gpio.newTimer(0.01):run(function(k, late) ... end, 100)</code>
+-- @param period Period in seconds.
+-- @param opts Table with field <code>spin</code>: seconds before each
+--        deadline spent polling the clock instead of sleeping for less
+--        jitter - default: 0.
+-- @return Timer.
+function newTimer(period, opts)
+   opts = opts or {}
+   return setmetatable({handle = timer_new(period, opts.spin)}, {__index = cTimer})
+end
+
 ---
 -- Returns info string.
 -- @return Info string.
@@ -2010,6 +3153,30 @@ function clearEventStats()
    return tryB(clear_event_statistics())
 end
 
+---
+-- Compile pigs style text commands for replay.
+--
+-- One or more commands per line, e.g. <code>W 21 1 MICS 100</code>.
+-- A line may start with the tick in microseconds at which it was recorded.
+-- Empty lines and lines starting with '#' are ignored.
+-- @param text Commands in a string.
+-- @return Compiled command list on success, nil + errormsg on failure.
+function compileCommands(text)
+   return replay_compile(text)
+end
+
+---
+-- Load and compile a file with pigs style text commands for replay.
+-- @param filename Name of the file.
+-- @return Compiled command list on success, nil + errormsg on failure.
+function loadCommands(filename)
+   local f, err = io.open(filename, "r")
+   if not f then return nil, err end
+   local text = f:read("*a")
+   f:close()
+   return replay_compile(text)
+end
+
 ---
 -- Start a new thrad.
 -- @param code Lua code in a string.
@@ -2022,12 +3189,113 @@ function startThread(code, name, ...)
    return ret
 end
 
+---
+-- Open a pool of worker threads.
+-- @param nworkers Number of worker threads - default: 4.
+-- @param modules List of modules to preload in each worker - default: {"pigpiod"}.
+-- @return Thread pool object on success, nil + errormsg on failure.
+function openThreadPool(nworkers, modules)
+   local handle, err = pool_create(nworkers or 4, modules or {"pigpiod"})
+   if not handle then return nil, err end
+   return setmetatable({handle = handle}, {__index = cThreadPool})
+end
+
+---
+-- Create a new channel or open an existing one by name.
+-- The channel exists as long as any Lua state holds a reference to it.
+-- @param capacity Maximum number of pending messages - default: 64.
+--        Ignored when opening an existing channel.
+-- @param name Name of the channel - default: unique name.
+-- @return Channel object on success, nil + errormsg on failure.
+function openChannel(capacity, name)
+   local handle, err
+   if name then
+      handle = chan_open(name)
+   end
+   if not handle then
+      handle, err = chan_create(capacity or 64, name)
+      if not handle and name then
+         -- created by another thread in the meantime
+         handle = chan_open(name)
+      end
+      if not handle then return nil, err end
+   end
+   return setmetatable({handle = handle}, {__index = cChannel})
+end
+
+---
+-- Create a packed numeric array.
+-- Arrays can be passed instead of strings to writes and transfers, and
+-- reads and transfers store the data received in an array given as
+-- their last argument. <code>array:view(type, offset, count)</code>
+-- reinterprets part of an array without copying, e.g. the big endian
+-- words of a sensor frame.
+-- @param typ Element type: "u8", "u16", "u32", "i16", "u16be", "u32be"
+--        or "i16be".
+-- @param init Number of elements (all 0), table of elements or string
+--        of bytes.
+-- @return Array.
+function newArray(typ, init)
+   return array_new(typ, init)
+end
+
+---
+-- Create an empty I2C zip program.
+-- <code>zip = gpio.newZip():addr(0x6a):write{0x28}:read(6, "accel")</code>
+-- @return Zip program.
+function newZip()
+   return setmetatable({handle = zip_create()}, {__index = cZip})
+end
+
+---
+-- Open a capture file for reading.
+-- @param filename Name of a file written by <code>session:startCapture()</code>.
+-- @return Capture file object on success, nil + errormsg on failure.
+function openCapture(filename)
+   local handle, err = capfile_open(filename)
+   if not handle then return nil, err end
+   return setmetatable({handle = handle}, {__index = cCaptureFile})
+end
+
 ---
 -- Stop given thread.
+-- The thread is asked to stop and unwinds at its next Lua instruction.
+-- Threads blocking in a C function stop after its return; they may poll
+-- <code>threadStopping()</code> to exit voluntarily.
 -- @param pthread Name or pthread userdata of thread.
+-- @param timeout Timeout in seconds - default: wait forever.
+-- @return true on success, nil + errormsg or "timeout" on failure.
+function stopThread(pthread, timeout)
+   local ok, err = stop_thread(pthread, timeout)
+   if not ok then return nil, err end
+   return true
+end
+
+---
+-- Set CPU affinity and real-time priority of given thread.
+-- @param pthread Name or pthread userdata of thread, nil for the calling thread.
+-- @param cpu CPU to run on, -1 leaves the affinity unchanged.
+-- @param priority SCHED_FIFO priority, 0 selects the default policy.
 -- @return true on success, nil + errormsg on failure.
-function stopThread(pthread)
-   return tryB(stop_thread(pthread))
+function setThreadScheduling(pthread, cpu, priority)
+   return tryB(thread_schedule(pthread, cpu or -1, priority or 0))
+end
+
+---
+-- Wait for the termination of given thread.
+-- @param pthread Name or pthread userdata of thread.
+-- @param timeout Timeout in seconds - default: wait forever.
+-- @return true + return values of the thread on success, nil + errormsg
+--         or "timeout" on failure.
+function joinThread(pthread, timeout)
+   return join_thread(pthread, timeout)
+end
+
+---
+-- Check whether the calling thread has been asked to stop.
+-- @return true if a stop is pending, false otherwise.
+function threadStopping()
+   return thread_stopping()
 end
 
 return _ENV
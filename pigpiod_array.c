@@ -0,0 +1,407 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Packed numeric arrays. An array either owns its storage, which follows
+ * the descriptor in the same userdata, or is a view into the storage of
+ * another array, which is then kept alive as the uservalue of the view.
+ * Elements are accessed by memcpy, hence views need not be aligned.
+ */
+static const struct {
+  const char *name;
+  int type;
+  int swap;
+} arraytypes[] = {
+  {"u8", ARRAY_U8, FALSE},
+  {"u16", ARRAY_U16, FALSE},
+  {"u32", ARRAY_U32, FALSE},
+  {"i16", ARRAY_I16, FALSE},
+  {"u16be", ARRAY_U16, TRUE},
+  {"u32be", ARRAY_U32, TRUE},
+  {"i16be", ARRAY_I16, TRUE},
+  {NULL, 0, 0}
+};
+
+static const size_t esizes[] = {1, 2, 4, 2};
+
+static size_t esize(const array_t *a)
+{
+  return esizes[a->type];
+}
+
+static void check_type(lua_State *L, int arg, int *type, int *swap)
+{
+  const char *name = luaL_checkstring(L, arg);
+  int i;
+  for (i = 0; arraytypes[i].name != NULL; i++){
+    if (strcmp(arraytypes[i].name, name) == 0){
+      *type = arraytypes[i].type;
+      *swap = arraytypes[i].swap;
+      return;
+    }
+  }
+  luaL_argerror(L, arg, lua_pushfstring(L, "invalid array type '%s'", name));
+}
+
+static const char *type_name(const array_t *a)
+{
+  int i;
+  for (i = 0; arraytypes[i].name != NULL; i++)
+    if (arraytypes[i].type == a->type && arraytypes[i].swap == a->swap)
+      return arraytypes[i].name;
+  return "?";
+}
+
+static lua_Integer get_element(const array_t *a, size_t i)
+{
+  uint8_t *p = a->data + i * esize(a);
+  uint16_t v16;
+  uint32_t v32;
+
+  switch (a->type){
+  case ARRAY_U8:
+    return *p;
+  case ARRAY_U16:
+  case ARRAY_I16:
+    memcpy(&v16, p, 2);
+    if (a->swap)
+      v16 = __builtin_bswap16(v16);
+    return (a->type == ARRAY_I16) ? (lua_Integer) (int16_t) v16 : v16;
+  default:
+    memcpy(&v32, p, 4);
+    if (a->swap)
+      v32 = __builtin_bswap32(v32);
+    return v32;
+  }
+}
+
+static void set_element(array_t *a, size_t i, lua_Integer v)
+{
+  uint8_t *p = a->data + i * esize(a);
+  uint16_t v16;
+  uint32_t v32;
+
+  switch (a->type){
+  case ARRAY_U8:
+    *p = (uint8_t) v;
+    break;
+  case ARRAY_U16:
+  case ARRAY_I16:
+    v16 = (uint16_t) v;
+    if (a->swap)
+      v16 = __builtin_bswap16(v16);
+    memcpy(p, &v16, 2);
+    break;
+  default:
+    v32 = (uint32_t) v;
+    if (a->swap)
+      v32 = __builtin_bswap32(v32);
+    memcpy(p, &v32, 4);
+    break;
+  }
+}
+
+array_t *test_array(lua_State *L, int arg)
+{
+  return luaL_testudata(L, arg, ARRAY_MT);
+}
+
+static array_t *check_array(lua_State *L, int arg)
+{
+  return luaL_checkudata(L, arg, ARRAY_MT);
+}
+
+/*
+ * Bytes of a string or array argument.
+ */
+const char *array_bytes(lua_State *L, int arg, size_t *len)
+{
+  array_t *a = test_array(L, arg);
+  if (a != NULL){
+    *len = a->count * esize(a);
+    return (const char *) a->data;
+  }
+  return luaL_checklstring(L, arg, len);
+}
+
+/*
+ * Destination of n bytes of a result: the array at dest if given, a Lua
+ * buffer otherwise. Complete with push_result.
+ */
+char *result_buffer(lua_State *L, int dest, size_t n, luaL_Buffer *b)
+{
+  array_t *a;
+
+  if (lua_isnoneornil(L, dest))
+    return luaL_buffinitsize(L, b, n);
+  a = check_array(L, dest);
+  if (a->count * esize(a) < n)
+    luaL_error(L, "Array of %d bytes too small for %d bytes.",
+               (int) (a->count * esize(a)), (int) n);
+  return (char *) a->data;
+}
+
+/*
+ * Push the result received via result_buffer: a string, or the array
+ * followed by the number of bytes received.
+ */
+int push_result(lua_State *L, int dest, luaL_Buffer *b, size_t nbytes)
+{
+  if (lua_isnoneornil(L, dest)){
+    luaL_pushresultsize(b, nbytes);
+    return 1;
+  }
+  lua_pushvalue(L, dest);
+  lua_pushinteger(L, nbytes);
+  return 2;
+}
+
+static int array_index(lua_State *L)
+{
+  array_t *a = check_array(L, 1);
+  lua_Integer i;
+
+  if (lua_isinteger(L, 2)){
+    i = lua_tointeger(L, 2);
+    if (i < 1 || (size_t) i > a->count)
+      return 0;
+    lua_pushinteger(L, get_element(a, i - 1));
+    return 1;
+  }
+  lua_pushvalue(L, 2);
+  lua_rawget(L, lua_upvalueindex(1));
+  return 1;
+}
+
+static int array_newindex(lua_State *L)
+{
+  array_t *a = check_array(L, 1);
+  lua_Integer i = luaL_checkinteger(L, 2);
+
+  if (i < 1 || (size_t) i > a->count)
+    luaL_error(L, "Index %d out of range 1..%d.", (int) i, (int) a->count);
+  set_element(a, i - 1, luaL_checkinteger(L, 3));
+  return 0;
+}
+
+static int array_len(lua_State *L)
+{
+  lua_pushinteger(L, check_array(L, 1)->count);
+  return 1;
+}
+
+static int array_tostring(lua_State *L)
+{
+  array_t *a = check_array(L, 1);
+  lua_pushfstring(L, "%s[%d]: %p", type_name(a), (int) a->count, a->data);
+  return 1;
+}
+
+/*
+ * Element range i..j (1 based, negative from the end) of arguments
+ * first and first + 1, clipped to the array.
+ */
+static void get_range(lua_State *L, array_t *a, int first, size_t *from, size_t *to)
+{
+  lua_Integer n = a->count;
+  lua_Integer i = luaL_optinteger(L, first, 1);
+  lua_Integer j = luaL_optinteger(L, first + 1, n);
+  if (i < 0) i += n + 1;
+  if (j < 0) j += n + 1;
+  if (i < 1) i = 1;
+  if (j > n) j = n;
+  *from = i - 1;
+  *to = (j < i) ? i - 1 : j;
+}
+
+/*
+ * Lua binding: s = array:bytes([i[, j]])
+ */
+static int array_tobytes(lua_State *L)
+{
+  array_t *a = check_array(L, 1);
+  size_t from, to;
+  get_range(L, a, 2, &from, &to);
+  lua_pushlstring(L, (char *) a->data + from * esize(a), (to - from) * esize(a));
+  return 1;
+}
+
+/*
+ * Lua binding: t = array:totable([i[, j]])
+ */
+static int array_totable(lua_State *L)
+{
+  array_t *a = check_array(L, 1);
+  size_t from, to, k;
+  get_range(L, a, 2, &from, &to);
+  lua_createtable(L, (int) (to - from), 0);
+  for (k = from; k < to; k++){
+    lua_pushinteger(L, get_element(a, k));
+    lua_rawseti(L, -2, (lua_Integer) (k - from + 1));
+  }
+  return 1;
+}
+
+/*
+ * Lua binding: view = array:view(type[, offset[, count]])
+ * offset in bytes from the start of array, count defaults to the
+ * elements up to the end of array.
+ */
+static int array_view(lua_State *L)
+{
+  array_t *a = check_array(L, 1), *v;
+  size_t size = a->count * esize(a);
+  lua_Integer offset, count;
+  int type, swap;
+
+  check_type(L, 2, &type, &swap);
+  offset = luaL_optinteger(L, 3, 0);
+  if (offset < 0)
+    luaL_argerror(L, 3, "non-negative offset expected");
+  if ((size_t) offset > size)
+    luaL_error(L, "Offset %d beyond array of %d bytes.", (int) offset, (int) size);
+  count = luaL_optinteger(L, 4, (size - offset) / esizes[type]);
+  if (count < 0)
+    luaL_argerror(L, 4, "non-negative count expected");
+  if ((size_t) count > (size - offset) / esizes[type])
+    luaL_error(L, "View of %d elements exceeds array of %d bytes.", (int) count, (int) size);
+  v = lua_newuserdata(L, sizeof(array_t));
+  v->type = type;
+  v->swap = swap;
+  v->count = count;
+  v->data = a->data + offset;
+  luaL_setmetatable(L, ARRAY_MT);
+  lua_pushvalue(L, 1);
+  lua_setuservalue(L, -2);
+  return 1;
+}
+
+/*
+ * Lua binding: array = array:fill(value)
+ */
+static int array_fill(lua_State *L)
+{
+  array_t *a = check_array(L, 1);
+  lua_Integer v = luaL_checkinteger(L, 2);
+  size_t k;
+  for (k = 0; k < a->count; k++)
+    set_element(a, k, v);
+  lua_settop(L, 1);
+  return 1;
+}
+
+/*
+ * Lua binding: type, count, nbytes = array:info()
+ */
+static int array_info(lua_State *L)
+{
+  array_t *a = check_array(L, 1);
+  lua_pushstring(L, type_name(a));
+  lua_pushinteger(L, a->count);
+  lua_pushinteger(L, a->count * esize(a));
+  return 3;
+}
+
+static const luaL_Reg array_methods[] = {
+  {"bytes", array_tobytes},
+  {"totable", array_totable},
+  {"view", array_view},
+  {"fill", array_fill},
+  {"info", array_info},
+  {NULL, NULL}
+};
+
+/*
+ * Push the metatable of arrays, created on first use.
+ */
+static void array_metatable(lua_State *L)
+{
+  if (luaL_newmetatable(L, ARRAY_MT)){
+    luaL_newlib(L, array_methods);
+    lua_pushcclosure(L, array_index, 1);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, array_newindex);
+    lua_setfield(L, -2, "__newindex");
+    lua_pushcfunction(L, array_len);
+    lua_setfield(L, -2, "__len");
+    lua_pushcfunction(L, array_tostring);
+    lua_setfield(L, -2, "__tostring");
+  }
+}
+
+/*
+ * Push a new zeroed array of count elements.
+ */
+array_t *new_array(lua_State *L, int type, int swap, size_t count)
+{
+  array_t *a;
+
+  if (count > (SIZE_MAX - sizeof(array_t)) / esizes[type])
+    luaL_error(L, "Array of %f elements too large.", (lua_Number) count);
+  a = lua_newuserdata(L, sizeof(array_t) + count * esizes[type]);
+  a->type = type;
+  a->swap = swap;
+  a->count = count;
+  a->data = (uint8_t *) (a + 1);
+  memset(a->data, 0, count * esizes[type]);
+  array_metatable(L);
+  lua_setmetatable(L, -2);
+  return a;
+}
+
+/*
+ * Lua binding: array = array_new(type, init)
+ * type is one of u8, u16, u32, i16, u16be, u32be or i16be. init is the
+ * number of elements (all zero), a table of elements or a string of
+ * bytes.
+ */
+int utlArrayNew(lua_State *L)
+{
+  int type, swap;
+  size_t len, k;
+  lua_Integer n;
+  const char *s;
+  array_t *a;
+
+  check_type(L, 1, &type, &swap);
+  switch (lua_type(L, 2)){
+  case LUA_TNUMBER:
+    n = luaL_checkinteger(L, 2);
+    if (n < 0)
+      luaL_argerror(L, 2, "non-negative count expected");
+    if ((lua_Unsigned) n > SIZE_MAX)
+      luaL_error(L, "Array of %f elements too large.", (lua_Number) n);
+    new_array(L, type, swap, (size_t) n);
+    break;
+  case LUA_TTABLE:
+    n = luaL_len(L, 2);
+    if (n < 0)
+      luaL_argerror(L, 2, "table of non-negative length expected");
+    len = (size_t) n;
+    a = new_array(L, type, swap, len);
+    for (k = 0; k < len; k++){
+      if (lua_rawgeti(L, 2, k + 1) != LUA_TNUMBER || !lua_isinteger(L, -1))
+        luaL_error(L, "Integer expected at index %d.", (int) k + 1);
+      set_element(a, k, lua_tointeger(L, -1));
+      lua_pop(L, 1);
+    }
+    break;
+  case LUA_TSTRING:
+    s = lua_tolstring(L, 2, &len);
+    if (len % esizes[type] != 0)
+      luaL_error(L, "String of %d bytes is no multiple of the element size.", (int) len);
+    a = new_array(L, type, swap, len / esizes[type]);
+    memcpy(a->data, s, len);
+    break;
+  default:
+    return luaL_argerror(L, 2, "count, table or string expected");
+  }
+  return 1;
+}
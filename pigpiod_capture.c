@@ -0,0 +1,795 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/*
+ * Capture file layout, all numbers in host byte order:
+ *
+ *   header | block | block | ... | index | trailer
+ *
+ * A block starts with the absolute tick and level of its first record,
+ * followed by the records encoded as varints relative to the previous
+ * record:
+ *
+ *   (dtick << 1) | hasflags, then flags if hasflags else level xor
+ *
+ * Ticks are unwrapped to 64 bit. The index holds tick and file offset
+ * of each block, it is written when the capture is stopped and rebuilt
+ * from the block headers when a capture was not stopped properly.
+ */
+#define CAPTURE_MAGIC "PIGCAP01"
+#define CAPTURE_VERSION (1)
+#define CAPTURE_BLOCK_MAGIC (0x4b4c4250)
+#define CAPTURE_INDEX_MAGIC (0x58444950)
+#define CAPTURE_MAX_RECORD (16)
+
+struct capheader {
+  char magic[8];
+  uint32_t version;
+  uint32_t bits;
+  uint32_t blocksize;
+  uint32_t reserved;
+  uint64_t started;        /* time of capture start in us since the epoch */
+};
+typedef struct capheader capheader_t;
+
+struct capblock {
+  uint32_t magic;
+  uint32_t nbytes;
+  uint32_t nrecords;
+  uint32_t level;
+  uint64_t tick;
+};
+typedef struct capblock capblock_t;
+
+struct capindex {
+  uint64_t tick;
+  uint64_t offset;
+};
+typedef struct capindex capindex_t;
+
+struct captrailer {
+  uint32_t magic;
+  uint32_t nblocks;
+  uint64_t records;
+  uint64_t index;
+};
+typedef struct captrailer captrailer_t;
+
+struct capbuf {
+  capblock_t hdr;
+  unsigned char *data;
+};
+typedef struct capbuf capbuf_t;
+
+/*
+ * Running capture. Records are encoded by the notification thread into
+ * the fill buffer, full buffers are written by the writer thread.
+ */
+struct capture {
+  int pi;
+  int hook;
+  int fd;
+  uint32_t bits;
+  unsigned blocksize;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  capbuf_t buf[CAPTURE_BUFFERS];
+  unsigned head;           /* oldest buffer waiting for the writer */
+  unsigned count;          /* buffers waiting for the writer */
+  int stop;
+  int running;
+  int error;
+  /* encoder state, notification thread only */
+  int started;
+  uint32_t lasttick;
+  uint64_t tickhi;
+  uint64_t tick;
+  uint32_t level;
+  /* writer state */
+  capindex_t *index;
+  unsigned nblocks;
+  unsigned maxblocks;
+  uint64_t offset;
+  /* statistics */
+  uint64_t records;
+  uint64_t drops;
+};
+typedef struct capture capture_t;
+
+/*
+ * Capture file opened for reading with a cursor which holds one record
+ * in advance.
+ */
+struct capfile {
+  int fd;
+  capheader_t hdr;
+  capindex_t *index;
+  unsigned nblocks;
+  uint64_t records;
+  uint64_t last;
+  unsigned block;
+  unsigned char *data;
+  unsigned size;
+  unsigned len;
+  unsigned pos;
+  unsigned left;
+  uint64_t tick;
+  uint32_t level;
+  int havenext;
+  uint64_t ntick;
+  uint32_t nlevel;
+  uint32_t nflags;
+};
+typedef struct capfile capfile_t;
+
+static unsigned put_varint(unsigned char *p, uint64_t v)
+{
+  unsigned n = 0;
+  while (v >= 0x80){
+    p[n++] = (unsigned char) (v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (unsigned char) v;
+  return n;
+}
+
+static int get_varint(capfile_t *f, uint64_t *v)
+{
+  unsigned shift = 0;
+  unsigned char c;
+  *v = 0;
+  do {
+    if (f->pos >= f->len || shift > 63)
+      return -1;
+    c = f->data[f->pos++];
+    *v |= (uint64_t) (c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  ssize_t n;
+  while (len > 0){
+    n = write(fd, p, len);
+    if (n < 0){
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int read_at(int fd, void *buf, size_t len, uint64_t offset)
+{
+  return (pread(fd, buf, len, (off_t) offset) == (ssize_t) len) ? 0 : -1;
+}
+
+/*
+ * Writer thread: writes full buffers and remembers their offsets.
+ */
+static void *capture_writer(void *arg)
+{
+  capture_t *cap = arg;
+  capbuf_t *buf;
+  capindex_t *index;
+  int err;
+
+  pthread_mutex_lock(&cap->mutex);
+  for (;;){
+    while (cap->count == 0 && cap->stop == FALSE)
+      pthread_cond_wait(&cap->cond, &cap->mutex);
+    if (cap->count == 0)
+      break;
+    buf = &cap->buf[cap->head];
+    pthread_mutex_unlock(&cap->mutex);
+    err = 0;
+    if (cap->nblocks == cap->maxblocks){
+      index = realloc(cap->index, 2 * cap->maxblocks * sizeof(capindex_t));
+      if (index == NULL)
+        err = ENOMEM;
+      else {
+        cap->index = index;
+        cap->maxblocks *= 2;
+      }
+    }
+    if (err == 0 &&
+        (write_all(cap->fd, &buf->hdr, sizeof(capblock_t)) < 0 ||
+         write_all(cap->fd, buf->data, buf->hdr.nbytes) < 0))
+      err = errno;
+    if (err == 0){
+      cap->index[cap->nblocks].tick = buf->hdr.tick;
+      cap->index[cap->nblocks].offset = cap->offset;
+      cap->nblocks++;
+      cap->offset += sizeof(capblock_t) + buf->hdr.nbytes;
+    }
+    pthread_mutex_lock(&cap->mutex);
+    if (err != 0 && cap->error == 0){
+      cap->error = err;
+      cap->drops += buf->hdr.nrecords;
+      cap->records -= buf->hdr.nrecords;
+    }
+    cap->head = (cap->head + 1) % CAPTURE_BUFFERS;
+    cap->count--;
+  }
+  pthread_mutex_unlock(&cap->mutex);
+  return NULL;
+}
+
+/*
+ * Hand the fill buffer to the writer. Returns -1 if the writer lags
+ * behind and no buffer is free. Must be called with cap->mutex locked.
+ */
+static int capture_flush(capture_t *cap)
+{
+  capbuf_t *buf;
+  if (cap->count + 1 >= CAPTURE_BUFFERS)
+    return -1;
+  cap->count++;
+  pthread_cond_signal(&cap->cond);
+  buf = &cap->buf[(cap->head + cap->count) % CAPTURE_BUFFERS];
+  buf->hdr.nbytes = 0;
+  buf->hdr.nrecords = 0;
+  return 0;
+}
+
+/*
+ * Report hook: encode level changes, watchdog and event reports.
+ */
+static void capture_reports(int pi, const gpioReport_t *r, unsigned count, void *userdata)
+{
+  capture_t *cap = userdata;
+  capbuf_t *buf;
+  uint32_t level, flags;
+  uint64_t tick, v;
+  unsigned i;
+
+  pthread_mutex_lock(&cap->mutex);
+  for (i = 0; i < count; i++, r++){
+    /* keep alive reports at least every minute keep the unwrap exact */
+    if (r->tick < cap->lasttick)
+      cap->tickhi += (uint64_t) 1 << 32;
+    cap->lasttick = r->tick;
+    tick = cap->tickhi | r->tick;
+    flags = r->flags;
+    level = r->level & cap->bits;
+    if (flags == 0){
+      if (cap->started && level == cap->level)
+        continue;
+    } else if (flags & PI_NTFY_FLAGS_WDOG){
+      if ((cap->bits & (1 << (flags & 31))) == 0)
+        continue;
+      level = cap->level;
+    } else if (flags & PI_NTFY_FLAGS_EVENT)
+      level = cap->level;
+    else
+      continue;
+    buf = &cap->buf[(cap->head + cap->count) % CAPTURE_BUFFERS];
+    if (buf->hdr.nbytes + CAPTURE_MAX_RECORD > cap->blocksize &&
+        capture_flush(cap) < 0){
+      cap->drops++;
+      continue;
+    }
+    buf = &cap->buf[(cap->head + cap->count) % CAPTURE_BUFFERS];
+    if (buf->hdr.nrecords == 0 || cap->started == FALSE){
+      /* a block starts with absolute values */
+      buf->hdr.tick = cap->tick = tick;
+      buf->hdr.level = cap->level = (flags == 0) ? level : cap->level;
+    }
+    v = (tick - cap->tick) << 1;
+    if (flags != 0){
+      buf->hdr.nbytes += put_varint(buf->data + buf->hdr.nbytes, v | 1);
+      buf->hdr.nbytes += put_varint(buf->data + buf->hdr.nbytes, flags);
+    } else {
+      buf->hdr.nbytes += put_varint(buf->data + buf->hdr.nbytes, v);
+      buf->hdr.nbytes += put_varint(buf->data + buf->hdr.nbytes, level ^ cap->level);
+    }
+    buf->hdr.nrecords++;
+    cap->tick = tick;
+    cap->level = level;
+    cap->started = TRUE;
+    cap->records++;
+  }
+  pthread_mutex_unlock(&cap->mutex);
+}
+
+static void free_capture(capture_t *cap)
+{
+  int i;
+  for (i = 0; i < CAPTURE_BUFFERS; i++)
+    free(cap->buf[i].data);
+  free(cap->index);
+  pthread_mutex_destroy(&cap->mutex);
+  pthread_cond_destroy(&cap->cond);
+  free(cap);
+}
+
+/*
+ * Stop a running capture: flush all buffers, write index and trailer.
+ * Returns 0 or an errno value.
+ */
+static int stop_capture(capture_t *cap)
+{
+  captrailer_t trailer;
+  capbuf_t *buf;
+
+  if (cap->running == FALSE)
+    return cap->error;
+  /* no reports beyond this point */
+  report_hook_cancel(cap->hook);
+  pthread_mutex_lock(&cap->mutex);
+  buf = &cap->buf[(cap->head + cap->count) % CAPTURE_BUFFERS];
+  if (buf->hdr.nrecords > 0){
+    /* the fill buffer is never queued, hence there is room for it */
+    cap->count++;
+  }
+  cap->stop = TRUE;
+  pthread_cond_signal(&cap->cond);
+  pthread_mutex_unlock(&cap->mutex);
+  pthread_join(cap->thread, NULL);
+  cap->running = FALSE;
+  if (cap->error == 0){
+    trailer.magic = CAPTURE_INDEX_MAGIC;
+    trailer.nblocks = cap->nblocks;
+    trailer.records = cap->records;
+    trailer.index = cap->offset;
+    if (write_all(cap->fd, cap->index, cap->nblocks * sizeof(capindex_t)) < 0 ||
+        write_all(cap->fd, &trailer, sizeof(trailer)) < 0)
+      cap->error = errno;
+  }
+  if (close(cap->fd) < 0 && cap->error == 0)
+    cap->error = errno;
+  return cap->error;
+}
+
+static int capture_gc(lua_State *L)
+{
+  capture_t **cp = luaL_checkudata(L, 1, CAPTURE_MT);
+  if (*cp != NULL){
+    stop_capture(*cp);
+    free_capture(*cp);
+    *cp = NULL;
+  }
+  return 0;
+}
+
+static capture_t *check_capture(lua_State *L, int arg)
+{
+  capture_t **cp = luaL_checkudata(L, arg, CAPTURE_MT);
+  if (*cp == NULL)
+    luaL_error(L, "Capture already released.");
+  return *cp;
+}
+
+/*
+ * Lua binding: cap = capture_start(pi, filename, bits[, blocksize])
+ * Records the levels of the GPIO in bits and watchdog and event reports
+ * of the notification stream of session pi into a file.
+ */
+int utlCaptureStart(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  const char *filename = luaL_checkstring(L, 2);
+  uint32_t bits = (uint32_t) luaL_checkinteger(L, 3);
+  unsigned blocksize = (unsigned) luaL_optinteger(L, 4, CAPTURE_BLOCKSIZE);
+  capture_t *cap, **cp;
+  capheader_t hdr;
+  struct timeval tv;
+  int i, err;
+
+  if (blocksize < 4096 || blocksize > (1 << 24))
+    luaL_error(L, "Block size must be between 4096 and %d, received %d.", 1 << 24, blocksize);
+  cp = lua_newuserdata(L, sizeof(capture_t *));
+  *cp = NULL;
+  if (luaL_newmetatable(L, CAPTURE_MT)){
+    lua_pushcfunction(L, capture_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  cap = calloc(1, sizeof(capture_t));
+  if (cap == NULL)
+    luaL_error(L, "Cannot allocate capture.");
+  pthread_mutex_init(&cap->mutex, NULL);
+  pthread_cond_init(&cap->cond, NULL);
+  cap->pi = pi;
+  cap->bits = bits;
+  cap->blocksize = blocksize;
+  cap->maxblocks = 64;
+  cap->index = malloc(cap->maxblocks * sizeof(capindex_t));
+  for (i = 0; i < CAPTURE_BUFFERS; i++)
+    if ((cap->buf[i].data = malloc(blocksize)) == NULL)
+      break;
+  if (cap->index == NULL || i < CAPTURE_BUFFERS){
+    free_capture(cap);
+    luaL_error(L, "Cannot allocate capture buffers.");
+  }
+  for (i = 0; i < CAPTURE_BUFFERS; i++)
+    cap->buf[i].hdr.magic = CAPTURE_BLOCK_MAGIC;
+  cap->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (cap->fd < 0){
+    err = errno;
+    free_capture(cap);
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", filename, strerror(err));
+    return 2;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+  hdr.version = CAPTURE_VERSION;
+  hdr.bits = bits;
+  hdr.blocksize = blocksize;
+  gettimeofday(&tv, NULL);
+  hdr.started = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+  if (write_all(cap->fd, &hdr, sizeof(hdr)) < 0 ||
+      pthread_create(&cap->thread, NULL, capture_writer, cap) != 0){
+    err = errno;
+    close(cap->fd);
+    free_capture(cap);
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", filename, strerror(err));
+    return 2;
+  }
+  cap->offset = sizeof(hdr);
+  cap->running = TRUE;
+  cap->hook = report_hook(pi, bits, capture_reports, cap);
+  if (cap->hook < 0){
+    err = cap->hook;
+    pthread_mutex_lock(&cap->mutex);
+    cap->stop = TRUE;
+    pthread_cond_signal(&cap->cond);
+    pthread_mutex_unlock(&cap->mutex);
+    pthread_join(cap->thread, NULL);
+    close(cap->fd);
+    unlink(filename);
+    free_capture(cap);
+    lua_pushnil(L);
+    lua_pushinteger(L, err);
+    return 2;
+  }
+  *cp = cap;
+  return 1;
+}
+
+static void push_capture_stats(lua_State *L, capture_t *cap)
+{
+  pthread_mutex_lock(&cap->mutex);
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, cap->records);
+  lua_setfield(L, -2, "records");
+  lua_pushinteger(L, cap->drops);
+  lua_setfield(L, -2, "drops");
+  lua_pushinteger(L, cap->nblocks);
+  lua_setfield(L, -2, "blocks");
+  lua_pushinteger(L, cap->offset);
+  lua_setfield(L, -2, "bytes");
+  lua_pushboolean(L, cap->running);
+  lua_setfield(L, -2, "running");
+  if (cap->error != 0){
+    lua_pushstring(L, strerror(cap->error));
+    lua_setfield(L, -2, "error");
+  }
+  pthread_mutex_unlock(&cap->mutex);
+}
+
+/*
+ * Lua binding: stats = capture_stop(cap)
+ * stats = {records=, drops=, blocks=, bytes=, running=, error=}
+ */
+int utlCaptureStop(lua_State *L)
+{
+  capture_t *cap = check_capture(L, 1);
+  int err = stop_capture(cap);
+  if (err != 0){
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(err));
+    return 2;
+  }
+  push_capture_stats(L, cap);
+  return 1;
+}
+
+/*
+ * Lua binding: stats = capture_info(cap)
+ */
+int utlCaptureInfo(lua_State *L)
+{
+  push_capture_stats(L, check_capture(L, 1));
+  return 1;
+}
+
+static int load_block(capfile_t *f, unsigned block)
+{
+  capblock_t hdr;
+  unsigned char *data;
+
+  if (read_at(f->fd, &hdr, sizeof(hdr), f->index[block].offset) < 0 ||
+      hdr.magic != CAPTURE_BLOCK_MAGIC)
+    return -1;
+  if (hdr.nbytes > f->size){
+    if ((data = realloc(f->data, hdr.nbytes)) == NULL)
+      return -1;
+    f->data = data;
+    f->size = hdr.nbytes;
+  }
+  if (read_at(f->fd, f->data, hdr.nbytes, f->index[block].offset + sizeof(hdr)) < 0)
+    return -1;
+  f->block = block;
+  f->len = hdr.nbytes;
+  f->pos = 0;
+  f->left = hdr.nrecords;
+  f->tick = hdr.tick;
+  f->level = hdr.level;
+  return 0;
+}
+
+/*
+ * Decode the next record into the lookahead. Returns FALSE at the end
+ * of the file.
+ */
+static int next_record(capfile_t *f)
+{
+  uint64_t v, x;
+
+  while (f->left == 0){
+    if (f->block + 1 >= f->nblocks || load_block(f, f->block + 1) < 0)
+      return f->havenext = FALSE;
+  }
+  if (get_varint(f, &v) < 0 || get_varint(f, &x) < 0){
+    f->left = 0;
+    f->block = f->nblocks;
+    return f->havenext = FALSE;
+  }
+  f->left--;
+  f->tick += v >> 1;
+  if (v & 1)
+    f->nflags = (uint32_t) x;
+  else {
+    f->nflags = 0;
+    f->level ^= (uint32_t) x;
+  }
+  f->ntick = f->tick;
+  f->nlevel = f->level;
+  return f->havenext = TRUE;
+}
+
+/*
+ * Position the cursor at the first record with tick >= from.
+ */
+static void seek_capfile(capfile_t *f, uint64_t from)
+{
+  unsigned lo = 0, hi = f->nblocks, mid;
+
+  f->havenext = FALSE;
+  if (f->nblocks == 0)
+    return;
+  /* last block starting at or before from */
+  while (hi - lo > 1){
+    mid = (lo + hi) / 2;
+    if (f->index[mid].tick <= from)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  if (load_block(f, lo) < 0){
+    f->block = f->nblocks;
+    f->left = 0;
+    return;
+  }
+  while (next_record(f) && f->ntick < from)
+    ;
+}
+
+/*
+ * Read the index from the trailer or rebuild it from the block headers.
+ */
+static int load_index(capfile_t *f, uint64_t size)
+{
+  captrailer_t trailer;
+  capblock_t hdr;
+  uint64_t offset;
+  unsigned max = 0;
+  capindex_t *index;
+
+  if (size >= sizeof(capheader_t) + sizeof(trailer) &&
+      read_at(f->fd, &trailer, sizeof(trailer), size - sizeof(trailer)) == 0 &&
+      trailer.magic == CAPTURE_INDEX_MAGIC &&
+      trailer.index + (uint64_t) trailer.nblocks * sizeof(capindex_t) + sizeof(trailer) == size){
+    f->nblocks = trailer.nblocks;
+    f->records = trailer.records;
+    f->index = malloc((f->nblocks + 1) * sizeof(capindex_t));
+    if (f->index == NULL)
+      return -1;
+    return read_at(f->fd, f->index, f->nblocks * sizeof(capindex_t), trailer.index);
+  }
+  offset = sizeof(capheader_t);
+  while (offset + sizeof(hdr) <= size &&
+         read_at(f->fd, &hdr, sizeof(hdr), offset) == 0 &&
+         hdr.magic == CAPTURE_BLOCK_MAGIC &&
+         offset + sizeof(hdr) + hdr.nbytes <= size){
+    if (f->nblocks == max){
+      max = max ? 2 * max : 64;
+      if ((index = realloc(f->index, max * sizeof(capindex_t))) == NULL)
+        return -1;
+      f->index = index;
+    }
+    f->index[f->nblocks].tick = hdr.tick;
+    f->index[f->nblocks].offset = offset;
+    f->nblocks++;
+    f->records += hdr.nrecords;
+    offset += sizeof(hdr) + hdr.nbytes;
+  }
+  return 0;
+}
+
+static void free_capfile(capfile_t *f)
+{
+  if (f->fd >= 0)
+    close(f->fd);
+  free(f->index);
+  free(f->data);
+  free(f);
+}
+
+static int capfile_gc(lua_State *L)
+{
+  capfile_t **fp = luaL_checkudata(L, 1, CAPFILE_MT);
+  if (*fp != NULL){
+    free_capfile(*fp);
+    *fp = NULL;
+  }
+  return 0;
+}
+
+static capfile_t *check_capfile(lua_State *L, int arg)
+{
+  capfile_t **fp = luaL_checkudata(L, arg, CAPFILE_MT);
+  if (*fp == NULL)
+    luaL_error(L, "Capture file already closed.");
+  return *fp;
+}
+
+/*
+ * Lua binding: file = capfile_open(filename)
+ */
+int utlCaptureOpen(lua_State *L)
+{
+  const char *filename = luaL_checkstring(L, 1);
+  capfile_t *f, **fp;
+  struct stat st;
+  const char *errmsg = NULL;
+
+  fp = lua_newuserdata(L, sizeof(capfile_t *));
+  *fp = NULL;
+  if (luaL_newmetatable(L, CAPFILE_MT)){
+    lua_pushcfunction(L, capfile_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  f = calloc(1, sizeof(capfile_t));
+  if (f == NULL)
+    luaL_error(L, "Cannot allocate capture file.");
+  f->fd = open(filename, O_RDONLY);
+  if (f->fd < 0 || fstat(f->fd, &st) < 0)
+    errmsg = strerror(errno);
+  else if (read_at(f->fd, &f->hdr, sizeof(f->hdr), 0) < 0 ||
+           memcmp(f->hdr.magic, CAPTURE_MAGIC, sizeof(f->hdr.magic)) != 0 ||
+           f->hdr.version != CAPTURE_VERSION)
+    errmsg = "not a capture file";
+  else if (load_index(f, (uint64_t) st.st_size) < 0)
+    errmsg = "cannot read capture index";
+  if (errmsg != NULL){
+    free_capfile(f);
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", filename, errmsg);
+    return 2;
+  }
+  /* tick of the last record */
+  if (f->nblocks > 0 && load_block(f, f->nblocks - 1) == 0){
+    f->last = f->tick;
+    while (next_record(f))
+      f->last = f->ntick;
+  }
+  seek_capfile(f, 0);
+  *fp = f;
+  return 1;
+}
+
+/*
+ * Lua binding: info = capfile_info(file)
+ * info = {bits=, blocksize=, started=, blocks=, records=, first=, last=}
+ */
+int utlCaptureFileInfo(lua_State *L)
+{
+  capfile_t *f = check_capfile(L, 1);
+  lua_createtable(L, 0, 7);
+  lua_pushinteger(L, f->hdr.bits);
+  lua_setfield(L, -2, "bits");
+  lua_pushinteger(L, f->hdr.blocksize);
+  lua_setfield(L, -2, "blocksize");
+  lua_pushnumber(L, f->hdr.started / 1e6);
+  lua_setfield(L, -2, "started");
+  lua_pushinteger(L, f->nblocks);
+  lua_setfield(L, -2, "blocks");
+  lua_pushinteger(L, f->records);
+  lua_setfield(L, -2, "records");
+  if (f->nblocks > 0){
+    lua_pushinteger(L, f->index[0].tick);
+    lua_setfield(L, -2, "first");
+    lua_pushinteger(L, f->last);
+    lua_setfield(L, -2, "last");
+  }
+  return 1;
+}
+
+/*
+ * Lua binding: capfile_seek(file, tick)
+ * Positions the file at the first record at or after tick.
+ */
+int utlCaptureSeek(lua_State *L)
+{
+  capfile_t *f = check_capfile(L, 1);
+  seek_capfile(f, (uint64_t) luaL_optinteger(L, 2, 0));
+  return 0;
+}
+
+/*
+ * Lua binding: ticks, levels, flags = capfile_read(file, max[, to])
+ * Reads up to max records with tick <= to from the current position.
+ * flags is 0 for level changes, otherwise the watchdog or event flags.
+ */
+int utlCaptureRead(lua_State *L)
+{
+  capfile_t *f = check_capfile(L, 1);
+  lua_Integer max = luaL_checkinteger(L, 2);
+  uint64_t to = lua_isnoneornil(L, 3) ? UINT64_MAX : (uint64_t) luaL_checkinteger(L, 3);
+  int n = 0;
+
+  if (max < 1)
+    luaL_error(L, "Positive number of records expected, received %d.", (int) max);
+  lua_createtable(L, max > 4096 ? 4096 : (int) max, 0);
+  lua_createtable(L, max > 4096 ? 4096 : (int) max, 0);
+  lua_createtable(L, max > 4096 ? 4096 : (int) max, 0);
+  while (n < max && f->havenext && f->ntick <= to){
+    n++;
+    lua_pushinteger(L, f->ntick);
+    lua_rawseti(L, -4, n);
+    lua_pushinteger(L, f->nlevel);
+    lua_rawseti(L, -3, n);
+    lua_pushinteger(L, f->nflags);
+    lua_rawseti(L, -2, n);
+    next_record(f);
+  }
+  return 3;
+}
+
+/*
+ * Lua binding: capfile_close(file)
+ */
+int utlCaptureClose(lua_State *L)
+{
+  capfile_t **fp = luaL_checkudata(L, 1, CAPFILE_MT);
+  if (*fp != NULL){
+    free_capfile(*fp);
+    *fp = NULL;
+  }
+  return 0;
+}
@@ -0,0 +1,356 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ * A message is a list of values. Single value messages avoid the
+ * extra allocation.
+ */
+struct message {
+  int n;
+  tvalue_t *v;
+  tvalue_t one;
+};
+typedef struct message message_t;
+
+/*
+ * Bounded channel shared by any number of Lua states. The read end of
+ * the pipe is readable as long as the channel holds messages or has been
+ * closed.
+ */
+struct chan {
+  struct chan *next;
+  char *name;
+  int refs;
+  int closed;
+  pthread_mutex_t mutex;
+  pthread_cond_t notempty;
+  pthread_cond_t notfull;
+  message_t *ring;
+  unsigned size;
+  unsigned head;
+  unsigned count;
+  int fd[2];
+};
+typedef struct chan chan_t;
+
+static chan_t *channels = NULL;
+static unsigned long chanseq = 0;
+static pthread_mutex_t chanmutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_message(message_t *msg)
+{
+  int i;
+  for (i = 0; i < msg->n; i++)
+    tvalue_free(&msg->v[i]);
+  if (msg->v != &msg->one)
+    free(msg->v);
+  msg->n = 0;
+}
+
+static void release_chan(chan_t *ch)
+{
+  chan_t **pp;
+  pthread_mutex_lock(&chanmutex);
+  if (--ch->refs > 0){
+    pthread_mutex_unlock(&chanmutex);
+    return;
+  }
+  for (pp = &channels; *pp != NULL; pp = &(*pp)->next){
+    if (*pp == ch){
+      *pp = ch->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&chanmutex);
+  while (ch->count > 0){
+    free_message(&ch->ring[ch->head]);
+    ch->head = (ch->head + 1) % ch->size;
+    ch->count--;
+  }
+  close(ch->fd[0]);
+  close(ch->fd[1]);
+  pthread_mutex_destroy(&ch->mutex);
+  pthread_cond_destroy(&ch->notempty);
+  pthread_cond_destroy(&ch->notfull);
+  free(ch->ring);
+  free(ch->name);
+  free(ch);
+}
+
+static int chan_gc(lua_State *L)
+{
+  chan_t **cp = luaL_checkudata(L, 1, CHAN_MT);
+  if (*cp != NULL){
+    release_chan(*cp);
+    *cp = NULL;
+  }
+  return 0;
+}
+
+static chan_t *check_chan(lua_State *L, int arg)
+{
+  return *((chan_t **) luaL_checkudata(L, arg, CHAN_MT));
+}
+
+/*
+ * Wrap a channel into a new userdata, taking a reference.
+ * Must be called with chanmutex locked.
+ */
+static void push_chan(lua_State *L, chan_t *ch)
+{
+  chan_t **cp = lua_newuserdata(L, sizeof(chan_t *));
+  *cp = ch;
+  ch->refs++;
+  if (luaL_newmetatable(L, CHAN_MT)){
+    lua_pushcfunction(L, chan_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+}
+
+static chan_t *find_chan(const char *name)
+{
+  chan_t *ch;
+  for (ch = channels; ch != NULL; ch = ch->next)
+    if (strcmp(ch->name, name) == 0)
+      return ch;
+  return NULL;
+}
+
+/*
+ * Wait on cond with optional timeout: < 0 forever, 0 do not wait.
+ * Returns 0 if signalled, -1 on timeout.
+ */
+static int chan_wait(chan_t *ch, pthread_cond_t *cond, double timeout,
+                     struct timespec *due)
+{
+  if (timeout == 0)
+    return -1;
+  if (timeout < 0){
+    pthread_cond_wait(cond, &ch->mutex);
+    return 0;
+  }
+  if (pthread_cond_timedwait(cond, &ch->mutex, due) == ETIMEDOUT)
+    return -1;
+  return 0;
+}
+
+/*
+ * Lua binding: chan = chan_create(capacity, name)
+ */
+int utlChanCreate(lua_State *L)
+{
+  int capacity = (int) luaL_checkinteger(L, 1);
+  const char *name = luaL_optstring(L, 2, NULL);
+  char namebuf[32];
+  chan_t *ch;
+
+  if (capacity < 1)
+    luaL_error(L, "Channel capacity must be at least 1, received %d.", capacity);
+  pthread_mutex_lock(&chanmutex);
+  if (name == NULL){
+    snprintf(namebuf, sizeof(namebuf), "chan-%lu", chanseq++);
+    name = namebuf;
+  }
+  if (find_chan(name) != NULL){
+    pthread_mutex_unlock(&chanmutex);
+    lua_pushnil(L);
+    lua_pushfstring(L, "channel '%s' already exists", name);
+    return 2;
+  }
+  ch = calloc(1, sizeof(chan_t));
+  ch->ring = calloc(capacity, sizeof(message_t));
+  if (ch->ring == NULL || pipe(ch->fd) < 0){
+    pthread_mutex_unlock(&chanmutex);
+    free(ch->ring);
+    free(ch);
+    lua_pushnil(L);
+    lua_pushstring(L, "cannot create channel");
+    return 2;
+  }
+  fcntl(ch->fd[0], F_SETFL, O_NONBLOCK);
+  fcntl(ch->fd[1], F_SETFL, O_NONBLOCK);
+  ch->size = capacity;
+  ch->name = strdup(name);
+  pthread_mutex_init(&ch->mutex, NULL);
+  pthread_cond_init(&ch->notempty, NULL);
+  pthread_cond_init(&ch->notfull, NULL);
+  ch->next = channels;
+  channels = ch;
+  push_chan(L, ch);
+  pthread_mutex_unlock(&chanmutex);
+  return 1;
+}
+
+/*
+ * Lua binding: chan = chan_open(name)
+ */
+int utlChanOpen(lua_State *L)
+{
+  const char *name = luaL_checkstring(L, 1);
+  chan_t *ch;
+
+  pthread_mutex_lock(&chanmutex);
+  ch = find_chan(name);
+  if (ch == NULL){
+    pthread_mutex_unlock(&chanmutex);
+    lua_pushnil(L);
+    lua_pushfstring(L, "channel '%s' not found", name);
+    return 2;
+  }
+  push_chan(L, ch);
+  pthread_mutex_unlock(&chanmutex);
+  return 1;
+}
+
+/*
+ * Lua binding: succ = chan_send(chan, timeout, ...)
+ * Returns nil + "full", "timeout" or "closed" on failure.
+ */
+int utlChanSend(lua_State *L)
+{
+  chan_t *ch = check_chan(L, 1);
+  double timeout = luaL_optnumber(L, 2, -1);
+  int i, n = lua_gettop(L) - 2;
+  struct timespec due;
+  message_t msg;
+  char c = 0;
+
+  if (n < 1 || lua_isnil(L, 3))
+    luaL_error(L, "Message must start with a non nil value.");
+  msg.n = 0;
+  msg.v = (n == 1) ? &msg.one : calloc(n, sizeof(tvalue_t));
+  if (msg.v == NULL)
+    luaL_error(L, "Cannot allocate message.");
+  for (i = 0; i < n; i++){
+    if (tvalue_get(L, i + 3, &msg.v[i]) < 0){
+      free_message(&msg);
+      luaL_error(L, "Invalid message value type '%s'.", luaL_typename(L, i + 3));
+    }
+    msg.n++;
+  }
+  if (timeout > 0)
+    get_deadline(timeout, &due);
+  pthread_mutex_lock(&ch->mutex);
+  while (ch->count == ch->size && !ch->closed){
+    if (chan_wait(ch, &ch->notfull, timeout, &due) < 0)
+      break;
+  }
+  if (ch->closed || ch->count == ch->size){
+    const char *err = ch->closed ? "closed" : (timeout == 0 ? "full" : "timeout");
+    pthread_mutex_unlock(&ch->mutex);
+    free_message(&msg);
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  ch->ring[(ch->head + ch->count) % ch->size] = msg;
+  if (n == 1)
+    ch->ring[(ch->head + ch->count) % ch->size].v =
+      &ch->ring[(ch->head + ch->count) % ch->size].one;
+  if (ch->count++ == 0)
+    write(ch->fd[1], &c, 1);
+  pthread_cond_signal(&ch->notempty);
+  pthread_mutex_unlock(&ch->mutex);
+  lua_pushboolean(L, TRUE);
+  return 1;
+}
+
+/*
+ * Lua binding: ... = chan_receive(chan, timeout)
+ * Returns nil + "empty", "timeout" or "closed" on failure.
+ */
+int utlChanReceive(lua_State *L)
+{
+  chan_t *ch = check_chan(L, 1);
+  double timeout = luaL_optnumber(L, 2, -1);
+  struct timespec due;
+  message_t msg;
+  int i;
+  char c;
+
+  if (timeout > 0)
+    get_deadline(timeout, &due);
+  pthread_mutex_lock(&ch->mutex);
+  while (ch->count == 0 && !ch->closed){
+    if (chan_wait(ch, &ch->notempty, timeout, &due) < 0)
+      break;
+  }
+  if (ch->count == 0){
+    const char *err = ch->closed ? "closed" : (timeout == 0 ? "empty" : "timeout");
+    pthread_mutex_unlock(&ch->mutex);
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  msg = ch->ring[ch->head];
+  if (msg.n == 1)
+    msg.v = &msg.one;
+  ch->head = (ch->head + 1) % ch->size;
+  /* a closed channel stays readable */
+  if (--ch->count == 0 && !ch->closed)
+    read(ch->fd[0], &c, 1);
+  pthread_cond_signal(&ch->notfull);
+  pthread_mutex_unlock(&ch->mutex);
+  luaL_checkstack(L, msg.n, "too many values in message");
+  for (i = 0; i < msg.n; i++)
+    tvalue_push(L, &msg.v[i]);
+  free_message(&msg);
+  return i;
+}
+
+/*
+ * Lua binding: fd = chan_fd(chan)
+ */
+int utlChanFd(lua_State *L)
+{
+  lua_pushinteger(L, check_chan(L, 1)->fd[0]);
+  return 1;
+}
+
+/*
+ * Lua binding: count, capacity, name = chan_info(chan)
+ */
+int utlChanInfo(lua_State *L)
+{
+  chan_t *ch = check_chan(L, 1);
+  pthread_mutex_lock(&ch->mutex);
+  lua_pushinteger(L, ch->count);
+  pthread_mutex_unlock(&ch->mutex);
+  lua_pushinteger(L, ch->size);
+  lua_pushstring(L, ch->name);
+  return 3;
+}
+
+/*
+ * Lua binding: succ = chan_close(chan)
+ * Pending messages can still be received, senders fail. The fd of the
+ * channel stays readable.
+ */
+int utlChanClose(lua_State *L)
+{
+  chan_t *ch = check_chan(L, 1);
+  char c = 0;
+
+  pthread_mutex_lock(&ch->mutex);
+  /* wake up consumers polling the fd of an empty channel */
+  if (!ch->closed && ch->count == 0)
+    write(ch->fd[1], &c, 1);
+  ch->closed = TRUE;
+  pthread_cond_broadcast(&ch->notempty);
+  pthread_cond_broadcast(&ch->notfull);
+  pthread_mutex_unlock(&ch->mutex);
+  lua_pushboolean(L, TRUE);
+  return 1;
+}
@@ -0,0 +1,395 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Tick clock. Relates the 32 bit tick of a daemon to the monotonic clock
+ * of the local host. A sync reads the tick in a short burst of round
+ * trips and keeps the one with the smallest round trip time, whose local
+ * midpoint is the best estimate of the local time of the tick. A line
+ * fitted through the recent syncs of small round trip time gives offset
+ * and drift. Ticks are unwrapped to 64 bit relative to the latest tick
+ * seen, hence any tick within +-35 minutes of it is unwrapped correctly.
+ * A thread may sync periodically. A sync whose round trips all failed
+ * keeps the previous fit and records the error.
+ */
+struct tcsample {
+  double local;             /* monotonic seconds */
+  double tick;              /* unwrapped tick - base */
+  double rtt;
+};
+typedef struct tcsample tcsample_t;
+
+struct tickclock {
+  int pi;
+  pthread_t thread;
+  int running;
+  int stop;
+  double interval;
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;      /* monotonic clock, signalled to stop */
+  int64_t last;             /* latest tick seen, unwrapped */
+  int seen;
+  int64_t base;             /* tick of the first sync */
+  tcsample_t *samples;
+  unsigned size;
+  unsigned head;
+  unsigned count;
+  double offset;            /* local = offset + (tick - base) * scale */
+  double scale;
+  double minrtt;
+  unsigned long syncs;
+  int err;                  /* error of the latest sync, 0 if none */
+};
+typedef struct tickclock tickclock_t;
+
+/*
+ * Seconds of the monotonic clock.
+ */
+double monotonic_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Unwrap tick relative to the latest tick seen. Call locked.
+ */
+static int64_t unwrap(tickclock_t *tc, uint32_t tick)
+{
+  int64_t t;
+
+  if (!tc->seen){
+    tc->seen = TRUE;
+    tc->last = tick;
+    return tick;
+  }
+  t = tc->last + (int32_t) (tick - (uint32_t) tc->last);
+  if (t > tc->last)
+    tc->last = t;
+  return t;
+}
+
+/*
+ * Fit local time over tick through the samples whose round trip time is
+ * at most twice the smallest one. Call locked.
+ */
+static void fit(tickclock_t *tc)
+{
+  double mx = 0, my = 0, sxx = 0, sxy = 0, limit;
+  tcsample_t *s;
+  unsigned i, n = 0;
+
+  tc->minrtt = HUGE_VAL;
+  for (i = 0; i < tc->count; i++)
+    if (tc->samples[i].rtt < tc->minrtt)
+      tc->minrtt = tc->samples[i].rtt;
+  limit = 2 * tc->minrtt;
+  for (i = 0; i < tc->count; i++){
+    s = &tc->samples[i];
+    if (s->rtt <= limit){
+      mx += s->tick;
+      my += s->local;
+      n++;
+    }
+  }
+  mx /= n;
+  my /= n;
+  for (i = 0; i < tc->count; i++){
+    s = &tc->samples[i];
+    if (s->rtt <= limit){
+      sxx += (s->tick - mx) * (s->tick - mx);
+      sxy += (s->tick - mx) * (s->local - my);
+    }
+  }
+  /* the slope needs samples spread over a second at least */
+  tc->scale = (sxx / n >= 1e12) ? sxy / sxx : 1e-6;
+  tc->offset = my - tc->scale * mx;
+}
+
+/*
+ * Read the tick in a burst of round trips and add the best one. The tick
+ * is read as a pipeline of one command, whose status is reported apart
+ * from the tick, as a tick may look like an error code. Returns 0 or the
+ * error code if all round trips failed.
+ */
+static int sync_clock(tickclock_t *tc)
+{
+  double t0, t1, best = HUGE_VAL, local = 0;
+  uint32_t besttick = 0;
+  pipe_cmd_t cmd;
+  int i, res, err = 0, n = 0;
+  tcsample_t *s;
+
+  for (i = 0; i < TICKCLOCK_BURST; i++){
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cmd = PI_CMD_TICK;
+    t0 = monotonic_time();
+    res = pigpio_pipeline(tc->pi, &cmd, 1);
+    t1 = monotonic_time();
+    if (res < 0){
+      err = res;
+      continue;
+    }
+    n++;
+    if (t1 - t0 < best){
+      best = t1 - t0;
+      local = (t0 + t1) / 2;
+      besttick = (uint32_t) cmd.res;
+    }
+  }
+  pthread_mutex_lock(&tc->mutex);
+  if (n == 0){
+    tc->err = err;
+    pthread_mutex_unlock(&tc->mutex);
+    return err;
+  }
+  tc->err = 0;
+  if (tc->syncs++ == 0)
+    tc->base = unwrap(tc, besttick);
+  s = &tc->samples[tc->head];
+  s->local = local;
+  s->tick = (double) (unwrap(tc, besttick) - tc->base);
+  s->rtt = best;
+  tc->head = (tc->head + 1) % tc->size;
+  if (tc->count < tc->size)
+    tc->count++;
+  fit(tc);
+  pthread_mutex_unlock(&tc->mutex);
+  return 0;
+}
+
+static void *clockSyncer(void *uparam)
+{
+  tickclock_t *tc = uparam;
+  struct timespec ts;
+  double due = monotonic_time();
+  int stop = FALSE;
+
+  /* the first sync is done when opening */
+  while (!stop){
+    due += tc->interval;
+    ts.tv_sec = (time_t) due;
+    ts.tv_nsec = (long) ((due - ts.tv_sec) * 1e9);
+    pthread_mutex_lock(&tc->mutex);
+    if (!tc->stop)
+      pthread_cond_timedwait(&tc->wake, &tc->mutex, &ts);
+    stop = tc->stop;
+    pthread_mutex_unlock(&tc->mutex);
+    if (!stop)
+      sync_clock(tc);
+  }
+  return NULL;
+}
+
+static void free_clock(tickclock_t *tc)
+{
+  if (tc->running){
+    pthread_mutex_lock(&tc->mutex);
+    tc->stop = TRUE;
+    pthread_cond_signal(&tc->wake);
+    pthread_mutex_unlock(&tc->mutex);
+    pthread_join(tc->thread, NULL);
+  }
+  pthread_mutex_destroy(&tc->mutex);
+  pthread_cond_destroy(&tc->wake);
+  free(tc->samples);
+  free(tc);
+}
+
+static int clock_gc(lua_State *L)
+{
+  tickclock_t **pp = luaL_checkudata(L, 1, TICKCLOCK_MT);
+  if (*pp != NULL){
+    free_clock(*pp);
+    *pp = NULL;
+  }
+  return 0;
+}
+
+static tickclock_t *check_clock(lua_State *L, int arg)
+{
+  tickclock_t **pp = luaL_checkudata(L, arg, TICKCLOCK_MT);
+  if (*pp == NULL)
+    luaL_error(L, "Tick clock already closed.");
+  return *pp;
+}
+
+/*
+ * Unwrapped tick: values beyond 32 bit are taken as unwrapped. Call
+ * locked, hence with the argument checked already.
+ */
+static int64_t get_tick(tickclock_t *tc, lua_Integer tick)
+{
+  if (tick < 0 || tick > 0xffffffff)
+    return tick;
+  return unwrap(tc, (uint32_t) tick);
+}
+
+/*
+ * Lua binding: t = monotonic()
+ * Seconds of the local monotonic clock.
+ */
+int utlMonotonic(lua_State *L)
+{
+  lua_pushnumber(L, monotonic_time());
+  return 1;
+}
+
+/*
+ * Lua binding: clock = tickclock_open(pi[, interval[, window]])
+ * Syncs once, then every interval seconds if interval > 0. Returns nil +
+ * code if the first sync fails.
+ */
+int utlTickClockOpen(lua_State *L)
+{
+  int pi = object_pi(L, 1);
+  double interval = luaL_optnumber(L, 2, TICKCLOCK_INTERVAL);
+  lua_Integer window = luaL_optinteger(L, 3, TICKCLOCK_WINDOW);
+  tickclock_t *tc, **pp;
+  pthread_condattr_t attr;
+  int err;
+
+  if (window < 2)
+    luaL_error(L, "Window must be at least 2, received %d.", (int) window);
+  pp = lua_newuserdata(L, sizeof(tickclock_t *));
+  *pp = NULL;
+  if (luaL_newmetatable(L, TICKCLOCK_MT)){
+    lua_pushcfunction(L, clock_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  tc = calloc(1, sizeof(tickclock_t));
+  if (tc == NULL || (tc->samples = malloc(window * sizeof(tcsample_t))) == NULL){
+    free(tc);
+    luaL_error(L, "Cannot allocate tick clock.");
+  }
+  pthread_mutex_init(&tc->mutex, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&tc->wake, &attr);
+  pthread_condattr_destroy(&attr);
+  tc->pi = pi;
+  tc->size = window;
+  tc->interval = interval;
+  if ((err = sync_clock(tc)) != 0){
+    free_clock(tc);
+    lua_pushnil(L);
+    lua_pushinteger(L, err);
+    return 2;
+  }
+  if (interval > 0){
+    if (pthread_create(&tc->thread, NULL, clockSyncer, tc) != 0){
+      free_clock(tc);
+      lua_pushnil(L);
+      lua_pushstring(L, "cannot start clock sync thread");
+      return 2;
+    }
+    tc->running = TRUE;
+  }
+  *pp = tc;
+  return 1;
+}
+
+/*
+ * Lua binding: succ = tickclock_sync(clock)
+ * Returns true or nil + code if all round trips failed.
+ */
+int utlTickClockSync(lua_State *L)
+{
+  int err = sync_clock(check_clock(L, 1));
+  if (err != 0){
+    lua_pushnil(L);
+    lua_pushinteger(L, err);
+    return 2;
+  }
+  lua_pushboolean(L, TRUE);
+  return 1;
+}
+
+/*
+ * Lua binding: tick64 = tickclock_unwrap(clock, tick)
+ */
+int utlTickClockUnwrap(lua_State *L)
+{
+  tickclock_t *tc = check_clock(L, 1);
+  lua_Integer tick = luaL_checkinteger(L, 2);
+  int64_t t;
+  pthread_mutex_lock(&tc->mutex);
+  t = get_tick(tc, tick);
+  pthread_mutex_unlock(&tc->mutex);
+  lua_pushinteger(L, t);
+  return 1;
+}
+
+/*
+ * Lua binding: t = tickclock_to_local(clock, tick)
+ * Local monotonic seconds of a tick.
+ */
+int utlTickClockToLocal(lua_State *L)
+{
+  tickclock_t *tc = check_clock(L, 1);
+  lua_Integer tick = luaL_checkinteger(L, 2);
+  double t;
+  pthread_mutex_lock(&tc->mutex);
+  t = tc->offset + (double) (get_tick(tc, tick) - tc->base) * tc->scale;
+  pthread_mutex_unlock(&tc->mutex);
+  lua_pushnumber(L, t);
+  return 1;
+}
+
+/*
+ * Lua binding: tick64 = tickclock_to_tick(clock[, t])
+ * Unwrapped tick at local monotonic time t, default: now.
+ */
+int utlTickClockToTick(lua_State *L)
+{
+  tickclock_t *tc = check_clock(L, 1);
+  double t = luaL_optnumber(L, 2, monotonic_time()), d;
+  int64_t base;
+  pthread_mutex_lock(&tc->mutex);
+  d = (t - tc->offset) / tc->scale;
+  base = tc->base;
+  pthread_mutex_unlock(&tc->mutex);
+  lua_pushinteger(L, base + (int64_t) (d >= 0 ? d + 0.5 : d - 0.5));
+  return 1;
+}
+
+/*
+ * Lua binding: offset, drift, minrtt, count, syncs, err = tickclock_info(clock)
+ * offset: local seconds at the tick of the first sync, drift: deviation
+ * of the tick rate from the local clock in ppm, minrtt: seconds, err:
+ * error of the latest sync, 0 if none.
+ */
+int utlTickClockInfo(lua_State *L)
+{
+  tickclock_t *tc = check_clock(L, 1);
+  pthread_mutex_lock(&tc->mutex);
+  lua_pushnumber(L, tc->offset);
+  lua_pushnumber(L, (1e-6 / tc->scale - 1) * 1e6);
+  lua_pushnumber(L, tc->minrtt);
+  lua_pushinteger(L, tc->count);
+  lua_pushinteger(L, tc->syncs);
+  lua_pushinteger(L, tc->err);
+  pthread_mutex_unlock(&tc->mutex);
+  return 6;
+}
+
+/*
+ * Lua binding: tickclock_close(clock)
+ */
+int utlTickClockClose(lua_State *L)
+{
+  return clock_gc(L);
+}
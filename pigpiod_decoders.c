@@ -0,0 +1,278 @@
+#include "pigpiod_decoders.h"
+#include <stdint.h>
+#include <string.h>
+
+#define TRUE (1)
+#define FALSE (0)
+
+/*
+ * Quadrature encoder on GPIO A and B.
+ * Parameter 0: steps per detent, default 4.
+ * Frame: position in detents, signed change since previous frame.
+ */
+struct quadrature {
+  int levels;
+  int32_t steps;
+  int32_t position;
+};
+
+static const int8_t quadtab[16] = {
+  0, -1, 1, 0,
+  1, 0, 0, -1,
+  -1, 0, 0, 1,
+  0, 1, -1, 0
+};
+
+static int quadInit(decoder_t *d)
+{
+  return (decoder_param(d, 0, 4) < 1) ? -1 : 0;
+}
+
+static void quadEdge(decoder_t *d, unsigned index, unsigned level, uint32_t tick)
+{
+  struct quadrature *q = decoder_state(d);
+  int bit = (index == 0) ? 2 : 1;
+  int levels = level ? (q->levels | bit) : (q->levels & ~bit);
+  int32_t position, per = decoder_param(d, 0, 4);
+  uint32_t frame[2];
+
+  q->steps += quadtab[(q->levels << 2) | levels];
+  q->levels = levels;
+  /* round towards minus infinity: detents have equal size around 0 */
+  position = (q->steps >= 0) ? q->steps / per : -((per - 1 - q->steps) / per);
+  if (position != q->position){
+    frame[0] = (uint32_t) position;
+    frame[1] = (uint32_t) (position - q->position);
+    q->position = position;
+    decoder_emit(d, frame, 2, tick);
+  }
+}
+
+const decoderType_t decQuadrature = {
+  "quadrature", 2, sizeof(struct quadrature), 0,
+  quadInit, quadEdge, NULL
+};
+
+/*
+ * Wiegand reader on GPIO D0 and D1, up to 64 bits.
+ * A frame ends when the lines are idle for the watchdog timeout.
+ * Frame: number of bits, code bits 0..31, code bits 32..63.
+ */
+struct wiegand {
+  unsigned nbits;
+  uint64_t code;
+  uint32_t last;
+};
+
+static void wiegandFlush(decoder_t *d, uint32_t tick)
+{
+  struct wiegand *w = decoder_state(d);
+  uint32_t frame[3];
+
+  if (w->nbits == 0)
+    return;
+  frame[0] = w->nbits;
+  frame[1] = (uint32_t) w->code;
+  frame[2] = (uint32_t) (w->code >> 32);
+  w->nbits = 0;
+  w->code = 0;
+  decoder_emit(d, frame, 3, tick);
+}
+
+static void wiegandEdge(decoder_t *d, unsigned index, unsigned level, uint32_t tick)
+{
+  struct wiegand *w = decoder_state(d);
+
+  if (level != 0)
+    return;
+  /* a gap of more than 25 ms also terminates a frame */
+  if (w->nbits > 0 && (uint32_t)(tick - w->last) > 25000)
+    wiegandFlush(d, w->last);
+  if (w->nbits < 64){
+    w->code = (w->code << 1) | index;
+    w->nbits++;
+  }
+  w->last = tick;
+}
+
+static void wiegandTimeout(decoder_t *d, unsigned index, uint32_t tick)
+{
+  wiegandFlush(d, tick);
+}
+
+const decoderType_t decWiegand = {
+  "wiegand", 2, sizeof(struct wiegand), 10,
+  NULL, wiegandEdge, wiegandTimeout
+};
+
+/*
+ * NEC infrared receiver on one GPIO.
+ * Parameter 0: 1 if the receiver output is active high, default 0.
+ * Parameter 1: timing tolerance in percent, default 25.
+ * Frame: address (8 or 16 bit), command, repeat flag, raw 32 bit code.
+ */
+enum necstate {NEC_IDLE, NEC_LEADER, NEC_DATA};
+
+struct nec {
+  enum necstate state;
+  uint32_t fall;
+  uint32_t rise;
+  unsigned nbits;
+  uint32_t code;
+  uint32_t frame[4];
+  int valid;
+};
+
+static int necNear(decoder_t *d, uint32_t t, uint32_t nominal)
+{
+  uint32_t tol = nominal * decoder_param(d, 1, 25) / 100;
+  return (t + tol >= nominal) && (t <= nominal + tol);
+}
+
+static void necEdge(decoder_t *d, unsigned index, unsigned level, uint32_t tick)
+{
+  struct nec *n = decoder_state(d);
+  int mark = decoder_param(d, 0, 0) ? level : !level;
+  uint32_t t;
+
+  if (mark){
+    /* mark starts: a space has ended */
+    t = tick - n->rise;
+    n->fall = tick;
+    switch (n->state){
+    case NEC_LEADER:
+      if (necNear(d, t, 4500)){
+        n->state = NEC_DATA;
+        n->nbits = 0;
+        n->code = 0;
+      } else {
+        if (necNear(d, t, 2250) && n->valid){
+          n->frame[2] = 1;
+          decoder_emit(d, n->frame, 4, tick);
+        }
+        n->state = NEC_IDLE;
+      }
+      break;
+    case NEC_DATA:
+      if (t < 300 || t > 2500){
+        n->state = NEC_IDLE;
+        break;
+      }
+      if (t > 1125)
+        n->code |= (uint32_t) 1 << n->nbits;
+      if (++n->nbits == 32){
+        uint32_t addr = n->code & 0xff;
+        uint32_t naddr = (n->code >> 8) & 0xff;
+        uint32_t cmd = (n->code >> 16) & 0xff;
+        uint32_t ncmd = (n->code >> 24) & 0xff;
+        if ((cmd ^ ncmd) == 0xff){
+          /* extended NEC uses a 16 bit address */
+          n->frame[0] = ((addr ^ naddr) == 0xff) ? addr : (n->code & 0xffff);
+          n->frame[1] = cmd;
+          n->frame[2] = 0;
+          n->frame[3] = n->code;
+          n->valid = TRUE;
+          decoder_emit(d, n->frame, 4, tick);
+        }
+        n->state = NEC_IDLE;
+      }
+      break;
+    default:
+      break;
+    }
+  } else {
+    /* mark ends */
+    t = tick - n->fall;
+    n->rise = tick;
+    if (n->state == NEC_DATA){
+      if (t < 300 || t > 900)
+        n->state = NEC_IDLE;
+    } else if (necNear(d, t, 9000))
+      n->state = NEC_LEADER;
+    else
+      n->state = NEC_IDLE;
+  }
+}
+
+const decoderType_t decNec = {
+  "nec", 1, sizeof(struct nec), 0,
+  NULL, necEdge, NULL
+};
+
+/*
+ * DHT11/DHT22 temperature and humidity sensor on one GPIO.
+ * The read is started by the host pulling the line low, the decoder
+ * evaluates the length of the last 40 high pulses once the line is idle.
+ * Parameter 0: model 22 or 11, default 22.
+ * Parameter 1: high time in us separating 0 from 1 bits, default 50.
+ * Frame: humidity in 0.1 %, temperature in 0.1 C (signed), checksum ok,
+ *        first 4 data bytes, checksum byte.
+ */
+#define DHT_BITS 40
+
+struct dht {
+  uint32_t rise;
+  int high;
+  unsigned nhigh;
+  uint8_t bits[DHT_BITS];
+};
+
+static int dhtInit(decoder_t *d)
+{
+  int model = decoder_param(d, 0, 22);
+  return (model == 22 || model == 11) ? 0 : -1;
+}
+
+static void dhtEdge(decoder_t *d, unsigned index, unsigned level, uint32_t tick)
+{
+  struct dht *h = decoder_state(d);
+
+  if (level){
+    h->rise = tick;
+    h->high = TRUE;
+  } else if (h->high){
+    /* keep the last 40 high pulses */
+    if (h->nhigh == DHT_BITS){
+      memmove(h->bits, h->bits + 1, DHT_BITS - 1);
+      h->nhigh--;
+    }
+    h->bits[h->nhigh++] = (uint32_t)(tick - h->rise) > (uint32_t) decoder_param(d, 1, 50);
+    h->high = FALSE;
+  }
+}
+
+static void dhtTimeout(decoder_t *d, unsigned index, uint32_t tick)
+{
+  struct dht *h = decoder_state(d);
+  uint8_t b[5];
+  uint32_t frame[5];
+  int i, temp;
+
+  if (h->nhigh < DHT_BITS){
+    h->nhigh = 0;
+    return;
+  }
+  memset(b, 0, sizeof(b));
+  for (i = 0; i < DHT_BITS; i++)
+    b[i / 8] = (b[i / 8] << 1) | h->bits[i];
+  h->nhigh = 0;
+  if (decoder_param(d, 0, 22) == 11){
+    frame[0] = b[0] * 10 + b[1];
+    temp = b[2] * 10 + b[3];
+  } else {
+    frame[0] = (b[0] << 8) | b[1];
+    temp = ((b[2] & 0x7f) << 8) | b[3];
+    if (b[2] & 0x80)
+      temp = -temp;
+  }
+  frame[1] = (uint32_t) temp;
+  frame[2] = ((b[0] + b[1] + b[2] + b[3]) & 0xff) == b[4];
+  frame[3] = ((uint32_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+  frame[4] = b[4];
+  decoder_emit(d, frame, 5, tick);
+}
+
+const decoderType_t decDht22 = {
+  "dht22", 1, sizeof(struct dht), 5,
+  dhtInit, dhtEdge, dhtTimeout
+};
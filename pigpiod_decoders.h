@@ -0,0 +1,14 @@
+#ifndef PIGPIOD_DECODERS_INCL
+#define PIGPIOD_DECODERS_INCL
+
+#include "pigpiod_if2.h"
+
+/*
+ * Built-in pulse train decoders, see decoder_register().
+ */
+extern const decoderType_t decQuadrature;
+extern const decoderType_t decWiegand;
+extern const decoderType_t decNec;
+extern const decoderType_t decDht22;
+
+#endif
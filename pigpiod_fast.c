@@ -0,0 +1,263 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Fast methods. The session and device methods called at high rates are
+ * C functions taking the pi and device handles from the object, see
+ * pigpiod_object.c. They are installed as the methods of the classes,
+ * which saves the field lookups, the generic wrapper and the result
+ * check in Lua per call; pigpiod.lua keeps only their documentation.
+ * Results are those of the class methods: a value or true on success,
+ * nil + errormsg + code on failure.
+ */
+#define PI      (check_object(L, 1)->pi)
+
+static unsigned arg_uint(lua_State *L, int arg)
+{
+  int isnum;
+  lua_Integer v = lua_tointegerx(L, arg, &isnum);
+  if (!isnum)
+    v = luaL_checkinteger(L, arg);
+  return (unsigned) v;
+}
+
+static int push_error(lua_State *L, int res)
+{
+  lua_pushnil(L);
+  lua_pushstring(L, pigpio_error(res));
+  lua_pushinteger(L, res);
+  return 3;
+}
+
+static int push_status(lua_State *L, int res)
+{
+  if (res < 0)
+    return push_error(L, res);
+  lua_pushboolean(L, TRUE);
+  return 1;
+}
+
+static int push_value(lua_State *L, int res)
+{
+  if (res < 0)
+    return push_error(L, res);
+  lua_pushinteger(L, res);
+  return 1;
+}
+
+/*
+ * Session methods.
+ */
+static int fast_read(lua_State *L)
+{
+  return push_value(L, gpio_read(PI, arg_uint(L, 2)));
+}
+
+static int fast_write(lua_State *L)
+{
+  return push_status(L, gpio_write(PI, arg_uint(L, 2), arg_uint(L, 3)));
+}
+
+static int fast_read_bank1(lua_State *L)
+{
+  lua_pushinteger(L, read_bank_1(PI));
+  return 1;
+}
+
+static int fast_read_bank2(lua_State *L)
+{
+  lua_pushinteger(L, read_bank_2(PI));
+  return 1;
+}
+
+static int fast_set_bank1(lua_State *L)
+{
+  return push_status(L, set_bank_1(PI, arg_uint(L, 2)));
+}
+
+static int fast_set_bank2(lua_State *L)
+{
+  return push_status(L, set_bank_2(PI, arg_uint(L, 2)));
+}
+
+static int fast_clear_bank1(lua_State *L)
+{
+  return push_status(L, clear_bank_1(PI, arg_uint(L, 2)));
+}
+
+static int fast_clear_bank2(lua_State *L)
+{
+  return push_status(L, clear_bank_2(PI, arg_uint(L, 2)));
+}
+
+static int fast_set_pwm(lua_State *L)
+{
+  return push_status(L, set_PWM_dutycycle(PI, arg_uint(L, 2), arg_uint(L, 3)));
+}
+
+static int fast_get_pwm(lua_State *L)
+{
+  return push_value(L, get_PWM_dutycycle(PI, arg_uint(L, 2)));
+}
+
+static int fast_hardware_pwm(lua_State *L)
+{
+  return push_status(L, hardware_PWM(PI, arg_uint(L, 2), arg_uint(L, 3), arg_uint(L, 4)));
+}
+
+static int fast_set_servo(lua_State *L)
+{
+  return push_status(L, set_servo_pulsewidth(PI, arg_uint(L, 2), arg_uint(L, 3)));
+}
+
+static int fast_get_servo(lua_State *L)
+{
+  return push_value(L, get_servo_pulsewidth(PI, arg_uint(L, 2)));
+}
+
+static int fast_tick(lua_State *L)
+{
+  lua_pushinteger(L, get_current_tick(PI));
+  return 1;
+}
+
+static const luaL_Reg session_methods[] = {
+  {"read", fast_read},
+  {"write", fast_write},
+  {"readBank1", fast_read_bank1},
+  {"readBank2", fast_read_bank2},
+  {"setBank1", fast_set_bank1},
+  {"setBank2", fast_set_bank2},
+  {"clearBank1", fast_clear_bank1},
+  {"clearBank2", fast_clear_bank2},
+  {"setPwmDutycycle", fast_set_pwm},
+  {"getPwmDutycycle", fast_get_pwm},
+  {"hardwarePwm", fast_hardware_pwm},
+  {"setServoPulsewidth", fast_set_servo},
+  {"servo", fast_set_servo},
+  {"getServoPulsewidth", fast_get_servo},
+  {"getCurrentTick", fast_tick},
+  {"tick", fast_tick},
+  {NULL, NULL}
+};
+
+/*
+ * SPI device methods.
+ */
+static int fast_spi_transfer(lua_State *L)
+{
+  object_t *o = check_object(L, 1);
+  luaL_Buffer lbuf;
+  size_t len;
+  const char *tx = array_bytes(L, 2, &len);
+  char *rx = result_buffer(L, 3, len, &lbuf);
+  int n = spi_xfer(o->pi, o->handle, (char *) tx, rx, len);
+  if (n < 0)
+    return push_error(L, n);
+  return push_result(L, 3, &lbuf, n);
+}
+
+static int fast_spi_read(lua_State *L)
+{
+  object_t *o = check_object(L, 1);
+  luaL_Buffer lbuf;
+  unsigned len = arg_uint(L, 2);
+  char *rx = result_buffer(L, 3, len, &lbuf);
+  int n = spi_read(o->pi, o->handle, rx, len);
+  if (n < 0)
+    return push_error(L, n);
+  return push_result(L, 3, &lbuf, n);
+}
+
+static const luaL_Reg spi_methods[] = {
+  {"transfer", fast_spi_transfer},
+  {"read", fast_spi_read},
+  {NULL, NULL}
+};
+
+/*
+ * I2C device methods.
+ */
+static int fast_i2c_read_byte(lua_State *L)
+{
+  object_t *o = check_object(L, 1);
+  return push_value(L, i2c_read_byte_data(o->pi, o->handle, arg_uint(L, 2)));
+}
+
+static int fast_i2c_write_byte(lua_State *L)
+{
+  object_t *o = check_object(L, 1);
+  return push_status(L, i2c_write_byte_data(o->pi, o->handle, arg_uint(L, 2), arg_uint(L, 3)));
+}
+
+static int fast_i2c_read_word(lua_State *L)
+{
+  object_t *o = check_object(L, 1);
+  return push_value(L, i2c_read_word_data(o->pi, o->handle, arg_uint(L, 2)));
+}
+
+static int fast_i2c_write_word(lua_State *L)
+{
+  object_t *o = check_object(L, 1);
+  return push_status(L, i2c_write_word_data(o->pi, o->handle, arg_uint(L, 2), arg_uint(L, 3)));
+}
+
+static int fast_i2c_read_device(lua_State *L)
+{
+  object_t *o = check_object(L, 1);
+  luaL_Buffer lbuf;
+  unsigned len = arg_uint(L, 2);
+  char *rx = result_buffer(L, 3, len, &lbuf);
+  int n = i2c_read_device(o->pi, o->handle, rx, len);
+  if (n < 0)
+    return push_error(L, n);
+  return push_result(L, 3, &lbuf, n);
+}
+
+static int fast_i2c_read_block(lua_State *L)
+{
+  object_t *o = check_object(L, 1);
+  luaL_Buffer lbuf;
+  unsigned reg = arg_uint(L, 2), len = arg_uint(L, 3);
+  char *rx;
+  int n;
+
+  if (len < 1 || len > 32)
+    luaL_error(L, "Number of bytes must be in range of 1 to 32, received %d.", (int) len);
+  rx = result_buffer(L, 4, len, &lbuf);
+  n = i2c_read_i2c_block_data(o->pi, o->handle, reg, rx, len);
+  if (n < 0)
+    return push_error(L, n);
+  return push_result(L, 4, &lbuf, n);
+}
+
+static const luaL_Reg i2c_methods[] = {
+  {"readByte", fast_i2c_read_byte},
+  {"writeByte", fast_i2c_write_byte},
+  {"readWord", fast_i2c_read_word},
+  {"writeWord", fast_i2c_write_word},
+  {"readDevice", fast_i2c_read_device},
+  {"readI2CBlockData", fast_i2c_read_block},
+  {NULL, NULL}
+};
+
+/*
+ * Lua binding: methods = fast_methods(kind)
+ * kind is "session", "spi" or "i2c".
+ */
+int utlFastMethods(lua_State *L)
+{
+  static const char *const kinds[] = {"session", "spi", "i2c", NULL};
+  static const luaL_Reg *const methods[] = {session_methods, spi_methods, i2c_methods};
+
+  lua_newtable(L);
+  luaL_setfuncs(L, methods[luaL_checkoption(L, 1, NULL, kinds)], 0);
+  return 1;
+}
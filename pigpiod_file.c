@@ -0,0 +1,312 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Bulk file transfer. Reads are issued as pipelines of FILE_PIPE_DEPTH
+ * PI_CMD_FR commands. The chunk size starts small, so that short files
+ * cost little memory, and doubles with every batch which is read in full
+ * up to FILE_CHUNK_MAX. Writes send local file contents as pipelines of
+ * PI_CMD_FW commands of the maximal size.
+ */
+
+/*
+ * Read the next batch of chunks into dst, which has space for
+ * FILE_PIPE_DEPTH chunks. Returns the number of bytes read, < 0 on
+ * failure. *eof is set when the end of the file has been reached.
+ */
+static int read_batch(int pi, unsigned handle, char *dst, unsigned *chunk, int *eof)
+{
+  pipe_cmd_t cmds[FILE_PIPE_DEPTH];
+  int i, res, pos = 0;
+
+  memset(cmds, 0, sizeof(cmds));
+  for (i = 0; i < FILE_PIPE_DEPTH; i++){
+    cmds[i].cmd = PI_CMD_FR;
+    cmds[i].p1 = handle;
+    cmds[i].p2 = *chunk;
+    cmds[i].rxext = 1;
+    cmds[i].rxbuf = dst + i * *chunk;
+    cmds[i].rxlen = *chunk;
+  }
+  res = pigpio_pipeline(pi, cmds, FILE_PIPE_DEPTH);
+  if (res < 0)
+    return res;
+  *eof = FALSE;
+  for (i = 0; i < FILE_PIPE_DEPTH; i++){
+    if (cmds[i].res < 0)
+      return cmds[i].res;
+    /* close the gap behind a short read */
+    if (dst + pos != cmds[i].rxbuf)
+      memmove(dst + pos, cmds[i].rxbuf, cmds[i].res);
+    pos += cmds[i].res;
+    if (cmds[i].res < (int) *chunk)
+      *eof = TRUE;
+  }
+  if (!*eof && *chunk < FILE_CHUNK_MAX)
+    *chunk = (2 * *chunk < FILE_CHUNK_MAX) ? 2 * *chunk : FILE_CHUNK_MAX;
+  return pos;
+}
+
+/*
+ * Lua binding: str = file_read_all(pi, handle)
+ * Reads from the current position to the end of the file.
+ */
+int utlFileReadAll(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned handle = (unsigned) luaL_checkinteger(L, 2);
+  unsigned chunk = FILE_CHUNK_MIN;
+  int n, eof = FALSE;
+  luaL_Buffer lbuf;
+  char *dst;
+
+  luaL_buffinit(L, &lbuf);
+  while (!eof){
+    /* replies are received straight into the Lua buffer */
+    dst = luaL_prepbuffsize(&lbuf, FILE_PIPE_DEPTH * chunk);
+    n = read_batch(pi, handle, dst, &chunk, &eof);
+    if (n < 0){
+      lua_pushnil(L);
+      lua_pushinteger(L, n);
+      return 2;
+    }
+    luaL_addsize(&lbuf, n);
+  }
+  luaL_pushresult(&lbuf);
+  return 1;
+}
+
+/*
+ * Lua binding: nbytes = file_copy_to(pi, handle, localpath)
+ * Copies from the current position to the end of the file into a local
+ * file. Returns nil + code on daemon errors, nil + message on local
+ * errors.
+ */
+int utlFileCopyTo(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned handle = (unsigned) luaL_checkinteger(L, 2);
+  const char *path = luaL_checkstring(L, 3);
+  unsigned chunk = FILE_CHUNK_MIN;
+  lua_Integer total = 0;
+  int n, err, eof = FALSE;
+  char *buf;
+  FILE *f;
+
+  buf = lua_newuserdata(L, FILE_PIPE_DEPTH * FILE_CHUNK_MAX);
+  if ((f = fopen(path, "wb")) == NULL){
+    err = errno;
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", path, strerror(err));
+    return 2;
+  }
+  while (!eof){
+    n = read_batch(pi, handle, buf, &chunk, &eof);
+    if (n < 0){
+      fclose(f);
+      lua_pushnil(L);
+      lua_pushinteger(L, n);
+      return 2;
+    }
+    if (fwrite(buf, 1, n, f) != (size_t) n){
+      err = errno;
+      fclose(f);
+      lua_pushnil(L);
+      lua_pushfstring(L, "%s: %s", path, strerror(err));
+      return 2;
+    }
+    total += n;
+  }
+  if (fclose(f) != 0){
+    err = errno;
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", path, strerror(err));
+    return 2;
+  }
+  lua_pushinteger(L, total);
+  return 1;
+}
+
+/*
+ * Lua binding: nbytes = file_write_from(pi, handle, localpath)
+ * Writes the contents of a local file at the current position.
+ */
+int utlFileWriteFrom(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned handle = (unsigned) luaL_checkinteger(L, 2);
+  const char *path = luaL_checkstring(L, 3);
+  pipe_cmd_t cmds[FILE_PIPE_DEPTH];
+  lua_Integer total = 0;
+  size_t n, off;
+  int i, k, res, err;
+  char *buf;
+  FILE *f;
+
+  buf = lua_newuserdata(L, FILE_PIPE_DEPTH * FILE_CHUNK_MAX);
+  if ((f = fopen(path, "rb")) == NULL){
+    err = errno;
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", path, strerror(err));
+    return 2;
+  }
+  while ((n = fread(buf, 1, FILE_PIPE_DEPTH * FILE_CHUNK_MAX, f)) > 0){
+    memset(cmds, 0, sizeof(cmds));
+    for (i = 0, off = 0; off < n; i++, off += FILE_CHUNK_MAX){
+      cmds[i].cmd = PI_CMD_FW;
+      cmds[i].p1 = handle;
+      cmds[i].p3 = (n - off < FILE_CHUNK_MAX) ? n - off : FILE_CHUNK_MAX;
+      cmds[i].ext = buf + off;
+    }
+    res = pigpio_pipeline(pi, cmds, i);
+    for (k = 0; res >= 0 && k < i; k++)
+      if (cmds[k].res < 0)
+        res = cmds[k].res;
+    if (res < 0){
+      fclose(f);
+      lua_pushnil(L);
+      lua_pushinteger(L, res);
+      return 2;
+    }
+    total += n;
+  }
+  err = ferror(f) ? errno : 0;
+  fclose(f);
+  if (err != 0){
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s: %s", path, strerror(err));
+    return 2;
+  }
+  lua_pushinteger(L, total);
+  return 1;
+}
+
+/*
+ * Push the listing of files matching pattern. The reply is received
+ * directly into a Lua buffer large enough for any listing the daemon
+ * sends. Returns the length of the listing, < 0 on failure with nothing
+ * pushed.
+ */
+static int push_listing(lua_State *L, int pi, const char *pattern)
+{
+  luaL_Buffer lbuf;
+  char *cbuf;
+  int nbytes;
+
+  cbuf = luaL_buffinitsize(L, &lbuf, LIST_FILE_BUFSIZE);
+  nbytes = file_list(pi, (char *) pattern, cbuf, LIST_FILE_BUFSIZE);
+  if (nbytes < 0){
+    luaL_pushresultsize(&lbuf, 0);
+    lua_pop(L, 1);
+    return nbytes;
+  }
+  luaL_pushresultsize(&lbuf, nbytes);
+  return nbytes;
+}
+
+/*
+ * Find the next name in the listing s of length len, starting at *pos.
+ * Returns the name length, < 0 at the end of the listing.
+ */
+static int next_name(const char *s, size_t len, size_t *pos, size_t *start)
+{
+  size_t i = *pos;
+
+  while (i < len && (s[i] == '\n' || s[i] == '\r'))
+    i++;
+  if (i == len){
+    *pos = i;
+    return -1;
+  }
+  *start = i;
+  while (i < len && s[i] != '\n' && s[i] != '\r')
+    i++;
+  *pos = i;
+  return (int) (i - *start);
+}
+
+/*
+ * Lua binding: files = file_list(pi, pattern)
+ * Returns the listing as received from the daemon.
+ */
+int utlFileList(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  const char *pattern = luaL_checkstring(L, 2);
+  int nbytes = push_listing(L, pi, pattern);
+  if (nbytes < 0){
+    lua_pushnil(L);
+    lua_pushinteger(L, nbytes);
+    return 2;
+  }
+  return 1;
+}
+
+/*
+ * Lua binding: names, listing = file_names(pi, pattern)
+ */
+int utlFileNames(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  const char *pattern = luaL_checkstring(L, 2);
+  size_t len, pos = 0, start;
+  const char *s;
+  int n, k = 0;
+
+  if ((n = push_listing(L, pi, pattern)) < 0){
+    lua_pushnil(L);
+    lua_pushinteger(L, n);
+    return 2;
+  }
+  s = lua_tolstring(L, -1, &len);
+  lua_newtable(L);
+  while ((n = next_name(s, len, &pos, &start)) >= 0){
+    lua_pushlstring(L, s + start, n);
+    lua_rawseti(L, -2, ++k);
+  }
+  lua_insert(L, -2);
+  return 2;
+}
+
+static int names_iter(lua_State *L)
+{
+  size_t len, pos = (size_t) lua_tointeger(L, lua_upvalueindex(2)), start;
+  const char *s = lua_tolstring(L, lua_upvalueindex(1), &len);
+  int n = next_name(s, len, &pos, &start);
+
+  lua_pushinteger(L, pos);
+  lua_replace(L, lua_upvalueindex(2));
+  if (n < 0)
+    return 0;
+  lua_pushlstring(L, s + start, n);
+  return 1;
+}
+
+/*
+ * Lua binding: iter = file_names_iter(pi, pattern)
+ * Each call of iter returns the next name, nil at the end. Only the
+ * listing is kept, names are created on demand.
+ */
+int utlFileNamesIter(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  const char *pattern = luaL_checkstring(L, 2);
+  int n;
+
+  if ((n = push_listing(L, pi, pattern)) < 0){
+    lua_pushnil(L);
+    lua_pushinteger(L, n);
+    return 2;
+  }
+  lua_pushinteger(L, 0);
+  lua_pushcclosure(L, names_iter, 2);
+  return 1;
+}
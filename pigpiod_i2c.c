@@ -0,0 +1,471 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Operations of an I2C transaction. Each operation maps to one daemon
+ * command, all commands of a transaction are sent as one pipeline.
+ */
+enum i2carg {
+  ARG_NONE,       /* no parameter */
+  ARG_P2,         /* value, register or byte count in p2 */
+  ARG_REG_VAL,    /* register in p2, 32 bit value in extension */
+  ARG_REG_DATA,   /* register in p2, bytes in extension */
+  ARG_DATA,       /* bytes in extension */
+  ARG_REG_COUNT,  /* register in p2, 32 bit byte count in extension */
+};
+
+enum i2cres {
+  RES_NONE,       /* true */
+  RES_VALUE,      /* number */
+  RES_BYTES,      /* string */
+};
+
+struct i2cop {
+  const char *name;
+  const char *alias;
+  unsigned cmd;
+  enum i2carg arg;
+  enum i2cres res;
+};
+typedef struct i2cop i2cop_t;
+
+static const i2cop_t i2cops[] = {
+  {"write_quick", "writeQuick", PI_CMD_I2CWQ, ARG_P2, RES_NONE},
+  {"send_byte", "sendByte", PI_CMD_I2CWS, ARG_P2, RES_NONE},
+  {"receive_byte", "receiveByte", PI_CMD_I2CRS, ARG_NONE, RES_VALUE},
+  {"write_byte", "writeByte", PI_CMD_I2CWB, ARG_REG_VAL, RES_NONE},
+  {"write_word", "writeWord", PI_CMD_I2CWW, ARG_REG_VAL, RES_NONE},
+  {"read_byte", "readByte", PI_CMD_I2CRB, ARG_P2, RES_VALUE},
+  {"read_word", "readWord", PI_CMD_I2CRW, ARG_P2, RES_VALUE},
+  {"process_call", "processCall", PI_CMD_I2CPC, ARG_REG_VAL, RES_VALUE},
+  {"write_block", "writeBlockData", PI_CMD_I2CWK, ARG_REG_DATA, RES_NONE},
+  {"read_block", "readBlockData", PI_CMD_I2CRK, ARG_P2, RES_BYTES},
+  {"write_i2c_block", "writeI2CBlockData", PI_CMD_I2CWI, ARG_REG_DATA, RES_NONE},
+  {"read_i2c_block", "readI2CBlockData", PI_CMD_I2CRI, ARG_REG_COUNT, RES_BYTES},
+  {"write_device", "writeDevice", PI_CMD_I2CWD, ARG_DATA, RES_NONE},
+  {"read_device", "readDevice", PI_CMD_I2CRD, ARG_P2, RES_BYTES},
+  {NULL, NULL, 0, ARG_NONE, RES_NONE}
+};
+
+static const i2cop_t *find_i2cop(const char *name)
+{
+  const i2cop_t *op;
+  for (op = i2cops; op->name != NULL; op++)
+    if (strcmp(op->name, name) == 0 || strcmp(op->alias, name) == 0)
+      return op;
+  return NULL;
+}
+
+/*
+ * Lua binding: results, errors = i2c_transact(pi, handle, ops)
+ * ops = {{"read_byte", reg}, {"write_word", reg, val}, ...}
+ * results holds the value read, true for writes or false if the
+ * operation failed; errors maps the index of failed operations to their
+ * error code and is nil if all operations succeeded.
+ */
+int utlI2CTransact(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned handle = (unsigned) luaL_checkinteger(L, 2);
+  const i2cop_t **opv;
+  pipe_cmd_t *cmds;
+  uint32_t *vals;
+  char *rxbuf;
+  size_t len, rxtotal = 0;
+  const char *s;
+  unsigned i, n;
+  int res, nerr = 0;
+
+  luaL_checktype(L, 3, LUA_TTABLE);
+  n = lua_rawlen(L, 3);
+  /* scratch memory is collected with the userdata on errors */
+  cmds = lua_newuserdata(L, n * (sizeof(pipe_cmd_t) + sizeof(i2cop_t *) + sizeof(uint32_t)) + 1);
+  opv = (const i2cop_t **) (cmds + n);
+  vals = (uint32_t *) (opv + n);
+  for (i = 0; i < n; i++){
+    lua_rawgeti(L, 3, i + 1);
+    if (lua_istable(L, -1) == 0)
+      luaL_error(L, "Operation %d: table expected, received %s.", i + 1, luaL_typename(L, -1));
+    lua_rawgeti(L, -1, 1);
+    s = lua_tostring(L, -1);
+    if (s == NULL || (opv[i] = find_i2cop(s)) == NULL)
+      luaL_error(L, "Operation %d: unknown I2C operation '%s'.", i + 1, s ? s : "?");
+    lua_pop(L, 1);
+    memset(&cmds[i], 0, sizeof(pipe_cmd_t));
+    cmds[i].cmd = opv[i]->cmd;
+    cmds[i].p1 = handle;
+    if (opv[i]->arg != ARG_NONE && opv[i]->arg != ARG_DATA){
+      lua_rawgeti(L, -1, 2);
+      cmds[i].p2 = (uint32_t) luaL_checkinteger(L, -1);
+      lua_pop(L, 1);
+    }
+    switch (opv[i]->arg){
+    case ARG_REG_VAL:
+    case ARG_REG_COUNT:
+      lua_rawgeti(L, -1, 3);
+      vals[i] = (uint32_t) luaL_checkinteger(L, -1);
+      lua_pop(L, 1);
+      cmds[i].p3 = sizeof(uint32_t);
+      cmds[i].ext = &vals[i];
+      break;
+    case ARG_REG_DATA:
+    case ARG_DATA:
+      /* strings stay referenced by ops: no copy */
+      lua_rawgeti(L, -1, opv[i]->arg == ARG_DATA ? 2 : 3);
+      s = luaL_checklstring(L, -1, &len);
+      lua_pop(L, 1);
+      cmds[i].p3 = len;
+      cmds[i].ext = (void *) s;
+      break;
+    default:
+      break;
+    }
+    lua_pop(L, 1);
+    if (opv[i]->res == RES_BYTES){
+      cmds[i].rxext = TRUE;
+      if (opv[i]->cmd == PI_CMD_I2CRK)
+        cmds[i].rxlen = 32;
+      else if (opv[i]->cmd == PI_CMD_I2CRI)
+        cmds[i].rxlen = vals[i];
+      else
+        cmds[i].rxlen = cmds[i].p2;
+      rxtotal += cmds[i].rxlen;
+    }
+  }
+  rxbuf = lua_newuserdata(L, rxtotal + 1);
+  for (i = 0; i < n; i++){
+    if (cmds[i].rxext){
+      cmds[i].rxbuf = rxbuf;
+      rxbuf += cmds[i].rxlen;
+    }
+  }
+  res = pigpio_pipeline(pi, cmds, n);
+  if (res < 0){
+    lua_pushnil(L);
+    lua_pushinteger(L, res);
+    return 2;
+  }
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++){
+    if (cmds[i].res < 0){
+      nerr++;
+      lua_pushboolean(L, FALSE);
+    } else if (opv[i]->res == RES_VALUE)
+      lua_pushinteger(L, cmds[i].res);
+    else if (opv[i]->res == RES_BYTES)
+      lua_pushlstring(L, cmds[i].rxbuf, cmds[i].res);
+    else
+      lua_pushboolean(L, TRUE);
+    lua_rawseti(L, -2, i + 1);
+  }
+  if (nerr == 0)
+    return 1;
+  lua_createtable(L, 0, nerr);
+  for (i = 0; i < n; i++){
+    if (cmds[i].res < 0){
+      lua_pushinteger(L, cmds[i].res);
+      lua_rawseti(L, -2, i + 1);
+    }
+  }
+  return 2;
+}
+
+/*
+ * Compiled i2c_zip/bb_i2c_zip command buffer. The names of the read
+ * operations are kept in the user value of the userdata.
+ */
+struct zip {
+  unsigned char *buf;
+  unsigned len;
+  unsigned size;
+  unsigned *reads;         /* byte count of each read operation */
+  unsigned nreads;
+  unsigned maxreads;
+  unsigned rxlen;          /* total number of bytes read */
+};
+typedef struct zip zip_t;
+
+static int zip_gc(lua_State *L)
+{
+  zip_t *zp = luaL_checkudata(L, 1, ZIP_MT);
+  free(zp->buf);
+  free(zp->reads);
+  zp->buf = NULL;
+  zp->reads = NULL;
+  return 0;
+}
+
+static zip_t *check_zip(lua_State *L, int arg)
+{
+  return luaL_checkudata(L, arg, ZIP_MT);
+}
+
+static void zip_reserve(lua_State *L, zip_t *zp, unsigned n)
+{
+  unsigned char *buf;
+  unsigned size;
+  if (zp->len + n <= zp->size)
+    return;
+  size = zp->size ? zp->size : 64;
+  while (size < zp->len + n)
+    size *= 2;
+  buf = realloc(zp->buf, size);
+  if (buf == NULL)
+    luaL_error(L, "Cannot allocate zip buffer.");
+  zp->buf = buf;
+  zp->size = size;
+}
+
+/*
+ * Append a command with parameter P. Values above 255 are escaped and
+ * sent as 16 bit value, least significant byte first.
+ */
+static void zip_param(lua_State *L, zip_t *zp, unsigned cmd, lua_Integer p)
+{
+  if (p < 0 || p > 0xffff)
+    luaL_error(L, "Zip parameter %d out of range.", (int) p);
+  zip_reserve(L, zp, 4);
+  if (p > 0xff){
+    zp->buf[zp->len++] = PI_I2C_ESC;
+    zp->buf[zp->len++] = cmd;
+    zp->buf[zp->len++] = p & 0xff;
+    zp->buf[zp->len++] = p >> 8;
+  } else {
+    zp->buf[zp->len++] = cmd;
+    zp->buf[zp->len++] = p;
+  }
+}
+
+/*
+ * Lua binding: zip = zip_create()
+ */
+int utlZipCreate(lua_State *L)
+{
+  zip_t *zp = lua_newuserdata(L, sizeof(zip_t));
+  memset(zp, 0, sizeof(zip_t));
+  if (luaL_newmetatable(L, ZIP_MT)){
+    lua_pushcfunction(L, zip_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  lua_setuservalue(L, -2);
+  return 1;
+}
+
+/*
+ * Lua binding: zip_add(zip, op[, arg[, name]])
+ * op: "addr", "flags", "start", "stop", "write", "read" or "end".
+ * write takes a string or a table of bytes, read the number of bytes
+ * and an optional name for the result.
+ */
+int utlZipAdd(lua_State *L)
+{
+  zip_t *zp = check_zip(L, 1);
+  const char *op = luaL_checkstring(L, 2);
+  const char *data;
+  unsigned *reads;
+  size_t len, i;
+  lua_Integer n, v;
+
+  if (strcmp(op, "addr") == 0)
+    zip_param(L, zp, PI_I2C_ADDR, luaL_checkinteger(L, 3));
+  else if (strcmp(op, "flags") == 0){
+    v = luaL_checkinteger(L, 3);
+    zip_reserve(L, zp, 3);
+    zp->buf[zp->len++] = PI_I2C_FLAGS;
+    zp->buf[zp->len++] = v & 0xff;
+    zp->buf[zp->len++] = (v >> 8) & 0xff;
+  } else if (strcmp(op, "start") == 0){
+    zip_reserve(L, zp, 1);
+    zp->buf[zp->len++] = PI_I2C_START;
+  } else if (strcmp(op, "stop") == 0){
+    zip_reserve(L, zp, 1);
+    zp->buf[zp->len++] = PI_I2C_STOP;
+  } else if (strcmp(op, "end") == 0){
+    zip_reserve(L, zp, 1);
+    zp->buf[zp->len++] = PI_I2C_END;
+  } else if (strcmp(op, "write") == 0){
+    if (lua_istable(L, 3)){
+      len = lua_rawlen(L, 3);
+      zip_param(L, zp, PI_I2C_WRITE, len);
+      zip_reserve(L, zp, len);
+      for (i = 1; i <= len; i++){
+        lua_rawgeti(L, 3, i);
+        zp->buf[zp->len++] = (unsigned char) luaL_checkinteger(L, -1);
+        lua_pop(L, 1);
+      }
+    } else {
+      data = luaL_checklstring(L, 3, &len);
+      zip_param(L, zp, PI_I2C_WRITE, len);
+      zip_reserve(L, zp, len);
+      memcpy(zp->buf + zp->len, data, len);
+      zp->len += len;
+    }
+  } else if (strcmp(op, "read") == 0){
+    n = luaL_checkinteger(L, 3);
+    zip_param(L, zp, PI_I2C_READ, n);
+    if (zp->nreads == zp->maxreads){
+      zp->maxreads = zp->maxreads ? 2 * zp->maxreads : 8;
+      reads = realloc(zp->reads, zp->maxreads * sizeof(unsigned));
+      if (reads == NULL)
+        luaL_error(L, "Cannot allocate zip reads.");
+      zp->reads = reads;
+    }
+    zp->reads[zp->nreads++] = n;
+    zp->rxlen += n;
+    lua_getuservalue(L, 1);
+    if (lua_isnoneornil(L, 4))
+      lua_pushinteger(L, zp->nreads);
+    else
+      lua_pushvalue(L, 4);
+    lua_rawseti(L, -2, zp->nreads);
+    lua_pop(L, 1);
+  } else
+    luaL_error(L, "Unknown zip operation '%s'.", op);
+  return 0;
+}
+
+/*
+ * Lua binding: results, raw = zip_run(pi, handle, zip, bb)
+ * Executes the buffer with i2c_zip or bb_i2c_zip. results maps the name
+ * (or index) of each read operation to the bytes read.
+ */
+int utlZipRun(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned handle = (unsigned) luaL_checkinteger(L, 2);
+  zip_t *zp = check_zip(L, 3);
+  int bb = lua_toboolean(L, 4);
+  char *rxbuf;
+  unsigned i, pos, n;
+  int res;
+
+  rxbuf = lua_newuserdata(L, zp->rxlen + 1);
+  if (bb)
+    res = bb_i2c_zip(pi, handle, (char *) zp->buf, zp->len, rxbuf, zp->rxlen);
+  else
+    res = i2c_zip(pi, handle, (char *) zp->buf, zp->len, rxbuf, zp->rxlen);
+  if (res < 0){
+    lua_pushnil(L);
+    lua_pushinteger(L, res);
+    return 2;
+  }
+  lua_getuservalue(L, 3);
+  lua_createtable(L, 0, zp->nreads);
+  for (i = 0, pos = 0; i < zp->nreads && pos < (unsigned) res; i++){
+    n = zp->reads[i];
+    if (pos + n > (unsigned) res)
+      n = res - pos;
+    lua_rawgeti(L, -2, i + 1);
+    lua_pushlstring(L, rxbuf + pos, n);
+    lua_rawset(L, -3);
+    pos += zp->reads[i];
+  }
+  lua_pushlstring(L, rxbuf, res);
+  return 2;
+}
+
+/*
+ * Lua binding: buf, rxlen = zip_info(zip)
+ */
+int utlZipInfo(lua_State *L)
+{
+  zip_t *zp = check_zip(L, 1);
+  lua_pushlstring(L, (char *) zp->buf, zp->len);
+  lua_pushinteger(L, zp->rxlen);
+  return 2;
+}
+
+/*
+ * Lua binding: list = i2c_scan(pi, bus[, first[, last]])
+ * list = {{addr=, status="ok"|"used", data=}, ...}
+ * Addresses are probed in batches: one pipeline opens a handle for each
+ * address of a batch, a second one reads a byte from and closes each
+ * handle.
+ */
+int utlI2CScan(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned bus = (unsigned) luaL_checkinteger(L, 2);
+  unsigned first = (unsigned) luaL_optinteger(L, 3, 0);
+  unsigned last = (unsigned) luaL_optinteger(L, 4, 0x7f);
+  pipe_cmd_t cmds[I2C_SCAN_BATCH];
+  pipe_cmd_t probe[2 * I2C_SCAN_BATCH];
+  uint32_t flags = 0;
+  unsigned addr, i, n, m, k = 0;
+  int res;
+
+  if (first > last || last > 0x7f)
+    luaL_error(L, "Invalid address range 0x%x..0x%x.", first, last);
+  lua_newtable(L);
+  for (addr = first; addr <= last; addr += n){
+    n = (last - addr + 1 < I2C_SCAN_BATCH) ? last - addr + 1 : I2C_SCAN_BATCH;
+    memset(cmds, 0, sizeof(cmds));
+    memset(probe, 0, sizeof(probe));
+    for (i = 0; i < n; i++){
+      cmds[i].cmd = PI_CMD_I2CO;
+      cmds[i].p1 = bus;
+      cmds[i].p2 = addr + i;
+      cmds[i].p3 = sizeof(uint32_t);
+      cmds[i].ext = &flags;
+    }
+    res = pigpio_pipeline(pi, cmds, n);
+    if (res < 0 || cmds[0].res == PI_BAD_I2C_BUS){
+      /* close what has been opened before giving up */
+      for (i = 0; res >= 0 && i < n; i++)
+        if (cmds[i].res >= 0)
+          i2c_close(pi, cmds[i].res);
+      lua_pushnil(L);
+      lua_pushinteger(L, res < 0 ? res : PI_BAD_I2C_BUS);
+      return 2;
+    }
+    for (i = 0, m = 0; i < n; i++){
+      if (cmds[i].res < 0)
+        continue;
+      probe[2 * m].cmd = PI_CMD_I2CRS;
+      probe[2 * m].p1 = cmds[i].res;
+      probe[2 * m + 1].cmd = PI_CMD_I2CC;
+      probe[2 * m + 1].p1 = cmds[i].res;
+      m++;
+    }
+    if (m > 0 && (res = pigpio_pipeline(pi, probe, 2 * m)) < 0){
+      /* the handles may still be open */
+      for (i = 0; i < n; i++)
+        if (cmds[i].res >= 0)
+          i2c_close(pi, cmds[i].res);
+      lua_pushnil(L);
+      lua_pushinteger(L, res);
+      return 2;
+    }
+    for (i = 0, m = 0; i < n; i++){
+      if (cmds[i].res < 0){
+        lua_createtable(L, 0, 3);
+        lua_pushstring(L, "used");
+        lua_setfield(L, -2, "status");
+        lua_pushinteger(L, 0xff);
+        lua_setfield(L, -2, "data");
+      } else {
+        res = probe[2 * m++].res;
+        if (res < 0)
+          continue;
+        lua_createtable(L, 0, 3);
+        lua_pushstring(L, "ok");
+        lua_setfield(L, -2, "status");
+        lua_pushinteger(L, res);
+        lua_setfield(L, -2, "data");
+      }
+      lua_pushinteger(L, addr + i);
+      lua_setfield(L, -2, "addr");
+      lua_rawseti(L, -2, ++k);
+    }
+  }
+  return 1;
+}
@@ -27,6 +27,10 @@ For more information, please refer to <http://unlicense.org/>
 
 /* PIGPIOD_IF2_VERSION 13 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -37,6 +41,7 @@ For more information, please refer to <http://unlicense.org/>
 #include <time.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -51,6 +56,7 @@ For more information, please refer to <http://unlicense.org/>
 #include "command.h"
 
 #include "pigpiod_if2.h"
+#include "pigpiod_decoders.h"
 
 #define PI_MAX_REPORTS_PER_READ 4096
 
@@ -58,6 +64,9 @@ For more information, please refer to <http://unlicense.org/>
 
 #define MAX_PI 32
 
+#define PIPELINE_DEPTH 64
+#define PIPELINE_BYTES (32*1024)
+
 typedef void (*CBF_t) ();
 
 struct callback_s
@@ -98,6 +107,60 @@ static int             gPigNotify   [MAX_PI];
 static uint32_t        gEventBits   [MAX_PI];
 static uint32_t        gNotifyBits  [MAX_PI];
 static uint32_t        gLastLevel   [MAX_PI];
+static uint32_t        gCounterBits [MAX_PI];
+
+static struct
+{
+   gpioCounter_t c;
+   uint32_t start;      /* window start tick */
+   uint32_t lastRise;
+   uint32_t lastEdge;
+   int      haveRise;
+   int      haveEdge;
+} gCounter[MAX_PI][32];
+
+struct decoder_s
+{
+   unsigned id;
+   int pi;
+   const decoderType_t *type;
+   unsigned gpio[DECODER_MAX_GPIO];
+   int param[DECODER_MAX_PARAM];
+   unsigned nparam;
+   unsigned watchdog;
+   uint32_t bits;
+   decFuncEx_t f;
+   void *user;
+   uint32_t frame[DECODER_MAX_DATA];
+   unsigned nframe;
+   uint32_t frameTick;
+   void *state;
+   decoder_t *prev;
+   decoder_t *next;
+};
+
+static decoder_t *gDecoderFirst = 0;
+static uint32_t   gDecoderBits [MAX_PI];
+
+static const decoderType_t *gDecoderTypes[DECODER_MAX_TYPES] =
+{
+   &decQuadrature, &decWiegand, &decNec, &decDht22,
+};
+
+typedef struct reportHook_s
+{
+   unsigned id;
+   int pi;
+   uint32_t bits;
+   reportFunc_t f;
+   void *user;
+   struct reportHook_s *prev;
+   struct reportHook_s *next;
+} reportHook_t;
+
+static reportHook_t *gReportHookFirst = 0;
+static uint32_t      gReportHookBits [MAX_PI];
+static int           gReportHooks    [MAX_PI];
 
 static pthread_t       *gPthNotify  [MAX_PI];
 
@@ -110,8 +173,34 @@ static callback_t *gCallBackLast  = 0;
 static evtCallback_t *geCallBackFirst = 0;
 static evtCallback_t *geCallBackLast  = 0;
 
+/* protects the callback lists against the notification threads */
+static pthread_mutex_t gCallbackMutex;
+static pthread_once_t  gCallbackOnce = PTHREAD_ONCE_INIT;
+
 /* PRIVATE ---------------------------------------------------------------- */
 
+static void _cbinit(void)
+{
+   pthread_mutexattr_t attr;
+
+   /* recursive: callbacks may register or cancel callbacks */
+   pthread_mutexattr_init(&attr);
+   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+   pthread_mutex_init(&gCallbackMutex, &attr);
+   pthread_mutexattr_destroy(&attr);
+}
+
+static void _cbl(void)
+{
+   pthread_once(&gCallbackOnce, _cbinit);
+   pthread_mutex_lock(&gCallbackMutex);
+}
+
+static void _cbu(void)
+{
+   pthread_mutex_unlock(&gCallbackMutex);
+}
+
 static void _pml(int pi)
 {
    int cancelState;
@@ -292,6 +381,83 @@ static int pigpioOpenSocket(char *addr, char *port)
    return sock;
 }
 
+static void count_edge(int pi, int g, int l, uint32_t tick)
+{
+   gpioCounter_t *c = &gCounter[pi][g].c;
+   uint32_t dt;
+
+   if (gCounter[pi][g].haveEdge)
+   {
+      /* time spent at the previous level */
+      dt = tick - gCounter[pi][g].lastEdge;
+      if (l) c->lowTime += dt; else c->highTime += dt;
+   }
+   else
+   {
+      /* time since counter start at the previous level */
+      dt = tick - gCounter[pi][g].start;
+      if (l) c->lowTime += dt; else c->highTime += dt;
+   }
+
+   if (l)
+   {
+      c->rising++;
+      if (gCounter[pi][g].haveRise)
+      {
+         c->period = tick - gCounter[pi][g].lastRise;
+         if ((c->periods == 0) || (c->period < c->minPeriod))
+            c->minPeriod = c->period;
+         if (c->period > c->maxPeriod) c->maxPeriod = c->period;
+         c->periodSum += c->period;
+         c->periods++;
+      }
+      gCounter[pi][g].lastRise = tick;
+      gCounter[pi][g].haveRise = 1;
+   }
+   else c->falling++;
+
+   c->edges++;
+   c->level = l;
+   c->tick = tick;
+   c->window = tick - gCounter[pi][g].start;
+   gCounter[pi][g].lastEdge = tick;
+   gCounter[pi][g].haveEdge = 1;
+}
+
+static void decode_edges(int pi, uint32_t changed, gpioReport_t *r)
+{
+   decoder_t *d;
+   unsigned i;
+
+   for (d=gDecoderFirst; d; d=d->next)
+   {
+      if ((d->pi != pi) || !(changed & d->bits)) continue;
+
+      for (i=0; i<d->type->ngpio; i++)
+      {
+         if (changed & (1<<d->gpio[i]))
+            d->type->edge(d, i, (r->level >> d->gpio[i]) & 1, r->tick);
+      }
+   }
+}
+
+static void decode_timeout(int pi, unsigned g, uint32_t tick)
+{
+   decoder_t *d;
+   unsigned i;
+
+   for (d=gDecoderFirst; d; d=d->next)
+   {
+      if ((d->pi != pi) || !(d->bits & (1<<g)) || !d->type->timeout)
+         continue;
+
+      for (i=0; i<d->type->ngpio; i++)
+      {
+         if (d->gpio[i] == g) d->type->timeout(d, i, tick);
+      }
+   }
+}
+
 static void dispatch_notification(int pi, gpioReport_t *r)
 {
    callback_t *p;
@@ -310,6 +476,17 @@ static void dispatch_notification(int pi, gpioReport_t *r)
 
       gLastLevel[pi] = r->level;
 
+      if (changed & gCounterBits[pi])
+      {
+         for (g=0; g<32; g++)
+         {
+            if ((changed & gCounterBits[pi]) & (1<<g))
+               count_edge(pi, g, (r->level >> g) & 1, r->tick);
+         }
+      }
+
+      if (changed & gDecoderBits[pi]) decode_edges(pi, changed, r);
+
       p = gCallBackFirst;
 
       while (p)
@@ -332,6 +509,8 @@ static void dispatch_notification(int pi, gpioReport_t *r)
       {
          g = (r->flags) & 31;
 
+         if (gDecoderBits[pi] & (1<<g)) decode_timeout(pi, g, r->tick);
+
          p = gCallBackFirst;
 
          while (p)
@@ -363,6 +542,16 @@ static void dispatch_notification(int pi, gpioReport_t *r)
    }
 }
 
+static void call_report_hooks(int pi, gpioReport_t *r, unsigned count)
+{
+   reportHook_t *h;
+
+   for (h=gReportHookFirst; h; h=h->next)
+   {
+      if (h->pi == pi) (h->f)(pi, r, count, h->user);
+   }
+}
+
 static void *pthNotifyThread(void *x)
 {
    static int got = 0;
@@ -382,6 +571,11 @@ static void *pthNotifyThread(void *x)
 
       r = 0;
 
+      _cbl();
+
+      if (gReportHooks[pi] && (got >= sizeof(gpioReport_t)))
+         call_report_hooks(pi, report, got / sizeof(gpioReport_t));
+
       while (got >= sizeof(gpioReport_t))
       {
          dispatch_notification(pi, &report[r]);
@@ -391,6 +585,8 @@ static void *pthNotifyThread(void *x)
          got -= sizeof(gpioReport_t);
       }
 
+      _cbu();
+
       /* copy any partial report to start of array */
       
       if (got && r) report[0] = report[r];
@@ -407,7 +603,7 @@ static void *pthNotifyThread(void *x)
 static void findNotifyBits(int pi)
 {
    callback_t *p;
-   uint32_t bits = 0;
+   uint32_t bits = gCounterBits[pi] | gDecoderBits[pi] | gReportHookBits[pi];
 
    p = gCallBackFirst;
 
@@ -430,7 +626,7 @@ static void _wfe(
    *(int *)user = 1;
 }
 
-static int intCallback(
+static int _intCallback(
    int pi, unsigned user_gpio, unsigned edge, void *f, void *user, int ex)
 {
    static int id = 0;
@@ -447,7 +643,8 @@ static int intCallback(
          if ((p->pi   == pi)        &&
              (p->gpio == user_gpio) &&
              (p->edge == edge)      &&
-             (p->f    == f))
+             (p->f    == f)         &&
+             (p->user == user))
          {
             return pigif_duplicate_callback;
          }
@@ -484,6 +681,18 @@ static int intCallback(
    return pigif_bad_callback;
 }
 
+static int intCallback(
+   int pi, unsigned user_gpio, unsigned edge, void *f, void *user, int ex)
+{
+   int id;
+
+   _cbl();
+   id = _intCallback(pi, user_gpio, edge, f, user, ex);
+   _cbu();
+
+   return id;
+}
+
 static void findEventBits(int pi)
 {
    evtCallback_t *ep;
@@ -510,7 +719,7 @@ static void _ewfe(
    *(int *)user = 1;
 }
 
-static int intEventCallback(
+static int _intEventCallback(
    int pi, unsigned event, void *f, void *user, int ex)
 {
    static int id = 0;
@@ -526,7 +735,8 @@ static int intEventCallback(
       {
          if ((ep->pi    == pi)    &&
              (ep->event == event) &&
-             (ep->f     == f))
+             (ep->f     == f)     &&
+             (ep->user  == user))
          {
             return pigif_duplicate_callback;
          }
@@ -562,6 +772,18 @@ static int intEventCallback(
    return pigif_bad_callback;
 }
 
+static int intEventCallback(
+   int pi, unsigned event, void *f, void *user, int ex)
+{
+   int id;
+
+   _cbl();
+   id = _intEventCallback(pi, event, f, user, ex);
+   _cbu();
+
+   return id;
+}
+
 static int recvMax(int pi, void *buf, int bufsize, int sent)
 {
    /*
@@ -653,6 +875,8 @@ char *pigpio_error(int errnum)
             return "not connected to Pi";
          case pigif_too_many_pis:
             return "too many connected Pis";
+         case pigif_bad_sched:
+            return "cannot set thread affinity or priority";
 
          default:
             return "unknown error";
@@ -708,6 +932,57 @@ void stop_thread(pthread_t *pth)
    }
 }
 
+int thread_sched(pthread_t *pth, int cpu, int priority)
+{
+   struct sched_param param;
+   int policy, maxprio;
+
+   if (!pth) return pigif_bad_sched;
+
+   if (cpu >= 0)
+   {
+#ifdef __linux__
+      cpu_set_t cpus;
+
+      CPU_ZERO(&cpus);
+      CPU_SET(cpu, &cpus);
+      if (pthread_setaffinity_np(*pth, sizeof(cpus), &cpus))
+         return pigif_bad_sched;
+#else
+      return pigif_bad_sched;
+#endif
+   }
+
+   if (priority > 0)
+   {
+      policy = SCHED_FIFO;
+      maxprio = sched_get_priority_max(SCHED_FIFO);
+      if (priority > maxprio) priority = maxprio;
+   }
+   else
+   {
+      policy = SCHED_OTHER;
+      priority = 0;
+   }
+
+   memset(&param, 0, sizeof(param));
+   param.sched_priority = priority;
+
+   if (pthread_setschedparam(*pth, policy, &param)) return pigif_bad_sched;
+
+   return 0;
+}
+
+int notify_sched(int pi, int cpu, int priority)
+{
+   if ((pi < 0) || (pi >= MAX_PI) || !gPiInUse[pi])
+      return pigif_unconnected_pi;
+
+   if (!gPthNotify[pi]) return pigif_notify_failed;
+
+   return thread_sched(gPthNotify[pi], cpu, priority);
+}
+
 int pigpio_start(char *addrStr, char *portStr)
 {
    int pi;
@@ -788,6 +1063,10 @@ void pigpio_stop(int pi)
       gPigNotify[pi] = -1;
    }
 
+   gCounterBits[pi] = 0;
+   gDecoderBits[pi] = 0;
+   gReportHookBits[pi] = 0;
+
    gPiInUse[pi] = 0;
 }
 
@@ -1966,7 +2245,7 @@ int callback_ex(
    int pi, unsigned user_gpio, unsigned edge, CBFuncEx_t f, void *user)
    {return intCallback(pi, user_gpio, edge, f, user, 1);}
 
-int callback_cancel(unsigned id)
+static int _callback_cancel(unsigned id)
 {
    callback_t *p;
    int pi;
@@ -1996,6 +2275,17 @@ int callback_cancel(unsigned id)
    return pigif_callback_not_found;
 }
 
+int callback_cancel(unsigned id)
+{
+   int res;
+
+   _cbl();
+   res = _callback_cancel(id);
+   _cbu();
+
+   return res;
+}
+
 int wait_for_edge(int pi, unsigned user_gpio, unsigned edge, double timeout)
 {
    int triggered = 0;
@@ -2074,7 +2364,7 @@ int event_callback_ex(
    int pi, unsigned event, evtCBFuncEx_t f, void *user)
    {return intEventCallback(pi, event, f, user, 1);}
 
-int event_callback_cancel(unsigned id)
+static int _event_callback_cancel(unsigned id)
 {
    evtCallback_t *ep;
    int pi;
@@ -2104,6 +2394,17 @@ int event_callback_cancel(unsigned id)
    return pigif_callback_not_found;
 }
 
+int event_callback_cancel(unsigned id)
+{
+   int res;
+
+   _cbl();
+   res = _event_callback_cancel(id);
+   _cbu();
+
+   return res;
+}
+
 int wait_for_event(int pi, unsigned event, double timeout)
 {
    int triggered = 0;
@@ -2129,3 +2430,489 @@ int wait_for_event(int pi, unsigned event, double timeout)
 int event_trigger(int pi, unsigned event)
    {return pigpio_command(pi, PI_CMD_EVM, event, 0, 1);}
 
+
+static unsigned pipeBudget(pipe_cmd_t *c)
+{
+   /*
+   Reply bytes the daemon may send for command c.  Reply data of
+   unknown size is charged with the whole budget so that such a
+   command is never in flight together with others.
+   */
+   if (!c->rxext) return sizeof(cmdCmd_t);
+   if (c->rxlen) return sizeof(cmdCmd_t) + c->rxlen;
+   return PIPELINE_BYTES;
+}
+
+int pigpio_pipeline(int pi, pipe_cmd_t *cmds, unsigned count)
+{
+   cmdCmd_t cmd;
+   unsigned sent, done, pending, budget;
+   int err = 0;
+
+   if ((pi < 0) || (pi >= MAX_PI) || !gPiInUse[pi])
+      return pigif_unconnected_pi;
+
+   _pml(pi);
+
+   sent = 0;
+   done = 0;
+   pending = 0;
+
+   while (done < count)
+   {
+      /*
+      Keep sending until the window is full.  The reply bytes the
+      daemon may queue for us are bounded by PIPELINE_BYTES so that
+      neither side can block on a full socket buffer.
+      */
+
+      while ((sent < count) && ((sent - done) < PIPELINE_DEPTH))
+      {
+         budget = pipeBudget(&cmds[sent]);
+
+         if ((sent > done) && ((pending + budget) > PIPELINE_BYTES)) break;
+
+         cmd.cmd = cmds[sent].cmd;
+         cmd.p1  = cmds[sent].p1;
+         cmd.p2  = cmds[sent].p2;
+         cmd.p3  = cmds[sent].p3;
+
+         if (send(gPigCommand[pi], &cmd, sizeof(cmd), 0) != sizeof(cmd))
+         {
+            err = pigif_bad_send;
+            break;
+         }
+
+         if (cmds[sent].p3 &&
+            (send(gPigCommand[pi], cmds[sent].ext, cmds[sent].p3, 0) !=
+               cmds[sent].p3))
+         {
+            err = pigif_bad_send;
+            break;
+         }
+
+         pending += budget;
+         sent++;
+      }
+
+      if (err) break;
+
+      if (recv(gPigCommand[pi], &cmd, sizeof(cmd), MSG_WAITALL) !=
+         sizeof(cmd))
+      {
+         err = pigif_bad_recv;
+         break;
+      }
+
+      cmds[done].res = cmd.res;
+
+      if (cmds[done].rxext && ((int)cmd.res > 0))
+      {
+         if (cmds[done].rxbuf)
+            cmds[done].res =
+               recvMax(pi, cmds[done].rxbuf, cmds[done].rxlen, cmd.res);
+         else
+            recvMax(pi, NULL, 0, cmd.res);
+      }
+
+      pending -= pipeBudget(&cmds[done]);
+      done++;
+   }
+
+   if (err)
+   {
+      /*
+      Replies of commands already sent are outstanding and a command
+      may have been sent partially, hence the command stream is out of
+      sync.  Shut the socket down so that later commands fail rather
+      than read stale replies.
+      */
+      shutdown(gPigCommand[pi], SHUT_RDWR);
+   }
+
+   _pmu(pi);
+
+   if (err) return err;
+
+   return done;
+}
+
+int counter_start(int pi, unsigned user_gpio)
+{
+   if ((pi < 0) || (pi >= MAX_PI) || !gPiInUse[pi])
+      return pigif_unconnected_pi;
+
+   if (user_gpio > 31) return pigif_bad_callback;
+
+   _cbl();
+
+   memset(&gCounter[pi][user_gpio], 0, sizeof(gCounter[pi][user_gpio]));
+   gCounter[pi][user_gpio].c.level = (gLastLevel[pi] >> user_gpio) & 1;
+   gCounter[pi][user_gpio].start = get_current_tick(pi);
+   gCounterBits[pi] |= (1<<user_gpio);
+
+   findNotifyBits(pi);
+
+   _cbu();
+
+   return 0;
+}
+
+int counter_read(int pi, unsigned user_gpio, gpioCounter_t *counter,
+   int reset)
+{
+   if ((pi < 0) || (pi >= MAX_PI) || !gPiInUse[pi])
+      return pigif_unconnected_pi;
+
+   if (user_gpio > 31) return pigif_bad_callback;
+
+   _cbl();
+
+   if (!(gCounterBits[pi] & (1<<user_gpio)))
+   {
+      _cbu();
+      return pigif_callback_not_found;
+   }
+
+   *counter = gCounter[pi][user_gpio].c;
+
+   if (reset)
+   {
+      /* new window starts at the last edge */
+      memset(&gCounter[pi][user_gpio].c, 0, sizeof(gpioCounter_t));
+      gCounter[pi][user_gpio].c.level = counter->level;
+      gCounter[pi][user_gpio].c.tick = counter->tick;
+      if (gCounter[pi][user_gpio].haveEdge)
+         gCounter[pi][user_gpio].start = gCounter[pi][user_gpio].lastEdge;
+      gCounter[pi][user_gpio].haveEdge = 0;
+   }
+
+   _cbu();
+
+   return 0;
+}
+
+int counter_stop(int pi, unsigned user_gpio)
+{
+   if ((pi < 0) || (pi >= MAX_PI) || !gPiInUse[pi])
+      return pigif_unconnected_pi;
+
+   if (user_gpio > 31) return pigif_bad_callback;
+
+   _cbl();
+
+   if (!(gCounterBits[pi] & (1<<user_gpio)))
+   {
+      _cbu();
+      return pigif_callback_not_found;
+   }
+
+   gCounterBits[pi] &= ~(1<<user_gpio);
+
+   findNotifyBits(pi);
+
+   _cbu();
+
+   return 0;
+}
+
+static void findDecoderBits(int pi)
+{
+   decoder_t *d;
+   uint32_t bits = 0;
+
+   for (d=gDecoderFirst; d; d=d->next)
+   {
+      if (d->pi == pi) bits |= d->bits;
+   }
+
+   gDecoderBits[pi] = bits;
+
+   findNotifyBits(pi);
+}
+
+int decoder_register(const decoderType_t *type)
+{
+   int i, res = pigif_bad_callback;
+
+   if (!type || !type->name || !type->edge ||
+       (type->ngpio < 1) || (type->ngpio > DECODER_MAX_GPIO))
+      return pigif_bad_callback;
+
+   _cbl();
+
+   for (i=0; i<DECODER_MAX_TYPES; i++)
+   {
+      if (!gDecoderTypes[i] || !strcmp(gDecoderTypes[i]->name, type->name))
+      {
+         gDecoderTypes[i] = type;
+         res = 0;
+         break;
+      }
+   }
+
+   _cbu();
+
+   return res;
+}
+
+int decoder_start(int pi, const char *name, const unsigned *gpio,
+   unsigned ngpio, const int *param, unsigned nparam, unsigned watchdog,
+   decFuncEx_t f, void *userdata)
+{
+   static unsigned id = 0;
+   const decoderType_t *type = 0;
+   decoder_t *d;
+   unsigned i;
+
+   if ((pi < 0) || (pi >= MAX_PI) || !gPiInUse[pi])
+      return pigif_unconnected_pi;
+
+   if (!name || (nparam > DECODER_MAX_PARAM)) return pigif_bad_callback;
+
+   _cbl();
+
+   for (i=0; i<DECODER_MAX_TYPES; i++)
+   {
+      if (gDecoderTypes[i] && !strcmp(gDecoderTypes[i]->name, name))
+      {
+         type = gDecoderTypes[i];
+         break;
+      }
+   }
+
+   _cbu();
+
+   if (!type || (ngpio != type->ngpio)) return pigif_bad_callback;
+
+   for (i=0; i<ngpio; i++)
+   {
+      if (gpio[i] > 31) return pigif_bad_callback;
+   }
+
+   d = calloc(1, sizeof(decoder_t));
+
+   if (!d) return pigif_bad_malloc;
+
+   if (type->size)
+   {
+      d->state = calloc(1, type->size);
+
+      if (!d->state)
+      {
+         free(d);
+         return pigif_bad_malloc;
+      }
+   }
+
+   d->pi = pi;
+   d->type = type;
+   d->nparam = nparam;
+   d->watchdog = watchdog ? watchdog : type->watchdog;
+   d->f = f;
+   d->user = userdata;
+
+   for (i=0; i<ngpio; i++)
+   {
+      d->gpio[i] = gpio[i];
+      d->bits |= (1<<gpio[i]);
+   }
+
+   for (i=0; i<nparam; i++) d->param[i] = param[i];
+
+   if (type->init && type->init(d))
+   {
+      free(d->state);
+      free(d);
+      return pigif_bad_callback;
+   }
+
+   if (d->watchdog)
+   {
+      for (i=0; i<ngpio; i++) set_watchdog(pi, d->gpio[i], d->watchdog);
+   }
+
+   _cbl();
+
+   d->id = id++;
+   d->next = gDecoderFirst;
+   if (gDecoderFirst) gDecoderFirst->prev = d;
+   gDecoderFirst = d;
+
+   findDecoderBits(pi);
+
+   _cbu();
+
+   return d->id;
+}
+
+int decoder_read(unsigned decoder_id, uint32_t *data, unsigned count,
+   uint32_t *tick)
+{
+   decoder_t *d;
+   int n = pigif_callback_not_found;
+
+   _cbl();
+
+   for (d=gDecoderFirst; d; d=d->next)
+   {
+      if (d->id == decoder_id)
+      {
+         n = (d->nframe < count) ? d->nframe : count;
+         memcpy(data, d->frame, n * sizeof(uint32_t));
+         if (tick) *tick = d->frameTick;
+         break;
+      }
+   }
+
+   _cbu();
+
+   return n;
+}
+
+int decoder_cancel(unsigned decoder_id)
+{
+   decoder_t *d;
+   unsigned i;
+
+   _cbl();
+
+   for (d=gDecoderFirst; d; d=d->next)
+   {
+      if (d->id == decoder_id) break;
+   }
+
+   if (!d)
+   {
+      _cbu();
+      return pigif_callback_not_found;
+   }
+
+   if (d->prev) d->prev->next = d->next;
+   else         gDecoderFirst = d->next;
+
+   if (d->next) d->next->prev = d->prev;
+
+   findDecoderBits(d->pi);
+
+   _cbu();
+
+   if (d->watchdog)
+   {
+      for (i=0; i<d->type->ngpio; i++) set_watchdog(d->pi, d->gpio[i], 0);
+   }
+
+   free(d->state);
+   free(d);
+
+   return 0;
+}
+
+void *decoder_state(decoder_t *d)
+{
+   return d->state;
+}
+
+int decoder_param(decoder_t *d, unsigned index, int deflt)
+{
+   if (index < d->nparam) return d->param[index];
+
+   return deflt;
+}
+
+void decoder_emit(decoder_t *d, const uint32_t *data, unsigned count,
+   uint32_t tick)
+{
+   if (count > DECODER_MAX_DATA) count = DECODER_MAX_DATA;
+
+   memcpy(d->frame, data, count * sizeof(uint32_t));
+   d->nframe = count;
+   d->frameTick = tick;
+
+   if (d->f) (d->f)(d->pi, d->id, data, count, tick, d->user);
+}
+
+static void findReportHookBits(int pi)
+{
+   reportHook_t *h;
+   uint32_t bits = 0;
+   int n = 0;
+
+   for (h=gReportHookFirst; h; h=h->next)
+   {
+      if (h->pi == pi)
+      {
+         bits |= h->bits;
+         n++;
+      }
+   }
+
+   gReportHookBits[pi] = bits;
+   gReportHooks[pi] = n;
+
+   findNotifyBits(pi);
+}
+
+int report_hook(int pi, uint32_t bits, reportFunc_t f, void *userdata)
+{
+   static unsigned id = 0;
+   reportHook_t *h;
+
+   if ((pi < 0) || (pi >= MAX_PI) || !gPiInUse[pi])
+      return pigif_unconnected_pi;
+
+   if (!f) return pigif_bad_callback;
+
+   h = calloc(1, sizeof(reportHook_t));
+
+   if (!h) return pigif_bad_malloc;
+
+   h->pi = pi;
+   h->bits = bits;
+   h->f = f;
+   h->user = userdata;
+
+   _cbl();
+
+   h->id = id++;
+   h->next = gReportHookFirst;
+   if (gReportHookFirst) gReportHookFirst->prev = h;
+   gReportHookFirst = h;
+
+   findReportHookBits(pi);
+
+   _cbu();
+
+   return h->id;
+}
+
+int report_hook_cancel(unsigned hook_id)
+{
+   reportHook_t *h;
+
+   _cbl();
+
+   for (h=gReportHookFirst; h; h=h->next)
+   {
+      if (h->id == hook_id) break;
+   }
+
+   if (!h)
+   {
+      _cbu();
+      return pigif_callback_not_found;
+   }
+
+   if (h->prev) h->prev->next = h->next;
+   else         gReportHookFirst = h->next;
+
+   if (h->next) h->next->prev = h->prev;
+
+   findReportHookBits(h->pi);
+
+   _cbu();
+
+   free(h);
+
+   return 0;
+}
@@ -312,6 +312,30 @@ pigpio_error               Get a text description of an error code.
 time_sleep                 Sleeps for a float number of seconds
 time_time                  Float number of seconds since the epoch
 
+EXTENSIONS
+
+pigpio_pipeline            Send a list of commands without waiting for
+                           each reply
+
+report_hook                Receive the raw notification reports
+report_hook_cancel         Stop receiving the raw notification reports
+
+decoder_register           Register a pulse train decoder type
+decoder_start              Start decoding pulse trains on GPIO
+decoder_read               Read the last frame of a decoder
+decoder_cancel             Stop a decoder
+decoder_state              Private state of a decoder
+decoder_param              Parameter of a decoder
+decoder_emit               Deliver a frame from a decoder
+
+counter_start              Start counting edges on a GPIO
+counter_read               Read edge counts, periods and duty cycle
+counter_stop               Stop counting edges on a GPIO
+
+thread_sched               Set CPU affinity and priority of a thread
+notify_sched               Set CPU affinity and priority of the
+                           notification thread
+
 OVERVIEW*/
 
 #ifdef __cplusplus
@@ -334,6 +358,63 @@ typedef void (*evtCBFuncEx_t)
 
 typedef struct evtCallback_s evtCallback_t;
 
+typedef struct
+{
+   uint32_t cmd;    /* PI_CMD_* */
+   uint32_t p1;
+   uint32_t p2;
+   uint32_t p3;     /* length of ext in bytes */
+   void    *ext;    /* extension sent after the command, may be NULL */
+   int      rxext;  /* non zero if the reply is followed by res bytes */
+   void    *rxbuf;  /* receives at most rxlen bytes of reply data, NULL
+                       discards it */
+   unsigned rxlen;
+   int      res;    /* result of the command */
+} pipe_cmd_t;
+
+typedef struct
+{
+   uint32_t edges;      /* edges since counter start or reset */
+   uint32_t rising;
+   uint32_t falling;
+   uint32_t level;      /* current level */
+   uint32_t tick;       /* tick of the last edge */
+   uint32_t period;     /* last rising to rising edge distance in us */
+   uint32_t minPeriod;
+   uint32_t maxPeriod;
+   uint32_t periods;    /* number of periods in the window */
+   uint64_t periodSum;
+   uint64_t highTime;   /* time at level 1 in the window in us */
+   uint64_t lowTime;    /* time at level 0 in the window in us */
+   uint32_t window;     /* window length in us */
+} gpioCounter_t;
+
+typedef void (*reportFunc_t)
+   (int pi, const gpioReport_t *report, unsigned count, void *userdata);
+
+#define DECODER_MAX_GPIO   4
+#define DECODER_MAX_PARAM  8
+#define DECODER_MAX_DATA   8
+#define DECODER_MAX_TYPES 16
+
+typedef struct decoder_s decoder_t;
+
+typedef void (*decFuncEx_t)
+   (int pi, unsigned decoder_id, const uint32_t *data, unsigned count,
+    uint32_t tick, void *userdata);
+
+typedef struct
+{
+   const char *name;
+   unsigned    ngpio;     /* number of GPIOs used by the decoder */
+   unsigned    size;      /* size of the private state in bytes */
+   unsigned    watchdog;  /* default watchdog timeout in ms, 0 none */
+   int  (*init)   (decoder_t *d);
+   void (*edge)   (decoder_t *d, unsigned index, unsigned level,
+                   uint32_t tick);
+   void (*timeout)(decoder_t *d, unsigned index, uint32_t tick);
+} decoderType_t;
+
 /*F*/
 double time_time(void);
 /*D
@@ -398,6 +479,44 @@ No value is returned.
 The thread to be stopped should have been started with [*start_thread*].
 D*/
 
+/*F*/
+int thread_sched(pthread_t *pth, int cpu, int priority);
+/*D
+Sets the CPU affinity and scheduling policy of a thread.
+
+. .
+     pth: the thread.
+     cpu: the CPU the thread is bound to, -1 leaves the affinity
+          unchanged.
+priority: the SCHED_FIFO priority, 0 selects SCHED_OTHER.
+. .
+
+Returns 0 if OK, otherwise pigif_bad_sched.
+
+Priorities above the maximum of SCHED_FIFO are reduced to the maximum.
+Real-time priorities usually require root privileges or CAP_SYS_NICE.
+CPU affinity is only supported on Linux.
+D*/
+
+/*F*/
+int notify_sched(int pi, int cpu, int priority);
+/*D
+Sets the CPU affinity and scheduling policy of the thread which
+receives notifications and dispatches callbacks for a Pi.
+
+. .
+      pi: >=0 (as returned by [*pigpio_start*]).
+     cpu: the CPU the thread is bound to, -1 leaves the affinity
+          unchanged.
+priority: the SCHED_FIFO priority, 0 selects SCHED_OTHER.
+. .
+
+Returns 0 if OK, otherwise pigif_unconnected_pi, pigif_notify_failed
+or pigif_bad_sched.
+
+See [*thread_sched*].
+D*/
+
 /*F*/
 int pigpio_start(char *addrStr, char *portStr);
 /*D
@@ -3328,6 +3447,9 @@ user_gpio: 0-31.
 The function returns a callback id if OK, otherwise pigif_bad_malloc,
 pigif_duplicate_callback, or pigif_bad_callback.
 
+A callback is only rejected as duplicate if f and userdata are
+the same as for an existing callback on the GPIO and edge.
+
 The callback is called with the GPIO, edge, tick, and the userdata
 pointer, whenever the GPIO has the identified edge.
 
@@ -3358,6 +3480,9 @@ callback_id: >=0, as returned by a call to [*callback*] or [*callback_ex*].
 . .
 
 The function returns 0 if OK, otherwise pigif_callback_not_found.
+
+Once the function has returned the callback is neither running nor
+called again.
 D*/
 
 /*F*/
@@ -3576,6 +3701,9 @@ userdata: a pointer to arbitrary user data.
 The function returns a callback id if OK, otherwise pigif_bad_malloc,
 pigif_duplicate_callback, or pigif_bad_callback.
 
+An event callback is only rejected as duplicate if f and userdata
+are the same as for an existing callback on the event.
+
 The callback is called with the event id, the tick, and the userdata
 pointer whenever the event occurs.
 D*/
@@ -3591,6 +3719,9 @@ callback_id: >=0, as returned by a call to [*event_callback*] or
 . .
 
 The function returns 0 if OK, otherwise pigif_callback_not_found.
+
+Once the function has returned the callback is neither running nor
+called again.
 D*/
 
 /*F*/
@@ -3635,6 +3766,223 @@ Note that other than its id and its tick there is no data associated
 with an event.
 D*/
 
+/*F*/
+int pigpio_pipeline(int pi, pipe_cmd_t *cmds, unsigned count);
+/*D
+Sends a list of commands to the daemon keeping several of them in
+flight instead of waiting for each reply before sending the next.
+
+. .
+   pi: >=0 (as returned by [*pigpio_start*]).
+ cmds: an array of commands.
+count: the number of commands in cmds.
+. .
+
+Returns the number of commands executed if OK, otherwise
+pigif_unconnected_pi, pigif_bad_send or pigif_bad_recv.
+
+The result of each command is stored in its res member.  For
+commands with rxext set res holds the number of reply bytes copied
+to rxbuf, data beyond rxlen is discarded.  With rxbuf NULL all reply
+data is discarded and res holds the number of bytes replied, rxlen
+then only bounds the reply.  An rxlen of 0 marks a reply of unknown
+size, such a command is never in flight together with others.
+
+The commands are executed in order.  The command stream is locked
+for the duration of the call so other threads using the same pi
+will not interleave with the list.
+D*/
+
+/*F*/
+int report_hook(int pi, uint32_t bits, reportFunc_t f, void *userdata);
+/*D
+Passes each batch of notification reports read from the pigpio daemon
+to a function before the reports are dispatched to callbacks.
+
+. .
+      pi: >=0 (as returned by [*pigpio_start*]).
+    bits: the GPIO to be included in the notifications.
+       f: the function receiving the reports.
+userdata: a pointer to arbitrary user data.
+. .
+
+Returns a hook id if OK, otherwise pigif_unconnected_pi,
+pigif_bad_callback or pigif_bad_malloc.
+
+f is called in the notification thread with all reports of a read, it
+must neither block nor call back into the library.  The reports
+include the levels of all notified GPIO, keep alive, watchdog and
+event reports.
+D*/
+
+/*F*/
+int report_hook_cancel(unsigned hook_id);
+/*D
+Stops passing notification reports to a hook.
+
+. .
+hook_id: as returned by [*report_hook*].
+. .
+
+Returns 0 if OK, otherwise pigif_callback_not_found.
+D*/
+
+/*F*/
+int decoder_register(const decoderType_t *type);
+/*D
+Registers a decoder type for use with [*decoder_start*].
+
+. .
+type: the decoder type, must stay valid while registered.
+. .
+
+Returns 0 if OK, otherwise pigif_bad_callback.
+
+Decoders turn the edges of one or more GPIO into frames.  Their
+functions are called in the notification thread:
+
+init is called once by [*decoder_start*] with zeroed private state.
+It returns 0 if the parameters are acceptable.
+
+edge is called for each level change of the GPIO at index in the
+list of GPIO given to [*decoder_start*].
+
+timeout is called for watchdog reports of the GPIO at index.  The
+watchdog is set up by [*decoder_start*] if the watchdog member or
+the watchdog parameter is non zero.
+
+Decoders deliver frames with [*decoder_emit*].  The built-in types
+"quadrature", "wiegand", "nec" and "dht22" are always available.
+D*/
+
+/*F*/
+int decoder_start(int pi, const char *name, const unsigned *gpio,
+   unsigned ngpio, const int *param, unsigned nparam, unsigned watchdog,
+   decFuncEx_t f, void *userdata);
+/*D
+Starts a decoder on a list of GPIO.
+
+. .
+      pi: >=0 (as returned by [*pigpio_start*]).
+    name: the name of a registered decoder type.
+    gpio: the GPIO used by the decoder.
+   ngpio: the number of GPIO, must match the decoder type.
+   param: decoder specific parameters, may be NULL.
+  nparam: the number of parameters, 0-DECODER_MAX_PARAM.
+watchdog: the watchdog timeout in ms, 0 uses the default of the type.
+       f: the function called for each frame, may be NULL.
+userdata: a pointer to arbitrary user data.
+. .
+
+Returns a decoder id if OK, otherwise pigif_unconnected_pi,
+pigif_bad_callback or pigif_bad_malloc.
+
+f is called in the notification thread with the frame data.  Without
+f frames can be polled with [*decoder_read*].
+D*/
+
+/*F*/
+int decoder_read(unsigned decoder_id, uint32_t *data, unsigned count,
+   uint32_t *tick);
+/*D
+Reads the last frame of a decoder.
+
+. .
+decoder_id: as returned by [*decoder_start*].
+      data: receives up to count values of the frame.
+     count: the size of data.
+      tick: receives the tick of the frame, may be NULL.
+. .
+
+Returns the number of values in the frame, 0 if no frame has been
+decoded yet, otherwise pigif_callback_not_found.
+D*/
+
+/*F*/
+int decoder_cancel(unsigned decoder_id);
+/*D
+Stops a decoder.
+
+. .
+decoder_id: as returned by [*decoder_start*].
+. .
+
+Returns 0 if OK, otherwise pigif_callback_not_found.
+D*/
+
+/*F*/
+void *decoder_state(decoder_t *d);
+/*D
+Returns the private state of a decoder.
+D*/
+
+/*F*/
+int decoder_param(decoder_t *d, unsigned index, int deflt);
+/*D
+Returns parameter index of a decoder or deflt if the parameter has
+not been given.
+D*/
+
+/*F*/
+void decoder_emit(decoder_t *d, const uint32_t *data, unsigned count,
+   uint32_t tick);
+/*D
+Delivers a frame of up to DECODER_MAX_DATA values.  To be called by
+the edge and timeout functions of a decoder type.
+D*/
+
+/*F*/
+int counter_start(int pi, unsigned user_gpio);
+/*D
+Starts counting edges on a GPIO.
+
+. .
+       pi: >=0 (as returned by [*pigpio_start*]).
+user_gpio: 0-31.
+. .
+
+Returns 0 if OK, otherwise pigif_unconnected_pi or pigif_bad_callback.
+
+Edges are counted in the notification thread from the ticks of the
+reports, no callback is involved.  Starting an already running
+counter resets it.
+D*/
+
+/*F*/
+int counter_read(int pi, unsigned user_gpio, gpioCounter_t *counter,
+   int reset);
+/*D
+Reads the counter of a GPIO.
+
+. .
+       pi: >=0 (as returned by [*pigpio_start*]).
+user_gpio: 0-31.
+  counter: receives the counter.
+    reset: if non zero the counter is reset after reading.
+. .
+
+Returns 0 if OK, otherwise pigif_unconnected_pi, pigif_bad_callback
+or pigif_callback_not_found if the counter is not running.
+
+Periods are measured between rising edges.  The window covers the
+time from counter start or the last reset to the last edge.  The mean
+period is periodSum/periods, the duty cycle highTime/(highTime+lowTime).
+D*/
+
+/*F*/
+int counter_stop(int pi, unsigned user_gpio);
+/*D
+Stops counting edges on a GPIO.
+
+. .
+       pi: >=0 (as returned by [*pigpio_start*]).
+user_gpio: 0-31.
+. .
+
+Returns 0 if OK, otherwise pigif_unconnected_pi, pigif_bad_callback
+or pigif_callback_not_found.
+D*/
+
 /*PARAMS
 
 active :: 0-1000000
@@ -4225,6 +4573,7 @@ typedef enum
    pigif_callback_not_found = -2010,
    pigif_unconnected_pi     = -2011,
    pigif_too_many_pis       = -2012,
+   pigif_bad_sched          = -2013,
 } pigifError_t;
 
 /*DEF_E*/
@@ -0,0 +1,354 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ * Notification reader. Reports either come from the notification pipe
+ * /dev/pigpioN of a local daemon, read in large non-blocking chunks,
+ * or from the in-band notification socket of the session via a report
+ * hook. In both cases they are buffered in a ring until read by Lua; from
+ * the pipe only as many as are read.
+ */
+struct notifyreader {
+  int pi;
+  int pipefd;              /* notification pipe, -1 with report hook */
+  int hook;                /* report hook id, -1 if not hooked */
+  int sigfd[2];            /* readable while the ring holds reports (hook) */
+  uint32_t bits;
+  uint32_t level;
+  pthread_mutex_t mutex;
+  gpioReport_t *ring;
+  unsigned size;
+  unsigned head;
+  unsigned count;
+  unsigned long drops;
+  unsigned got;            /* bytes of a partial report */
+  char partial[sizeof(gpioReport_t)];
+};
+typedef struct notifyreader notifyreader_t;
+
+static void ring_put(notifyreader_t *nr, const gpioReport_t *r)
+{
+  if (nr->count == nr->size){
+    /* keep the newest reports */
+    nr->head = (nr->head + 1) % nr->size;
+    nr->count--;
+    nr->drops++;
+  }
+  nr->ring[(nr->head + nr->count) % nr->size] = *r;
+  nr->count++;
+}
+
+/*
+ * Report hook: keep the reports the pipe of the daemon would deliver for
+ * the monitored GPIO.
+ */
+static void notify_reports(int pi, const gpioReport_t *r, unsigned count, void *userdata)
+{
+  notifyreader_t *nr = userdata;
+  unsigned i, empty;
+  uint32_t changed;
+  char c = 0;
+
+  pthread_mutex_lock(&nr->mutex);
+  empty = (nr->count == 0);
+  for (i = 0; i < count; i++, r++){
+    if (r->flags == 0){
+      changed = (r->level ^ nr->level) & nr->bits;
+      nr->level = r->level;
+      if (changed == 0)
+        continue;
+    } else if (r->flags & PI_NTFY_FLAGS_WDOG){
+      if ((nr->bits & (1 << (r->flags & 31))) == 0)
+        continue;
+    } else if ((r->flags & PI_NTFY_FLAGS_EVENT) == 0)
+      continue;
+    ring_put(nr, r);
+  }
+  if (empty && nr->count > 0)
+    (void) write(nr->sigfd[1], &c, 1);
+  pthread_mutex_unlock(&nr->mutex);
+}
+
+/*
+ * Move reports available in the notification pipe into the ring until it
+ * holds want reports. Reports beyond stay in the pipe, which hence remains
+ * readable while reports are waiting. Returns -1 on read errors other
+ * than EAGAIN.
+ */
+static int fill_from_pipe(notifyreader_t *nr, unsigned want)
+{
+  char buf[NOTIFY_CHUNK * sizeof(gpioReport_t)];
+  ssize_t n;
+  size_t size;
+  unsigned i, len;
+
+  while (nr->count < want){
+    size = (want - nr->count < NOTIFY_CHUNK) ? want - nr->count : NOTIFY_CHUNK;
+    size = size * sizeof(gpioReport_t) - nr->got;
+    memcpy(buf, nr->partial, nr->got);
+    n = read(nr->pipefd, buf + nr->got, size);
+    if (n < 0){
+      if (errno == EINTR)
+        continue;
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    if (n == 0)
+      return 0;
+    len = nr->got + n;
+    for (i = 0; i + sizeof(gpioReport_t) <= len; i += sizeof(gpioReport_t))
+      ring_put(nr, (gpioReport_t *) (buf + i));
+    nr->got = len - i;
+    memcpy(nr->partial, buf + i, nr->got);
+    if ((size_t) n < size)
+      return 0;
+  }
+  return 0;
+}
+
+static void unhook(notifyreader_t *nr)
+{
+  if (nr->hook >= 0){
+    report_hook_cancel(nr->hook);
+    nr->hook = -1;
+  }
+}
+
+static void free_reader(notifyreader_t *nr)
+{
+  unhook(nr);
+  if (nr->pipefd >= 0)
+    close(nr->pipefd);
+  if (nr->sigfd[0] >= 0){
+    close(nr->sigfd[0]);
+    close(nr->sigfd[1]);
+  }
+  pthread_mutex_destroy(&nr->mutex);
+  free(nr->ring);
+  free(nr);
+}
+
+static int reader_gc(lua_State *L)
+{
+  notifyreader_t **np = luaL_checkudata(L, 1, NOTIFY_MT);
+  if (*np != NULL){
+    free_reader(*np);
+    *np = NULL;
+  }
+  return 0;
+}
+
+static notifyreader_t *check_reader(lua_State *L, int arg)
+{
+  notifyreader_t **np = luaL_checkudata(L, arg, NOTIFY_MT);
+  if (*np == NULL)
+    luaL_error(L, "Notification reader already closed.");
+  return *np;
+}
+
+/*
+ * Lua binding: reader = notify_reader_open(pi, handle[, capacity])
+ * With handle >= 0 the pipe /dev/pigpio<handle> of a local daemon is
+ * read, with handle < 0 the reports are taken from the notification
+ * socket of session pi.
+ */
+int utlNotifyReaderOpen(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  int handle = (int) luaL_checkinteger(L, 2);
+  int capacity = (int) luaL_optinteger(L, 3, NOTIFY_RING);
+  notifyreader_t *nr, **np;
+  char name[32];
+  int err;
+
+  if (capacity < 1)
+    luaL_error(L, "Ring capacity must be at least 1, received %d.", capacity);
+  np = lua_newuserdata(L, sizeof(notifyreader_t *));
+  *np = NULL;
+  if (luaL_newmetatable(L, NOTIFY_MT)){
+    lua_pushcfunction(L, reader_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  nr = calloc(1, sizeof(notifyreader_t));
+  if (nr == NULL || (nr->ring = malloc(capacity * sizeof(gpioReport_t))) == NULL){
+    free(nr);
+    luaL_error(L, "Cannot allocate notification reader.");
+  }
+  pthread_mutex_init(&nr->mutex, NULL);
+  nr->pi = pi;
+  nr->size = capacity;
+  nr->hook = -1;
+  nr->pipefd = -1;
+  nr->sigfd[0] = nr->sigfd[1] = -1;
+  if (handle >= 0){
+    snprintf(name, sizeof(name), "/dev/pigpio%d", handle);
+    nr->pipefd = open(name, O_RDONLY | O_NONBLOCK);
+    if (nr->pipefd < 0){
+      err = errno;
+      free_reader(nr);
+      lua_pushnil(L);
+      lua_pushfstring(L, "%s: %s", name, strerror(err));
+      return 2;
+    }
+  } else if (pipe(nr->sigfd) < 0){
+    err = errno;
+    nr->sigfd[0] = nr->sigfd[1] = -1;
+    free_reader(nr);
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(err));
+    return 2;
+  } else {
+    fcntl(nr->sigfd[0], F_SETFL, O_NONBLOCK);
+    fcntl(nr->sigfd[1], F_SETFL, O_NONBLOCK);
+  }
+  *np = nr;
+  return 1;
+}
+
+/*
+ * Lua binding: res = notify_reader_begin(reader, bits)
+ * Starts taking reports from the notification socket.
+ */
+int utlNotifyReaderBegin(lua_State *L)
+{
+  notifyreader_t *nr = check_reader(L, 1);
+  uint32_t bits = (uint32_t) luaL_checkinteger(L, 2);
+  int res;
+
+  if (nr->pipefd >= 0)
+    luaL_error(L, "Notification reader reads a pipe.");
+  unhook(nr);
+  pthread_mutex_lock(&nr->mutex);
+  nr->bits = bits;
+  pthread_mutex_unlock(&nr->mutex);
+  res = report_hook(nr->pi, bits, notify_reports, nr);
+  if (res >= 0){
+    nr->hook = res;
+    res = 0;
+  }
+  lua_pushinteger(L, res);
+  return 1;
+}
+
+/*
+ * Lua binding: res = notify_reader_pause(reader)
+ */
+int utlNotifyReaderPause(lua_State *L)
+{
+  notifyreader_t *nr = check_reader(L, 1);
+  unhook(nr);
+  lua_pushinteger(L, 0);
+  return 1;
+}
+
+/*
+ * Lua binding: ticks, levels, flags, seqnos = notify_reader_read(reader, max[, timeout])
+ * Waits at most timeout seconds (default: do not wait) for reports.
+ */
+int utlNotifyReaderRead(lua_State *L)
+{
+  notifyreader_t *nr = check_reader(L, 1);
+  lua_Integer max = luaL_checkinteger(L, 2);
+  double timeout = luaL_optnumber(L, 3, 0);
+  struct pollfd pfd;
+  gpioReport_t *r;
+  unsigned want;
+  int n, res;
+  char c;
+
+  if (max < 1)
+    luaL_error(L, "Positive number of samples expected, received %d.", (int) max);
+  pfd.fd = (nr->pipefd >= 0) ? nr->pipefd : nr->sigfd[0];
+  pfd.events = POLLIN;
+  /* take no more reports from the pipe than are returned */
+  want = (max < nr->size) ? (unsigned) max : nr->size;
+  pthread_mutex_lock(&nr->mutex);
+  if (nr->pipefd >= 0)
+    res = fill_from_pipe(nr, want);
+  else
+    res = 0;
+  if (res == 0 && nr->count == 0 && timeout != 0){
+    pthread_mutex_unlock(&nr->mutex);
+    poll(&pfd, 1, (timeout < 0) ? -1 : (int) (timeout * 1000));
+    pthread_mutex_lock(&nr->mutex);
+    if (nr->pipefd >= 0)
+      res = fill_from_pipe(nr, want);
+  }
+  if (res < 0){
+    res = errno;
+    pthread_mutex_unlock(&nr->mutex);
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(res));
+    return 2;
+  }
+  n = (max < nr->count) ? (int) max : (int) nr->count;
+  lua_createtable(L, n, 0);
+  lua_createtable(L, n, 0);
+  lua_createtable(L, n, 0);
+  lua_createtable(L, n, 0);
+  for (res = 1; res <= n; res++){
+    r = &nr->ring[nr->head];
+    nr->head = (nr->head + 1) % nr->size;
+    nr->count--;
+    lua_pushinteger(L, r->tick);
+    lua_rawseti(L, -5, res);
+    lua_pushinteger(L, r->level);
+    lua_rawseti(L, -4, res);
+    lua_pushinteger(L, r->flags);
+    lua_rawseti(L, -3, res);
+    lua_pushinteger(L, r->seqno);
+    lua_rawseti(L, -2, res);
+  }
+  if (nr->pipefd < 0 && nr->count == 0)
+    while (read(nr->sigfd[0], &c, 1) == 1)
+      ;
+  pthread_mutex_unlock(&nr->mutex);
+  return 4;
+}
+
+/*
+ * Lua binding: fd = notify_reader_fd(reader)
+ * Readable while reports are waiting: the ring holds reports (hook), or
+ * the pipe does, since reads take no more reports from it than they
+ * return.
+ */
+int utlNotifyReaderFd(lua_State *L)
+{
+  notifyreader_t *nr = check_reader(L, 1);
+  lua_pushinteger(L, (nr->pipefd >= 0) ? nr->pipefd : nr->sigfd[0]);
+  return 1;
+}
+
+/*
+ * Lua binding: count, capacity, drops = notify_reader_info(reader)
+ */
+int utlNotifyReaderInfo(lua_State *L)
+{
+  notifyreader_t *nr = check_reader(L, 1);
+  pthread_mutex_lock(&nr->mutex);
+  lua_pushinteger(L, nr->count);
+  lua_pushinteger(L, nr->size);
+  lua_pushinteger(L, nr->drops);
+  pthread_mutex_unlock(&nr->mutex);
+  return 3;
+}
+
+/*
+ * Lua binding: notify_reader_close(reader)
+ */
+int utlNotifyReaderClose(lua_State *L)
+{
+  return reader_gc(L);
+}
@@ -0,0 +1,192 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Session and device objects. An object is a userdata holding the pi
+ * handle and the device handle natively, which is where C methods and
+ * callbacks take them from. All other fields live in the uservalue table
+ * of the object. The methods of an object are those of its class table:
+ * each class gets a metatable of its own, whose __index looks up the
+ * class first, then the handles, then the fields.
+ * Open sessions are anchored by a reference held in the object itself,
+ * which is released when the session is closed.
+ */
+static char objectkey;   /* marks object metatables */
+static char classkey;    /* registry: class table -> metatable */
+
+/*
+ * Check for an object; NULL if arg is no object.
+ */
+object_t *test_object(lua_State *L, int arg)
+{
+  object_t *o = lua_touserdata(L, arg);
+  int isobj;
+
+  if (o == NULL || !lua_getmetatable(L, arg))
+    return NULL;
+  isobj = (lua_rawgetp(L, -1, &objectkey) != LUA_TNIL);
+  lua_pop(L, 2);
+  return isobj ? o : NULL;
+}
+
+/*
+ * Check for an open object.
+ */
+object_t *check_object(lua_State *L, int arg)
+{
+  object_t *o = test_object(L, arg);
+  if (o == NULL)
+    luaL_argerror(L, arg, "session or device expected");
+  if (o->handle < 0)
+    luaL_error(L, "Object already closed.");
+  return o;
+}
+
+/*
+ * Pi handle of a session object or a plain pi handle at arg.
+ */
+int object_pi(lua_State *L, int arg)
+{
+  object_t *o;
+  if (lua_isinteger(L, arg))
+    return (int) lua_tointeger(L, arg);
+  o = check_object(L, arg);
+  return o->pi;
+}
+
+static int object_index(lua_State *L)
+{
+  object_t *o = lua_touserdata(L, 1);
+  const char *key;
+
+  lua_pushvalue(L, 2);
+  if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TNIL)
+    return 1;
+  if ((key = lua_tostring(L, 2)) != NULL){
+    if (strcmp(key, "handle") == 0){
+      if (o->handle < 0)
+        lua_pushnil(L);
+      else
+        lua_pushinteger(L, o->handle);
+      return 1;
+    }
+    if (strcmp(key, "pihandle") == 0){
+      lua_pushinteger(L, o->pi);
+      return 1;
+    }
+  }
+  lua_getuservalue(L, 1);
+  lua_pushvalue(L, 2);
+  lua_rawget(L, -2);
+  return 1;
+}
+
+static int object_newindex(lua_State *L)
+{
+  object_t *o = lua_touserdata(L, 1);
+  const char *key = lua_tostring(L, 2);
+
+  if (key != NULL && strcmp(key, "handle") == 0){
+    if (lua_isnil(L, 3)){
+      /* closed: drop the anchor */
+      o->handle = -1;
+      luaL_unref(L, LUA_REGISTRYINDEX, o->ref);
+      o->ref = LUA_NOREF;
+    } else
+      o->handle = (int) luaL_checkinteger(L, 3);
+    return 0;
+  }
+  if (key != NULL && strcmp(key, "pihandle") == 0){
+    o->pi = (int) luaL_checkinteger(L, 3);
+    return 0;
+  }
+  lua_getuservalue(L, 1);
+  lua_insert(L, 2);
+  lua_rawset(L, 2);
+  return 0;
+}
+
+/*
+ * Close objects which are still open when collected.
+ */
+static int object_gc(lua_State *L)
+{
+  object_t *o = lua_touserdata(L, 1);
+
+  if (o->handle < 0)
+    return 0;
+  lua_getfield(L, lua_upvalueindex(1), "close");
+  if (lua_isfunction(L, -1)){
+    lua_pushvalue(L, 1);
+    lua_pcall(L, 1, 0, 0);
+  }
+  return 0;
+}
+
+/*
+ * Push the metatable for objects of the class at arg.
+ */
+static void push_class(lua_State *L, int arg)
+{
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &classkey) == LUA_TNIL){
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &classkey);
+  }
+  lua_pushvalue(L, arg);
+  if (lua_rawget(L, -2) != LUA_TNIL){
+    lua_remove(L, -2);
+    return;
+  }
+  lua_pop(L, 1);
+  lua_createtable(L, 0, 4);
+  lua_pushboolean(L, TRUE);
+  lua_rawsetp(L, -2, &objectkey);
+  lua_pushvalue(L, arg);
+  lua_pushcclosure(L, object_index, 1);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, object_newindex);
+  lua_setfield(L, -2, "__newindex");
+  lua_pushvalue(L, arg);
+  lua_pushcclosure(L, object_gc, 1);
+  lua_setfield(L, -2, "__gc");
+  lua_pushvalue(L, arg);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -4);
+  lua_remove(L, -2);
+}
+
+/*
+ * Lua binding: obj = object_new(class, pi, handle[, anchor])
+ * An anchored object is kept alive until its handle is set to nil.
+ */
+int utlObjectNew(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 2);
+  int handle = (int) luaL_checkinteger(L, 3);
+  int anchor = lua_toboolean(L, 4);
+  object_t *o;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  o = lua_newuserdata(L, sizeof(object_t));
+  o->pi = pi;
+  o->handle = handle;
+  o->ref = LUA_NOREF;
+  lua_newtable(L);
+  lua_setuservalue(L, -2);
+  push_class(L, 1);
+  lua_setmetatable(L, -2);
+  if (anchor){
+    lua_pushvalue(L, -1);
+    o->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  return 1;
+}
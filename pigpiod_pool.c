@@ -0,0 +1,478 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+enum jobstate {
+  JOB_QUEUED = 0,
+  JOB_RUNNING = 1,
+  JOB_DONE = 2
+};
+
+/*
+ * A job is shared between the Lua job object and the pool. It is freed
+ * when both have released it.
+ */
+struct job {
+  struct job *next;
+  char *code;
+  size_t codelen;
+  tvalue_t *args;
+  int nargs;
+  tvalue_t *results;
+  int nresults;
+  char *errmsg;
+  int state;
+  int refs;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+typedef struct job job_t;
+
+struct pool;
+
+struct worker {
+  struct pool *pool;
+  lua_State *L;
+  pthread_t *t;
+  int ncached;
+  unsigned long njobs;
+};
+typedef struct worker worker_t;
+
+struct pool {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  job_t *first;
+  job_t *last;
+  int njobs;
+  int closing;
+  int nworkers;
+  worker_t *workers;
+};
+typedef struct pool pool_t;
+
+/* Registry key of the compiled chunk cache in each worker state */
+static int cachekey;
+
+static void release_job(job_t *job)
+{
+  int i, refs;
+  pthread_mutex_lock(&job->mutex);
+  refs = --job->refs;
+  pthread_mutex_unlock(&job->mutex);
+  if (refs > 0)
+    return;
+  for (i = 0; i < job->nargs; i++)
+    tvalue_free(&job->args[i]);
+  for (i = 0; i < job->nresults; i++)
+    tvalue_free(&job->results[i]);
+  free(job->args);
+  free(job->results);
+  free(job->code);
+  free(job->errmsg);
+  pthread_mutex_destroy(&job->mutex);
+  pthread_cond_destroy(&job->cond);
+  free(job);
+}
+
+static void finish_job(job_t *job, const char *errmsg)
+{
+  pthread_mutex_lock(&job->mutex);
+  if (errmsg != NULL)
+    job->errmsg = strdup(errmsg);
+  job->state = JOB_DONE;
+  pthread_cond_broadcast(&job->cond);
+  pthread_mutex_unlock(&job->mutex);
+  release_job(job);
+}
+
+/*
+ * Execute a job in the worker's state. Compiled chunks are cached by
+ * their code string.
+ */
+static void run_job(worker_t *w, job_t *job)
+{
+  lua_State *L = w->L;
+  int i, n;
+  char msg[64];
+
+  lua_settop(L, 0);
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &cachekey);      /* cache */
+  lua_pushlstring(L, job->code, job->codelen);        /* code, cache */
+  lua_rawget(L, 1);                                   /* func, cache */
+  if (lua_isnil(L, -1)){
+    lua_pop(L, 1);
+    if (luaL_loadbuffer(L, job->code, job->codelen, "=job") != LUA_OK){
+      finish_job(job, lua_tostring(L, -1));
+      return;
+    }
+    if (w->ncached >= POOL_CACHE_MAX){
+      /* cache full: start over */
+      lua_newtable(L);
+      lua_replace(L, 1);
+      lua_pushvalue(L, 1);
+      lua_rawsetp(L, LUA_REGISTRYINDEX, &cachekey);
+      w->ncached = 0;
+    }
+    lua_pushlstring(L, job->code, job->codelen);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, 1);
+    w->ncached++;
+  }
+  for (i = 0; i < job->nargs; i++)
+    tvalue_push(L, &job->args[i]);
+  if (lua_pcall(L, job->nargs, LUA_MULTRET, 0) != LUA_OK){
+    finish_job(job, lua_isstring(L, -1) ? lua_tostring(L, -1) :
+               "error object is not a string");
+    lua_settop(L, 0);
+    return;
+  }
+  n = lua_gettop(L) - 1;
+  if (n > 0){
+    job->results = calloc(n, sizeof(tvalue_t));
+    if (job->results == NULL){
+      lua_settop(L, 0);
+      finish_job(job, "cannot allocate job results");
+      return;
+    }
+    for (i = 0; i < n; i++){
+      if (tvalue_get(L, i + 2, &job->results[i]) < 0){
+        snprintf(msg, sizeof(msg), "unsupported result type '%s'",
+                 luaL_typename(L, i + 2));
+        job->nresults = i;
+        lua_settop(L, 0);
+        finish_job(job, msg);
+        return;
+      }
+    }
+    job->nresults = n;
+  }
+  lua_settop(L, 0);
+  finish_job(job, NULL);
+}
+
+static void *poolWorker(void *uparam)
+{
+  worker_t *w = uparam;
+  pool_t *pool = w->pool;
+  job_t *job;
+
+  while (1){
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->first == NULL && !pool->closing)
+      pthread_cond_wait(&pool->cond, &pool->mutex);
+    if (pool->closing){
+      pthread_mutex_unlock(&pool->mutex);
+      break;
+    }
+    job = pool->first;
+    pool->first = job->next;
+    if (pool->first == NULL)
+      pool->last = NULL;
+    pool->njobs--;
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_lock(&job->mutex);
+    job->state = JOB_RUNNING;
+    pthread_mutex_unlock(&job->mutex);
+    run_job(w, job);
+    w->njobs++;
+  }
+  return NULL;
+}
+
+static pool_t **check_pool(lua_State *L, int arg)
+{
+  pool_t **pp = luaL_checkudata(L, arg, POOL_MT);
+  if (*pp == NULL)
+    luaL_error(L, "Thread pool is closed.");
+  return pp;
+}
+
+static job_t *check_job(lua_State *L, int arg)
+{
+  return *((job_t **) luaL_checkudata(L, arg, JOB_MT));
+}
+
+/*
+ * Stop all workers. Queued jobs fail, running jobs are completed.
+ */
+static void close_pool(pool_t *pool)
+{
+  int i;
+  job_t *job;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->closing = TRUE;
+  job = pool->first;
+  pool->first = pool->last = NULL;
+  pool->njobs = 0;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+  while (job != NULL){
+    job_t *next = job->next;
+    finish_job(job, "thread pool closed");
+    job = next;
+  }
+  for (i = 0; i < pool->nworkers; i++){
+    if (pool->workers[i].t != NULL){
+      pthread_join(*pool->workers[i].t, NULL);
+      free(pool->workers[i].t);
+    }
+    lua_close(pool->workers[i].L);
+  }
+  free(pool->workers);
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->cond);
+  free(pool);
+}
+
+static int pool_gc(lua_State *L)
+{
+  pool_t **pp = luaL_checkudata(L, 1, POOL_MT);
+  if (*pp != NULL){
+    close_pool(*pp);
+    *pp = NULL;
+  }
+  return 0;
+}
+
+static int job_gc(lua_State *L)
+{
+  job_t **jp = luaL_checkudata(L, 1, JOB_MT);
+  if (*jp != NULL){
+    release_job(*jp);
+    *jp = NULL;
+  }
+  return 0;
+}
+
+/*
+ * Create a worker state with the given modules preloaded.
+ * On failure the error message is left on the stack of L.
+ */
+static lua_State *new_worker_state(lua_State *L, int modules)
+{
+  int i, n;
+  lua_State *newL = luaL_newstate();
+
+  if (newL == NULL){
+    lua_pushstring(L, "cannot create Lua state");
+    return NULL;
+  }
+  luaL_openlibs(newL);
+  lua_newtable(newL);
+  lua_rawsetp(newL, LUA_REGISTRYINDEX, &cachekey);
+  n = lua_istable(L, modules) ? luaL_len(L, modules) : 0;
+  for (i = 1; i <= n; i++){
+    lua_rawgeti(L, modules, i);
+    lua_getglobal(newL, "require");
+    lua_pushstring(newL, lua_tostring(L, -1));
+    lua_pop(L, 1);
+    if (lua_pcall(newL, 1, 0, 0) != LUA_OK){
+      lua_pushstring(L, lua_tostring(newL, -1));
+      lua_close(newL);
+      return NULL;
+    }
+  }
+  return newL;
+}
+
+/*
+ * Lua binding: pool = pool_create(nworkers, modules)
+ */
+int utlPoolCreate(lua_State *L)
+{
+  int i, nworkers;
+  pool_t *pool, **pp;
+
+  nworkers = (int) luaL_checkinteger(L, 1);
+  if (nworkers < 1 || nworkers > POOL_MAX_WORKERS)
+    luaL_error(L, "Number of workers must be in range of 1 to %d.", POOL_MAX_WORKERS);
+  pp = lua_newuserdata(L, sizeof(pool_t *));
+  *pp = NULL;
+  if (luaL_newmetatable(L, POOL_MT)){
+    lua_pushcfunction(L, pool_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  pool = calloc(1, sizeof(pool_t));
+  if (pool == NULL || (pool->workers = calloc(nworkers, sizeof(worker_t))) == NULL){
+    free(pool);
+    luaL_error(L, "Cannot allocate thread pool.");
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  /* states are prepared here, so that errors can be reported */
+  for (i = 0; i < nworkers; i++){
+    pool->workers[i].pool = pool;
+    pool->workers[i].L = new_worker_state(L, 2);
+    if (pool->workers[i].L == NULL){
+      pool->nworkers = i;
+      close_pool(pool);
+      lua_pushnil(L);
+      lua_insert(L, -2);
+      return 2;
+    }
+    pool->nworkers = i + 1;
+  }
+  for (i = 0; i < nworkers; i++){
+    pool->workers[i].t = start_thread(poolWorker, &pool->workers[i]);
+    if (pool->workers[i].t == NULL){
+      close_pool(pool);
+      lua_pushnil(L);
+      lua_pushstring(L, "cannot start worker thread");
+      return 2;
+    }
+  }
+  *pp = pool;
+  return 1;
+}
+
+/*
+ * Lua binding: job = pool_submit(pool, code, ...)
+ */
+int utlPoolSubmit(lua_State *L)
+{
+  pool_t *pool = *check_pool(L, 1);
+  size_t len;
+  const char *code = luaL_checklstring(L, 2, &len);
+  int i, nargs = lua_gettop(L) - 2;
+  job_t *job, **jp;
+
+  jp = lua_newuserdata(L, sizeof(job_t *));
+  *jp = NULL;
+  if (luaL_newmetatable(L, JOB_MT)){
+    lua_pushcfunction(L, job_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  job = calloc(1, sizeof(job_t));
+  if (job == NULL || (job->code = malloc(len > 0 ? len : 1)) == NULL ||
+      (nargs > 0 && (job->args = calloc(nargs, sizeof(tvalue_t))) == NULL)){
+    if (job != NULL)
+      free(job->code);
+    free(job);
+    luaL_error(L, "Cannot allocate job.");
+  }
+  memcpy(job->code, code, len);
+  job->codelen = len;
+  pthread_mutex_init(&job->mutex, NULL);
+  pthread_cond_init(&job->cond, NULL);
+  /* one reference for the Lua object, one for the pool */
+  job->refs = 2;
+  *jp = job;
+  if (nargs > 0){
+    for (i = 0; i < nargs; i++){
+      if (tvalue_get(L, i + 3, &job->args[i]) < 0){
+        job->nargs = i;
+        job->refs = 1;
+        luaL_error(L, "Invalid parameter type '%s'.", luaL_typename(L, i + 3));
+      }
+    }
+    job->nargs = nargs;
+  }
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->last == NULL)
+    pool->first = job;
+  else
+    pool->last->next = job;
+  pool->last = job;
+  pool->njobs++;
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+  return 1;
+}
+
+/*
+ * Lua binding: true, ... = pool_wait(job, timeout)
+ * Returns nil + errormsg if the job failed or the timeout expired.
+ */
+int utlPoolWait(lua_State *L)
+{
+  job_t *job = check_job(L, 1);
+  double timeout = luaL_optnumber(L, 2, -1);
+  struct timespec due;
+  int i;
+
+  if (job == NULL)
+    luaL_error(L, "Job already released.");
+  if (timeout >= 0)
+    get_deadline(timeout, &due);
+  pthread_mutex_lock(&job->mutex);
+  while (job->state != JOB_DONE){
+    if (timeout < 0)
+      pthread_cond_wait(&job->cond, &job->mutex);
+    else if (pthread_cond_timedwait(&job->cond, &job->mutex, &due) == ETIMEDOUT)
+      break;
+  }
+  if (job->state != JOB_DONE){
+    pthread_mutex_unlock(&job->mutex);
+    lua_pushnil(L);
+    lua_pushstring(L, "timeout");
+    return 2;
+  }
+  pthread_mutex_unlock(&job->mutex);
+  if (job->errmsg != NULL){
+    lua_pushnil(L);
+    lua_pushstring(L, job->errmsg);
+    return 2;
+  }
+  luaL_checkstack(L, job->nresults + 1, "too many results");
+  lua_pushboolean(L, TRUE);
+  for (i = 0; i < job->nresults; i++)
+    tvalue_push(L, &job->results[i]);
+  return job->nresults + 1;
+}
+
+/*
+ * Lua binding: state = pool_job_state(job)
+ */
+int utlPoolJobState(lua_State *L)
+{
+  static const char *names[] = {"queued", "running", "done"};
+  job_t *job = check_job(L, 1);
+  int state;
+
+  if (job == NULL)
+    luaL_error(L, "Job already released.");
+  pthread_mutex_lock(&job->mutex);
+  state = job->state;
+  pthread_mutex_unlock(&job->mutex);
+  lua_pushstring(L, names[state]);
+  return 1;
+}
+
+/*
+ * Lua binding: queued, nworkers = pool_info(pool)
+ */
+int utlPoolInfo(lua_State *L)
+{
+  pool_t *pool = *check_pool(L, 1);
+  int n;
+  pthread_mutex_lock(&pool->mutex);
+  n = pool->njobs;
+  pthread_mutex_unlock(&pool->mutex);
+  lua_pushinteger(L, n);
+  lua_pushinteger(L, pool->nworkers);
+  return 2;
+}
+
+/*
+ * Lua binding: succ = pool_close(pool)
+ */
+int utlPoolClose(lua_State *L)
+{
+  pool_t **pp = check_pool(L, 1);
+  close_pool(*pp);
+  *pp = NULL;
+  lua_pushnumber(L, TRUE);
+  return 1;
+}
@@ -0,0 +1,325 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include "command.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+/*
+ * Compiled command list as produced by replay_compile().
+ * Extension data of all instructions is kept in a single pool.
+ */
+struct replayinstr {
+  uint32_t cmd;
+  uint32_t p1;
+  uint32_t p2;
+  uint32_t p3;
+  uint32_t ext;     /* offset into pool */
+  uint32_t tick;    /* recorded tick, valid if timed */
+  uint8_t rxext;
+  uint8_t timed;
+};
+typedef struct replayinstr replayinstr_t;
+
+struct replay {
+  replayinstr_t *instr;
+  unsigned ninstr;
+  unsigned maxinstr;
+  char *pool;
+  size_t poolsize;
+  size_t poolmax;
+};
+typedef struct replay replay_t;
+
+static replay_t *check_replay(lua_State *L, int arg)
+{
+  return luaL_checkudata(L, arg, REPLAY_MT);
+}
+
+static void free_replay(replay_t *rp)
+{
+  free(rp->instr);
+  free(rp->pool);
+  rp->instr = NULL;
+  rp->pool = NULL;
+  rp->ninstr = rp->maxinstr = 0;
+  rp->poolsize = rp->poolmax = 0;
+}
+
+static int replay_gc(lua_State *L)
+{
+  free_replay(check_replay(L, 1));
+  return 0;
+}
+
+static int replay_len(lua_State *L)
+{
+  lua_pushinteger(L, check_replay(L, 1)->ninstr);
+  return 1;
+}
+
+/*
+ * Append one instruction. Returns 0 on success, -1 if out of memory.
+ */
+static int add_instr(replay_t *rp, uint32_t *p, char *ext, int rxext,
+                     int timed, uint32_t tick)
+{
+  replayinstr_t *ip;
+  if (rp->ninstr == rp->maxinstr){
+    unsigned n = rp->maxinstr ? 2 * rp->maxinstr : 1024;
+    ip = realloc(rp->instr, n * sizeof(replayinstr_t));
+    if (ip == NULL)
+      return -1;
+    rp->instr = ip;
+    rp->maxinstr = n;
+  }
+  if (rp->poolsize + p[3] > rp->poolmax){
+    size_t n = rp->poolmax ? 2 * rp->poolmax : 4096;
+    char *pool;
+    while (n < rp->poolsize + p[3])
+      n *= 2;
+    pool = realloc(rp->pool, n);
+    if (pool == NULL)
+      return -1;
+    rp->pool = pool;
+    rp->poolmax = n;
+  }
+  ip = &rp->instr[rp->ninstr++];
+  ip->cmd = p[0];
+  ip->p1 = p[1];
+  ip->p2 = p[2];
+  ip->p3 = p[3];
+  ip->ext = rp->poolsize;
+  ip->tick = tick;
+  ip->rxext = rxext;
+  ip->timed = timed;
+  memcpy(rp->pool + rp->poolsize, ext, p[3]);
+  rp->poolsize += p[3];
+  return 0;
+}
+
+/*
+ * Parse all commands in text into rp.
+ * Returns 0 on success, otherwise the failing line number and an
+ * error message in msg.
+ */
+static int compile(replay_t *rp, char *text, char *ext, char *msg, size_t msglen)
+{
+  char *line, *next, *s;
+  int lineno = 0, idx, timed;
+  uint32_t p[CMD_P_ARR], tick;
+  cmdCtlParse_t ctl;
+
+  for (line = text; line != NULL; line = next){
+    lineno++;
+    next = strchr(line, '\n');
+    if (next != NULL)
+      *next++ = '\0';
+    for (s = line; isspace((unsigned char) *s); s++);
+    if (*s == '\0' || *s == '#')
+      continue;
+    /* optional leading tick as recorded */
+    timed = FALSE;
+    tick = 0;
+    if (isdigit((unsigned char) *s)){
+      tick = strtoul(s, &s, 10);
+      timed = TRUE;
+    }
+    ctl.eaten = 0;
+    while (1){
+      /* cmdParse expects at least one more word in s */
+      while (isspace((unsigned char) s[ctl.eaten]))
+        ctl.eaten++;
+      if (s[ctl.eaten] == '\0')
+        break;
+      idx = cmdParse(s, p, CMD_MAX_EXTENSION, ext, &ctl);
+      if (idx == CMD_UNKNOWN_CMD){
+        snprintf(msg, msglen, "line %d: unknown command '%s'", lineno, cmdStr());
+        return lineno;
+      }
+      if (idx < 0){
+        snprintf(msg, msglen, "line %d: bad parameter for '%s'", lineno, cmdStr());
+        return lineno;
+      }
+      if (p[0] == PI_CMD_HELP || p[0] == PI_CMD_NOIB){
+        snprintf(msg, msglen, "line %d: command '%s' cannot be replayed",
+                 lineno, cmdInfo[idx].name);
+        return lineno;
+      }
+      if (add_instr(rp, p, ext, cmdInfo[idx].rv >= 6, timed, tick) < 0){
+        snprintf(msg, msglen, "line %d: out of memory", lineno);
+        return lineno;
+      }
+      /* only the first command of a line carries the tick */
+      timed = FALSE;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Lua binding: prog = replay_compile(text)
+ */
+int utlReplayCompile(lua_State *L)
+{
+  size_t len;
+  const char *text = luaL_checklstring(L, 1, &len);
+  char *buf, *ext;
+  char msg[128];
+  replay_t *rp;
+
+  rp = lua_newuserdata(L, sizeof(replay_t));
+  memset(rp, 0, sizeof(replay_t));
+  if (luaL_newmetatable(L, REPLAY_MT)){
+    lua_pushcfunction(L, replay_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, replay_len);
+    lua_setfield(L, -2, "__len");
+  }
+  lua_setmetatable(L, -2);
+  /* cmdParse works on a private copy of the text */
+  buf = malloc(len + 1);
+  ext = malloc(CMD_MAX_EXTENSION);
+  if (buf == NULL || ext == NULL){
+    free(buf);
+    free(ext);
+    luaL_error(L, "Cannot allocate replay buffers.");
+  }
+  memcpy(buf, text, len);
+  buf[len] = '\0';
+  if (compile(rp, buf, ext, msg, sizeof(msg)) != 0){
+    free(buf);
+    free(ext);
+    free_replay(rp);
+    lua_pushnil(L);
+    lua_pushstring(L, msg);
+    return 2;
+  }
+  free(buf);
+  free(ext);
+  return 1;
+}
+
+static double monotonic(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Upper bound of the reply data of an instruction, 0 if unknown. Replies
+ * of known size are pipelined together with other commands.
+ */
+static unsigned reply_bound(const replayinstr_t *ip)
+{
+  switch (ip->cmd){
+  case PI_CMD_I2CRD:
+  case PI_CMD_SPIR:
+  case PI_CMD_SERR:
+  case PI_CMD_SLR:
+  case PI_CMD_FR:
+    return ip->p2;
+  case PI_CMD_SPIX:
+  case PI_CMD_BSPIX:
+    return ip->p3;
+  case PI_CMD_I2CRI:
+  case PI_CMD_I2CRK:
+  case PI_CMD_I2CPK:
+    return 32;
+  case PI_CMD_PROCP:
+    return 4 * (PI_MAX_SCRIPT_PARAMS + 1);
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Lua binding: ncmd, nerr[, results] = replay_run(pi, prog, timed, speed, results)
+ * Untimed lists are sent in chunks through pigpio_pipeline(). With timed
+ * replay every instruction carrying a tick is delayed until its recorded
+ * offset from the first tick, scaled by speed, has elapsed.
+ * Reply data is dropped, the result of such a command is the number of
+ * bytes the daemon replied.
+ */
+int utlReplayRun(lua_State *L)
+{
+  int pi, timed, wantres, res;
+  double speed, t0 = 0, due;
+  uint64_t elapsed = 0;
+  uint32_t lasttick = 0;
+  unsigned i, n, start, nerr = 0, done = 0, first = TRUE;
+  pipe_cmd_t *chunk;
+  replay_t *rp;
+
+  pi = (int) luaL_checkinteger(L, 1);
+  rp = check_replay(L, 2);
+  timed = lua_toboolean(L, 3);
+  speed = luaL_optnumber(L, 4, 1.0);
+  wantres = lua_toboolean(L, 5);
+  if (speed <= 0)
+    luaL_error(L, "Replay speed must be positive, received %f.", speed);
+  if (wantres)
+    lua_createtable(L, rp->ninstr, 0);          /* results */
+  chunk = malloc(REPLAY_CHUNK * sizeof(pipe_cmd_t));
+  if (chunk == NULL)
+    luaL_error(L, "Cannot allocate replay chunk.");
+  for (start = 0; start < rp->ninstr; start += n){
+    /* a chunk ends in front of the next timed instruction */
+    for (n = 0; n < REPLAY_CHUNK && start + n < rp->ninstr; n++){
+      replayinstr_t *ip = &rp->instr[start + n];
+      if (n > 0 && timed && ip->timed)
+        break;
+      chunk[n].cmd = ip->cmd;
+      chunk[n].p1 = ip->p1;
+      chunk[n].p2 = ip->p2;
+      chunk[n].p3 = ip->p3;
+      chunk[n].ext = rp->pool + ip->ext;
+      chunk[n].rxext = ip->rxext;
+      chunk[n].rxbuf = NULL;
+      chunk[n].rxlen = ip->rxext ? reply_bound(ip) : 0;
+    }
+    if (timed && rp->instr[start].timed){
+      if (first){
+        t0 = monotonic();
+        first = FALSE;
+      } else {
+        elapsed += (uint32_t)(rp->instr[start].tick - lasttick);
+      }
+      lasttick = rp->instr[start].tick;
+      due = t0 + elapsed / (1e6 * speed);
+      if (due > monotonic())
+        time_sleep(due - monotonic());
+    }
+    res = pigpio_pipeline(pi, chunk, n);
+    if (res < 0){
+      free(chunk);
+      lua_pushnil(L);
+      lua_pushnumber(L, res);
+      return 2;
+    }
+    for (i = 0; i < n; i++){
+      if (chunk[i].res < 0)
+        nerr++;
+      if (wantres){
+        lua_pushinteger(L, chunk[i].res);
+        lua_rawseti(L, -2, done + i + 1);
+      }
+    }
+    done += n;
+  }
+  free(chunk);
+  lua_pushinteger(L, done);
+  lua_pushinteger(L, nerr);
+  if (wantres){
+    lua_pushvalue(L, -3);
+    return 3;
+  }
+  return 2;
+}
@@ -0,0 +1,345 @@
+#define _GNU_SOURCE
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ * Serial stream. A thread polls the serial device (or bit bang serial
+ * read GPIO) and appends the bytes received to a buffer, from which Lua
+ * takes lines, delimited or fixed length messages. The poll interval
+ * grows while the line is idle and drops back as soon as data arrives.
+ * The read end of the pipe is readable as long as the buffer holds data.
+ */
+struct serialstream {
+  int pi;
+  unsigned handle;
+  int bb;
+  pthread_t thread;
+  int running;
+  int stop;
+  int err;
+  pthread_mutex_t mutex;
+  pthread_cond_t data;     /* signalled on new data and errors */
+  pthread_cond_t wake;     /* signalled to stop the poller */
+  char *buf;
+  size_t size;
+  size_t start;
+  size_t len;
+  double mininterval;
+  double maxinterval;
+  unsigned long polls;
+  unsigned long bytes;
+  int fd[2];
+  char chunk[SERIAL_CHUNK];
+};
+typedef struct serialstream serialstream_t;
+
+/*
+ * Append n bytes to the buffer. The caller guarantees the space.
+ */
+static void stream_put(serialstream_t *st, const char *p, size_t n)
+{
+  if (st->start + st->len + n > st->size){
+    memmove(st->buf, st->buf + st->start, st->len);
+    st->start = 0;
+  }
+  memcpy(st->buf + st->start + st->len, p, n);
+  st->len += n;
+}
+
+static void *serialPoller(void *uparam)
+{
+  serialstream_t *st = uparam;
+  struct timespec due;
+  double interval = st->mininterval;
+  size_t space;
+  int n;
+  char c = 0;
+
+  pthread_mutex_lock(&st->mutex);
+  while (!st->stop){
+    space = st->size - st->len;
+    if (space > SERIAL_CHUNK)
+      space = SERIAL_CHUNK;
+    n = 0;
+    if (space > 0){
+      pthread_mutex_unlock(&st->mutex);
+      /* a read returns what is buffered: no need to ask first */
+      if (st->bb)
+        n = bb_serial_read(st->pi, st->handle, st->chunk, space);
+      else
+        n = serial_read(st->pi, st->handle, st->chunk, space);
+      if (n == PI_SER_READ_NO_DATA)
+        n = 0;
+      pthread_mutex_lock(&st->mutex);
+      st->polls++;
+      if (n < 0){
+        st->err = n;
+        pthread_cond_broadcast(&st->data);
+        (void) write(st->fd[1], &c, 1);
+        break;
+      }
+      if (n > 0){
+        if (st->len == 0)
+          (void) write(st->fd[1], &c, 1);
+        stream_put(st, st->chunk, n);
+        st->bytes += n;
+        pthread_cond_broadcast(&st->data);
+      }
+    }
+    if (n == (int) SERIAL_CHUNK)
+      continue;
+    if (n > 0)
+      interval = st->mininterval;
+    else if ((interval *= 2) > st->maxinterval)
+      interval = st->maxinterval;
+    get_deadline(interval, &due);
+    if (!st->stop)
+      pthread_cond_timedwait(&st->wake, &st->mutex, &due);
+  }
+  pthread_mutex_unlock(&st->mutex);
+  return NULL;
+}
+
+static void free_stream(serialstream_t *st)
+{
+  if (st->running){
+    pthread_mutex_lock(&st->mutex);
+    st->stop = TRUE;
+    pthread_cond_signal(&st->wake);
+    pthread_mutex_unlock(&st->mutex);
+    pthread_join(st->thread, NULL);
+  }
+  if (st->fd[0] >= 0){
+    close(st->fd[0]);
+    close(st->fd[1]);
+  }
+  pthread_mutex_destroy(&st->mutex);
+  pthread_cond_destroy(&st->data);
+  pthread_cond_destroy(&st->wake);
+  free(st->buf);
+  free(st);
+}
+
+static int stream_gc(lua_State *L)
+{
+  serialstream_t **sp = luaL_checkudata(L, 1, SERIAL_STREAM_MT);
+  if (*sp != NULL){
+    free_stream(*sp);
+    *sp = NULL;
+  }
+  return 0;
+}
+
+static serialstream_t *check_stream(lua_State *L, int arg)
+{
+  serialstream_t **sp = luaL_checkudata(L, arg, SERIAL_STREAM_MT);
+  if (*sp == NULL)
+    luaL_error(L, "Serial stream already closed.");
+  return *sp;
+}
+
+/*
+ * Lua binding: stream = serial_stream_open(pi, handle, bb[, capacity[, mininterval[, maxinterval]]])
+ * handle is a serial handle, or the GPIO of a bit bang serial read
+ * device if bb is true. Intervals are in seconds.
+ */
+int utlSerialStreamOpen(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned handle = (unsigned) luaL_checkinteger(L, 2);
+  int bb = lua_toboolean(L, 3);
+  lua_Integer capacity = luaL_optinteger(L, 4, SERIAL_RING);
+  double mininterval = luaL_optnumber(L, 5, SERIAL_POLL_MIN);
+  double maxinterval = luaL_optnumber(L, 6, SERIAL_POLL_MAX);
+  serialstream_t *st, **sp;
+  int err;
+
+  if (capacity < 1)
+    luaL_error(L, "Buffer capacity must be at least 1, received %d.", (int) capacity);
+  if (mininterval <= 0 || maxinterval < mininterval)
+    luaL_error(L, "Invalid poll intervals %f..%f.", mininterval, maxinterval);
+  sp = lua_newuserdata(L, sizeof(serialstream_t *));
+  *sp = NULL;
+  if (luaL_newmetatable(L, SERIAL_STREAM_MT)){
+    lua_pushcfunction(L, stream_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  st = calloc(1, sizeof(serialstream_t));
+  if (st == NULL || (st->buf = malloc(capacity)) == NULL){
+    free(st);
+    luaL_error(L, "Cannot allocate serial stream.");
+  }
+  pthread_mutex_init(&st->mutex, NULL);
+  pthread_cond_init(&st->data, NULL);
+  pthread_cond_init(&st->wake, NULL);
+  st->pi = pi;
+  st->handle = handle;
+  st->bb = bb;
+  st->size = capacity;
+  st->mininterval = mininterval;
+  st->maxinterval = maxinterval;
+  if (pipe(st->fd) < 0){
+    err = errno;
+    st->fd[0] = st->fd[1] = -1;
+    free_stream(st);
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(err));
+    return 2;
+  }
+  fcntl(st->fd[0], F_SETFL, O_NONBLOCK);
+  fcntl(st->fd[1], F_SETFL, O_NONBLOCK);
+  if (pthread_create(&st->thread, NULL, serialPoller, st) != 0){
+    free_stream(st);
+    lua_pushnil(L);
+    lua_pushstring(L, "cannot start serial poller thread");
+    return 2;
+  }
+  st->running = TRUE;
+  *sp = st;
+  return 1;
+}
+
+/*
+ * Find the end of the next message in the buffer.
+ * Returns the number of bytes to take from the buffer, 0 if no complete
+ * message has arrived yet. *mlen is the length of the message proper.
+ */
+static size_t find_message(serialstream_t *st, int mode, const char *delim,
+                           size_t dlen, size_t n, size_t *mlen)
+{
+  const char *p = st->buf + st->start, *q;
+
+  switch (mode){
+  case 'l':
+  case 'd':
+    q = memmem(p, st->len, delim, dlen);
+    if (q == NULL)
+      return 0;
+    *mlen = q - p;
+    if (mode == 'l' && *mlen > 0 && p[*mlen - 1] == '\r')
+      (*mlen)--;
+    return (q - p) + dlen;
+  case 'n':
+    if (st->len < n)
+      return 0;
+    *mlen = n;
+    return n;
+  default:
+    *mlen = (st->len < n) ? st->len : n;
+    return *mlen;
+  }
+}
+
+/*
+ * Lua binding: str = serial_stream_read(stream, mode, arg[, timeout])
+ * mode "line": a line without end of line, arg is ignored.
+ * mode "delim": a message terminated by the string arg.
+ * mode "length": exactly arg bytes.
+ * mode "any": up to arg bytes, at least one.
+ * Waits at most timeout seconds (< 0: forever, default: do not wait).
+ * Returns nil + "timeout" if no complete message has arrived, nil + code
+ * if the poller has failed.
+ */
+int utlSerialStreamRead(lua_State *L)
+{
+  static const char *const modes[] = {"line", "delim", "length", "any", NULL};
+  static const int modechars[] = {'l', 'd', 'n', 'a'};
+  serialstream_t *st = check_stream(L, 1);
+  int mode = modechars[luaL_checkoption(L, 2, NULL, modes)];
+  double timeout = luaL_optnumber(L, 4, 0);
+  const char *delim = "\n";
+  size_t dlen = 1, n = 0, take, mlen = 0;
+  struct timespec due;
+  char c;
+
+  if (mode == 'd'){
+    delim = luaL_checklstring(L, 3, &dlen);
+    if (dlen == 0)
+      luaL_error(L, "Empty delimiter.");
+  } else if (mode == 'n' || mode == 'a'){
+    n = (size_t) luaL_checkinteger(L, 3);
+    if (n < 1 || n > st->size)
+      luaL_error(L, "Message length must be in range of 1 to %d.", (int) st->size);
+  }
+  if (timeout > 0)
+    get_deadline(timeout, &due);
+  pthread_mutex_lock(&st->mutex);
+  while ((take = find_message(st, mode, delim, dlen, n, &mlen)) == 0 && st->err == 0){
+    if (timeout == 0 || st->len == st->size)
+      break;
+    if (timeout < 0)
+      pthread_cond_wait(&st->data, &st->mutex);
+    else if (pthread_cond_timedwait(&st->data, &st->mutex, &due) == ETIMEDOUT)
+      break;
+  }
+  if (take == 0){
+    int err = st->err;
+    /* a full buffer without delimiter can never complete */
+    int full = (st->len == st->size);
+    pthread_mutex_unlock(&st->mutex);
+    lua_pushnil(L);
+    if (err != 0)
+      lua_pushinteger(L, err);
+    else
+      lua_pushstring(L, full ? "overflow" : "timeout");
+    return 2;
+  }
+  lua_pushlstring(L, st->buf + st->start, mlen);
+  st->start += take;
+  st->len -= take;
+  if (st->len == 0){
+    st->start = 0;
+    while (read(st->fd[0], &c, 1) == 1)
+      ;
+  }
+  pthread_mutex_unlock(&st->mutex);
+  return 1;
+}
+
+/*
+ * Lua binding: fd = serial_stream_fd(stream)
+ * Readable while the stream holds data, not necessarily a complete
+ * message.
+ */
+int utlSerialStreamFd(lua_State *L)
+{
+  serialstream_t *st = check_stream(L, 1);
+  lua_pushinteger(L, st->fd[0]);
+  return 1;
+}
+
+/*
+ * Lua binding: count, capacity, polls, bytes, err = serial_stream_info(stream)
+ */
+int utlSerialStreamInfo(lua_State *L)
+{
+  serialstream_t *st = check_stream(L, 1);
+  pthread_mutex_lock(&st->mutex);
+  lua_pushinteger(L, st->len);
+  lua_pushinteger(L, st->size);
+  lua_pushinteger(L, st->polls);
+  lua_pushinteger(L, st->bytes);
+  lua_pushinteger(L, st->err);
+  pthread_mutex_unlock(&st->mutex);
+  return 5;
+}
+
+/*
+ * Lua binding: serial_stream_close(stream)
+ */
+int utlSerialStreamClose(lua_State *L)
+{
+  return stream_gc(L);
+}
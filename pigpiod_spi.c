@@ -0,0 +1,375 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * SPI sampler. A thread repeats a fixed tx frame at a target rate. The
+ * transfers due are sent as one pipeline framed by two tick commands;
+ * the ticks of the transfers are interpolated between both. Each sample
+ * is reduced to a value taken from the rx frame and stored with its tick
+ * in a ring, which Lua drains in batches.
+ */
+struct spisample {
+  uint32_t tick;
+  uint32_t value;
+};
+typedef struct spisample spisample_t;
+
+struct spisampler {
+  int pi;
+  unsigned handle;
+  char tx[SPI_FRAME_MAX];
+  unsigned len;
+  unsigned first;          /* value: bytes first..first+nbytes-1 of rx */
+  unsigned nbytes;
+  uint32_t mask;
+  double rate;
+  pthread_t thread;
+  int running;
+  int stop;
+  int err;
+  pthread_mutex_t mutex;
+  pthread_cond_t data;     /* signalled on new samples and errors */
+  pthread_cond_t wake;     /* monotonic clock, signalled to stop */
+  spisample_t *ring;
+  unsigned size;
+  unsigned head;
+  unsigned count;
+  unsigned long drops;
+  unsigned long samples;
+  unsigned long batches;
+  pipe_cmd_t cmds[SPI_SAMPLER_BATCH + 2];
+  char rx[SPI_SAMPLER_BATCH][SPI_FRAME_MAX];
+};
+typedef struct spisampler spisampler_t;
+
+static double monotonic(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Sleep until monotonic time t or until stopped. Returns the stop flag.
+ */
+static int sleep_until(spisampler_t *sp, double t)
+{
+  struct timespec ts;
+  int stop;
+
+  ts.tv_sec = (time_t) t;
+  ts.tv_nsec = (long) ((t - ts.tv_sec) * 1e9);
+  pthread_mutex_lock(&sp->mutex);
+  if (!sp->stop)
+    pthread_cond_timedwait(&sp->wake, &sp->mutex, &ts);
+  stop = sp->stop;
+  pthread_mutex_unlock(&sp->mutex);
+  return stop;
+}
+
+/*
+ * Run one pipeline of k transfers and store the samples.
+ */
+static int sample_batch(spisampler_t *sp, unsigned k)
+{
+  pipe_cmd_t *c = sp->cmds;
+  uint32_t t0, t1, value;
+  unsigned i, j, slot;
+  int res;
+
+  memset(c, 0, (k + 2) * sizeof(pipe_cmd_t));
+  c[0].cmd = c[k + 1].cmd = PI_CMD_TICK;
+  for (i = 1; i <= k; i++){
+    c[i].cmd = PI_CMD_SPIX;
+    c[i].p1 = sp->handle;
+    c[i].p3 = sp->len;
+    c[i].ext = sp->tx;
+    c[i].rxext = 1;
+    c[i].rxbuf = sp->rx[i - 1];
+    c[i].rxlen = sp->len;
+  }
+  res = pigpio_pipeline(sp->pi, c, k + 2);
+  if (res < 0)
+    return res;
+  for (i = 1; i <= k; i++)
+    if (c[i].res < 0)
+      return c[i].res;
+  t0 = (uint32_t) c[0].res;
+  t1 = (uint32_t) c[k + 1].res;
+  pthread_mutex_lock(&sp->mutex);
+  for (i = 0; i < k; i++){
+    for (j = 0, value = 0; j < sp->nbytes; j++)
+      value = (value << 8) | (uint8_t) sp->rx[i][sp->first + j];
+    if (sp->count == sp->size){
+      sp->head = (sp->head + 1) % sp->size;
+      sp->count--;
+      sp->drops++;
+    }
+    slot = (sp->head + sp->count) % sp->size;
+    /* transfers are evenly spread between both ticks */
+    sp->ring[slot].tick = t0 + (uint32_t) (((uint64_t) (t1 - t0) * (2 * i + 1)) / (2 * k));
+    sp->ring[slot].value = value & sp->mask;
+    sp->count++;
+  }
+  sp->samples += k;
+  sp->batches++;
+  pthread_cond_broadcast(&sp->data);
+  pthread_mutex_unlock(&sp->mutex);
+  return 0;
+}
+
+static void *spiSampler(void *uparam)
+{
+  spisampler_t *sp = uparam;
+  double start = monotonic(), now;
+  unsigned long taken = 0, due;
+  unsigned k;
+  int res;
+
+  for (;;){
+    now = monotonic();
+    due = (unsigned long) ((now - start) * sp->rate) + 1;
+    if (due <= taken){
+      if (sleep_until(sp, start + taken / sp->rate))
+        break;
+      continue;
+    }
+    /* fall behind rather than queue up an unbounded backlog */
+    if (due - taken > SPI_SAMPLER_BATCH){
+      k = SPI_SAMPLER_BATCH;
+      if (due - taken > 2 * SPI_SAMPLER_BATCH)
+        taken = due - SPI_SAMPLER_BATCH;
+    } else
+      k = due - taken;
+    if ((res = sample_batch(sp, k)) < 0){
+      pthread_mutex_lock(&sp->mutex);
+      sp->err = res;
+      pthread_cond_broadcast(&sp->data);
+      pthread_mutex_unlock(&sp->mutex);
+      break;
+    }
+    taken += k;
+    pthread_mutex_lock(&sp->mutex);
+    res = sp->stop;
+    pthread_mutex_unlock(&sp->mutex);
+    if (res)
+      break;
+  }
+  return NULL;
+}
+
+static void free_sampler(spisampler_t *sp)
+{
+  if (sp->running){
+    pthread_mutex_lock(&sp->mutex);
+    sp->stop = TRUE;
+    pthread_cond_signal(&sp->wake);
+    pthread_mutex_unlock(&sp->mutex);
+    pthread_join(sp->thread, NULL);
+  }
+  pthread_mutex_destroy(&sp->mutex);
+  pthread_cond_destroy(&sp->data);
+  pthread_cond_destroy(&sp->wake);
+  free(sp->ring);
+  free(sp);
+}
+
+static int sampler_gc(lua_State *L)
+{
+  spisampler_t **pp = luaL_checkudata(L, 1, SPI_SAMPLER_MT);
+  if (*pp != NULL){
+    free_sampler(*pp);
+    *pp = NULL;
+  }
+  return 0;
+}
+
+static spisampler_t *check_sampler(lua_State *L, int arg)
+{
+  spisampler_t **pp = luaL_checkudata(L, arg, SPI_SAMPLER_MT);
+  if (*pp == NULL)
+    luaL_error(L, "SPI sampler already stopped.");
+  return *pp;
+}
+
+/*
+ * Lua binding: sampler = spi_sampler_start(pi, handle, tx, rate[, capacity[, first[, nbytes[, mask]]]])
+ * The value of a sample is the big endian number in bytes first to
+ * first + nbytes - 1 (0 based) of the rx frame, and-ed with mask.
+ */
+int utlSPISamplerStart(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned handle = (unsigned) luaL_checkinteger(L, 2);
+  size_t len;
+  const char *tx = luaL_checklstring(L, 3, &len);
+  double rate = luaL_checknumber(L, 4);
+  lua_Integer capacity = luaL_optinteger(L, 5, SPI_SAMPLER_RING);
+  lua_Integer first = luaL_optinteger(L, 6, 0);
+  lua_Integer nbytes = luaL_optinteger(L, 7, (len < 4) ? len : 4);
+  uint32_t mask = (uint32_t) luaL_optinteger(L, 8, 0xffffffff);
+  spisampler_t *sp, **pp;
+  pthread_condattr_t attr;
+
+  if (len < 1 || len > SPI_FRAME_MAX)
+    luaL_error(L, "Frame length must be in range of 1 to %d.", SPI_FRAME_MAX);
+  if (rate <= 0)
+    luaL_error(L, "Positive sample rate expected.");
+  if (capacity < 1)
+    luaL_error(L, "Ring capacity must be at least 1, received %d.", (int) capacity);
+  if (first < 0 || nbytes < 1 || nbytes > 4 || first + nbytes > (lua_Integer) len)
+    luaL_error(L, "Invalid value bytes %d..%d.", (int) first, (int) (first + nbytes - 1));
+  pp = lua_newuserdata(L, sizeof(spisampler_t *));
+  *pp = NULL;
+  if (luaL_newmetatable(L, SPI_SAMPLER_MT)){
+    lua_pushcfunction(L, sampler_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  sp = calloc(1, sizeof(spisampler_t));
+  if (sp == NULL || (sp->ring = malloc(capacity * sizeof(spisample_t))) == NULL){
+    free(sp);
+    luaL_error(L, "Cannot allocate SPI sampler.");
+  }
+  pthread_mutex_init(&sp->mutex, NULL);
+  pthread_cond_init(&sp->data, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&sp->wake, &attr);
+  pthread_condattr_destroy(&attr);
+  sp->pi = pi;
+  sp->handle = handle;
+  memcpy(sp->tx, tx, len);
+  sp->len = len;
+  sp->first = first;
+  sp->nbytes = nbytes;
+  sp->mask = mask;
+  sp->rate = rate;
+  sp->size = capacity;
+  if (pthread_create(&sp->thread, NULL, spiSampler, sp) != 0){
+    free_sampler(sp);
+    lua_pushnil(L);
+    lua_pushstring(L, "cannot start SPI sampler thread");
+    return 2;
+  }
+  sp->running = TRUE;
+  *pp = sp;
+  return 1;
+}
+
+/*
+ * Destination u32 array of a batch, NULL if not given.
+ */
+static array_t *check_dest(lua_State *L, int arg)
+{
+  array_t *a;
+
+  if (lua_isnoneornil(L, arg))
+    return NULL;
+  a = test_array(L, arg);
+  if (a == NULL || a->type != ARRAY_U32 || a->swap)
+    luaL_argerror(L, arg, "u32 array expected");
+  return a;
+}
+
+/*
+ * Lua binding: ticks, values, n = spi_sampler_read(sampler, max[, timeout[, ticks, values]])
+ * Waits at most timeout seconds (< 0: forever, default: do not wait) for
+ * samples. The samples are stored in the u32 arrays ticks and values if
+ * given, in new u32 arrays of n elements otherwise. Returns nil + code if
+ * the sampler has failed.
+ */
+int utlSPISamplerRead(lua_State *L)
+{
+  spisampler_t *sp = check_sampler(L, 1);
+  lua_Integer max = luaL_checkinteger(L, 2);
+  double timeout = luaL_optnumber(L, 3, 0);
+  array_t *ticks = check_dest(L, 4), *values = check_dest(L, 5);
+  struct timespec due;
+  spisample_t *s;
+  size_t i, n;
+  int err;
+
+  if (max < 1)
+    luaL_error(L, "Positive number of samples expected, received %d.", (int) max);
+  if ((ticks == NULL) != (values == NULL))
+    luaL_error(L, "Both or none of the arrays ticks and values expected.");
+  if (ticks != NULL){
+    if ((size_t) max > ticks->count)
+      max = ticks->count;
+    if ((size_t) max > values->count)
+      max = values->count;
+  }
+  if (timeout > 0)
+    get_deadline(timeout, &due);
+  pthread_mutex_lock(&sp->mutex);
+  while (sp->count == 0 && sp->err == 0 && timeout != 0){
+    if (timeout < 0)
+      pthread_cond_wait(&sp->data, &sp->mutex);
+    else if (pthread_cond_timedwait(&sp->data, &sp->mutex, &due) == ETIMEDOUT)
+      break;
+  }
+  if (sp->count == 0 && sp->err != 0){
+    err = sp->err;
+    pthread_mutex_unlock(&sp->mutex);
+    lua_pushnil(L);
+    lua_pushinteger(L, err);
+    return 2;
+  }
+  n = ((size_t) max < sp->count) ? (size_t) max : sp->count;
+  if (ticks == NULL){
+    /* Allocate unlocked, the ring keeps at least n samples meanwhile */
+    pthread_mutex_unlock(&sp->mutex);
+    ticks = new_array(L, ARRAY_U32, FALSE, n);
+    values = new_array(L, ARRAY_U32, FALSE, n);
+    pthread_mutex_lock(&sp->mutex);
+  } else {
+    lua_pushvalue(L, 4);
+    lua_pushvalue(L, 5);
+  }
+  for (i = 0; i < n; i++){
+    s = &sp->ring[sp->head];
+    sp->head = (sp->head + 1) % sp->size;
+    memcpy(ticks->data + 4 * i, &s->tick, 4);
+    memcpy(values->data + 4 * i, &s->value, 4);
+  }
+  sp->count -= n;
+  pthread_mutex_unlock(&sp->mutex);
+  lua_pushinteger(L, n);
+  return 3;
+}
+
+/*
+ * Lua binding: count, capacity, drops, samples, batches, err = spi_sampler_info(sampler)
+ */
+int utlSPISamplerInfo(lua_State *L)
+{
+  spisampler_t *sp = check_sampler(L, 1);
+  pthread_mutex_lock(&sp->mutex);
+  lua_pushinteger(L, sp->count);
+  lua_pushinteger(L, sp->size);
+  lua_pushinteger(L, sp->drops);
+  lua_pushinteger(L, sp->samples);
+  lua_pushinteger(L, sp->batches);
+  lua_pushinteger(L, sp->err);
+  pthread_mutex_unlock(&sp->mutex);
+  return 6;
+}
+
+/*
+ * Lua binding: spi_sampler_stop(sampler)
+ */
+int utlSPISamplerStop(lua_State *L)
+{
+  return sampler_gc(L);
+}
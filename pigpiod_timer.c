@@ -0,0 +1,199 @@
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "pigpiod_util.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Periodic timer. Runs a Lua function at absolute deadlines start + k *
+ * period of the monotonic clock, hence late wake ups and the time spent
+ * in the function do not add up to drift. While waiting for a deadline
+ * the callbacks of arriving events are called, see dispatch_until(). The
+ * final spin seconds before a deadline may be spent polling the clock,
+ * which trades CPU for less jitter. A run overrunning its period skips
+ * the deadlines missed, keeping the phase of the schedule.
+ */
+struct ptimer {
+  int64_t period;           /* nanoseconds */
+  int64_t spin;
+  int stop;
+  unsigned long runs;
+  unsigned long overruns;
+  unsigned long skipped;
+  double minlate;           /* seconds of wake up after a deadline */
+  double maxlate;
+  double sumlate;
+  double sumlate2;
+  double maxexec;           /* seconds spent in the function */
+};
+typedef struct ptimer ptimer_t;
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void to_timespec(int64_t t, struct timespec *ts)
+{
+  ts->tv_sec = (time_t) (t / 1000000000);
+  ts->tv_nsec = (long) (t % 1000000000);
+}
+
+static int64_t to_ns(double t)
+{
+  return (int64_t) (t * 1e9 + 0.5);
+}
+
+static void clear_stats(ptimer_t *pt)
+{
+  pt->runs = pt->overruns = pt->skipped = 0;
+  pt->minlate = pt->maxlate = pt->sumlate = pt->sumlate2 = pt->maxexec = 0;
+}
+
+static ptimer_t *check_timer(lua_State *L, int arg)
+{
+  return luaL_checkudata(L, arg, TIMER_MT);
+}
+
+/*
+ * Lua binding: timer = timer_new(period[, spin])
+ */
+int utlTimerNew(lua_State *L)
+{
+  double period = luaL_checknumber(L, 1);
+  double spin = luaL_optnumber(L, 2, 0);
+  ptimer_t *pt;
+
+  if (period < 1e-6)
+    luaL_error(L, "Period must be at least 1 us.");
+  if (spin < 0 || spin > period)
+    luaL_error(L, "Spin time must be in range of 0 to the period.");
+  pt = lua_newuserdata(L, sizeof(ptimer_t));
+  memset(pt, 0, sizeof(ptimer_t));
+  pt->period = to_ns(period);
+  pt->spin = to_ns(spin);
+  luaL_newmetatable(L, TIMER_MT);
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+/*
+ * Lua binding: periods = timer_run(timer, func[, count])
+ * Calls func(k, late) at deadline k = 1, 2, ... with late the seconds
+ * between deadline and call. Stops after count periods if count > 0, when
+ * func returns false or after timer_stop().
+ */
+int utlTimerRun(lua_State *L)
+{
+  ptimer_t *pt = check_timer(L, 1);
+  lua_Integer count = luaL_optinteger(L, 3, 0);
+  int64_t start, due, now, missed;
+  lua_Integer k = 0;
+  struct timespec ts;
+  double late, exec;
+
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  pt->stop = FALSE;
+  start = now_ns();
+  while (!pt->stop && (count <= 0 || k < count)){
+    k++;
+    due = start + k * pt->period;
+    to_timespec(due - pt->spin, &ts);
+    dispatch_until(L, &ts);
+    while ((now = now_ns()) < due)
+      ;
+    late = (now - due) * 1e-9;
+    if (pt->runs == 0 || late < pt->minlate)
+      pt->minlate = late;
+    if (late > pt->maxlate)
+      pt->maxlate = late;
+    pt->sumlate += late;
+    pt->sumlate2 += late * late;
+    pt->runs++;
+    lua_pushvalue(L, 2);
+    lua_pushinteger(L, k);
+    lua_pushnumber(L, late);
+    lua_call(L, 2, 1);
+    if (lua_isboolean(L, -1) && !lua_toboolean(L, -1))
+      pt->stop = TRUE;
+    lua_pop(L, 1);
+    now = now_ns();
+    exec = (now - due) * 1e-9 - late;
+    if (exec > pt->maxexec)
+      pt->maxexec = exec;
+    if (now >= due + pt->period){
+      missed = (now - due) / pt->period;
+      pt->overruns++;
+      pt->skipped += missed;
+      k += missed;
+    }
+  }
+  lua_pushinteger(L, k);
+  return 1;
+}
+
+/*
+ * Lua binding: timer_stop(timer)
+ * Ends a run after the current call.
+ */
+int utlTimerStop(lua_State *L)
+{
+  check_timer(L, 1)->stop = TRUE;
+  return 0;
+}
+
+/*
+ * Lua binding: runs, overruns, skipped, minlate, maxlate, meanlate, varlate, maxexec = timer_info(timer[, clear])
+ */
+int utlTimerInfo(lua_State *L)
+{
+  ptimer_t *pt = check_timer(L, 1);
+  double mean = 0, var = 0;
+
+  if (pt->runs > 0){
+    mean = pt->sumlate / pt->runs;
+    var = pt->sumlate2 / pt->runs - mean * mean;
+  }
+  lua_pushinteger(L, pt->runs);
+  lua_pushinteger(L, pt->overruns);
+  lua_pushinteger(L, pt->skipped);
+  lua_pushnumber(L, pt->minlate);
+  lua_pushnumber(L, pt->maxlate);
+  lua_pushnumber(L, mean);
+  lua_pushnumber(L, (var > 0) ? var : 0);
+  lua_pushnumber(L, pt->maxexec);
+  if (lua_toboolean(L, 2))
+    clear_stats(pt);
+  return 8;
+}
+
+/*
+ * Lua binding: wait_events(t)
+ * Sleep t seconds calling the callbacks of arriving events.
+ */
+int utlWaitEvents(lua_State *L)
+{
+  struct timespec ts;
+  to_timespec(now_ns() + to_ns(luaL_checknumber(L, 1)), &ts);
+  dispatch_until(L, &ts);
+  return 0;
+}
+
+/*
+ * Lua binding: busy_wait(t)
+ * Poll the monotonic clock for t seconds.
+ */
+int utlBusyWait(lua_State *L)
+{
+  int64_t due = now_ns() + to_ns(luaL_checknumber(L, 1));
+  while (now_ns() < due)
+    ;
+  return 0;
+}
@@ -7,7 +7,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <pthread.h>
+#include <sys/time.h>
 
 //#define DEBUG
 #if DEBUG == 1
@@ -30,21 +32,10 @@
 /*
  * Forward declaration.
  */
-static int enqueue(anchor_t* anchor, event_t *event);
-static event_t* dequeue(anchor_t* anchor);
+static int enqueue(evctx_t *ctx, event_t *event);
+static int enqueue_locked(evctx_t *ctx, event_t *event);
+static event_t* dequeue(evctx_t *ctx);
 
-/*
- * Array of callback function entries. We use addresses within the members
- * as keys into LUA_REGISTRYTABLE.
- */
-static callbackfuncEx_t callbackfuncsEx[MAX_CALLBACKS];
-static eventcallbackfuncEx_t eventcallbackfuncsEx[MAX_EVENTCALLBACKS];
-
-static lua_State *LL = NULL;
-static lua_Hook oldhook = NULL;
-static int oldmask = 0;
-static int oldcount = 0;
-static anchor_t anchor = {NULL, NULL, 0, LIMIT_EVENT_QUEUE};
 static eventstat_t eventstat = {0, 0};
 pthread_mutex_t eventmutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -64,6 +55,100 @@ static unsigned int get_numarg(lua_State *L, int stackindex, unsigned min, unsig
   }
   return arg;
 }
+
+/*
+ * Copy a Lua value into a state independent representation.
+ * Returns 0 on success, -1 if the type cannot be transferred.
+ */
+int tvalue_get(lua_State *L, int idx, tvalue_t *v)
+{
+  const char *s;
+  v->type = lua_type(L, idx);
+  switch (v->type){
+  case LUA_TNIL:
+  case LUA_TNONE:
+    v->type = LUA_TNIL;
+    break;
+  case LUA_TBOOLEAN:
+    v->v.b = lua_toboolean(L, idx);
+    break;
+  case LUA_TNUMBER:
+    if (lua_isinteger(L, idx)){
+      v->v.i = lua_tointeger(L, idx);
+      v->isint = TRUE;
+    } else {
+      v->v.n = lua_tonumber(L, idx);
+      v->isint = FALSE;
+    }
+    break;
+  case LUA_TSTRING:
+    s = lua_tolstring(L, idx, &v->v.s.len);
+    v->v.s.ptr = malloc(v->v.s.len + 1);
+    if (v->v.s.ptr == NULL)
+      return -1;
+    memcpy(v->v.s.ptr, s, v->v.s.len + 1);
+    break;
+  case LUA_TLIGHTUSERDATA:
+    v->v.p = lua_touserdata(L, idx);
+    break;
+  default:
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Push a value captured by tvalue_get() onto the stack of L.
+ */
+void tvalue_push(lua_State *L, tvalue_t *v)
+{
+  switch (v->type){
+  case LUA_TBOOLEAN:
+    lua_pushboolean(L, v->v.b);
+    break;
+  case LUA_TNUMBER:
+    if (v->isint)
+      lua_pushinteger(L, v->v.i);
+    else
+      lua_pushnumber(L, v->v.n);
+    break;
+  case LUA_TSTRING:
+    lua_pushlstring(L, v->v.s.ptr, v->v.s.len);
+    break;
+  case LUA_TLIGHTUSERDATA:
+    lua_pushlightuserdata(L, v->v.p);
+    break;
+  default:
+    lua_pushnil(L);
+    break;
+  }
+}
+
+/*
+ * Release memory held by a captured value.
+ */
+void tvalue_free(tvalue_t *v)
+{
+  if (v->type == LUA_TSTRING)
+    free(v->v.s.ptr);
+  v->type = LUA_TNIL;
+}
+
+/*
+ * Absolute time for pthread_cond_timedwait() timeout seconds from now.
+ */
+void get_deadline(double timeout, struct timespec *due)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  due->tv_sec = now.tv_sec + (time_t) timeout;
+  due->tv_nsec = now.tv_usec * 1000 + (long)((timeout - (time_t) timeout) * 1e9);
+  if (due->tv_nsec >= 1000000000){
+    due->tv_sec++;
+    due->tv_nsec -= 1000000000;
+  }
+}
+
 #if 0
 /*
  * Copy data from C universe (buffer) to Lua universe (table)
@@ -96,6 +181,54 @@ static char *table_to_buf(lua_State *L, int n)
   return buf;
 }
 #endif
+/*
+ * Registry key of the thread descriptor in the thread's own state, and
+ * of the set of descriptors not yet joined in the starting state.
+ */
+static char threadkey;
+static char threadskey;
+
+/*
+ * Add (on = TRUE) or remove a thread descriptor from the set of threads
+ * not yet joined.
+ */
+static void set_thread(lua_State *L, threadfunc_t *cbfunc, int on)
+{
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &threadskey) == LUA_TNIL){
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &threadskey);
+  }
+  if (on)
+    lua_pushboolean(L, TRUE);
+  else
+    lua_pushnil(L);
+  lua_rawsetp(L, -2, cbfunc);
+  lua_pop(L, 1);
+}
+
+static threadfunc_t *get_self(lua_State *L)
+{
+  threadfunc_t *cbfunc;
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &threadkey);
+  cbfunc = lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return cbfunc;
+}
+
+/*
+ * Count hook of thread states: unwinds the Lua code once a stop has
+ * been requested. Errors are only raised between Lua instructions, hence
+ * never while a pigpiod_if2 function holds one of its locks.
+ */
+static void stopHook(lua_State *L, lua_Debug *ar)
+{
+  threadfunc_t *cbfunc = get_self(L);
+  if (cbfunc != NULL && cbfunc->stop)
+    luaL_error(L, "thread '%s' stopped", cbfunc->n);
+}
+
 /*
  * new thread: param, func 
  */
@@ -104,9 +237,32 @@ static void *threadFunc(void *uparam)
   threadfunc_t *cbfunc = uparam;
   lua_State *L = cbfunc->L;
   int narg = cbfunc->a;
+  int i, n;
   dprintf("thread: %s %d\n", lua_typename(L, lua_type(L,1)), lua_gettop(L));
   luaL_openlibs(L);
-  lua_call(L, narg, 0);
+  lua_pushlightuserdata(L, cbfunc);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &threadkey);
+  lua_sethook(L, stopHook, LUA_MASKCOUNT, THREAD_HOOK_COUNT);
+  if (lua_pcall(L, narg, LUA_MULTRET, 0) != LUA_OK){
+    cbfunc->errmsg = strdup(lua_isstring(L, -1) ? lua_tostring(L, -1) :
+                            "error object is not a string");
+    if (!cbfunc->stop)
+      eprintf("thread '%s': %s\n", cbfunc->n, cbfunc->errmsg);
+  } else {
+    n = lua_gettop(L);
+    cbfunc->results = calloc(n > 0 ? n : 1, sizeof(tvalue_t));
+    /* results which cannot be transferred are delivered as nil */
+    for (i = 0; i < n; i++)
+      if (tvalue_get(L, i + 1, &cbfunc->results[i]) < 0)
+        cbfunc->results[i].type = LUA_TNIL;
+    cbfunc->nresults = n;
+  }
+  lua_close(L);
+  cbfunc->L = NULL;
+  pthread_mutex_lock(&cbfunc->mutex);
+  cbfunc->done = TRUE;
+  pthread_cond_broadcast(&cbfunc->cond);
+  pthread_mutex_unlock(&cbfunc->mutex);
   return NULL;
 }
 
@@ -122,17 +278,11 @@ int utlStartThread(lua_State *L)
   const char *code;
   const char *name;
   int narg;
+  tvalue_t v;
 
-  /* allocate a descriptor*/
-  cbfunc = malloc(sizeof(threadfunc_t));
-  cbfunc->f = threadFunc;
-  narg = lua_gettop(L);
-  cbfunc->a = narg - 1;
-  newL = luaL_newstate();
-  cbfunc->L = newL;
   if (lua_type(L, 1) != LUA_TSTRING){
     luaL_error(L, "Cannot use '%s' to define thread main routine.",
-               luaL_typename(L, lua_type(L, 1)));
+               luaL_typename(L, 1));
   }
   /* get code from stack */
   code = lua_tolstring(L, 1, &len);
@@ -144,32 +294,15 @@ int utlStartThread(lua_State *L)
   if (lua_isnil(L, -1) == 0){
     luaL_error(L, "Name '%s' already registered.", name);
   }
-  /* load and compile string into new state */
-  if (luaL_loadbuffer(newL, code, len, name) != 0){  /* ns: func */
-    lua_pushstring(L, lua_tostring(newL, -1));
-    lua_close(newL);
-    luaL_error(L, lua_tostring(L, -1));
-  }
-  /* Push name on new stack */
-  lua_pushstring(newL, name);                        /* ns: name, func */
-  cbfunc->n = strdup(name);
-  /* Provide parameters on new stack */
+  lua_pop(L, 1);
+  narg = lua_gettop(L);
   for (i = 3; i <= narg; i++){
     switch(lua_type(L, i)){
     case LUA_TNUMBER:
-      lua_pushnumber(newL, lua_tonumber(L, i));      /* ns: param, name, func */
-      break;
     case LUA_TSTRING:
-      lua_pushstring(newL, lua_tostring(L, i));
-      break;
     case LUA_TBOOLEAN:
-      lua_pushboolean(newL, lua_toboolean(L, 1));
-      break;
     case LUA_TNIL:
-      lua_pushnil(newL);
-      break;
     case LUA_TLIGHTUSERDATA:
-      lua_pushlightuserdata(L, lua_touserdata(L, 1));
       break;
     default:
       luaL_error(L, "Invalid parameter type '%s'.",
@@ -177,53 +310,219 @@ int utlStartThread(lua_State *L)
       break;
     }
   }
+  newL = luaL_newstate();
+  /* load and compile string into new state */
+  if (luaL_loadbuffer(newL, code, len, name) != 0){  /* ns: func */
+    lua_pushstring(L, lua_tostring(newL, -1));
+    lua_close(newL);
+    luaL_error(L, lua_tostring(L, -1));
+  }
+  /* allocate a descriptor*/
+  cbfunc = calloc(1, sizeof(threadfunc_t));
+  cbfunc->f = threadFunc;
+  cbfunc->a = narg - 1;
+  cbfunc->L = newL;
+  pthread_mutex_init(&cbfunc->mutex, NULL);
+  pthread_cond_init(&cbfunc->cond, NULL);
+  /* Push name on new stack */
+  lua_pushstring(newL, name);                        /* ns: name, func */
+  cbfunc->n = strdup(name);
+  /* Provide parameters on new stack */
+  for (i = 3; i <= narg; i++){
+    tvalue_get(L, i, &v);
+    tvalue_push(newL, &v);                           /* ns: param, name, func */
+    tvalue_free(&v);
+  }
   /* 
    * Start new pthread.
    * Stack: param_n, ..., param_2, param_1, name, func  
    */
   cbfunc->t = start_thread(cbfunc->f, cbfunc);
-  /* remind descriptor  in registry for later usage */
-  lua_pushstring(L, cbfunc->n);
-  lua_pushlightuserdata(L, cbfunc);
-  lua_settable(L, LUA_REGISTRYINDEX);
   if (cbfunc->t == NULL){
+    lua_close(newL);
+    free(cbfunc->n);
     free(cbfunc);
     luaL_error(L, "Cannot start thread.");
-  } else {
-    lua_pushlightuserdata(L, cbfunc);
   }
+  /* remind descriptor  in registry for later usage */
+  lua_pushstring(L, cbfunc->n);
+  lua_pushlightuserdata(L, cbfunc);
+  lua_settable(L, LUA_REGISTRYINDEX);
+  set_thread(L, cbfunc, TRUE);
+  lua_pushlightuserdata(L, cbfunc);
   return 1;
 }
 
 /*
- * Lua binding: succ = stopThread(name | userdata)
+ * Get thread descriptor given by name or userdata at stack index 1.
+ * Userdata of threads already joined, whose descriptor has been freed,
+ * are rejected.
  */
-int utlStopThread(lua_State *L)
+static threadfunc_t *check_thread(lua_State *L)
 {
   threadfunc_t *cbfunc;
   int argtype = lua_type(L, 1);
-  
+
   if (argtype == LUA_TSTRING) {
-    /* get thread descriptor */
+    lua_pushvalue(L, 1);
     lua_gettable(L, LUA_REGISTRYINDEX);
     if (lua_isnil(L, -1)){
       luaL_error(L, "Thread with name '%s' cannot be found.", lua_tostring(L, 1));
     }
-  } else if (argtype != LUA_TLIGHTUSERDATA){
+    cbfunc = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+  } else if (argtype == LUA_TLIGHTUSERDATA){
+    cbfunc = lua_touserdata(L, 1);
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &threadskey);
+    if (!lua_istable(L, -1) || lua_rawgetp(L, -1, cbfunc) == LUA_TNIL)
+      luaL_error(L, "Thread already joined or unknown.");
+    lua_pop(L, 2);
+  } else {
     luaL_error(L, "String or userdata expected as arg %d 'name', received %s.", 1,
                lua_typename(L, lua_type(L, 1)));
+    return NULL;
   }
-  cbfunc = lua_touserdata(L, -1);
+  return cbfunc;
+}
+
+/*
+ * Wait for termination of a thread, push its results and release the
+ * descriptor. Returns the number of pushed values or -1 on timeout.
+ */
+static int join_thread(lua_State *L, threadfunc_t *cbfunc, double timeout)
+{
+  struct timespec due;
+  int i, n;
+
+  if (timeout >= 0)
+    get_deadline(timeout, &due);
+  pthread_mutex_lock(&cbfunc->mutex);
+  while (!cbfunc->done){
+    if (timeout < 0)
+      pthread_cond_wait(&cbfunc->cond, &cbfunc->mutex);
+    else if (pthread_cond_timedwait(&cbfunc->cond, &cbfunc->mutex, &due) != 0)
+      break;
+  }
+  if (!cbfunc->done){
+    pthread_mutex_unlock(&cbfunc->mutex);
+    return -1;
+  }
+  pthread_mutex_unlock(&cbfunc->mutex);
+  pthread_join(*cbfunc->t, NULL);
+  free(cbfunc->t);
+  /* forget name and descriptor */
   lua_pushstring(L, cbfunc->n);
-  stop_thread(cbfunc->t);
   lua_pushnil(L);
   lua_settable(L, LUA_REGISTRYINDEX);
+  set_thread(L, cbfunc, FALSE);
+  if (cbfunc->errmsg != NULL){
+    lua_pushnil(L);
+    lua_pushstring(L, cbfunc->errmsg);
+    n = 2;
+  } else {
+    luaL_checkstack(L, cbfunc->nresults + 1, "too many thread results");
+    lua_pushboolean(L, TRUE);
+    for (i = 0; i < cbfunc->nresults; i++)
+      tvalue_push(L, &cbfunc->results[i]);
+    n = cbfunc->nresults + 1;
+  }
+  for (i = 0; i < cbfunc->nresults; i++)
+    tvalue_free(&cbfunc->results[i]);
+  free(cbfunc->results);
+  free(cbfunc->errmsg);
+  pthread_mutex_destroy(&cbfunc->mutex);
+  pthread_cond_destroy(&cbfunc->cond);
   free(cbfunc->n);
   free(cbfunc);
+  return n;
+}
+
+/*
+ * Lua binding: succ = stopThread(name | userdata, timeout)
+ * Requests the thread to stop and waits for its termination. The thread
+ * is unwound at the next Lua instruction and its state is closed.
+ */
+int utlStopThread(lua_State *L)
+{
+  threadfunc_t *cbfunc = check_thread(L);
+  double timeout = luaL_optnumber(L, 2, -1);
+
+  cbfunc->stop = TRUE;
+  if (join_thread(L, cbfunc, timeout) < 0){
+    lua_pushnil(L);
+    lua_pushstring(L, "timeout");
+    return 2;
+  }
   lua_pushnumber(L, TRUE);
   return 1;
 }
 
+/*
+ * Lua binding: succ, ... = joinThread(name | userdata, timeout)
+ * Waits for the thread to return and delivers its results.
+ */
+int utlJoinThread(lua_State *L)
+{
+  threadfunc_t *cbfunc = check_thread(L);
+  double timeout = luaL_optnumber(L, 2, -1);
+  int n;
+
+  n = join_thread(L, cbfunc, timeout);
+  if (n < 0){
+    lua_pushnil(L);
+    lua_pushstring(L, "timeout");
+    return 2;
+  }
+  return n;
+}
+
+/*
+ * Lua binding: res = threadSched(name | userdata | nil, cpu, priority)
+ * Without thread the calling thread is addressed.
+ */
+int utlThreadSched(lua_State *L)
+{
+  pthread_t self;
+  pthread_t *pth;
+  int cpu = (int) luaL_optinteger(L, 2, -1);
+  int priority = (int) luaL_optinteger(L, 3, 0);
+
+  if (lua_isnoneornil(L, 1)){
+    self = pthread_self();
+    pth = &self;
+  } else {
+    pth = check_thread(L)->t;
+  }
+  lua_pushinteger(L, thread_sched(pth, cpu, priority));
+  return 1;
+}
+
+/*
+ * Lua binding: res = notify_sched(pi, cpu, priority)
+ * Bound natively: notify_sched() is not declared by the pigpiod_if2.h
+ * wrapped by SWIG.
+ */
+int utlNotifySched(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  int cpu = (int) luaL_optinteger(L, 2, -1);
+  int priority = (int) luaL_optinteger(L, 3, 0);
+
+  lua_pushinteger(L, notify_sched(pi, cpu, priority));
+  return 1;
+}
+
+/*
+ * Lua binding: stopping = threadStopping()
+ * True if the calling thread has been requested to stop.
+ */
+int utlThreadStopping(lua_State *L)
+{
+  threadfunc_t *cbfunc = get_self(L);
+  lua_pushboolean(L, cbfunc != NULL && cbfunc->stop);
+  return 1;
+}
+
 /*
  * Lua binding: succ = waveAddGeneric(pi, pulses)
  * pulses = {{on=PATTERN, off=PATTERN, tick=TICKS},...}
@@ -264,11 +563,19 @@ int utlWaveAddGeneric(lua_State *L)
 /*
  * Translate parameters given as Lua list into uint32_t array.
  */
-static uint32_t *get_params(lua_State *L, int arg, int *nparam)
+/*
+ * Script parameters from a table or an u32 array.
+ */
+static int get_params(lua_State *L, int arg, uint32_t *params)
 {
-  uint32_t *params;
+  array_t *a = test_array(L, arg);
   int i, n;
-  
+
+  if (a != NULL && a->type == ARRAY_U32 && !a->swap){
+    n = (a->count < 10) ? (int) a->count : 10;
+    memcpy(params, a->data, n * sizeof(uint32_t));
+    return n;
+  }
   if (!lua_istable(L, arg)){
     luaL_error(L, "Table expected as arg %d 'params', received %s.", 3,
                lua_typename(L, lua_type(L, arg)));
@@ -276,15 +583,12 @@ static uint32_t *get_params(lua_State *L, int arg, int *nparam)
   n = luaL_len(L, arg);
   if (n > 10)
     n = 10;
-  params = malloc(n * sizeof(uint32_t));
   for (i = 0; i < n; i++){
-    lua_pushnumber(L, i + 1);
-    lua_gettable(L, -2);
-    params[i] = lua_tonumber(L, -1);
-    lua_settop(L, -1);
+    lua_rawgeti(L, arg, i + 1);
+    params[i] = (uint32_t) lua_tonumber(L, -1);
+    lua_pop(L, 1);
   }
-  *nparam = n;
-  return params;
+  return n;
 }
 
 static void get_ids(lua_State *L, int arg, int *pi, int *id)
@@ -299,12 +603,11 @@ static void get_ids(lua_State *L, int arg, int *pi, int *id)
 int utlRunScript(lua_State *L)
 {
   int pi, id, n, res;
-  uint32_t *params;
+  uint32_t params[10];
   
   get_ids(L, 1, &pi, &id);
-  params = get_params(L, 3, &n);
+  n = get_params(L, 3, params);
   res = run_script(pi, id, n, params);
-  free(params);
   lua_pushnumber(L, res);
   return 1;
 }
@@ -312,118 +615,397 @@ int utlRunScript(lua_State *L)
 int utlUpdateScript(lua_State *L)
 {
   int pi, id, n, res;
-  uint32_t *params;
+  uint32_t params[10];
   get_ids(L, 1, &pi, &id);
-  params = get_params(L, 3, &n);
+  n = get_params(L, 3, params);
   res = update_script(pi, id, n, params);
-  free(params);
   lua_pushnumber(L, res);
   return 1;
 }
 
+/*
+ * Lua binding: params, status = script_status(pi, id[, dest])
+ * params is a table, or the u32 array dest if given.
+ */
 int utlScriptStatus(lua_State *L)
 {
   int pi, id, res, i;
   uint32_t params[10];
+  array_t *a;
   get_ids(L, 1, &pi, &id);
+  if (!lua_isnoneornil(L, 3)){
+    a = test_array(L, 3);
+    if (a == NULL || a->type != ARRAY_U32 || a->swap || a->count < 10)
+      luaL_argerror(L, 3, "u32 array of 10 elements expected");
+    res = script_status(pi, id, (uint32_t *) a->data);
+    lua_pushvalue(L, 3);
+    lua_pushinteger(L, res);
+    return 2;
+  }
   res = script_status(pi, id, params);
-  lua_newtable(L);                /* tab */
+  lua_createtable(L, 10, 0);
   for (i = 0; i < 10; i++){
-    lua_pushnumber(L, i + 1);     /* key, tab */
-    lua_pushnumber(L, params[i]); /* val, key, tab */
-    lua_settable(L, -3);          /* tab */
+    lua_pushinteger(L, params[i]);
+    lua_rawseti(L, -2, i + 1);
   }
-  lua_pushnumber(L, res);         /* res, tab */
+  lua_pushinteger(L, res);
   return 2;
 }
 
 /*
- * Remind Lua hooks.
- * Must only be called when all lgpio event hook slots are empty. 
+ * Registry keys of the event context of a Lua state and of the tables
+ * mapping callback ids to their descriptors.
  */
-static void remind_hooks(lua_State *L)
+static char evctxkey;
+static char callbackkey;
+static char eventcallbackkey;
+static char decoderkey;
+
+static void release_evctx(evctx_t *ctx)
 {
-  if (anchor.count == 0){
-    /* empty slot table: remind old hook */
-    dprintf("remind_hooks\n");
-    oldhook = lua_gethook(L);
-    oldmask = lua_gethookmask(L);
-    oldcount = lua_gethookcount(L);
+  int refs;
+  pthread_mutex_lock(&ctx->mutex);
+  refs = --ctx->refs;
+  pthread_mutex_unlock(&ctx->mutex);
+  if (refs > 0)
+    return;
+  pthread_mutex_destroy(&ctx->mutex);
+  pthread_cond_destroy(&ctx->queued);
+  free(ctx);
+}
+
+/*
+ * Drop one queued event of a callback. Returns TRUE if the callback
+ * descriptor can be freed. Must be called with ctx->mutex locked.
+ */
+static int drop_event(luacallback_t *cb)
+{
+  return (--cb->pending == 0) && cb->cancelled;
+}
+
+static void free_callback(luacallback_t *cb)
+{
+  evctx_t *ctx = cb->ctx;
+  free(cb);
+  release_evctx(ctx);
+}
+
+/*
+ * Cancel a callback with pigpiod_if2 and release its Lua values.
+ * The descriptor is freed as soon as no event refers to it anymore.
+ */
+static int cancel_callback(lua_State *L, luacallback_t *cb)
+{
+  int res, freeit;
+  evctx_t *ctx = cb->ctx;
+
+  if (cb->type == CALLBACK)
+    res = callback_cancel(cb->id);
+  else if (cb->type == DECODER)
+    res = decoder_cancel(cb->id);
+  else
+    res = event_callback_cancel(cb->id);
+  /* no dispatch of this callback beyond this point */
+  luaL_unref(L, LUA_REGISTRYINDEX, cb->sref);
+  luaL_unref(L, LUA_REGISTRYINDEX, cb->fref);
+  luaL_unref(L, LUA_REGISTRYINDEX, cb->uref);
+  pthread_mutex_lock(&ctx->mutex);
+  cb->cancelled = TRUE;
+  freeit = (cb->pending == 0);
+  pthread_mutex_unlock(&ctx->mutex);
+  if (freeit)
+    free_callback(cb);
+  return res;
+}
+
+/*
+ * Cancel all callbacks listed in the registry table with given key.
+ */
+static void cancel_all(lua_State *L, void *key)
+{
+  lua_rawgetp(L, LUA_REGISTRYINDEX, key);
+  if (lua_istable(L, -1)){
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0){
+      cancel_callback(L, lua_touserdata(L, -1));
+      lua_pop(L, 1);
+    }
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+  }
+  lua_pop(L, 1);
+}
+
+/*
+ * Collected with the Lua state: cancel all callbacks of the state and
+ * drop events still waiting for dispatch.
+ */
+static int evctx_gc(lua_State *L)
+{
+  evctx_t **ctxp = luaL_checkudata(L, 1, EVCTX_MT);
+  evctx_t *ctx = *ctxp;
+  event_t *event, *freelist = NULL;
+
+  pthread_mutex_lock(&ctx->mutex);
+  ctx->L = NULL;
+  while ((event = ctx->anchor.first) != NULL){
+    ctx->anchor.first = event->next;
+    if (event->cb->latest == event)
+      event->cb->latest = NULL;
+    if (drop_event(event->cb)){
+      /* defer: free_callback needs ctx->mutex */
+      event->next = freelist;
+      freelist = event;
+    } else
+      free(event);
+  }
+  ctx->anchor.count = 0;
+  pthread_mutex_unlock(&ctx->mutex);
+  while ((event = freelist) != NULL){
+    freelist = event->next;
+    free_callback(event->cb);
+    free(event);
+  }
+  cancel_all(L, &callbackkey);
+  cancel_all(L, &eventcallbackkey);
+  cancel_all(L, &decoderkey);
+  release_evctx(ctx);
+  *ctxp = NULL;
+  return 0;
+}
+
+/*
+ * Get the event context of a Lua state, create it on first use.
+ */
+static evctx_t *get_evctx(lua_State *L)
+{
+  evctx_t **ctxp;
+  evctx_t *ctx;
+  pthread_condattr_t attr;
+
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &evctxkey);
+  if (lua_isnil(L, -1) == 0){
+    ctx = *((evctx_t **) lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return ctx;
+  }
+  lua_pop(L, 1);
+  ctx = calloc(1, sizeof(evctx_t));
+  if (ctx == NULL)
+    luaL_error(L, "Cannot allocate event context.");
+  /* events are always dispatched in the main thread of the state */
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  ctx->L = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  ctx->anchor.limit = LIMIT_EVENT_QUEUE;
+  ctx->refs = 1;
+  pthread_mutex_init(&ctx->mutex, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&ctx->queued, &attr);
+  pthread_condattr_destroy(&attr);
+  ctxp = lua_newuserdata(L, sizeof(evctx_t *));
+  *ctxp = ctx;
+  if (luaL_newmetatable(L, EVCTX_MT)){
+    lua_pushcfunction(L, evctx_gc);
+    lua_setfield(L, -2, "__gc");
   }
+  lua_setmetatable(L, -2);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &evctxkey);
+  return ctx;
+}
+
+/*
+ * Create a callback descriptor for the function at stack index func and
+ * the user value at index udata, which are called with the session at
+ * index sess.
+ */
+static luacallback_t *new_callback(lua_State *L, evctx_t *ctx, slottype_t type,
+                                   int pi, int sess, int func, int udata)
+{
+  luacallback_t *cb = calloc(1, sizeof(luacallback_t));
+  if (cb == NULL)
+    luaL_error(L, "Cannot allocate callback.");
+  cb->ctx = ctx;
+  cb->type = type;
+  cb->pi = pi;
+  lua_pushvalue(L, sess);
+  cb->sref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_pushvalue(L, func);
+  cb->fref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_pushvalue(L, udata);
+  cb->uref = luaL_ref(L, LUA_REGISTRYINDEX);
+  pthread_mutex_lock(&ctx->mutex);
+  ctx->refs++;
+  pthread_mutex_unlock(&ctx->mutex);
+  return cb;
+}
+
+/*
+ * Finish registration: on success remember the descriptor under its id,
+ * otherwise drop it.
+ */
+static void register_callback(lua_State *L, void *key, luacallback_t *cb, int id)
+{
+  if (id < 0){
+    luaL_unref(L, LUA_REGISTRYINDEX, cb->sref);
+    luaL_unref(L, LUA_REGISTRYINDEX, cb->fref);
+    luaL_unref(L, LUA_REGISTRYINDEX, cb->uref);
+    free_callback(cb);
+    return;
+  }
+  cb->id = id;
+  lua_rawgetp(L, LUA_REGISTRYINDEX, key);
+  if (lua_isnil(L, -1)){
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+  }
+  lua_pushlightuserdata(L, cb);
+  lua_rawseti(L, -2, id);
+  lua_pop(L, 1);
+}
+
+/*
+ * Remove the descriptor with given id from the registry table.
+ * Returns NULL if this state does not own such a callback.
+ */
+static luacallback_t *unregister_callback(lua_State *L, void *key, int id)
+{
+  luacallback_t *cb = NULL;
+  lua_rawgetp(L, LUA_REGISTRYINDEX, key);
+  if (lua_istable(L, -1)){
+    lua_rawgeti(L, -1, id);
+    cb = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, id);
+  }
+  lua_pop(L, 1);
+  return cb;
 }
 
 /* 
  * Hook handler:
- * Process all slots with a valid entry and call the corresponding Lua callback.
+ * Process all events queued for this Lua state and call the corresponding
+ * Lua callback.
  * - callback(sess, pin, level, tick, uparam)
  * - eventcallback(sess, event, tick, uparam)
+ * - decoder(sess, id, tick, uparam, data...)
  * When all callbacks are processed the Lua hook is restored.
  */
 static void handler(lua_State *L, lua_Debug *ar)
 {
   (void) ar;
+  evctx_t *ctx = get_evctx(L);
   event_t *event;
-  event = dequeue(&anchor);
+  luacallback_t *cb;
+  int nargs, freeit;
+  unsigned i;
+
+  event = dequeue(ctx);
   dprintf("HANDLER 1: %p qlen=%d qfirst=%p qlast=%p\n",
-          event, anchor.count, anchor.first, anchor.last);
+          event, ctx->anchor.count, ctx->anchor.first, ctx->anchor.last);
   while (event != NULL) {
-    switch (event->type){
-    case CALLBACK:
-      {
-        callbackfuncEx_t *cbfunc = &callbackfuncsEx[event->slot.callback.index];
+    cb = event->cb;
+    nargs = -1;
+    if (cb->cancelled == FALSE){
+      lua_rawgeti(L, LUA_REGISTRYINDEX, cb->fref);     /* func */
+      lua_rawgeti(L, LUA_REGISTRYINDEX, cb->sref);     /* sess, func */
+      switch (event->type){
+      case CALLBACK:
         dprintf("HANDLER 2.1: ev.index=%d ev.level=%d ev.tick=%d\n",
-                event->slot.callback.index, even->slot.callback.level,  event->slot.callback.tick);
-        lua_pushlightuserdata(L, &cbfunc->f);            
-        lua_gettable(L, LUA_REGISTRYINDEX);              /* func */
-        lua_getglobal(L, PIGPIO_SESSIONS);               /* stab, func */
-        lua_pushnumber(L, event->slot.callback.pi);      /* handle, stab, func */
-        lua_gettable(L, -2);                             /* sess, stab, func */
-        lua_replace(L, -2);                              /* sess, func */
+                event->slot.callback.index, event->slot.callback.level,
+                event->slot.callback.tick);
         lua_pushnumber(L, event->slot.callback.index);
         lua_pushnumber(L, event->slot.callback.level);
         lua_pushnumber(L, event->slot.callback.tick);
-        lua_pushlightuserdata(L, &cbfunc->u);
-        lua_gettable(L, LUA_REGISTRYINDEX);
-        lua_call(L, 5, 0);
-      }
-      break;
-    case EVENTCALLBACK:
-      {
-        eventcallbackfuncEx_t *cbfunc = &eventcallbackfuncsEx[event->slot.eventcallback.index];
+        nargs = 6;
+        break;
+      case EVENTCALLBACK:
         dprintf("HANDLER 2.2: ev.event=0x%08x ev.tick=%d\n",
-                event->slot.eventcallback.event, even->slot.eventcallback.tick);
-        lua_pushlightuserdata(L, &cbfunc->f);
-        lua_gettable(L, LUA_REGISTRYINDEX);              /* func */
-        lua_getglobal(L, PIGPIO_SESSIONS);               /* stab, func */
-        lua_pushnumber(L, event->slot.callback.pi);      /* handle, stab, func */
-        lua_gettable(L, -2);                             /* sess, stab, func */
-        lua_replace(L, -2);                              /* sess, func */
+                event->slot.eventcallback.index, event->slot.eventcallback.tick);
         lua_pushnumber(L, event->slot.eventcallback.index);
         lua_pushnumber(L, event->slot.eventcallback.tick);
-        lua_pushlightuserdata(L, &cbfunc->u);
-        lua_gettable(L, LUA_REGISTRYINDEX);
-        lua_call(L, 4, 0);
+        nargs = 4;
+        break;
+      case DECODER:
+        lua_pushinteger(L, event->slot.decoder.index);
+        lua_pushnumber(L, event->slot.decoder.tick);
+        nargs = 5 + event->slot.decoder.count;
+        break;
       }
-      break;
+      lua_rawgeti(L, LUA_REGISTRYINDEX, cb->uref);
+      if (event->type == CALLBACK)
+        lua_pushnumber(L, event->slot.callback.count);
+      else if (event->type == DECODER)
+        for (i = 0; i < event->slot.decoder.count; i++)
+          lua_pushinteger(L, event->slot.decoder.data[i]);
     }
-    dprintf("HANDLER 3: almost done. qlen=%d qfirst=%p qlast=%p\n",
-            anchor.count, anchor.first, anchor.last);
+    /* release event before calling: the callback may cancel itself */
+    pthread_mutex_lock(&ctx->mutex);
+    freeit = drop_event(cb);
+    pthread_mutex_unlock(&ctx->mutex);
+    if (freeit)
+      free_callback(cb);
     free(event);
-    event = dequeue(&anchor);
+    if (nargs > 0)
+      lua_call(L, nargs, 0);
+    event = dequeue(ctx);
     dprintf("HANDLER 4: %p qlen=%d qfirst=%p qlast=%p\n",
-            event, anchor.count, anchor.first, anchor.last);
+            event, ctx->anchor.count, ctx->anchor.first, ctx->anchor.last);
   }
-  /* All slots processed: restore old hooks */
-  lua_sethook(L, oldhook, oldmask, oldcount);
 }
 
 /*
- * Append event to tail of event queue.
+ * Wait until monotonic time due and call the Lua callbacks of the events
+ * arriving meanwhile, instead of at the next Lua call or return.
  */
-static int enqueue(anchor_t* anchor, event_t* event)
+void dispatch_until(lua_State *L, const struct timespec *due)
 {
-  pthread_mutex_lock(&eventmutex);
-  if (anchor->count < anchor->limit){
+  evctx_t *ctx = get_evctx(L);
+  struct timespec now;
+  int res = 0, pending;
+
+  do {
+    pthread_mutex_lock(&ctx->mutex);
+    while (ctx->anchor.count == 0 && res != ETIMEDOUT)
+      res = pthread_cond_timedwait(&ctx->queued, &ctx->mutex, due);
+    pending = ctx->anchor.count;
+    pthread_mutex_unlock(&ctx->mutex);
+    if (pending > 0)
+      handler(L, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } while (res != ETIMEDOUT &&
+           (now.tv_sec < due->tv_sec ||
+            (now.tv_sec == due->tv_sec && now.tv_nsec < due->tv_nsec)));
+}
+
+/*
+ * Append event to tail of the event queue of a Lua state and arm the
+ * dispatch hook of the state.
+ * The previous hook of the state is saved and restored by dequeue() once
+ * the queue has been drained.
+ */
+static int enqueue(evctx_t *ctx, event_t* event)
+{
+  int res;
+  pthread_mutex_lock(&ctx->mutex);
+  res = enqueue_locked(ctx, event);
+  pthread_mutex_unlock(&ctx->mutex);
+  return res;
+}
+
+/*
+ * Same as enqueue() with ctx->mutex already locked.
+ */
+static int enqueue_locked(evctx_t *ctx, event_t* event)
+{
+  anchor_t *anchor = &ctx->anchor;
+  if (ctx->L != NULL && anchor->count < anchor->limit){
+    event->next = NULL;
+    event->cb->pending++;
     if (anchor->count++ == 0)
       /* list empty: event becomes first in queue */
       anchor->first = anchor->last = event;
@@ -432,137 +1014,445 @@ static int enqueue(anchor_t* anchor, event_t* event)
       anchor->last->next = event;
       anchor->last = event;
     }
+    pthread_cond_signal(&ctx->queued);
+    pthread_mutex_lock(&eventmutex);
     if (anchor->count > eventstat.maxcount)
       eventstat.maxcount = anchor->count;
-    dprintf2("eq: cnt=%d max=%d\n", anchor->count, eventstat.maxcount);
     pthread_mutex_unlock(&eventmutex);
+    dprintf2("eq: cnt=%d max=%d\n", anchor->count, eventstat.maxcount);
+    if (ctx->armed == FALSE){
+      ctx->oldhook = lua_gethook(ctx->L);
+      ctx->oldmask = lua_gethookmask(ctx->L);
+      ctx->oldcount = lua_gethookcount(ctx->L);
+      ctx->armed = TRUE;
+      lua_sethook(ctx->L, handler, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+    }
     return 0;
   } else {
+    pthread_mutex_lock(&eventmutex);
     eventstat.drop++;
-    eprintf("Warning: event drop=%lu at count=%d.\n", eventstat.drop, anchor->count);
     pthread_mutex_unlock(&eventmutex);
+    eprintf("Warning: event drop=%lu at count=%d.\n", eventstat.drop, anchor->count);
+    free(event);
     return -1;
   }  
 }
 
 /*
- * Pop an event from head of event queue.
+ * Pop an event from head of the event queue of a Lua state.
+ * Restores the previous hook of the state when the queue is empty.
  */
-static event_t* dequeue(anchor_t* anchor)
+static event_t* dequeue(evctx_t *ctx)
 {
+  anchor_t *anchor = &ctx->anchor;
   event_t* current;
-  pthread_mutex_lock(&eventmutex);
-  if (anchor->count-- == 0){
-    anchor->count = 0;
-    pthread_mutex_unlock(&eventmutex);
+  pthread_mutex_lock(&ctx->mutex);
+  if (anchor->count == 0){
+    if (ctx->armed == TRUE){
+      lua_sethook(ctx->L, ctx->oldhook, ctx->oldmask, ctx->oldcount);
+      ctx->armed = FALSE;
+    }
+    pthread_mutex_unlock(&ctx->mutex);
     return NULL;
   }
+  anchor->count--;
   current = anchor->first;
   anchor->first = current->next;
+  if (current->cb->latest == current)
+    /* further edges need a new event */
+    current->cb->latest = NULL;
   dprintf2("dq: %d\n", anchor->count);
-  pthread_mutex_unlock(&eventmutex);
+  pthread_mutex_unlock(&ctx->mutex);
   return current;
 }
 
+/*
+ * Called by the notification thread for each edge. Applies the delivery
+ * policy of the callback: only POLICY_ALL allocates an event per edge.
+ */
 static void callbackFuncEx(int pi, unsigned gpio, unsigned level, uint32_t tick, void *userparam)
 {
-  lua_State *L = userparam;
+  luacallback_t *cb = userparam;
+  evctx_t *ctx = cb->ctx;
   event_t *event;
-  
-  remind_hooks(L);
+
+  pthread_mutex_lock(&ctx->mutex);
+  cb->level = level;
+  switch (cb->policy){
+  case POLICY_COUNT:
+    cb->total++;
+    cb->tick = tick;
+    pthread_mutex_unlock(&ctx->mutex);
+    return;
+  case POLICY_LATEST:
+    if (cb->latest != NULL){
+      /* update the event still waiting for dispatch */
+      cb->latest->slot.callback.level = level;
+      cb->latest->slot.callback.tick = tick;
+      cb->latest->slot.callback.count++;
+      pthread_mutex_unlock(&ctx->mutex);
+      return;
+    }
+    break;
+  case POLICY_RATE:
+    cb->edges++;
+    if (cb->delivered && (uint32_t)(tick - cb->tick) < cb->interval){
+      pthread_mutex_unlock(&ctx->mutex);
+      return;
+    }
+    cb->tick = tick;
+    cb->delivered = TRUE;
+    break;
+  default:
+    cb->edges++;
+    break;
+  }
   event = malloc(sizeof(event_t));
+  if (event == NULL){
+    pthread_mutex_unlock(&ctx->mutex);
+    return;
+  }
   event->type = CALLBACK;
+  event->cb = cb;
   event->slot.callback.pi = pi;
   event->slot.callback.index = gpio;
   event->slot.callback.level = level;
   event->slot.callback.tick = tick;
-  enqueue(&anchor, event);
-  lua_sethook(L, handler, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);  
+  event->slot.callback.count = (cb->policy == POLICY_LATEST) ? 1 : cb->edges;
+  cb->edges = 0;
+  if (enqueue_locked(ctx, event) == 0 && cb->policy == POLICY_LATEST)
+    cb->latest = event;
+  pthread_mutex_unlock(&ctx->mutex);
 }
 
 /*
- * Lua binding: id = callback(pi, gpio, edge, func[, userdata])
+ * Lua binding: id = callback(sess, gpio, edge, func[, userdata[, policy[, rate]]])
+ * Events are delivered to the Lua state registering the callback.
+ * Any number of callbacks may be registered for the same pin.
  */
 int utlCallback(lua_State *L)
 {
   unsigned gpio, edge;
-  callbackfuncEx_t *cbfunc;
-  int pi, retval;
+  luacallback_t *cb;
+  int pi, retval, policy;
+  double rate;
   
-  pi = (int) luaL_checkinteger(L, 1);
+  pi = object_pi(L, 1);
   gpio = (int) get_numarg(L, 2, 0, MAX_CALLBACKS - 1);
   edge = get_numarg(L, 3, RISING_EDGE, EITHER_EDGE);
-  if (lua_isfunction(L, 4) == 0){
+  policy = (int) luaL_optinteger(L, 6, POLICY_ALL);
+  rate = luaL_optnumber(L, 7, 0);
+  if (policy < POLICY_ALL || policy > POLICY_COUNT)
+    luaL_error(L, "Invalid delivery policy %d.", policy);
+  if (policy == POLICY_RATE && rate <= 0)
+    luaL_error(L, "Positive rate expected for rate limited callback.");
+  if (lua_isfunction(L, 4) == 0 && !(policy == POLICY_COUNT && lua_isnil(L, 4))){
     luaL_error(L, "Function expected as arg 3, receive %s.", lua_typename(L, lua_type(L, 4)));
   }
-  cbfunc = &callbackfuncsEx[gpio];
-  cbfunc->f = callbackFuncEx;
-  lua_pushlightuserdata(L, &cbfunc->f);
-  lua_pushvalue(L, 4);
-  lua_settable(L, LUA_REGISTRYINDEX);
-  if (lua_isnoneornil(L, 5) == 1){
-    lua_pushlightuserdata(L, &cbfunc->u);
-    lua_pushnil(L);
-  } else {
-    lua_pushlightuserdata(L, &cbfunc->u);
-    lua_pushvalue(L, 5);
-  }
-  lua_settable(L, LUA_REGISTRYINDEX);
-  LL = L;
-  retval = callback_ex(pi, gpio, edge, cbfunc->f, L);
+  lua_settop(L, 5);
+  cb = new_callback(L, get_evctx(L), CALLBACK, pi, 1, 4, 5);
+  cb->policy = policy;
+  if (policy == POLICY_RATE)
+    cb->interval = (rate >= 1e6) ? 1 : (uint32_t)(1e6 / rate);
+  retval = callback_ex(pi, gpio, edge, callbackFuncEx, cb);
+  register_callback(L, &callbackkey, cb, retval);
   lua_pushnumber(L, retval);
   return 1;
 }
 
 static void eventCallbackFuncEx(int pi, unsigned uevent, uint32_t tick, void *userparam)
 {
-  lua_State *L = userparam;
+  luacallback_t *cb = userparam;
   event_t *event;
   
-  remind_hooks(L);
   event = malloc(sizeof(event_t));
   event->type = EVENTCALLBACK;
+  event->cb = cb;
+  event->slot.eventcallback.pi = pi;
   event->slot.eventcallback.index = uevent;
   event->slot.eventcallback.tick = tick;
-  enqueue(&anchor, event);
-  lua_sethook(L, handler, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);  
+  enqueue(cb->ctx, event);
 }
 
 /*
- * Lua binding: id = eventCallback(pi, event, func[, userdata])
+ * Lua binding: id = eventCallback(sess, event, func[, userdata])
+ * Events are delivered to the Lua state registering the callback.
  */
 int utlEventCallback(lua_State *L)
 {
   int pi, retval;
   unsigned int event;
-  eventcallbackfuncEx_t *cbfunc;
+  luacallback_t *cb;
 
-  pi = (int) luaL_checkinteger(L, 1);
+  pi = object_pi(L, 1);
   event = get_numarg(L, 2, 0, MAX_EVENTCALLBACKS - 1);
   if (lua_isfunction(L, 3) == 0){
     luaL_error(L, "Function expected as arg 2, received %s.", lua_typename(L, lua_type(L, 2)));
   }
-  cbfunc = &eventcallbackfuncsEx[event];
-  cbfunc->f = eventCallbackFuncEx;
-  lua_pushlightuserdata(L, &cbfunc->f);
-  lua_pushvalue(L, 3);
-  lua_settable(L, LUA_REGISTRYINDEX);
-  if (lua_isnoneornil(L, 4) == 1){
-    lua_pushlightuserdata(L, &cbfunc->u);
+  lua_settop(L, 4);
+  cb = new_callback(L, get_evctx(L), EVENTCALLBACK, pi, 1, 3, 4);
+  retval = event_callback_ex(pi, event, eventCallbackFuncEx, cb);
+  register_callback(L, &eventcallbackkey, cb, retval);
+  lua_pushnumber(L, retval);
+  return 1;
+}
+
+/*
+ * Lua binding: res = cancelCallback(id)
+ * Must be called from the Lua state which registered the callback.
+ */
+int utlCallbackCancel(lua_State *L)
+{
+  luacallback_t *cb;
+  cb = unregister_callback(L, &callbackkey, (int) luaL_checkinteger(L, 1));
+  lua_pushinteger(L, cb ? cancel_callback(L, cb) : pigif_callback_not_found);
+  return 1;
+}
+
+/*
+ * Lua binding: count, level, tick = callbackCount(id[, reset])
+ * Edges seen by a callback with POLICY_COUNT.
+ */
+int utlCallbackCount(lua_State *L)
+{
+  luacallback_t *cb;
+  int id = (int) luaL_checkinteger(L, 1);
+  int reset = lua_toboolean(L, 2);
+  unsigned long total;
+  int level;
+  uint32_t tick;
+
+  cb = NULL;
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &callbackkey);
+  if (lua_istable(L, -1)){
+    lua_rawgeti(L, -1, id);
+    cb = lua_touserdata(L, -1);
+  }
+  if (cb == NULL){
     lua_pushnil(L);
+    lua_pushnumber(L, pigif_callback_not_found);
+    return 2;
+  }
+  pthread_mutex_lock(&cb->ctx->mutex);
+  total = cb->total;
+  level = cb->level;
+  tick = cb->tick;
+  if (reset)
+    cb->total = 0;
+  pthread_mutex_unlock(&cb->ctx->mutex);
+  lua_pushinteger(L, total);
+  lua_pushinteger(L, level);
+  lua_pushnumber(L, tick);
+  return 3;
+}
+
+/*
+ * Lua binding: res = cancelEventCallback(id)
+ * Must be called from the Lua state which registered the callback.
+ */
+int utlEventCallbackCancel(lua_State *L)
+{
+  luacallback_t *cb;
+  cb = unregister_callback(L, &eventcallbackkey, (int) luaL_checkinteger(L, 1));
+  lua_pushinteger(L, cb ? cancel_callback(L, cb) : pigif_callback_not_found);
+  return 1;
+}
+
+/*
+ * Lua binding: res = counter_start(pi, gpio)
+ * The counter functions are bound natively: they are not declared by the
+ * pigpiod_if2.h wrapped by SWIG.
+ */
+int utlCounterStart(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned gpio = get_numarg(L, 2, 0, MAX_CALLBACKS - 1);
+  lua_pushinteger(L, counter_start(pi, gpio));
+  return 1;
+}
+
+/*
+ * Lua binding: res = counter_stop(pi, gpio)
+ */
+int utlCounterStop(lua_State *L)
+{
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned gpio = get_numarg(L, 2, 0, MAX_CALLBACKS - 1);
+  lua_pushinteger(L, counter_stop(pi, gpio));
+  return 1;
+}
+
+/*
+ * Lua binding: counter = counterRead(pi, gpio, reset)
+ * counter = {edges=, rising=, falling=, level=, tick=, period=, minperiod=,
+ *            maxperiod=, meanperiod=, frequency=, duty=, window=}
+ */
+int utlCounterRead(lua_State *L)
+{
+  gpioCounter_t c;
+  int pi, res;
+  unsigned gpio;
+
+  pi = (int) luaL_checkinteger(L, 1);
+  gpio = get_numarg(L, 2, 0, MAX_CALLBACKS - 1);
+  res = counter_read(pi, gpio, &c, lua_toboolean(L, 3));
+  if (res < 0){
+    lua_pushnil(L);
+    lua_pushnumber(L, res);
+    return 2;
+  }
+  lua_createtable(L, 0, 12);
+  lua_pushinteger(L, c.edges);
+  lua_setfield(L, -2, "edges");
+  lua_pushinteger(L, c.rising);
+  lua_setfield(L, -2, "rising");
+  lua_pushinteger(L, c.falling);
+  lua_setfield(L, -2, "falling");
+  lua_pushinteger(L, c.level);
+  lua_setfield(L, -2, "level");
+  lua_pushinteger(L, c.tick);
+  lua_setfield(L, -2, "tick");
+  lua_pushinteger(L, c.window);
+  lua_setfield(L, -2, "window");
+  if (c.periods > 0){
+    double mean = (double) c.periodSum / c.periods;
+    lua_pushinteger(L, c.period);
+    lua_setfield(L, -2, "period");
+    lua_pushinteger(L, c.minPeriod);
+    lua_setfield(L, -2, "minperiod");
+    lua_pushinteger(L, c.maxPeriod);
+    lua_setfield(L, -2, "maxperiod");
+    lua_pushnumber(L, mean);
+    lua_setfield(L, -2, "meanperiod");
+    lua_pushnumber(L, mean > 0 ? 1e6 / mean : 0);
+    lua_setfield(L, -2, "frequency");
+  }
+  if (c.highTime + c.lowTime > 0){
+    lua_pushnumber(L, (double) c.highTime / (c.highTime + c.lowTime));
+    lua_setfield(L, -2, "duty");
+  }
+  return 1;
+}
+
+/*
+ * Called by the notification thread for each decoded frame.
+ */
+static void decoderFuncEx(int pi, unsigned id, const uint32_t *data, unsigned count,
+                          uint32_t tick, void *userparam)
+{
+  luacallback_t *cb = userparam;
+  event_t *event;
+
+  event = malloc(sizeof(event_t));
+  if (event == NULL)
+    return;
+  event->type = DECODER;
+  event->cb = cb;
+  event->slot.decoder.pi = pi;
+  event->slot.decoder.index = id;
+  event->slot.decoder.tick = tick;
+  event->slot.decoder.count = count;
+  memcpy(event->slot.decoder.data, data, count * sizeof(uint32_t));
+  enqueue(cb->ctx, event);
+}
+
+/*
+ * Read up to max integers from the array at stack index arg.
+ */
+static unsigned get_intarray(lua_State *L, int arg, unsigned *uvals, int *ivals, unsigned max)
+{
+  unsigned i, n;
+
+  if (lua_isnoneornil(L, arg))
+    return 0;
+  luaL_checktype(L, arg, LUA_TTABLE);
+  n = lua_rawlen(L, arg);
+  if (n > max)
+    luaL_error(L, "At most %d values expected, received %d.", max, n);
+  for (i = 0; i < n; i++){
+    lua_rawgeti(L, arg, i + 1);
+    if (uvals != NULL)
+      uvals[i] = (unsigned) luaL_checkinteger(L, -1);
+    else
+      ivals[i] = (int) luaL_checkinteger(L, -1);
+    lua_pop(L, 1);
+  }
+  return n;
+}
+
+/*
+ * Lua binding: id = decoderStart(sess, name, gpios, params, watchdog[, func[, userdata]])
+ * Frames are delivered to the Lua state starting the decoder. Without
+ * func the last frame can only be polled with decoderRead().
+ */
+int utlDecoderStart(lua_State *L)
+{
+  unsigned gpio[DECODER_MAX_GPIO], ngpio, nparam, watchdog;
+  int param[DECODER_MAX_PARAM];
+  const char *name;
+  luacallback_t *cb = NULL;
+  int pi, retval;
+
+  pi = object_pi(L, 1);
+  name = luaL_checkstring(L, 2);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  ngpio = get_intarray(L, 3, gpio, NULL, DECODER_MAX_GPIO);
+  nparam = get_intarray(L, 4, NULL, param, DECODER_MAX_PARAM);
+  watchdog = (unsigned) luaL_optinteger(L, 5, 0);
+  if (lua_isnoneornil(L, 6) == 0 && lua_isfunction(L, 6) == 0)
+    luaL_error(L, "Function expected as arg 5, received %s.", lua_typename(L, lua_type(L, 6)));
+  lua_settop(L, 7);
+  if (lua_isnil(L, 6)){
+    retval = decoder_start(pi, name, gpio, ngpio, param, nparam, watchdog, NULL, NULL);
   } else {
-    lua_pushlightuserdata(L, &cbfunc->u);
-    lua_pushvalue(L, 4);
+    cb = new_callback(L, get_evctx(L), DECODER, pi, 1, 6, 7);
+    retval = decoder_start(pi, name, gpio, ngpio, param, nparam, watchdog, decoderFuncEx, cb);
+    register_callback(L, &decoderkey, cb, retval);
   }
-  lua_settable(L, LUA_REGISTRYINDEX);
-  LL = L;
-  retval = event_callback_ex(pi, event, cbfunc->f, L);
-  lua_pushnumber(L, retval);
+  lua_pushinteger(L, retval);
   return 1;
 }
 
 /*
- * Lua binding: str = serial<xx>:read(n)
+ * Lua binding: tick, data... = decoderRead(id)
+ * Returns the last frame of a decoder, nothing if no frame was decoded yet.
+ */
+int utlDecoderRead(lua_State *L)
+{
+  uint32_t data[DECODER_MAX_DATA], tick;
+  int i, n;
+
+  n = decoder_read((unsigned) luaL_checkinteger(L, 1), data, DECODER_MAX_DATA, &tick);
+  if (n < 0){
+    lua_pushnil(L);
+    lua_pushinteger(L, n);
+    return 2;
+  }
+  if (n == 0)
+    return 0;
+  lua_pushnumber(L, tick);
+  for (i = 0; i < n; i++)
+    lua_pushinteger(L, data[i]);
+  return n + 1;
+}
+
+/*
+ * Lua binding: res = decoderCancel(id)
+ * Decoders with a Lua function must be cancelled by the Lua state which
+ * started them.
+ */
+int utlDecoderCancel(lua_State *L)
+{
+  luacallback_t *cb;
+  int id = (int) luaL_checkinteger(L, 1);
+
+  cb = unregister_callback(L, &decoderkey, id);
+  lua_pushinteger(L, cb ? cancel_callback(L, cb) : decoder_cancel(id));
+  return 1;
+}
+
+/*
+ * Lua binding: str = serial<xx>:read(n[, dest])
  */
 static int _utlSerialRead(lua_State *L, int bb)
 {
@@ -573,26 +1463,22 @@ static int _utlSerialRead(lua_State *L, int bb)
   pi = (int) luaL_checkinteger(L, 1);
   handle = (lua_Unsigned) luaL_checkinteger(L, 2);
   n = (int) luaL_checkinteger(L, 3);
-  luaL_buffinit(L, &lbuf);
-  cbuf = malloc(n * sizeof(char));
+  /* read straight into the Lua buffer or array */
+  cbuf = result_buffer(L, 4, n, &lbuf);
   if (bb == 1)
     nbytes = bb_serial_read(pi, handle, cbuf, n);
   else
     nbytes = serial_read(pi, handle, cbuf, n);
   if (nbytes < 0){
-    free(cbuf);
     lua_pushnil(L);
     lua_pushnumber(L, nbytes);
     return 2;
   }
-  luaL_addlstring(&lbuf, cbuf, nbytes);
-  free(cbuf);
-  luaL_pushresult(&lbuf);
-  return 1;
+  return push_result(L, 4, &lbuf, nbytes);
 }
 
 /*
- * Lua binding: str = serial:read(n)
+ * Lua binding: str = serial:read(n[, dest])
  */
 int utlSerialRead(lua_State *L)
 {
@@ -600,7 +1486,7 @@ int utlSerialRead(lua_State *L)
 }
 
 /*
- * Lua binding: str = serial:read(n)
+ * Lua binding: str = serialbb:read(n[, dest])
  */
 int utlSerialbbRead(lua_State *L)
 {
@@ -608,7 +1494,7 @@ int utlSerialbbRead(lua_State *L)
 }
 
 /*
- * Lua binding: str = i2c:readBlockData(reg)
+ * Lua binding: str = i2c:readBlockData(reg[, dest])
  */
 int utlI2CReadBlockData(lua_State *L)
 {
@@ -619,19 +1505,14 @@ int utlI2CReadBlockData(lua_State *L)
   pi = (int) luaL_checkinteger(L, 1);
   handle = (lua_Unsigned) luaL_checkinteger(L, 2);
   reg = (lua_Unsigned) luaL_checkinteger(L, 3);
-  luaL_buffinit(L, &lbuf);
-  cbuf = malloc(32 * sizeof(char));
+  cbuf = result_buffer(L, 4, 32, &lbuf);
   nbytes = i2c_read_block_data(pi, handle, reg, cbuf);
   if (nbytes < 0){
-    free(cbuf);
     lua_pushnil(L);
     lua_pushnumber(L, nbytes);
     return 2;
   }
-  luaL_addlstring(&lbuf, cbuf, nbytes);
-  free(cbuf);
-  luaL_pushresult(&lbuf);
-  return 1;
+  return push_result(L, 4, &lbuf, nbytes);
 }
 
 /*
@@ -660,7 +1541,7 @@ int utlI2CBlockProcessCall(lua_State *L)
 }
 
 /*
- * Lua binding: str = i2c:readI2CBlockData(reg, nbytes)
+ * Lua binding: str = i2c:readI2CBlockData(reg, nbytes[, dest])
  */
 int utlI2CReadI2CBlockData(lua_State *L)
 {
@@ -672,23 +1553,20 @@ int utlI2CReadI2CBlockData(lua_State *L)
   handle = (lua_Unsigned) luaL_checkinteger(L, 2);
   reg = (lua_Unsigned) luaL_checkinteger(L, 3);
   n = (int) luaL_checkinteger(L, 4);
-  luaL_buffinit(L, &lbuf);
-  cbuf = malloc(32 * sizeof(char));
+  if (n < 1 || n > 32)
+    luaL_error(L, "Number of bytes must be in range of 1 to 32, received %d.", n);
+  cbuf = result_buffer(L, 5, n, &lbuf);
   nbytes = i2c_read_i2c_block_data(pi, handle, reg, cbuf, n);
   if (nbytes < 0){
-    free(cbuf);
     lua_pushnil(L);
     lua_pushnumber(L, nbytes);
     return 2;
   }
-  luaL_addlstring(&lbuf, cbuf, nbytes);
-  free(cbuf);
-  luaL_pushresult(&lbuf);
-  return 1;
+  return push_result(L, 5, &lbuf, nbytes);
 }
 
 /*
- * Lua binding: str = i2c:readDevice(nbytes)
+ * Lua binding: str = i2c:readDevice(nbytes[, dest])
  */
 int utlI2CReadDevice(lua_State *L)
 {
@@ -699,19 +1577,14 @@ int utlI2CReadDevice(lua_State *L)
   pi = (int) luaL_checkinteger(L, 1);
   handle = (lua_Unsigned) luaL_checkinteger(L, 2);
   n = (int) luaL_checkinteger(L, 3);
-  luaL_buffinit(L, &lbuf);
-  cbuf = malloc(n * sizeof(char));
+  cbuf = result_buffer(L, 4, n, &lbuf);
   nbytes = i2c_read_device(pi, handle, cbuf, n);
   if (nbytes < 0){
-    free(cbuf);
     lua_pushnil(L);
     lua_pushnumber(L, nbytes);
     return 2;
   }
-  luaL_addlstring(&lbuf, cbuf, nbytes);
-  free(cbuf);
-  luaL_pushresult(&lbuf);
-  return 1;
+  return push_result(L, 4, &lbuf, nbytes);
 }
 
 /*
@@ -729,11 +1602,18 @@ static int _utlI2CZip(lua_State *L, int bb)
   inbuf = (char *) luaL_checkstring(L, 3);
   m = luaL_len(L, 3);
   n = (int) luaL_checkinteger(L, 4);
+  luaL_buffinit(L, &lbuf);
   cbuf = malloc(n * sizeof(char));
   if (bb == 1)
     nbytes = bb_i2c_zip(pi, handle, inbuf, m, cbuf, n);
   else
     nbytes = i2c_zip(pi, handle, inbuf, m, cbuf, n);
+  if (nbytes < 0){
+    free(cbuf);
+    lua_pushnil(L);
+    lua_pushnumber(L, nbytes);
+    return 2;
+  }
   luaL_addlstring(&lbuf, cbuf, nbytes);
   free(cbuf);
   luaL_pushresult(&lbuf);
@@ -772,7 +1652,7 @@ int clear_event_statistics(void)
 }
 
 /*
- * Lua binding: str = spi:read(n)
+ * Lua binding: str = spi:read(n[, dest])
  */
 int utlSPIRead(lua_State *L)
 {
@@ -783,23 +1663,20 @@ int utlSPIRead(lua_State *L)
   pi = (int) luaL_checkinteger(L, 1);
   handle = (lua_Unsigned) luaL_checkinteger(L, 2);
   n = (int) luaL_checkinteger(L, 3);
-  luaL_buffinit(L, &lbuf);
-  cbuf = malloc(n * sizeof(char));
+  cbuf = result_buffer(L, 4, n, &lbuf);
   nbytes = spi_read(pi, handle, cbuf, n);
   if (nbytes < 0){
-    free(cbuf);
     lua_pushnil(L);
     lua_pushnumber(L, nbytes);
     return 2;
   }
-  luaL_addlstring(&lbuf, cbuf, nbytes);
-  free(cbuf);
-  luaL_pushresult(&lbuf);
-  return 1;  
+  return push_result(L, 4, &lbuf, nbytes);
 }
 
 /*
- * Lua binding: str = spi<bb>:transfer(data)
+ * Lua binding: str = spi<bb>:transfer(data[, n[, dest]])
+ * data is a string or an array. With array dest given, the bytes
+ * received are stored in dest, which is returned with their number.
  */
 static int _utlSPITransfer(lua_State *L, int bb)
 {
@@ -807,26 +1684,24 @@ static int _utlSPITransfer(lua_State *L, int bb)
   lua_Unsigned handle;
   luaL_Buffer lbuf;
   char *rxbuf, *txbuf;
+  size_t len;
   pi = (int) luaL_checkinteger(L, 1);
   handle = (lua_Unsigned) luaL_checkinteger(L, 2);
-  txbuf = (char *)luaL_checkstring(L, 3);
-  n = (int) luaL_checkinteger(L, 4);
-  luaL_buffinit(L, &lbuf);
-  rxbuf = malloc(n * sizeof(char));
+  txbuf = (char *) array_bytes(L, 3, &len);
+  n = (int) luaL_optinteger(L, 4, len);
+  if (n < 0 || (size_t) n > len)
+    luaL_error(L, "Cannot transfer %d of %d bytes.", n, (int) len);
+  rxbuf = result_buffer(L, 5, n, &lbuf);
   if (bb == 1)
     nbytes = bb_spi_xfer(pi, handle, txbuf, rxbuf, n);
   else
     nbytes = spi_xfer(pi, handle, txbuf, rxbuf, n);
   if (nbytes < 0){
-    free(rxbuf);
     lua_pushnil(L);
     lua_pushnumber(L, nbytes);
     return 2;
   }
-  luaL_addlstring(&lbuf, rxbuf, nbytes);
-  free(rxbuf);
-  luaL_pushresult(&lbuf);
-  return 1;  
+  return push_result(L, 5, &lbuf, nbytes);
 }
 
 /*
@@ -846,7 +1721,7 @@ int utlSPIbbTransfer(lua_State *L)
 }
 
 /*
- * Lua binding: str = file:read(n)
+ * Lua binding: str = file:read(n[, dest])
  */
 int utlFileRead(lua_State *L)
 {
@@ -857,44 +1732,14 @@ int utlFileRead(lua_State *L)
   pi = (int) luaL_checkinteger(L, 1);
   handle = (lua_Unsigned) luaL_checkinteger(L, 2);
   n = (int) luaL_checkinteger(L, 3);
-  luaL_buffinit(L, &lbuf);
-  cbuf = malloc(n * sizeof(char));
+  cbuf = result_buffer(L, 4, n, &lbuf);
   nbytes = file_read(pi, handle, cbuf, n);
   if (nbytes < 0){
-    free(cbuf);
     lua_pushnil(L);
     lua_pushnumber(L, nbytes);
     return 2;
   }
-  luaL_addlstring(&lbuf, cbuf, nbytes);
-  free(cbuf);
-  luaL_pushresult(&lbuf);
-  return 1;
-}
-
-/*
- * Lua binding: files = session:listFiles(pattern)
- */
-int utlFileList(lua_State *L)
-{
-  int pi, n = LIST_FILE_BUFSIZE, nbytes;
-  luaL_Buffer lbuf;
-  char *cbuf, *pattern;
-  pi = (int) luaL_checkinteger(L, 1);
-  pattern = (char *)luaL_checkstring(L, 2);
-  luaL_buffinit(L, &lbuf);
-  cbuf = malloc(n * sizeof(char));
-  nbytes = file_list(pi, pattern, cbuf, n);
-  if (nbytes < 0){
-    free(cbuf);
-    lua_pushnil(L);
-    lua_pushnumber(L, nbytes);
-    return 2;
-  }
-  luaL_addlstring(&lbuf, cbuf, nbytes);
-  free(cbuf);
-  luaL_pushresult(&lbuf);
-  return 1;  
+  return push_result(L, 4, &lbuf, nbytes);
 }
 
 /*
@@ -929,3 +1774,55 @@ int utlI2CSlaveTransfer(lua_State *L)
   return 2;  
 }
 
+
+/*
+ * Lua binding: nbytes = write_chunked(pi, kind, handle, data[, chunksize])
+ * kind is one of "serial", "spi", "i2c" or "file". Data larger than
+ * chunksize is sent as a pipeline of writes, each addressing its part of
+ * the Lua string in place. Returns the number of bytes written, on
+ * failure nil, the error code of the first failing write and the number
+ * of bytes written before.
+ */
+int utlWriteChunked(lua_State *L)
+{
+  static const char *const kinds[] = {"serial", "spi", "i2c", "file", NULL};
+  static const unsigned cmdcodes[] = {PI_CMD_SERW, PI_CMD_SPIW, PI_CMD_I2CWD, PI_CMD_FW};
+  int pi = (int) luaL_checkinteger(L, 1);
+  unsigned cmd = cmdcodes[luaL_checkoption(L, 2, NULL, kinds)];
+  unsigned handle = (unsigned) luaL_checkinteger(L, 3);
+  size_t len, off;
+  char *data = (char *) array_bytes(L, 4, &len);
+  lua_Integer chunk = luaL_optinteger(L, 5, WRITE_CHUNK_MAX);
+  pipe_cmd_t *cmds;
+  unsigned i, n;
+  int res;
+
+  if (chunk < 1 || chunk > WRITE_CHUNK_MAX)
+    luaL_error(L, "Chunk size must be in range of 1 to %d.", WRITE_CHUNK_MAX);
+  n = (len == 0) ? 1 : (unsigned) ((len + chunk - 1) / chunk);
+  cmds = lua_newuserdata(L, n * sizeof(pipe_cmd_t));
+  memset(cmds, 0, n * sizeof(pipe_cmd_t));
+  for (i = 0, off = 0; i < n; i++, off += chunk){
+    cmds[i].cmd = cmd;
+    cmds[i].p1 = handle;
+    cmds[i].p3 = (len - off < (size_t) chunk) ? len - off : chunk;
+    cmds[i].ext = data + off;
+  }
+  res = pigpio_pipeline(pi, cmds, n);
+  if (res < 0){
+    lua_pushnil(L);
+    lua_pushinteger(L, res);
+    lua_pushinteger(L, 0);
+    return 3;
+  }
+  for (i = 0, off = 0; i < n; off += cmds[i].p3, i++){
+    if (cmds[i].res < 0){
+      lua_pushnil(L);
+      lua_pushinteger(L, cmds[i].res);
+      lua_pushinteger(L, off);
+      return 3;
+    }
+  }
+  lua_pushinteger(L, len);
+  return 1;
+}
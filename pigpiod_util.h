@@ -2,7 +2,9 @@
 #define PIGPIOD_UTIL_INCL
 
 #include <pthread.h>
+#include <time.h>
 #include "lua.h"
+#include "lauxlib.h"
 #include "pigpiod_if2.h"
 
 #define DEBUG (0)
@@ -16,21 +18,109 @@
 #define MAX_CALLBACKS (32)
 #define MAX_EVENTCALLBACKS (32)
 
-#define PIGPIO_SESSIONS "_PIGPIOD_SESSIONS"
+#define EVCTX_MT "pigpiod.evctx"
 
-#define LIST_FILE_BUFSIZE 4096
+/* the daemon is asked for listings of at most 60000 bytes */
+#define LIST_FILE_BUFSIZE (60000)
 
-struct callbackfuncEx {
-  CBFuncEx_t f;
-  void *u;
+#define THREAD_HOOK_COUNT (1000)
+
+#define REPLAY_MT "pigpiod.replay"
+#define REPLAY_CHUNK (256)
+
+#define POOL_MT "pigpiod.pool"
+#define JOB_MT "pigpiod.job"
+#define POOL_MAX_WORKERS (64)
+#define POOL_CACHE_MAX (64)
+
+#define CHAN_MT "pigpiod.channel"
+
+#define CAPTURE_MT "pigpiod.capture"
+#define CAPFILE_MT "pigpiod.capfile"
+#define CAPTURE_BLOCKSIZE (64 * 1024)
+#define CAPTURE_BUFFERS (8)
+
+#define NOTIFY_MT "pigpiod.notifyreader"
+#define NOTIFY_RING (4096)
+#define NOTIFY_CHUNK (512)
+
+#define ZIP_MT "pigpiod.zip"
+#define I2C_SCAN_BATCH (16)
+
+#define SERIAL_STREAM_MT "pigpiod.serialstream"
+#define SERIAL_RING (4096)
+#define SERIAL_CHUNK (1024)
+#define SERIAL_POLL_MIN (0.001)
+#define SERIAL_POLL_MAX (0.05)
+
+/* largest command extension accepted by the daemon */
+#define WRITE_CHUNK_MAX (65535)
+
+#define FILE_CHUNK_MIN (4096)
+#define FILE_CHUNK_MAX (65535)
+#define FILE_PIPE_DEPTH (8)
+
+#define SPI_SAMPLER_MT "pigpiod.spisampler"
+#define SPI_SAMPLER_RING (65536)
+/* transfers per pipeline, two more commands read the tick */
+#define SPI_SAMPLER_BATCH (62)
+#define SPI_FRAME_MAX (32)
+
+#define TICKCLOCK_MT "pigpiod.tickclock"
+#define TICKCLOCK_BURST (4)
+#define TICKCLOCK_WINDOW (32)
+#define TICKCLOCK_INTERVAL (1.0)
+
+#define TIMER_MT "pigpiod.timer"
+
+#define ARRAY_MT "pigpiod.array"
+
+/*
+ * Values which can be transferred between Lua states.
+ */
+struct tvalue {
+  int type;
+  int isint;
+  union {
+    int b;
+    lua_Integer i;
+    lua_Number n;
+    void *p;
+    struct {
+      char *ptr;
+      size_t len;
+    } s;
+  } v;
+};
+typedef struct tvalue tvalue_t;
+
+enum arraytype {
+  ARRAY_U8 = 0,
+  ARRAY_U16 = 1,
+  ARRAY_U32 = 2,
+  ARRAY_I16 = 3,
+};
+
+/*
+ * Packed numeric array, see pigpiod_array.c.
+ */
+struct array {
+  int type;
+  int swap;        /* elements are stored big endian */
+  size_t count;
+  uint8_t *data;
 };
-typedef struct callbackfuncEx callbackfuncEx_t;
+typedef struct array array_t;
 
-struct eventcallbackfuncEx {
-  evtCBFuncEx_t f;
-  void *u;
+/*
+ * Session or device object, see pigpiod_object.c.
+ */
+struct object {
+  int pi;
+  int handle;      /* < 0: closed */
+  int ref;         /* anchor of an open session */
 };
-typedef struct eventcallbackfuncEx eventcallbackfuncEx_t;
+typedef struct object object_t;
 
 struct threadfunc {
   gpioThreadFunc_t *f;
@@ -38,12 +128,20 @@ struct threadfunc {
   int a;
   pthread_t *t;
   char *n;
+  volatile int stop;
+  int done;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  tvalue_t *results;
+  int nresults;
+  char *errmsg;
 };
 typedef struct threadfunc threadfunc_t;
 
 enum slottype {
                CALLBACK= 0,
                EVENTCALLBACK = 1,
+               DECODER = 2,
 };
 typedef enum slottype slottype_t;
 
@@ -52,6 +150,7 @@ struct callbackslot {
   unsigned index;  
   int level;
   uint32_t tick;
+  unsigned count;
 };
 typedef struct callbackslot callbackslot_t;
 
@@ -62,15 +161,26 @@ struct eventcallbackslot {
 };
 typedef struct eventcallbackslot eventcallbackslot_t;
 
+struct decoderslot {
+  int pi;
+  unsigned index;
+  uint32_t tick;
+  unsigned count;
+  uint32_t data[DECODER_MAX_DATA];
+};
+typedef struct decoderslot decoderslot_t;
+
 union slot {
   callbackslot_t callback;
   eventcallbackslot_t eventcallback;
+  decoderslot_t decoder;
 };
 typedef union slot slot_t;
 
 struct event {
   slottype_t type;
   struct event *next;
+  struct luacallback *cb;
   slot_t slot;
 };
 typedef struct event event_t;
@@ -84,6 +194,58 @@ struct anchor {
 };
 typedef struct anchor anchor_t;
 
+/*
+ * Event queue and dispatch hook of a Lua state.
+ */
+struct evctx {
+  lua_State *L;
+  anchor_t anchor;
+  pthread_mutex_t mutex;
+  pthread_cond_t queued;     /* monotonic clock, signalled per event */
+  int armed;
+  int refs;
+  lua_Hook oldhook;
+  int oldmask;
+  int oldcount;
+};
+typedef struct evctx evctx_t;
+
+/*
+ * Delivery policies of pin callbacks.
+ */
+enum cbpolicy {
+               POLICY_ALL = 0,     /* one event per edge */
+               POLICY_LATEST = 1,  /* one pending event with final level */
+               POLICY_RATE = 2,    /* at most rate events per second */
+               POLICY_COUNT = 3,   /* count edges only */
+};
+typedef enum cbpolicy cbpolicy_t;
+
+/*
+ * A Lua callback registered with pigpiod_if2. The descriptor is passed
+ * as userdata to pigpiod_if2 and carried by each queued event.
+ */
+struct luacallback {
+  evctx_t *ctx;
+  slottype_t type;
+  int id;
+  int pi;
+  int sref;               /* session passed to the Lua function */
+  int fref;
+  int uref;
+  int pending;
+  int cancelled;
+  cbpolicy_t policy;
+  uint32_t interval;       /* POLICY_RATE: minimum distance in us */
+  struct event *latest;    /* POLICY_LATEST: event still queued */
+  unsigned edges;          /* edges not yet delivered */
+  unsigned long total;     /* POLICY_COUNT: edges counted */
+  int level;
+  uint32_t tick;
+  int delivered;           /* POLICY_RATE: tick is valid */
+};
+typedef struct luacallback luacallback_t;
+
 struct eventstat {
   unsigned long maxcount;
   unsigned long drop;
@@ -91,14 +253,32 @@ struct eventstat {
 typedef struct eventstat eventstat_t;
 
 
+int tvalue_get(lua_State *L, int idx, tvalue_t *v);
+void tvalue_push(lua_State *L, tvalue_t *v);
+void tvalue_free(tvalue_t *v);
+void get_deadline(double timeout, struct timespec *due);
+
 int utlStartThread(lua_State *L);
 int utlStopThread(lua_State *L);
+int utlJoinThread(lua_State *L);
+int utlThreadStopping(lua_State *L);
+int utlThreadSched(lua_State *L);
+int utlNotifySched(lua_State *L);
 int utlWaveAddGeneric(lua_State *L);
 int utlRunScript(lua_State *L);
 int utlUpdateScript(lua_State *L);
 int utlScriptStatus(lua_State *L);
 int utlCallback(lua_State *L);
 int utlEventCallback(lua_State *L);
+int utlCallbackCancel(lua_State *L);
+int utlEventCallbackCancel(lua_State *L);
+int utlCallbackCount(lua_State *L);
+int utlCounterStart(lua_State *L);
+int utlCounterStop(lua_State *L);
+int utlCounterRead(lua_State *L);
+int utlDecoderStart(lua_State *L);
+int utlDecoderRead(lua_State *L);
+int utlDecoderCancel(lua_State *L);
 int utlSerialWrite(lua_State *L);
 int utlSerialRead(lua_State *L);
 int utlI2CReadBlockData(lua_State *L);
@@ -113,4 +293,83 @@ int utlSerialbbRead(lua_State *L);
 int utlFileRead(lua_State *L);
 int utlFileList(lua_State *L);
 int utlI2CSlaveTransfer(lua_State *L);
+int utlReplayCompile(lua_State *L);
+int utlReplayRun(lua_State *L);
+int utlPoolCreate(lua_State *L);
+int utlPoolSubmit(lua_State *L);
+int utlPoolWait(lua_State *L);
+int utlPoolJobState(lua_State *L);
+int utlPoolInfo(lua_State *L);
+int utlPoolClose(lua_State *L);
+int utlChanCreate(lua_State *L);
+int utlChanOpen(lua_State *L);
+int utlChanSend(lua_State *L);
+int utlChanReceive(lua_State *L);
+int utlChanFd(lua_State *L);
+int utlChanInfo(lua_State *L);
+int utlChanClose(lua_State *L);
+int utlCaptureStart(lua_State *L);
+int utlCaptureStop(lua_State *L);
+int utlCaptureInfo(lua_State *L);
+int utlCaptureOpen(lua_State *L);
+int utlCaptureFileInfo(lua_State *L);
+int utlCaptureSeek(lua_State *L);
+int utlCaptureRead(lua_State *L);
+int utlCaptureClose(lua_State *L);
+int utlNotifyReaderOpen(lua_State *L);
+int utlNotifyReaderBegin(lua_State *L);
+int utlNotifyReaderPause(lua_State *L);
+int utlNotifyReaderRead(lua_State *L);
+int utlNotifyReaderFd(lua_State *L);
+int utlNotifyReaderInfo(lua_State *L);
+int utlNotifyReaderClose(lua_State *L);
+int utlI2CTransact(lua_State *L);
+int utlZipCreate(lua_State *L);
+int utlZipAdd(lua_State *L);
+int utlZipRun(lua_State *L);
+int utlZipInfo(lua_State *L);
+int utlI2CbbZip(lua_State *L);
+int utlI2CScan(lua_State *L);
+int utlSerialStreamOpen(lua_State *L);
+int utlSerialStreamRead(lua_State *L);
+int utlSerialStreamFd(lua_State *L);
+int utlSerialStreamInfo(lua_State *L);
+int utlSerialStreamClose(lua_State *L);
+int utlWriteChunked(lua_State *L);
+int utlFileReadAll(lua_State *L);
+int utlFileCopyTo(lua_State *L);
+int utlFileWriteFrom(lua_State *L);
+int utlFileNames(lua_State *L);
+int utlFileNamesIter(lua_State *L);
+int utlSPISamplerStart(lua_State *L);
+int utlSPISamplerRead(lua_State *L);
+int utlSPISamplerInfo(lua_State *L);
+int utlSPISamplerStop(lua_State *L);
+int utlArrayNew(lua_State *L);
+int utlFastMethods(lua_State *L);
+int utlObjectNew(lua_State *L);
+int utlMonotonic(lua_State *L);
+int utlTickClockOpen(lua_State *L);
+int utlTickClockSync(lua_State *L);
+int utlTickClockUnwrap(lua_State *L);
+int utlTickClockToLocal(lua_State *L);
+int utlTickClockToTick(lua_State *L);
+int utlTickClockInfo(lua_State *L);
+int utlTickClockClose(lua_State *L);
+array_t *test_array(lua_State *L, int arg);
+array_t *new_array(lua_State *L, int type, int swap, size_t count);
+const char *array_bytes(lua_State *L, int arg, size_t *len);
+char *result_buffer(lua_State *L, int dest, size_t n, luaL_Buffer *b);
+int push_result(lua_State *L, int dest, luaL_Buffer *b, size_t nbytes);
+object_t *test_object(lua_State *L, int arg);
+object_t *check_object(lua_State *L, int arg);
+int object_pi(lua_State *L, int arg);
+double monotonic_time(void);
+int utlTimerNew(lua_State *L);
+int utlTimerRun(lua_State *L);
+int utlTimerStop(lua_State *L);
+int utlTimerInfo(lua_State *L);
+int utlWaitEvents(lua_State *L);
+int utlBusyWait(lua_State *L);
+void dispatch_until(lua_State *L, const struct timespec *due);
 #endif
@@ -0,0 +1,53 @@
+local gpio = require "pigpiod"
+local host, port = os.getenv("host") or "localhost", 8888
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+printf("Note: This test requires a sensehat board.")
+
+local N = tonumber(os.getenv("n") or "1000")
+local CTRL_REG6_XL = 0x20
+local OUT_X_XL = 0x28
+
+local sess = assert(gpio.open(host, port))
+printf("Session with host %s on port %d opened, handle = %d", host, port, sess.handle)
+
+local dev = assert(sess:openI2C(1, 0x6a, "lsm9ds1"))
+printf("Device %s opened, handle = %d", dev.name, dev.handle)
+
+-- accelerometer on at 119 Hz, +-2 g
+assert(dev:writeByte(CTRL_REG6_XL, 0x60))
+
+-- one frame buffer for all reads, viewed as 3 little endian words
+local frame = gpio.newArray("u8", 6)
+local accel = frame:view("i16")
+printf("Frame %s, view %s", tostring(frame), tostring(accel))
+
+local sum = gpio.newArray("u32", 3)
+printf("Reading %d frames into the same array ...", N)
+local t0 = os.clock()
+for i = 1, N do
+   local _, n = assert(dev:readI2CBlockData(OUT_X_XL, 6, frame))
+   assert(n == 6)
+   for k = 1, 3 do
+      sum[k] = sum[k] + accel[k] + 32768
+   end
+end
+local t1 = os.clock()
+printf("   last: x=%d y=%d z=%d (raw: %s)", accel[1], accel[2], accel[3],
+       table.concat(frame:totable(), " "))
+printf("   mean: x=%.1f y=%.1f z=%.1f", sum[1] / N - 32768, sum[2] / N - 32768, sum[3] / N - 32768)
+printf("   %.1f us CPU per frame", (t1 - t0) / N * 1e6)
+
+-- arrays are accepted wherever binary data is written
+local cmd = gpio.newArray("u8", {CTRL_REG6_XL | 0x80})
+assert(dev:writeDevice(cmd))
+local ctrl = assert(dev:readDevice(1))
+printf("   CTRL_REG6_XL = 0x%02x", ctrl:byte())
+
+printf("Cleanup ...")
+assert(dev:writeByte(CTRL_REG6_XL, 0))
+dev:close()
+sess:close()
@@ -0,0 +1,56 @@
+local gpio = require "pigpiod"
+
+local host = os.getenv("host") or "localhost"
+local n = tonumber(os.getenv("n")) or 50
+local pinp, pout = 20, 21
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local sess1 = gpio.open(host, nil, "sess1")
+local sess2 = gpio.open(host, nil, "sess2")
+sess1:setMode(pout, gpio.OUTPUT)
+sess1:setMode(pinp, gpio.INPUT)
+
+-- Several callbacks on the same pin: same and different edges and sessions
+local counts = {}
+local function count(sess, pin, level, tick, name)
+   counts[name] = (counts[name] or 0) + 1
+end
+local cbs = {
+   sess1:callback(pinp, gpio.EITHER_EDGE, count, "s1-either-a"),
+   sess1:callback(pinp, gpio.EITHER_EDGE, count, "s1-either-b"),
+   sess1:callback(pinp, gpio.RISING_EDGE, count, "s1-rising"),
+   sess2:callback(pinp, gpio.FALLING_EDGE, count, "s2-falling"),
+   sess2:callback(pinp, gpio.EITHER_EDGE, count, "s2-either"),
+}
+for i, cb in ipairs(cbs) do assert(cb, "callback " .. i .. " failed") end
+
+sess1:write(pout, 0)
+gpio.wait(0.1)
+for k in pairs(counts) do counts[k] = 0 end
+for i = 1, n do
+   sess1:write(pout, 1)
+   gpio.wait(0.005)
+   sess1:write(pout, 0)
+   gpio.wait(0.005)
+end
+gpio.wait(0.2)
+local expected = {
+   ["s1-either-a"] = 2 * n, ["s1-either-b"] = 2 * n, ["s1-rising"] = n,
+   ["s2-falling"] = n, ["s2-either"] = 2 * n
+}
+for name, exp in pairs(expected) do
+   printf("%-12s: %4d (expected %d)", name, counts[name] or 0, exp)
+end
+
+-- Cancel one of two callbacks on the same pin and edge
+cbs[2]:cancel()
+counts["s1-either-a"], counts["s1-either-b"] = 0, 0
+sess1:write(pout, 1)
+gpio.wait(0.1)
+printf("after cancel: a=%d b=%d (expected 1 0)", counts["s1-either-a"], counts["s1-either-b"])
+
+sess2:close()
+sess1:close()
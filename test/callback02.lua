@@ -0,0 +1,44 @@
+local gpio = require "pigpiod"
+
+local host = os.getenv("host") or "localhost"
+local n = tonumber(os.getenv("n")) or 2000
+local pinp, pout = 20, 21
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local sess = gpio.open(host)
+sess:setMode(pout, gpio.OUTPUT)
+sess:setMode(pinp, gpio.INPUT)
+sess:write(pout, 0)
+
+local ncalls, nedges = {}, {}
+local function cbfunc(sess, pin, level, tick, name, count)
+   ncalls[name] = (ncalls[name] or 0) + 1
+   nedges[name] = (nedges[name] or 0) + count
+end
+
+local cball = sess:callback(pinp, gpio.EITHER_EDGE, cbfunc, "all")
+local cblatest = sess:callback(pinp, gpio.EITHER_EDGE, cbfunc, "latest", {policy = "latest"})
+local cbrate = sess:callback(pinp, gpio.EITHER_EDGE, cbfunc, "rate", {policy = "rate", rate = 20})
+local cbcount = sess:callback(pinp, gpio.EITHER_EDGE, nil, nil, {policy = "count"})
+assert(cball and cblatest and cbrate and cbcount)
+
+-- Burst of edges without giving Lua a chance to dispatch
+local t0 = gpio.time()
+for i = 1, n do
+   sess:write(pout, i % 2)
+end
+gpio.wait(0.5)
+local dt = gpio.time() - t0
+
+for _, name in ipairs{"all", "latest", "rate"} do
+   printf("%-6s: %5d calls for %5d edges", name, ncalls[name] or 0, nedges[name] or 0)
+end
+printf("expected at most %d rate limited calls", math.ceil(dt * 20) + 1)
+local count, level, tick = cbcount:count(true)
+printf("count : %5d edges, level=%d tick=%d (expected %d edges)", count, level, tick, n)
+assert(cbcount:count() == 0)
+
+sess:close()
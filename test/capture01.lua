@@ -0,0 +1,44 @@
+local gpio = require "pigpiod"
+
+local host = os.getenv("host") or "localhost"
+local filename = os.getenv("file") or "/tmp/capture01.cap"
+local freq = tonumber(os.getenv("freq")) or 1000
+local duration = tonumber(os.getenv("duration")) or 5
+local pinp, pout = 20, 21
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local sess = gpio.open(host)
+sess:setMode(pout, gpio.OUTPUT)
+sess:setMode(pinp, gpio.INPUT)
+
+-- Capture a PWM signal looped back from the output to the input pin
+local cap = assert(sess:startCapture(filename, {pinp}))
+sess:setPwmFrequency(pout, freq)
+sess:setPwmDutycycle(pout, 128)
+gpio.wait(duration)
+sess:setPwmDutycycle(pout, 0)
+gpio.wait(0.1)
+local stats = assert(cap:stop())
+printf("records=%d drops=%d blocks=%d bytes=%d", stats.records, stats.drops,
+       stats.blocks, stats.bytes)
+
+local file = assert(gpio.openCapture(filename))
+local info = file:info()
+printf("records=%d blocks=%d first=%d last=%d", info.records, info.blocks,
+       info.first or 0, info.last or 0)
+
+-- Count rising edges in the second half of the capture
+local from = info.first + (info.last - info.first) // 2
+local rising, last = 0, nil
+local t = gpio.time()
+for tick, levels, flags in file:samples(from) do
+   local level = (levels >> pinp) & 1
+   if flags == 0 and last == 0 and level == 1 then rising = rising + 1 end
+   last = level
+end
+printf("rising edges in second half: %d (%.3f s)", rising, gpio.time() - t)
+file:close()
+sess:close()
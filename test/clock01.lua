@@ -0,0 +1,34 @@
+local gpio = require "pigpiod"
+local host, port = os.getenv("host") or "localhost", 8888
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local duration = tonumber(os.getenv("t") or "10")
+
+local sess = assert(gpio.open(host, port))
+printf("Session with host %s on port %d opened, handle = %d", host, port, sess.handle)
+
+local clock = assert(sess:openClock{interval = 0.5})
+printf("Tracking the tick of %s for %d s ...", host, duration)
+
+local t0 = gpio.monotonic()
+while gpio.monotonic() - t0 < duration do
+   gpio.sleep(1)
+   -- compare the estimate with a tick read just now
+   local before = gpio.monotonic()
+   local tick = clock:unwrap(sess:tick())
+   local after = gpio.monotonic()
+   local est = clock:toTick((before + after) / 2)
+   local info = clock:info()
+   printf("   tick %d: estimate off by %4d us, drift %7.2f ppm, min rtt %4.0f us, %d syncs",
+          tick, est - tick, info.drift, info.minrtt * 1e6, info.syncs)
+end
+
+local tick = sess:tick()
+printf("Tick %d is at local time %.6f s, now is %.6f s", tick, clock:toLocal(tick), gpio.monotonic())
+
+printf("Cleanup ...")
+clock:close()
+sess:close()
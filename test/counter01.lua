@@ -0,0 +1,33 @@
+local gpio = require "pigpiod"
+
+local host = os.getenv("host") or "localhost"
+local freq = tonumber(os.getenv("freq")) or 1000
+local duty = tonumber(os.getenv("duty")) or 0.25
+local pinp, pout = 20, 21
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local sess = gpio.open(host)
+sess:setMode(pout, gpio.OUTPUT)
+sess:setMode(pinp, gpio.INPUT)
+
+-- Generate a PWM signal on the output pin looped back to the input pin
+sess:setPwmFrequency(pout, freq)
+sess:setPwmRange(pout, 1000)
+sess:setPwmDutycycle(pout, duty * 1000)
+
+assert(sess:startCounter(pinp))
+for i = 1, 5 do
+   gpio.wait(1)
+   local c = assert(sess:counter(pinp, true))
+   printf("edges=%6d rising=%6d falling=%6d freq=%8.1f Hz period=%d/%d/%.1f us duty=%.3f window=%d us",
+          c.edges, c.rising, c.falling, c.frequency or 0,
+          c.minperiod or 0, c.maxperiod or 0, c.meanperiod or 0,
+          c.duty or 0, c.window)
+end
+assert(sess:stopCounter(pinp))
+assert(sess:counter(pinp) == nil)
+sess:setPwmDutycycle(pout, 0)
+sess:close()
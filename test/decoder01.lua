@@ -0,0 +1,56 @@
+local gpio = require "pigpiod"
+
+local host = os.getenv("host") or "localhost"
+local decoder = os.getenv("decoder") or "quadrature"
+local duration = tonumber(os.getenv("duration")) or 10
+local pina, pinb = 20, 21
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local sess = gpio.open(host)
+
+local show = {
+   quadrature = function(f)
+      printf("tick=%10d position=%5d delta=%3d", f.tick, f.position, f.delta)
+   end,
+   wiegand = function(f)
+      printf("tick=%10d bits=%2d code=0x%x", f.tick, f.bits, f.code)
+   end,
+   nec = function(f)
+      printf("tick=%10d address=0x%04x command=0x%02x repeated=%s",
+             f.tick, f.address, f.command, tostring(f.repeated))
+   end,
+   dht22 = function(f)
+      printf("tick=%10d humidity=%.1f %% temperature=%.1f C valid=%s",
+             f.tick, f.humidity, f.temperature, tostring(f.valid))
+   end
+}
+
+local pins = {pina, pinb}
+if decoder == "nec" or decoder == "dht22" then pins = {pina} end
+for _, pin in ipairs(pins) do
+   sess:setMode(pin, gpio.INPUT)
+   sess:setPullUpDown(pin, gpio.PUD_UP)
+end
+
+local dec = assert(sess:openDecoder(decoder, pins, function(sess, frame, ud)
+   show[ud](frame)
+end, decoder))
+
+local t = gpio.time()
+while gpio.time() - t < duration do
+   if decoder == "dht22" then
+      assert(dec:trigger())
+      gpio.wait(2)
+   else
+      gpio.wait(0.1)
+   end
+end
+
+-- The last frame is also available by polling
+local frame = dec:read()
+if frame then show[decoder](frame) end
+assert(dec:cancel())
+sess:close()
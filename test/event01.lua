@@ -1,5 +1,4 @@
 local gpio = require "pigpiod"
-local posix = require "posix"
 local sig = require "posix.signal"
 local host = "localhost"
 local remHost = "raspberrypi2"
@@ -29,10 +28,6 @@ printf("Open notification channel ...")
 local notify = sess:openNotify()
 printf("  notify handle:%d", notify.handle)
 
-printf("Open notification file ...")
-local fd = posix.open(notify.filename, posix.O_RDONLY)
-printf("  fd=%d", fd)
-
 printf("Begin notifications ...")
 notify:begin(eventindex)
 
@@ -53,12 +48,11 @@ wait(1)
 print("Reading notification buffer ...")
 -- Note: This will only return the first 10 and last 10 transitions - indpendently on
 --       the number of total transitions.
-while posix.rpoll(fd, 100) == 1 do
-   local s = posix.read(fd, 12)
-   local t = notify:decode(s)
+local ticks, levels, flags, seqnos = notify:read(1024, 0.1)
+for i = 1, #ticks do
    print(string.format("sample %d: flags=%04X tick=%d level=%08X dt=%d",
-                       t.seqno, t.flags, t.tick, t.level, t.tick - last_tick2))
-   last_tick2 = t.tick
+                       seqnos[i], flags[i], ticks[i], levels[i], ticks[i] - (last_tick2 or ticks[i])))
+   last_tick2 = ticks[i]
 end
 
 printf("Cleanup ...")
@@ -68,8 +62,5 @@ cb:cancel()
 printf("  Close notification ...")
 notify:close()
 
-printf("  Close notification file ...")
-posix.close(fd)
-
 printf("  Closing session(s) ...")
 sess:close()
@@ -0,0 +1,61 @@
+local gpio = require "pigpiod"
+
+local host = os.getenv("host") or "localhost"
+local n = tonumber(os.getenv("n")) or 100
+local pinp1, pout1 = 20, 21
+local pinp2, pout2 = 19, 26
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+-- Worker counting edges on its own pin and reporting via channel
+local worker_code = [[
+local gpio = require "pigpiod"
+local name, host, pin, chname = select(1, ...)
+local sess = gpio.open(host)
+local chan = gpio.openChannel(nil, chname)
+local count = 0
+sess:setMode(pin, gpio.INPUT)
+local cb = sess:callback(pin, gpio.EITHER_EDGE, function(sess, pin, level, tick)
+  count = count + 1
+end)
+while not gpio.threadStopping() do
+  gpio.wait(0.01)
+  chan:trySend(0, count)
+end
+cb:cancel()
+sess:close()
+]]
+
+local chan = gpio.openChannel(1000, "event02")
+local sess = gpio.open(host)
+sess:setMode(pout1, gpio.OUTPUT)
+sess:setMode(pout2, gpio.OUTPUT)
+sess:setMode(pinp1, gpio.INPUT)
+
+local count = 0
+local cb = sess:callback(pinp1, gpio.EITHER_EDGE, function(sess, pin, level, tick)
+   count = count + 1
+end)
+
+local th = gpio.startThread(worker_code, "edgeworker", host, pinp2, "event02")
+gpio.wait(0.5)
+for i = 1, n do
+   sess:write(pout1, i % 2)
+   sess:write(pout2, i % 2)
+   sess:write(pout2, (i + 1) % 2)
+   gpio.wait(0.005)
+end
+gpio.wait(0.5)
+local wcount = 0
+while true do
+   local ok, c = chan:tryReceive()
+   if not ok then break end
+   wcount = c
+end
+printf("main state: %d edges on pin %d (expected %d)", count, pinp1, n)
+printf("worker    : %d edges on pin %d (expected %d)", wcount, pinp2, 2 * n)
+cb:cancel()
+assert(gpio.stopThread(th))
+sess:close()
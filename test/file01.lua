@@ -25,6 +25,15 @@ flist = assert(sess:listFiles("/home/leuwer/tmp/file_*"))
 assert(#flist == 10)
 printf("   ok - found %d entries", #flist)
 
+printf("Iterating over files ...")
+local n = 0
+for name in assert(sess:eachFile("/home/leuwer/tmp/file_*")) do
+   assert(name == flist[n + 1])
+   n = n + 1
+end
+assert(n == 10)
+printf("   ok - iterated over %d entries", n)
+
 printf("Deleting files again ...")
 for i=1,10 do
    os.execute(string.format("rm /home/leuwer/tmp/file_%s", i))
@@ -0,0 +1,42 @@
+local gpio = require "pigpiod"
+local host = os.getenv("host") or "localhost"
+local port = 8888
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+printf("Open session ...")
+local sess = gpio.open(host, port, "mysess")
+printf("   Session %q with host %q on port %d opened, handle = %d",
+       sess.name, host, port, sess.handle)
+
+local t = {}
+for i = 1, 1024 * 1024 / 16 do
+   t[i] = string.format("%015d\n", i)
+end
+local data = table.concat(t)
+
+printf("Writing %d bytes in one call ...", #data)
+local openflags = bit32.bor(gpio.FILE_RW, gpio.FILE_CREATE, gpio.FILE_TRUNC)
+local f = assert(sess:openFile("/home/leuwer/tmp/large.txt", openflags))
+local t1 = gpio.tick()
+assert(f:write(data))
+local t2 = gpio.tick()
+printf("   ok - %.1f kB/s", #data / 1024 / ((t2 - t1) / 1e6))
+
+printf("Checking size ...")
+local size = assert(f:seek(0, gpio.FROM_END))
+assert(size == #data, "unexpected size "..size)
+printf("   ok - %d bytes", size)
+
+printf("Reading back a record behind the first chunk ...")
+assert(f:seek(65536 // 16 * 16 + 16, gpio.FROM_START))
+local s = assert(f:read(16))
+assert(s == t[65536 // 16 + 2])
+printf("   ok - %q", s)
+
+printf("Cleanup ...")
+f:close()
+os.execute("rm -f /home/leuwer/tmp/large.txt")
+sess:close()
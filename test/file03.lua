@@ -0,0 +1,63 @@
+local gpio = require "pigpiod"
+local host = os.getenv("host") or "localhost"
+local port = 8888
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local remote = "/home/leuwer/tmp/bulk.bin"
+local src, dst = os.tmpname(), os.tmpname()
+
+printf("Open session ...")
+local sess = gpio.open(host, port, "mysess")
+printf("   Session %q with host %q on port %d opened, handle = %d",
+       sess.name, host, port, sess.handle)
+
+printf("Creating local file of 4 MB ...")
+local t = {}
+for i = 1, 4 * 1024 * 1024 / 16 do
+   t[i] = string.format("%015d\n", i)
+end
+local data = table.concat(t)
+local f = assert(io.open(src, "wb"))
+f:write(data)
+f:close()
+
+local function rate(nbytes, t1, t2)
+   return nbytes / 1024 / ((t2 - t1) / 1e6)
+end
+
+printf("Uploading ...")
+local openflags = bit32.bor(gpio.FILE_RW, gpio.FILE_CREATE, gpio.FILE_TRUNC)
+local rf = assert(sess:openFile(remote, openflags))
+local t1 = gpio.tick()
+local n = assert(rf:writeFrom(src))
+local t2 = gpio.tick()
+assert(n == #data)
+printf("   ok - %d bytes, %.1f kB/s", n, rate(n, t1, t2))
+
+printf("Reading back into a string ...")
+assert(rf:seek(0, gpio.FROM_START))
+t1 = gpio.tick()
+local s = assert(rf:readAll())
+t2 = gpio.tick()
+assert(s == data)
+printf("   ok - %d bytes, %.1f kB/s", #s, rate(#s, t1, t2))
+
+printf("Downloading ...")
+assert(rf:seek(0, gpio.FROM_START))
+t1 = gpio.tick()
+n = assert(rf:copyTo(dst))
+t2 = gpio.tick()
+f = assert(io.open(dst, "rb"))
+assert(f:read("a") == data)
+f:close()
+printf("   ok - %d bytes, %.1f kB/s", n, rate(n, t1, t2))
+
+printf("Cleanup ...")
+rf:close()
+os.remove(src)
+os.remove(dst)
+os.execute("rm -f " .. remote)
+sess:close()
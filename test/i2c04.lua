@@ -0,0 +1,45 @@
+local gpio = require "pigpiod"
+local host = os.getenv("host") or "localhost"
+local N = tonumber(os.getenv("N")) or 1000
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local sess = gpio.open(host)
+printf("Note: This test requires a sensehat board.")
+
+local BUS = 1
+local LSM9DS1_AG = 0x6a
+local WHO_AM_I, CTRL_REG6_XL, OUT_X_L_G = 0x0f, 0x20, 0x18
+
+local dev = assert(sess:openI2C(BUS, LSM9DS1_AG, "LSM9DS1 Accelerometer"))
+
+-- Enable the accelerometer and read the id in one transaction
+local res = assert(dev:transact{
+   {"write_byte", CTRL_REG6_XL, 0x60},
+   {"read_byte", WHO_AM_I}
+})
+printf("id=0x%02x", res[2])
+
+-- 12 gyro and accelerometer output registers
+local ops = {}
+for i = 0, 11 do
+   ops[#ops + 1] = {"read_byte", OUT_X_L_G + i + (i >= 6 and 0x10 or 0)}
+end
+
+local t = gpio.time()
+for i = 1, N do
+   res = assert(dev:transact(ops))
+end
+local dt = gpio.time() - t
+printf("transact: %d x 12 registers in %.3f s, %.3f ms per transaction", N, dt, dt / N * 1000)
+
+t = gpio.time()
+for i = 1, N do
+   for j = 1, #ops do dev:readByte(ops[j][2]) end
+end
+dt = gpio.time() - t
+printf("readByte: %d x 12 registers in %.3f s, %.3f ms per 12 reads", N, dt, dt / N * 1000)
+
+dev:close()
+sess:close()
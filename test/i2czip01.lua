@@ -0,0 +1,42 @@
+local gpio = require "pigpiod"
+local host = os.getenv("host") or "localhost"
+local N = tonumber(os.getenv("N")) or 1000
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local sess = gpio.open(host)
+printf("Note: This test requires a sensehat board.")
+
+local BUS = 1
+local LSM9DS1_AG = 0x6a
+local WHO_AM_I, OUT_X_L_G, OUT_X_L_XL = 0x0f, 0x18, 0x28
+
+local dev = assert(sess:openI2C(BUS, LSM9DS1_AG, "LSM9DS1 Accelerometer"))
+
+-- Build the program once: id, gyro and accelerometer with repeated starts
+local zip = gpio.newZip()
+   :addr(LSM9DS1_AG)
+   :combinedOn()
+   :write{WHO_AM_I}:read(1, "id")
+   :write{OUT_X_L_G}:read(6, "gyro")
+   :write{OUT_X_L_XL}:read(6, "accel")
+   :combinedOff()
+local buf, rxlen = zip:buffer()
+printf("program: %d bytes, reads %d bytes", #buf, rxlen)
+
+local res = assert(dev:zip(zip))
+printf("id=0x%02x", res.id:byte())
+
+local t = gpio.time()
+for i = 1, N do
+   res = assert(dev:zip(zip))
+end
+local dt = gpio.time() - t
+local gx, gy, gz = string.unpack("<i2i2i2", res.gyro)
+local ax, ay, az = string.unpack("<i2i2i2", res.accel)
+printf("gyro=%d,%d,%d accel=%d,%d,%d", gx, gy, gz, ax, ay, az)
+printf("%d zip runs in %.3f s, %.3f ms per run", N, dt, dt / N * 1000)
+
+dev:close()
+sess:close()
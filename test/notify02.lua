@@ -1,6 +1,5 @@
 local gpio = require "pigpiod"
 local util = require "test.test_util"
-local posix = require "posix"
 local wait = gpio.wait
 
 local host, port = "localhost", 8888
@@ -19,10 +18,7 @@ local x = 1
 local last_tick
 local cbcnt = 1
 local eventindex = 1
-local notify = sess:openNotify()
-local fname = notify.filename
---local fh = io.open(fname, "r")
-local fd = posix.open(fname, posix.O_RDONLY)
+local notify = assert(sess:openNotify())
 
 ---
 --Alert callback.
@@ -106,12 +102,11 @@ end
 print("Reading notification buffer ...")
 -- Note: This will only return the first 10 and last 10 transitions - indpendently on
 --       the number of total transitions.
-while posix.rpoll(fd, 100) == 1 do
-   local s = posix.read(fd, 12)
-   local t = notify:decode(s)
+local ticks, levels, flags, seqnos = notify:read(1024, 0.1)
+for i = 1, #ticks do
    print(string.format("sample %d: flags=%04X tick=%d level=%08X dt=%d",
-                       t.seqno, t.flags, t.tick, t.level, t.tick - last_tick2))
-   last_tick2 = t.tick
+                       seqnos[i], flags[i], ticks[i], levels[i], ticks[i] - last_tick2))
+   last_tick2 = ticks[i]
 end
 
 print("close notification ...")
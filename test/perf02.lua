@@ -0,0 +1,44 @@
+local gpio = require "pigpiod"
+local host, port = os.getenv("host") or "localhost", 8888
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local pout = tonumber(os.getenv("pin") or "21")
+local N = tonumber(os.getenv("n") or "10000")
+
+local sess = assert(gpio.open(host, port))
+printf("Session with host %s on port %d opened, handle = %d", host, port, sess.handle)
+sess:setMode(pout, gpio.OUTPUT)
+
+-- the generated binding wrapped like the former Lua method
+local function luawrite(self, pin, val)
+   local res = gpio.gpio_write(self.handle, pin, val)
+   if res ~= 0 then return nil, gpio.perror(res), res end
+   return true
+end
+
+local function rate(what, write)
+   local t1 = os.clock()
+   for i = 1, N do
+      write(sess, pout, 1)
+      write(sess, pout, 0)
+   end
+   local t2 = os.clock()
+   printf("   %-14s %8.0f toggles per CPU second", what, 2 * N / (t2 - t1))
+end
+
+printf("Toggling pin %d %d times ...", pout, N)
+rate("Lua wrapper:", luawrite)
+rate("native method:", sess.write)
+
+local t1 = os.clock()
+for i = 1, N do
+   sess:tick()
+end
+printf("   %-14s %8.0f calls per CPU second", "tick:", N / (os.clock() - t1))
+
+printf("Cleanup ...")
+sess:setMode(pout, gpio.INPUT)
+sess:close()
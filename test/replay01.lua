@@ -0,0 +1,52 @@
+local gpio = require "pigpiod"
+local host, port = "localhost", 8888
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local sess = gpio.open(host, port)
+
+local pinp, pout = 20, 21
+local N = tonumber(os.getenv("n")) or 10000
+sess:setPullUpDown(pinp, gpio.PUD_UP)
+sess:setMode(pinp, gpio.INPUT)
+sess:setMode(pout, gpio.OUTPUT)
+
+printf("Compile %d toggles ...", N)
+local t = {}
+for i = 1, N do
+   t[#t+1] = string.format("W %d 1 W %d 0", pout, pout)
+end
+local prog = assert(gpio.compileCommands(table.concat(t, "\n")))
+printf("  %d commands compiled", #prog)
+
+printf("Invalid commands are rejected ...")
+local bad, err = gpio.compileCommands("W 21 1\nXYZ 1 2")
+printf("  %s %s", tostring(bad), err)
+
+printf("Replay untimed ...")
+local t1 = gpio.time()
+local n, nerr = assert(sess:replay(prog))
+local t2 = gpio.time()
+printf("  %d commands, %d errors, %d toggles per second", n, nerr, N/(t2-t1))
+
+printf("Replay timed (10 ms period) with results ...")
+local tick = 0
+t = {}
+for i = 1, 20 do
+   t[#t+1] = string.format("%d W %d %d", tick, pout, i % 2)
+   t[#t+1] = string.format("R %d", pinp)
+   tick = tick + 10000
+end
+local timed = assert(gpio.compileCommands(table.concat(t, "\n")))
+local t1 = gpio.time()
+local n, nerr, results = assert(sess:replay(timed, {timed=true, results=true}))
+local t2 = gpio.time()
+printf("  %d commands, %d errors in %.3f s (expected %.3f s)", n, nerr, t2-t1, (tick-10000)/1e6)
+for i = 2, #results, 2 do
+   io.write(results[i], " ")
+end
+print()
+
+sess:setMode(pout, gpio.INPUT)
+sess:close()
@@ -0,0 +1,49 @@
+local gpio = require "pigpiod"
+
+local host = os.getenv("host") or "localhost"
+local cpu = tonumber(os.getenv("cpu")) or 1
+local prio = tonumber(os.getenv("prio")) or 50
+local n = tonumber(os.getenv("n")) or 1000
+local pinp, pout = 20, 21
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local function measure(sess, what)
+   local tmin, tmax, tsum, cnt = 1e9, 0, 0, 0
+   local t0
+   sess:setMode(pout, gpio.OUTPUT)
+   sess:setMode(pinp, gpio.INPUT)
+   local cb = sess:callback(pinp, gpio.EITHER_EDGE, function(s, pin, level, tick)
+      local dt = sess:tick() - tick
+      if dt < tmin then tmin = dt end
+      if dt > tmax then tmax = dt end
+      tsum = tsum + dt
+      cnt = cnt + 1
+   end)
+   for i = 1, n do
+      sess:write(pout, i % 2)
+      gpio.wait(0.002)
+   end
+   cb:cancel()
+   printf("%-10s: n=%d latency min=%d us max=%d us mean=%.1f us",
+          what, cnt, tmin, tmax, tsum / math.max(cnt, 1))
+end
+
+local sess = gpio.open(host)
+measure(sess, "default")
+sess:close()
+
+sess, err = gpio.open(host, nil, nil, {cpu = cpu, priority = prio,
+                                       dispatchpriority = prio - 1})
+if not sess then
+   print("Cannot use real-time scheduling: " .. err)
+   os.exit(0)
+end
+measure(sess, "SCHED_FIFO")
+
+local th = gpio.startThread("local gpio = require 'pigpiod' gpio.wait(0.5)", "rtworker")
+assert(gpio.setThreadScheduling(th, cpu, prio - 2))
+assert(gpio.joinThread(th))
+sess:close()
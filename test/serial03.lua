@@ -0,0 +1,74 @@
+local gpio = require "pigpiod"
+local wait = gpio.wait
+
+local arg = {select(1, ...)}
+local index = tonumber(arg[1] or "3")
+local nlines = tonumber(arg[2] or "100")
+assert(index > 0 and index < 7, "index must be 1..6")
+local TTYDEV = "/dev/serial0"
+local baudrate = gpio.baudrates[index]
+
+local dest = {
+   you = {host = "localhost", port = 8888},
+   me = {host = "raspberrypi2", port = 8888}
+}
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local sess = {}
+
+printf("Open sessions ...")
+
+sess.me = gpio.open(dest.me.host, dest.me.port, "sess-me")
+printf("Session %q with host %q on port %d opened, handle = %d",
+       sess.me.name, dest.me.host, dest.me.port, sess.me.handle)
+
+sess.you = gpio.open(dest.you.host, dest.you.port, "sess-you")
+printf("Session %q with host %q on port %d opened, handle = %d",
+       sess.you.name, dest.you.host, dest.you.port, sess.you.handle)
+
+printf("Open serial devices with baudrate %d ...", baudrate)
+local dev = {}
+dev.me = assert(sess.me:openSerial(baudrate, TTYDEV))
+dev.you = assert(sess.you:openSerial(baudrate, TTYDEV))
+
+printf("Start streaming receiver ...")
+local stream = assert(dev.you:openStream{capacity = 8192})
+
+printf("Send %d NMEA like lines ...", nlines)
+local t1 = gpio.tick()
+for i = 1, nlines do
+   assert(dev.me:write(string.format("$GPTST,%06d,%s*00\r\n", i, string.rep("x", 40))))
+end
+
+printf("Receive lines ...")
+local n = 0
+while n < nlines do
+   local line, err = stream:readLine(2)
+   if not line then
+      printf("   readLine failed after %d lines: %s", n, err)
+      break
+   end
+   n = n + 1
+   assert(tonumber(line:match("^%$GPTST,(%d+),")) == n, "unexpected line "..line)
+end
+local t2 = gpio.tick()
+printf("   %d lines received in %.3f s", n, (t2 - t1) / 1e6)
+
+printf("Delimited and fixed length frames ...")
+assert(dev.me:write("abc|def|" .. string.char(1, 2, 3, 4)))
+printf("   %q", assert(stream:readUntil("|", 1)))
+printf("   %q", assert(stream:readUntil("|", 1)))
+local frame = assert(stream:readBytes(4, 1))
+printf("   %d bytes: %d %d %d %d", #frame, frame:byte(1, 4))
+printf("   timeout: %s", select(2, stream:readLine(0.1)))
+
+local count, capacity, polls, bytes, err = stream:info()
+printf("Stream info: count=%d capacity=%d polls=%d bytes=%d err=%d",
+       count, capacity, polls, bytes, err)
+
+print("Cleanup ...")
+stream:close()
+sess.me:close()
+sess.you:close()
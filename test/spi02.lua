@@ -0,0 +1,47 @@
+local gpio = require "pigpiod"
+local host, port = os.getenv("host") or "localhost", 8888
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+-- MCP3008 single ended channel 0: start bit, SGL/DIFF + channel, don't care
+local channel = tonumber(os.getenv("ch") or "0")
+local srate = tonumber(os.getenv("sr") or "10000")
+local duration = tonumber(os.getenv("t") or "2")
+
+local sess = assert(gpio.open(host, port))
+printf("Session with host %s on port %d opened, handle = %d", host, port, sess.handle)
+
+local dev = assert(sess:openSPI(0, 1000000, 0, "adc"))
+printf("Device %s opened on channel 0 with 1 Mbps, handle = %d", dev.name, dev.handle)
+
+printf("Sampling channel %d with %d S/s for %.1f s ...", channel, srate, duration)
+local sampler = assert(dev:startSampling(string.char(1, 0x80 + channel * 16, 0), srate,
+                                         {first = 1, nbytes = 2, mask = 0x3ff}))
+local n, sum, first, last = 0, 0
+local t0 = os.time()
+while os.time() - t0 < duration do
+   local ticks, values = assert(sampler:read(4096, 0.1))
+   for i = 1, #values do
+      sum = sum + values[i]
+   end
+   if #ticks > 0 then
+      first = first or ticks[1]
+      last = ticks[#ticks]
+   end
+   n = n + #values
+end
+local count, capacity, drops, samples, batches, err = sampler:info()
+sampler:stop()
+
+printf("   %d samples, mean value %.1f", n, n > 0 and sum / n or 0)
+if n > 1 then
+   printf("   %.0f S/s measured on the daemon ticks", (n - 1) / ((last - first) / 1e6))
+end
+printf("   %d pipelines, %.1f samples each, %d dropped, err=%d",
+       batches, samples / batches, drops, err)
+
+printf("Cleanup ...")
+dev:close()
+sess:close()
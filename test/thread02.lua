@@ -0,0 +1,65 @@
+local gpio = require "pigpiod"
+
+local n = tonumber(os.getenv("n")) or 20
+
+local worker_code = [[
+local gpio = require "pigpiod"
+local name, count = select(1, ...)
+local sum = 0
+for i = 1, count do
+  sum = sum + i
+end
+return name, sum
+]]
+
+local endless_code = [[
+local gpio = require "pigpiod"
+local name = select(1, ...)
+local t = {}
+while true do
+  -- allocate some memory which must be released on stop
+  t[#t % 1000 + 1] = string.rep("x", 100)
+  gpio.wait(0.01)
+end
+]]
+
+local polite_code = [[
+local gpio = require "pigpiod"
+while not gpio.threadStopping() do
+  gpio.wait(0.1)
+end
+return "bye"
+]]
+
+print("Join thread with results ...")
+local th = gpio.startThread(worker_code, "worker", 1000)
+local ok, name, sum = gpio.joinThread(th)
+print("  ", ok, name, sum)
+assert(ok == true and name == "worker" and sum == 500500)
+
+print("Join thread with error ...")
+th = gpio.startThread("error('failed on purpose')", "failing")
+ok, err = gpio.joinThread(th)
+print("  ", ok, err)
+assert(ok == nil)
+
+print("Start and stop endless thread " .. n .. " times ...")
+for i = 1, n do
+   th = gpio.startThread(endless_code, "endless")
+   gpio.wait(0.05)
+   assert(gpio.stopThread("endless"))
+end
+print("  memory in KB after stops: " .. collectgarbage("count"))
+
+print("Stop thread polling threadStopping() ...")
+th = gpio.startThread(polite_code, "polite")
+gpio.wait(0.2)
+assert(gpio.stopThread(th, 2))
+
+print("Join with timeout ...")
+th = gpio.startThread(endless_code, "endless")
+ok, err = gpio.joinThread(th, 0.1)
+print("  ", ok, err)
+assert(ok == nil and err == "timeout")
+assert(gpio.stopThread(th))
+print("done.")
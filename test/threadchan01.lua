@@ -0,0 +1,70 @@
+local gpio = require "pigpiod"
+
+local m = tonumber(os.getenv("m")) or 500
+local n = tonumber(os.getenv("n")) or 2
+
+local function code()
+   return [[
+local gpio = require "pigpiod"
+local name, reqname, repname = select(1, ...)
+local sess = gpio.open()
+local req = gpio.openChannel(nil, reqname)
+local rep = gpio.openChannel(nil, repname)
+print(name .. ": Waiting messages on channel '" .. reqname .. "' ...")
+while true do
+  local seq, t1 = req:receive()
+  if not seq then break end
+  rep:send(seq, t1, sess:tick())
+end
+print(name .. ": channel closed.")
+]]
+end
+-- Create session
+local sess = gpio.open()
+
+-- Create channels and threads (echo servers)
+local req, rep, meas = {}, {}, {}
+for i = 1,n do
+   req[i] = gpio.openChannel(16, "req-"..i)
+   rep[i] = gpio.openChannel(16, "rep-"..i)
+   gpio.startThread(code(), "chanThread-"..i, "chanThread-"..i, "req-"..i, "rep-"..i)
+   meas[i] = {
+      dtsmax=0, dtrmax=0, dtmax=0,
+      dtsmin=1e6, dtrmin=1e6, dtmin=1e6
+   }
+end
+local seq = 0
+for j = 1,m do
+   for i = 1, n do
+      req[i]:send(seq, sess:tick())
+      seq = seq + 1
+   end
+   for i = 1, n do
+      local s = meas[i]
+      local seq, t1, t2 = rep[i]:receive(5)
+      assert(seq, t1)
+      local t3 = sess:tick()
+      local dts, dtr, dt = t2-t1, t3-t2, t3-t1
+      if dts > s.dtsmax then s.dtsmax = dts end
+      if dts < s.dtsmin then s.dtsmin = dts end
+      if dtr > s.dtrmax then s.dtrmax = dtr end
+      if dtr < s.dtrmin then s.dtrmin = dtr end
+      if dt > s.dtmax then s.dtmax = dt end
+      if dt < s.dtmin then s.dtmin = dt end
+      print(string.format("seq=%5d chan=%2d dTsend=%4d dTrecv=%4d dT=%4d",
+                          seq, i, dts, dtr, dt))
+   end
+end
+-- Non blocking receive on an empty channel
+local ok, err = rep[1]:tryReceive()
+assert(ok == nil and err == "empty")
+for i = 1, n do
+   print("CHAN-"..i .. " min/max")
+   local s = meas[i]
+   print("send:", s.dtsmin .." us", s.dtsmax .." us")
+   print("recv:", s.dtrmin .." us", s.dtrmax .." us")
+   print("rtt: ", s.dtmin .." us", s.dtmax .." us")
+   req[i]:close()
+end
+gpio.wait(0.5)
+sess:close()
@@ -0,0 +1,48 @@
+local gpio = require "pigpiod"
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local N = tonumber(os.getenv("n")) or 10000
+
+printf("Open pool with 4 workers ...")
+local pool = assert(gpio.openThreadPool(4))
+printf("  queued=%d workers=%d", pool:info())
+
+local code = [[
+local a, b = ...
+return a + b, "sum"
+]]
+
+printf("Run a single job ...")
+print("  ", pool:run(code, 1, 2))
+
+printf("Job errors are returned ...")
+print("  ", pool:run("error('this job fails')"))
+print("  ", pool:run("return {}"))
+
+printf("Submit %d jobs ...", N)
+local jobs = {}
+local t1 = gpio.time()
+for i = 1, N do
+   jobs[i] = pool:submit(code, i, i)
+end
+local sum = 0
+for i = 1, N do
+   local ok, res = jobs[i]:wait()
+   sum = sum + res
+end
+local t2 = gpio.time()
+printf("  sum=%d, %.1f us per job", sum, (t2-t1)/N*1e6)
+
+printf("Jobs can use pigpiod ...")
+print("  ", pool:run([[
+local gpio = require "pigpiod"
+local sess = gpio.open()
+local tick = sess:tick()
+sess:close()
+return tick
+]]))
+
+printf("Close pool ...")
+pool:close()
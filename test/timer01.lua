@@ -0,0 +1,51 @@
+local gpio = require "pigpiod"
+local host, port = os.getenv("host") or "localhost", 8888
+
+local function printf(fmt, ...)
+   print(string.format(fmt, ...))
+end
+
+local period = tonumber(os.getenv("period") or "0.01")
+local count = tonumber(os.getenv("count") or "500")
+local pin = 4
+
+local sess = assert(gpio.open(host, port))
+printf("Session with host %s on port %d opened, handle = %d", host, port, sess.handle)
+
+-- Toggle a pin each period and count the edges seen by a callback.
+assert(sess:setMode(pin, gpio.OUTPUT))
+local edges = 0
+local cb = assert(sess:callback(pin, gpio.EITHER_EDGE, function(sess, pin, level, tick)
+   edges = edges + 1
+end))
+
+local timer = gpio.newTimer(period)
+printf("Running %d periods of %.3f s ...", count, period)
+local t0 = gpio.monotonic()
+local n = timer:run(function(k, late)
+   sess:write(pin, k % 2)
+end, count)
+local elapsed = gpio.monotonic() - t0
+gpio.wait(0.1)
+
+local info = timer:info(true)
+printf("   %d periods in %.6f s, drift %.1f us", n, elapsed, (elapsed - n * period) * 1e6)
+printf("   %d runs, %d overruns, %d skipped, %d edges", info.runs, info.overruns, info.skipped, edges)
+printf("   lateness min %.1f us, mean %.1f us, max %.1f us, jitter %.1f us, max exec %.1f us",
+       info.minlate * 1e6, info.meanlate * 1e6, info.maxlate * 1e6, info.jitter * 1e6,
+       info.maxexec * 1e6)
+
+printf("Same with 200 us spinning ...")
+timer = gpio.newTimer(period, {spin = 0.0002})
+timer:run(function(k, late)
+   sess:write(pin, k % 2)
+   -- stop early by returning false
+   return k < count
+end)
+info = timer:info()
+printf("   %d runs, lateness mean %.1f us, max %.1f us, jitter %.1f us",
+       info.runs, info.meanlate * 1e6, info.maxlate * 1e6, info.jitter * 1e6)
+
+printf("Cleanup ...")
+cb:cancel()
+sess:close()